@@ -0,0 +1,56 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "allocations.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void* p = std::malloc(size > 0 ? size : 1))
+    return p;
+
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace bench
+{
+
+size_t allocation_count()
+{
+  return g_allocations.load(std::memory_order_relaxed);
+}
+
+} // namespace bench
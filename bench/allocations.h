@@ -0,0 +1,19 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_BENCH_ALLOCATIONS_H
+#define TYPEWRITER_BENCH_ALLOCATIONS_H
+
+#include <cstddef>
+
+namespace bench
+{
+
+// number of calls to operator new since the start of the program,
+// counted by the replacement of the global operator new in allocations.cpp
+size_t allocation_count();
+
+} // namespace bench
+
+#endif // !TYPEWRITER_BENCH_ALLOCATIONS_H
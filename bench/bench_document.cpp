@@ -0,0 +1,155 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "benchmark.h"
+#include "corpus.h"
+
+#include "typewriter/textcursor.h"
+#include "typewriter/textdiff.h"
+#include "typewriter/textdocument.h"
+
+#include <algorithm>
+
+using namespace typewriter;
+using bench::Corpus;
+
+template<Corpus C>
+static void DocumentLoad(bench::State& state)
+{
+  const std::string text = bench::generate(C, 10000);
+
+  while (state.keepRunning())
+  {
+    TextDocument document{ text };
+  }
+
+  state.setItemsProcessed(state.iterations() * 10000);
+  state.setBytesProcessed(state.iterations() * text.size());
+}
+
+static bench::Registration reg_load_short{ "DocumentLoad/ShortLines", &DocumentLoad<Corpus::ShortLines> };
+static bench::Registration reg_load_long{ "DocumentLoad/LongLines", &DocumentLoad<Corpus::LongLines> };
+static bench::Registration reg_load_tabs{ "DocumentLoad/Tabs", &DocumentLoad<Corpus::Tabs> };
+static bench::Registration reg_load_unicode{ "DocumentLoad/Unicode", &DocumentLoad<Corpus::Unicode> };
+
+template<Corpus C>
+static void DocumentToString(bench::State& state)
+{
+  TextDocument document{ bench::generate(C, 10000) };
+  size_t bytes = 0;
+
+  while (state.keepRunning())
+  {
+    bytes += document.toString().size();
+  }
+
+  state.setBytesProcessed(bytes);
+}
+
+static bench::Registration reg_tostring_short{ "DocumentToString/ShortLines", &DocumentToString<Corpus::ShortLines> };
+static bench::Registration reg_tostring_unicode{ "DocumentToString/Unicode", &DocumentToString<Corpus::Unicode> };
+
+// one random insertion or removal per iteration
+template<Corpus C>
+static void RandomEdits(bench::State& state)
+{
+  TextDocument document{ bench::generate(C, 2000) };
+  TextCursor cursor{ &document };
+  bench::Random random;
+
+  while (state.keepRunning())
+  {
+    const int line = random(document.lineCount());
+    cursor.setPosition(Position{ line, 0 });
+    const int length = cursor.block().length();
+    cursor.setPosition(Position{ line, random(length + 1) });
+
+    if (random(2) == 0 || length == 0)
+    {
+      cursor.insertText(random(8) == 0 ? "new\nline" : "text");
+    }
+    else
+    {
+      cursor.setPosition(Position{ line, std::min(length, cursor.position().column + 4) }, TextCursor::KeepAnchor);
+      cursor.removeSelectedText();
+    }
+  }
+}
+
+static bench::Registration reg_edits_short{ "RandomEdits/ShortLines", &RandomEdits<Corpus::ShortLines> };
+static bench::Registration reg_edits_long{ "RandomEdits/LongLines", &RandomEdits<Corpus::LongLines> };
+static bench::Registration reg_edits_unicode{ "RandomEdits/Unicode", &RandomEdits<Corpus::Unicode> };
+
+// undoes and redoes the last of 100 edits
+static void UndoRedo(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::ShortLines, 2000) };
+  TextCursor cursor{ &document };
+  bench::Random random;
+
+  for (int i(0); i < 100; ++i)
+  {
+    cursor.setPosition(Position{ random(document.lineCount()), 0 });
+    cursor.insertText("edit\n");
+  }
+
+  while (state.keepRunning())
+  {
+    cursor.undo();
+    cursor.redo();
+  }
+
+  state.setItemsProcessed(2 * state.iterations());
+}
+
+TYPEWRITER_BENCHMARK(UndoRedo);
+
+// composes 1000 random edits into a single TextDiff
+static void TextDiffCompose(bench::State& state)
+{
+  size_t diffs = 0; // the resulting diffs are used so that the loop is not optimized away
+
+  while (state.keepRunning())
+  {
+    bench::Random random;
+    TextDiff delta;
+
+    for (int i(0); i < 1000; ++i)
+    {
+      const Position pos{ random(200), random(40) };
+
+      if (random(3) == 0)
+        delta << diff::remove(pos, "abc");
+      else
+        delta << diff::insert(pos, random(4) == 0 ? "a\nb" : "abc");
+    }
+
+    diffs += delta.diffs().size();
+  }
+
+  state.setItemsProcessed(state.iterations() * 1000);
+  state.setLabel(std::to_string(diffs / state.iterations()) + " diffs");
+}
+
+TYPEWRITER_BENCHMARK(TextDiffCompose);
+
+static void TextDiffCompute(bench::State& state)
+{
+  const std::string from = bench::generate(Corpus::ShortLines, 2000, 1);
+  std::string to = from;
+
+  bench::Random random{ 2 };
+
+  for (int i(0); i < 50; ++i)
+    to.insert(random(static_cast<int>(to.size())), "inserted\n");
+
+  while (state.keepRunning())
+  {
+    TextDiff result = diff::compute(from, to);
+  }
+
+  state.setBytesProcessed(state.iterations() * (from.size() + to.size()));
+}
+
+TYPEWRITER_BENCHMARK(TextDiffCompute);
@@ -0,0 +1,121 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "benchmark.h"
+#include "corpus.h"
+
+#include "typewriter/textcursor.h"
+#include "typewriter/textdocument.h"
+#include "typewriter/textsearch.h"
+#include "typewriter/textsearchindex.h"
+#include "typewriter/textview.h"
+
+using namespace typewriter;
+using bench::Corpus;
+
+// each iteration searches the whole document
+static void FindAll(bench::State& state, const char* pattern, bool case_sensitive, bool regex)
+{
+  TextDocument document{ bench::generate(Corpus::LongLines, 2000) };
+
+  SearchOptions options;
+  options.case_sensitive = case_sensitive;
+  options.regex = regex;
+  TextSearcher searcher{ pattern, options };
+
+  size_t matches = 0;
+
+  while (state.keepRunning())
+  {
+    matches = findAll(document, searcher).size();
+  }
+
+  state.setBytesProcessed(state.iterations() * document.size());
+  state.setLabel(std::to_string(matches) + " matches");
+}
+
+static void FindAllLiteral(bench::State& state) { FindAll(state, "nullptr", true, false); }
+static void FindAllLiteralRare(bench::State& state) { FindAll(state, "cursor block view", true, false); }
+static void FindAllCaseInsensitive(bench::State& state) { FindAll(state, "NULLPTR", false, false); }
+static void FindAllRegex(bench::State& state) { FindAll(state, "[0-9]+ ?\\)", true, true); }
+static void FindAllRegexAlternation(bench::State& state) { FindAll(state, "(while|for) \\(", true, true); }
+
+TYPEWRITER_BENCHMARK(FindAllLiteral);
+TYPEWRITER_BENCHMARK(FindAllLiteralRare);
+TYPEWRITER_BENCHMARK(FindAllCaseInsensitive);
+TYPEWRITER_BENCHMARK(FindAllRegex);
+TYPEWRITER_BENCHMARK(FindAllRegexAlternation);
+
+// the text is converted to a string and searched with std::string::find()
+static void FindAllToString(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::LongLines, 2000) };
+  size_t matches = 0;
+
+  while (state.keepRunning())
+  {
+    const std::string text = document.toString();
+    matches = 0;
+
+    for (size_t pos = text.find("nullptr"); pos != std::string::npos; pos = text.find("nullptr", pos + 7))
+      ++matches;
+  }
+
+  state.setBytesProcessed(state.iterations() * document.size());
+  state.setLabel(std::to_string(matches) + " matches");
+}
+
+TYPEWRITER_BENCHMARK(FindAllToString);
+
+// the document is indexed once, only the candidate lines are searched
+static void FindAllIndexed(bench::State& state, const char* pattern, bool regex)
+{
+  TextDocument document{ bench::generate(Corpus::LongLines, 2000) };
+  document.append("\nerror 0xDEADBEEF\n" + bench::generate(Corpus::LongLines, 2000));
+  TextSearchIndex index{ &document };
+  index.rebuild();
+
+  SearchOptions options;
+  options.regex = regex;
+  TextSearcher searcher{ pattern, options };
+
+  size_t matches = 0;
+
+  while (state.keepRunning())
+  {
+    matches = findAll(index, searcher).size();
+  }
+
+  state.setBytesProcessed(state.iterations() * document.size());
+  state.setLabel(std::to_string(matches) + " matches, index " + std::to_string(index.memoryUsage() / 1024) + " KB");
+}
+
+static void FindAllIndexedLiteral(bench::State& state) { FindAllIndexed(state, "nullptr", false); }
+static void FindAllIndexedLiteralRare(bench::State& state) { FindAllIndexed(state, "0xDEADBEEF", false); }
+static void FindAllIndexedRegex(bench::State& state) { FindAllIndexed(state, "0x[0-9A-F]*BEEF", true); }
+
+TYPEWRITER_BENCHMARK(FindAllIndexedLiteral);
+TYPEWRITER_BENCHMARK(FindAllIndexedLiteralRare);
+TYPEWRITER_BENCHMARK(FindAllIndexedRegex);
+
+// each iteration replaces all the occurrences in a document with a view, then undoes it
+static void ReplaceAll(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::LongLines, 2000) };
+  TextView view{ &document };
+  TextCursor cursor{ &document };
+  TextSearcher searcher{ "nullptr" };
+  size_t replacements = 0;
+
+  while (state.keepRunning())
+  {
+    replacements = replaceAll(cursor, searcher, "NULL");
+    cursor.undo();
+  }
+
+  state.setBytesProcessed(state.iterations() * document.size());
+  state.setLabel(std::to_string(replacements) + " replacements");
+}
+
+TYPEWRITER_BENCHMARK(ReplaceAll);
@@ -0,0 +1,266 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "benchmark.h"
+#include "corpus.h"
+
+#include "typewriter/syntaxhighlighter.h"
+#include "typewriter/textcursor.h"
+#include "typewriter/textdecorations.h"
+#include "typewriter/textsearch.h"
+#include "typewriter/textview.h"
+#include "typewriter/view/fragment.h"
+
+using namespace typewriter;
+using bench::Corpus;
+
+// each iteration relayouts the whole view (charactersPerLine alternates between 80 and 81)
+template<Corpus C, TextView::WrapMode WM>
+static void Relayout(bench::State& state)
+{
+  TextDocument document{ bench::generate(C, 5000) };
+  TextView view{ &document };
+  view.setWrapMode(WM);
+  view.setCharactersPerLine(80);
+
+  while (state.keepRunning())
+  {
+    view.setCharactersPerLine(view.charactersPerLine() == 80 ? 81 : 80);
+  }
+
+  state.setItemsProcessed(state.iterations() * 5000);
+  state.setLabel(std::to_string(view.height()) + " rows");
+}
+
+static bench::Registration reg_relayout_nowrap{ "Relayout/ShortLines/NoWrap", &Relayout<Corpus::ShortLines, TextView::WrapMode::NoWrap> };
+static bench::Registration reg_relayout_long_nowrap{ "Relayout/LongLines/NoWrap", &Relayout<Corpus::LongLines, TextView::WrapMode::NoWrap> };
+static bench::Registration reg_relayout_word{ "Relayout/LongLines/Word", &Relayout<Corpus::LongLines, TextView::WrapMode::Word> };
+static bench::Registration reg_relayout_anywhere{ "Relayout/LongLines/Anywhere", &Relayout<Corpus::LongLines, TextView::WrapMode::Anywhere> };
+static bench::Registration reg_relayout_boundary{ "Relayout/LongLines/WordBoundaryOrAnywhere", &Relayout<Corpus::LongLines, TextView::WrapMode::WordBoundaryOrAnywhere> };
+static bench::Registration reg_relayout_tabs{ "Relayout/Tabs/Word", &Relayout<Corpus::Tabs, TextView::WrapMode::Word> };
+static bench::Registration reg_relayout_unicode{ "Relayout/Unicode/Word", &Relayout<Corpus::Unicode, TextView::WrapMode::Word> };
+
+// a fold every 10 lines and an insert every 20 lines
+static void RelayoutFoldsAndInserts(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::ShortLines, 5000) };
+  TextView view{ &document };
+
+  TextCursor cursor{ &document };
+
+  for (int i(0); i + 5 < document.lineCount(); i += 10)
+  {
+    cursor.setPosition(Position{ i, 0 });
+    cursor.setPosition(Position{ i + 3, 0 }, TextCursor::KeepAnchor);
+    view.addFold(i, cursor);
+  }
+
+  for (int i(5); i < document.lineCount(); i += 20)
+  {
+    view::Insert ins;
+    ins.cursor = TextCursor{ &document };
+    ins.cursor.setPosition(Position{ i, 0 });
+    ins.span = 1;
+    view.addInsert(ins);
+  }
+
+  while (state.keepRunning())
+  {
+    view.setTabSize(view.tabSize() == 4 ? 2 : 4);
+  }
+
+  state.setItemsProcessed(state.iterations() * 5000);
+  state.setLabel(std::to_string(view.height()) + " rows");
+}
+
+TYPEWRITER_BENCHMARK(RelayoutFoldsAndInserts);
+
+// each iteration folds every 10 lines of the document in one call, then unfolds them
+static void ToggleFolds(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::ShortLines, 50000) };
+  TextView view{ &document };
+
+  std::vector<TextFold> folds;
+  std::vector<int> ids;
+
+  for (int i(0); i + 5 < document.lineCount(); i += 10)
+  {
+    TextCursor cursor{ &document };
+    cursor.setPosition(Position{ i, 2 });
+    cursor.setPosition(Position{ i + 5, 0 }, TextCursor::KeepAnchor);
+    folds.push_back(TextFold{ cursor, 3, i });
+    ids.push_back(i);
+  }
+
+  while (state.keepRunning())
+  {
+    view.addFolds(folds);
+    view.removeFolds(ids);
+  }
+
+  state.setItemsProcessed(state.iterations() * folds.size());
+  state.setLabel(std::to_string(folds.size()) + " folds");
+}
+
+TYPEWRITER_BENCHMARK(ToggleFolds);
+
+// each iteration adds an inline hint to every line in one call, then removes them
+static void ToggleInlineInserts(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::ShortLines, 50000) };
+  TextView view{ &document };
+
+  std::vector<view::InlineInsert> inserts;
+  inserts.reserve(document.lineCount());
+
+  for (int i(0); i < document.lineCount(); ++i)
+  {
+    view::InlineInsert ins;
+    ins.cursor = TextCursor{ &document };
+    ins.cursor.setPosition(Position{ i, 0 });
+    ins.span = 4;
+    inserts.push_back(ins);
+  }
+
+  while (state.keepRunning())
+  {
+    view.addInlineInserts(inserts);
+    view.clearInserts();
+  }
+
+  state.setItemsProcessed(state.iterations() * inserts.size());
+  state.setLabel(std::to_string(inserts.size()) + " inserts");
+}
+
+TYPEWRITER_BENCHMARK(ToggleInlineInserts);
+
+// a character is typed in a random visible block, the view is updated incrementally
+static void TypingInView(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::LongLines, 2000) };
+  TextView view{ &document };
+  view.setWrapMode(TextView::WrapMode::Word);
+  view.setCharactersPerLine(100);
+
+  TextCursor cursor{ &document };
+  bench::Random random;
+
+  while (state.keepRunning())
+  {
+    cursor.setPosition(Position{ random(document.lineCount()), 10 });
+    cursor.insertChar('x');
+  }
+}
+
+TYPEWRITER_BENCHMARK(TypingInView);
+
+static void Highlight(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::ShortLines, 5000) };
+  TextView view{ &document };
+  SyntaxHighlighter highlighter{ view };
+
+  while (state.keepRunning())
+  {
+    for (int line(0); line < document.lineCount(); ++line)
+    {
+      highlighter.setFormat(line, 0, 3, 1);
+      highlighter.setFormat(line, 5, 4, 2);
+      highlighter.setFormat(line, 12, 6, 3);
+    }
+  }
+
+  state.setItemsProcessed(state.iterations() * 5000);
+}
+
+TYPEWRITER_BENCHMARK(Highlight);
+
+// iterates over the StyledFragments of every line of a highlighted view
+template<Corpus C>
+static void StyledFragments(bench::State& state)
+{
+  TextDocument document{ bench::generate(C, 5000) };
+  TextView view{ &document };
+  SyntaxHighlighter highlighter{ view };
+
+  for (int line(0); line < document.lineCount(); ++line)
+  {
+    for (int col(0); col < 60; col += 10)
+      highlighter.setFormat(line, col, 4, 1 + col / 10);
+  }
+
+  size_t fragments = 0;
+
+  while (state.keepRunning())
+  {
+    for (const view::Line& l : view.lines())
+    {
+      for (const view::LineElement& e : l.elements)
+      {
+        if (e.kind != view::LineElement::LE_BlockFragment)
+          continue;
+
+        view::StyledFragments frags = view.fragments(l, e);
+
+        for (view::StyledFragment f = frags.begin(); f != frags.end(); f = f.next())
+          ++fragments;
+      }
+    }
+  }
+
+  state.setItemsProcessed(fragments);
+}
+
+static bench::Registration reg_fragments_short{ "StyledFragments/ShortLines", &StyledFragments<Corpus::ShortLines> };
+static bench::Registration reg_fragments_unicode{ "StyledFragments/Unicode", &StyledFragments<Corpus::Unicode> };
+
+// each iteration shows then hides the matches of a search in a highlighted view
+static void ToggleDecorations(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::ShortLines, 50000) };
+  TextView view{ &document };
+  SyntaxHighlighter highlighter{ view };
+
+  for (int line(0); line < document.lineCount(); ++line)
+    highlighter.setFormat(line, 0, 3, 1);
+
+  TextDecorations decorations{ &document };
+  view.setDecorations(&decorations);
+  const std::vector<SearchMatch> matches = findAll(document, TextSearcher("e"));
+
+  while (state.keepRunning())
+  {
+    decorations.add(matches, 2);
+    decorations.clear();
+  }
+
+  state.setItemsProcessed(state.iterations() * matches.size());
+  state.setLabel(std::to_string(matches.size()) + " matches");
+}
+
+TYPEWRITER_BENCHMARK(ToggleDecorations);
+
+// maps random positions to the view and back
+static void MapAndHitTest(bench::State& state)
+{
+  TextDocument document{ bench::generate(Corpus::LongLines, 2000) };
+  TextView view{ &document };
+  view.setWrapMode(TextView::WrapMode::Word);
+  view.setCharactersPerLine(100);
+
+  bench::Random random;
+  int sum = 0;
+
+  while (state.keepRunning())
+  {
+    const view::Point pt = view.map(Position{ random(document.lineCount()), random(400) });
+    sum += view.hitTest(pt).column;
+  }
+
+  state.setItemsProcessed(2 * state.iterations());
+  state.setLabel(sum == -1 ? "" : std::to_string(view.height()) + " rows");
+}
+
+TYPEWRITER_BENCHMARK(MapAndHitTest);
@@ -0,0 +1,77 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_BENCH_BENCHMARK_H
+#define TYPEWRITER_BENCH_BENCHMARK_H
+
+#include "allocations.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+
+class State
+{
+public:
+  explicit State(size_t iterations);
+
+  // runs the timed loop; the timer starts on the first call so that
+  // the setup done before the loop is not measured
+  bool keepRunning();
+
+  void pauseTiming();
+  void resumeTiming();
+
+  // totals over all the iterations
+  void setItemsProcessed(size_t n) { m_items = n; }
+  void setBytesProcessed(size_t n) { m_bytes = n; }
+  void setLabel(const std::string& label) { m_label = label; }
+
+  size_t iterations() const { return m_iterations; }
+  double elapsed() const; // in seconds
+  size_t allocations() const { return m_allocations; }
+  size_t itemsProcessed() const { return m_items; }
+  size_t bytesProcessed() const { return m_bytes; }
+  const std::string& label() const { return m_label; }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  size_t m_iterations;
+  size_t m_remaining;
+  bool m_started = false;
+  bool m_running = false;
+  clock::time_point m_start;
+  clock::duration m_elapsed = clock::duration::zero();
+  size_t m_allocations_start = 0;
+  size_t m_allocations = 0;
+  size_t m_items = 0;
+  size_t m_bytes = 0;
+  std::string m_label;
+};
+
+typedef void(*Function)(State&);
+
+struct Benchmark
+{
+  std::string name;
+  Function function;
+};
+
+std::vector<Benchmark>& registry();
+
+struct Registration
+{
+  Registration(const char* name, Function f);
+};
+
+} // namespace bench
+
+#define TYPEWRITER_BENCHMARK(func) static bench::Registration bench_registration_##func{ #func, func }
+
+#endif // !TYPEWRITER_BENCH_BENCHMARK_H
@@ -0,0 +1,94 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "corpus.h"
+
+namespace bench
+{
+
+static const char* words[] = {
+  "int", "return", "const", "auto", "for", "while", "if", "else", "std::string", "value",
+  "document", "cursor", "block", "view", "line", "column", "position", "=", "+=", "==",
+  "(", ")", "{", "}", ";", "0", "42", "nullptr", "true", "false",
+};
+
+// "é", "ß", "日本", "語", "🙂", "👍🏽", "ä"
+static const char* unicode_words[] = {
+  "\xC3\xA9t\xC3\xA9", "stra\xC3\x9F" "e", "\xE6\x97\xA5\xE6\x9C\xAC", "\xE8\xAA\x9E",
+  "\xF0\x9F\x99\x82", "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD", "k\xC3\xA4se",
+};
+
+const char* name(Corpus c)
+{
+  switch (c)
+  {
+  case Corpus::ShortLines:
+    return "ShortLines";
+  case Corpus::LongLines:
+    return "LongLines";
+  case Corpus::Tabs:
+    return "Tabs";
+  case Corpus::Unicode:
+    return "Unicode";
+  default:
+    return "";
+  }
+}
+
+static void append_words(std::string& line, Random& random, size_t length, bool unicode)
+{
+  const int nwords = sizeof(words) / sizeof(words[0]);
+  const int nunicode = sizeof(unicode_words) / sizeof(unicode_words[0]);
+
+  while (line.size() < length)
+  {
+    if (unicode && random(3) == 0)
+      line += unicode_words[random(nunicode)];
+    else
+      line += words[random(nwords)];
+
+    line.push_back(' ');
+  }
+}
+
+std::string generate(Corpus c, int lines, uint32_t seed)
+{
+  Random random{ seed };
+  std::string result;
+  std::string line;
+
+  for (int i(0); i < lines; ++i)
+  {
+    line.clear();
+
+    switch (c)
+    {
+    case Corpus::ShortLines:
+      line.append(2 * random(4), ' ');
+      append_words(line, random, random(60), false);
+      break;
+    case Corpus::LongLines:
+      append_words(line, random, 500 + random(1500), false);
+      break;
+    case Corpus::Tabs:
+      line.append(random(4), '\t');
+      append_words(line, random, random(40), false);
+      line += "\t// ";
+      append_words(line, random, line.size() + random(20), false);
+      break;
+    case Corpus::Unicode:
+      append_words(line, random, random(80), true);
+      break;
+    }
+
+    result += line;
+
+    if (i + 1 < lines)
+      result.push_back('\n');
+  }
+
+  return result;
+}
+
+} // namespace bench
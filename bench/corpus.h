@@ -0,0 +1,53 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_BENCH_CORPUS_H
+#define TYPEWRITER_BENCH_CORPUS_H
+
+#include <cstdint>
+#include <string>
+
+namespace bench
+{
+
+// Synthetic documents, the same seed always produces the same text.
+enum class Corpus
+{
+  ShortLines, // source-code like lines of 0 to 60 characters
+  LongLines, // lines of 500 to 2000 characters
+  Tabs, // tab-indented lines with tabs inside the lines
+  Unicode, // mix of ascii, accented letters, CJK and emojis
+};
+
+const char* name(Corpus c);
+
+std::string generate(Corpus c, int lines, uint32_t seed = 42);
+
+// xorshift32, deterministic across platforms (unlike std distributions)
+class Random
+{
+public:
+  explicit Random(uint32_t seed = 42) : m_state(seed ? seed : 1) { }
+
+  uint32_t next()
+  {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state;
+  }
+
+  // returns a number in [0, n)
+  int operator()(int n)
+  {
+    return n > 0 ? static_cast<int>(next() % static_cast<uint32_t>(n)) : 0;
+  }
+
+private:
+  uint32_t m_state;
+};
+
+} // namespace bench
+
+#endif // !TYPEWRITER_BENCH_CORPUS_H
@@ -0,0 +1,188 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "benchmark.h"
+
+#include "typewriter/utils/instrumentation.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace bench
+{
+
+State::State(size_t iterations)
+  : m_iterations(iterations),
+    m_remaining(iterations)
+{
+
+}
+
+bool State::keepRunning()
+{
+  if (!m_started)
+  {
+    m_started = true;
+    resumeTiming();
+  }
+
+  if (m_remaining > 0)
+  {
+    --m_remaining;
+    return true;
+  }
+
+  pauseTiming();
+  return false;
+}
+
+void State::pauseTiming()
+{
+  if (!m_running)
+    return;
+
+  m_elapsed += clock::now() - m_start;
+  m_allocations += allocation_count() - m_allocations_start;
+  m_running = false;
+}
+
+void State::resumeTiming()
+{
+  if (m_running)
+    return;
+
+  m_allocations_start = allocation_count();
+  m_start = clock::now();
+  m_running = true;
+}
+
+double State::elapsed() const
+{
+  return std::chrono::duration<double>(m_elapsed).count();
+}
+
+std::vector<Benchmark>& registry()
+{
+  static std::vector<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+Registration::Registration(const char* name, Function f)
+{
+  registry().push_back(Benchmark{ name, f });
+}
+
+} // namespace bench
+
+static std::string format_rate(double value, const char* unit)
+{
+  const char* prefixes[] = { "", "k", "M", "G" };
+  int i = 0;
+
+  while (value >= 1000.0 && i < 3)
+  {
+    value /= 1000.0;
+    ++i;
+  }
+
+  char buffer[64];
+  std::snprintf(buffer, sizeof(buffer), "%.2f %s%s/s", value, prefixes[i], unit);
+  return buffer;
+}
+
+// runs a benchmark with an increasing number of iterations until it takes at least 'min_time'
+static bench::State run(const bench::Benchmark& b, double min_time)
+{
+  size_t iterations = 1;
+
+  for (;;)
+  {
+    bench::State state{ iterations };
+    b.function(state);
+
+    if (state.elapsed() >= min_time || iterations >= 1000000000)
+      return state;
+
+    const double ratio = state.elapsed() > 0 ? (1.4 * min_time / state.elapsed()) : 10.0;
+    const size_t next = static_cast<size_t>(iterations * std::min(ratio, 10.0));
+    iterations = next > iterations ? next : iterations + 1;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const char* filter = nullptr;
+  double min_time = 0.5;
+  const char* trace = nullptr;
+
+  for (int i(1); i < argc; ++i)
+  {
+    if (std::strncmp(argv[i], "--filter=", 9) == 0)
+    {
+      filter = argv[i] + 9;
+    }
+    else if (std::strncmp(argv[i], "--min-time=", 11) == 0)
+    {
+      min_time = std::atof(argv[i] + 11);
+    }
+    else if (std::strncmp(argv[i], "--trace=", 8) == 0)
+    {
+      trace = argv[i] + 8;
+    }
+    else
+    {
+      std::printf("Usage: %s [--filter=<substring>] [--min-time=<seconds>] [--trace=<file.json>]\n", argv[0]);
+      return argv[i] == std::string("--help") ? 0 : 1;
+    }
+  }
+
+  // probes only record something if the library was built with TYPEWRITER_INSTRUMENTATION
+  if (trace)
+    typewriter::instrumentation::startTracing();
+
+  std::printf("%-40s %14s %12s %16s %12s  %s\n", "Benchmark", "Time/op (ns)", "Iterations", "ops/s", "allocs/op", "Throughput");
+
+  for (const bench::Benchmark& b : bench::registry())
+  {
+    if (filter && b.name.find(filter) == std::string::npos)
+      continue;
+
+    bench::State state = run(b, min_time);
+
+    const double n = static_cast<double>(state.iterations());
+    const double elapsed = state.elapsed();
+
+    std::string throughput;
+
+    if (state.itemsProcessed() > 0)
+      throughput += format_rate(state.itemsProcessed() / elapsed, "items");
+
+    if (state.bytesProcessed() > 0)
+      throughput += (throughput.empty() ? "" : ", ") + format_rate(state.bytesProcessed() / elapsed, "B");
+
+    if (!state.label().empty())
+      throughput += (throughput.empty() ? "" : " ") + state.label();
+
+    std::printf("%-40s %14.0f %12zu %16s %12.1f  %s\n", b.name.c_str(), 1e9 * elapsed / n, state.iterations(),
+      format_rate(n / elapsed, "").c_str(), state.allocations() / n, throughput.c_str());
+    std::fflush(stdout);
+  }
+
+  if (trace)
+  {
+    typewriter::instrumentation::stopTracing();
+
+    std::ofstream file{ trace };
+    typewriter::instrumentation::writeChromeTrace(file);
+
+    std::cout << "\n";
+    typewriter::instrumentation::writeSummary(std::cout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,51 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_MEMORYUSAGE_P_H
+#define TYPEWRITER_MEMORYUSAGE_P_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace typewriter
+{
+
+// Estimates of the heap memory used by standard containers.
+// Allocator overhead is not taken into account.
+namespace memory
+{
+
+// 0 if the string uses its small buffer
+inline size_t heap_size(const std::string& str)
+{
+  static const size_t sso_capacity = std::string().capacity();
+  return str.capacity() > sso_capacity ? str.capacity() + 1 : 0;
+}
+
+template<typename T>
+size_t heap_size(const std::vector<T>& vec)
+{
+  return vec.capacity() * sizeof(T);
+}
+
+// a node of a std::list or std::unordered_map
+template<typename T>
+size_t node_size()
+{
+  return sizeof(T) + 2 * sizeof(void*);
+}
+
+// an object created by std::make_shared, together with its control block
+template<typename T>
+size_t shared_node_size()
+{
+  return sizeof(T) + sizeof(void*) + 2 * sizeof(int);
+}
+
+} // namespace memory
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_MEMORYUSAGE_P_H
@@ -0,0 +1,106 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_REGEX_P_H
+#define TYPEWRITER_REGEX_P_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <bitset>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace typewriter
+{
+
+namespace regex
+{
+
+struct NfaState
+{
+  enum Kind
+  {
+    ByteSet,
+    Split, // out1 may be -1
+    LineStart,
+    LineEnd,
+    Match,
+  };
+
+  Kind kind = Split;
+  std::bitset<256> bytes;
+  int out = -1;
+  int out1 = -1;
+};
+
+// A regular expression compiled to a Thompson NFA working on UTF-8 bytes.
+// Supported: literals, '.', classes, \d \w \s (and their negation),
+// groups, alternations, the usual quantifiers and the ^ and $ anchors.
+// Throws std::runtime_error if the expression is invalid or unsupported.
+class Program
+{
+public:
+  std::vector<NfaState> states;
+  int start = -1;
+
+  static std::shared_ptr<const Program> compile(const std::string& pattern, bool case_sensitive);
+};
+
+// Returns the longest sequence of bytes contained in every match of the
+// expression, or an empty string.
+std::string required_literal(const std::string& pattern);
+
+// DFA built lazily from a Program, one text line at a time.
+// Matches are leftmost-longest.
+class Dfa
+{
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  explicit Dfa(std::shared_ptr<const Program> prog);
+  Dfa(const Dfa& other);
+
+  const std::shared_ptr<const Program>& program() const { return m_program; }
+
+  bool find(const char* text, size_t size, size_t from, size_t& begin, size_t& end);
+
+  Dfa& operator=(const Dfa&) = delete;
+
+protected:
+  size_t earliestMatchEnd(const char* text, size_t size, size_t from);
+  size_t longestMatchAt(const char* text, size_t size, size_t pos);
+
+  struct State
+  {
+    std::vector<int> nfa; // sorted
+    bool match = false;
+    bool match_at_end = false;
+    int next[256];
+  };
+
+  int start(bool unanchored, bool at_start);
+  int step(bool unanchored, int state, unsigned char c);
+  int add_state(bool unanchored, std::vector<int>& set);
+  void closure(std::vector<int>& set, bool at_start, bool at_end);
+  void flush();
+
+private:
+  std::shared_ptr<const Program> m_program;
+  std::vector<int> m_marks;
+  int m_mark = 0;
+  std::vector<int> m_stack;
+  std::vector<State> m_states[2]; // anchored, unanchored
+  std::map<std::vector<int>, int> m_ids[2];
+  int m_starts[2][2];
+  std::bitset<256> m_first_bytes; // bytes that can start a non-empty match
+  bool m_can_match_empty = false;
+};
+
+} // namespace regex
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_REGEX_P_H
@@ -7,6 +7,13 @@
 
 #include "typewriter/typewriter-defs.h"
 
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(TYPEWRITER_ATOMIC_REFCOUNT)
+#include <atomic>
+#endif
 
 namespace typewriter
 {
@@ -37,21 +44,114 @@ public:
   inline bool operator==(const TextBlockImpl *ptr) { return d == ptr; }
 };
 
+// Sparse index mapping columns (i.e. code points) to byte offsets and 
+// display widths.
+// The offset and the display width of the text preceding every Stride-th
+// code point are stored, unless the text is pure ASCII in which case 
+// columns, offsets and widths are the same.
+class TYPEWRITER_API ColumnIndex
+{
+public:
+  static const int Stride = 64;
+
+  void build(const std::string& text);
+
+  bool isAscii() const { return m_ascii; }
+  int length() const { return m_length; }
+  int width() const { return m_width; }
+
+  size_t byteOffset(const std::string& text, int column) const;
+  int columnAt(const std::string& text, size_t offset) const;
+
+  int displayWidth(const std::string& text, int column) const;
+  int columnAtDisplayWidth(const std::string& text, int w) const;
+
+  size_t memoryUsage() const;
+  void shrink();
+
+private:
+  bool m_ascii = true;
+  int m_length = 0;
+  int m_width = 0;
+  std::vector<size_t> m_offsets;
+  std::vector<int> m_widths;
+};
+
 class TYPEWRITER_API TextBlockImpl
 {
 public:
   TextBlockImpl();
   explicit TextBlockImpl(const std::string& text);
 
+#if defined(TYPEWRITER_ATOMIC_REFCOUNT)
+  std::atomic<int> ref;
+#else
   int ref;
+#endif
   int id;
   int revision;
-  std::string content;
   TextBlockRef previous;
   TextBlockRef next;
 
+  // The text is shared with the snapshot tree of the document and copied 
+  // by edit() if a snapshot may still read it.
+  const std::string& content() const { return *m_content; }
+  const std::shared_ptr<std::string>& sharedContent() const { return m_content; }
+  std::string& edit();
+
   inline bool isGarbage() const { return revision < 0; }
   void setGarbage();
+
+  // Every modification of the content must be followed by a call to 
+  // contentChanged(), which increments the revision and rebuilds the column 
+  // index: the const accessors never write to the block and can be used from 
+  // several threads.
+  void contentChanged();
+  const ColumnIndex& columnIndex() const { return m_column_index; }
+  int length() const { return columnIndex().length(); }
+  size_t byteOffset(int column) const { return columnIndex().byteOffset(content(), column); }
+  int columnAt(size_t offset) const { return columnIndex().columnAt(content(), offset); }
+  int displayWidth(int column) const { return columnIndex().displayWidth(content(), column); }
+  int columnAtDisplayWidth(int w) const { return columnIndex().columnAtDisplayWidth(content(), w); }
+
+  size_t columnIndexMemoryUsage() const { return m_column_index.memoryUsage(); }
+  void shrink();
+
+  inline void addRef() noexcept
+  {
+#if defined(TYPEWRITER_ATOMIC_REFCOUNT)
+    // a new reference can only be made from an existing one, 
+    // no ordering is required
+    ref.fetch_add(1, std::memory_order_relaxed);
+#else
+    ++ref;
+#endif
+  }
+
+  // returns true if the last reference was released
+  inline bool deref() noexcept
+  {
+#if defined(TYPEWRITER_ATOMIC_REFCOUNT)
+    // all accesses made through other references must happen before the deletion
+    return ref.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#else
+    return --ref == 0;
+#endif
+  }
+
+private:
+  std::shared_ptr<std::string> m_content;
+  ColumnIndex m_column_index;
+};
+
+// iterates over the contents of the blocks following a block
+struct BlockLines
+{
+  const TextBlockImpl* block;
+
+  const std::string& operator*() const { return block->content(); }
+  BlockLines& operator++() { block = block->next.get(); return *this; }
+  bool operator!=(const BlockLines& other) const { return block != other.block; }
 };
 
 } // namespace typewriter
@@ -8,6 +8,8 @@
 #include "typewriter/textdiff.h"
 
 #include "typewriter/private/textblock_p.h"
+#include "typewriter/private/textsnapshot_p.h"
+#include "typewriter/private/undohistory_p.h"
 
 #include <unicode/unicode.h>
 
@@ -17,67 +19,8 @@
 namespace typewriter
 {
 
-class Contributor;
 class TextDocument;
-
-// @TODO: rework the undo/redo system
-class Author
-{
-public:
-  Contributor* contributor = nullptr;
-  TextCursor* cursor = nullptr;
-
-  Author() = default;
-
-  Author(Contributor* c)
-    : contributor(c)
-  {
-
-  }
-
-  Author(TextCursor* c)
-    : cursor(c)
-  {
-
-  }
-
-  bool is_null() const
-  {
-    return contributor == nullptr && cursor == nullptr;
-  }
-};
-
-inline bool operator==(const Author& lhs, const Author& rhs)
-{
-  return lhs.contributor == rhs.contributor && lhs.cursor == rhs.cursor;
-}
-
-inline bool operator!=(const Author& lhs, const Author& rhs)
-{
-  return !(lhs == rhs);
-}
-
-struct Contribution
-{
-  Author author;
-  TextDiff delta;
-};
-
-inline bool from_same_author(const Contribution& lhs, const Contribution& rhs)
-{
-  return lhs.author == rhs.author;
-}
-
-inline Contribution merge(Contribution&& lhs, Contribution&& rhs)
-{
-  assert(from_same_author(lhs, rhs));
-
-  Contribution ret;
-  ret.author = lhs.author;
-  ret.delta = std::move(lhs.delta);
-  ret.delta << rhs.delta;
-  return ret;
-}
+class TextDocumentLoader;
 
 struct TextDocumentTransaction
 {
@@ -94,8 +37,12 @@ struct TextDocumentTransaction
 class TYPEWRITER_API TextDocumentImpl
 {
 public:
+  // diffs with at least this many edits are applied by apply_batch()
+  static const size_t BatchThreshold = 64;
+
   TextDocument *document;
   int lineCount;
+  size_t byteCount; // newlines included
   TextBlockRef firstBlock;
   TextBlockRef lastBlock;
 
@@ -105,12 +52,17 @@ public:
 
   int idgen;
 
+  // built on the first call to TextDocument::snapshot()
+  SnapshotTree snapshots;
+
   // @TODO: rework the undo/redo system
   TextDocumentTransaction transaction;
-  std::vector<Contribution> m_undo_stack;
-  std::vector<Contribution> m_redo_stack;
+  UndoHistory history;
   bool cursors_are_ghosts = false;
 
+  TextDocumentLoader* loader = nullptr;
+  int maximumBlockCount = 0;
+
 public:
   TextDocumentImpl(TextDocument *doc);
   ~TextDocumentImpl();
@@ -121,6 +73,8 @@ public:
   void register_cursor(TextCursor* c);
   void swap_cursor(TextCursor* existing_cursor, TextCursor* new_cursor) noexcept;
   void deregister_cursor(TextCursor* c) noexcept;
+  void deregister_cursors(std::vector<TextCursor*> list);
+  void register_cursors(const std::vector<TextCursor*>& list);
 
   void insertBlock(Position pos, const TextBlock & block);
   void insertChar(Position pos, const TextBlock & block, unicode::Character c);
@@ -135,15 +89,19 @@ public:
   void undo(Author author);
   void redo(Author author);
 
+  void append(const char* begin, const char* end);
+  void discard_blocks(int count);
+
+  void apply(const TextDiff& diff, bool inv = false);
+  void revert(const TextDiff& diff);
+
 protected:
   void remove_selection_singleline(const Position begin, const TextBlock & beginBlock, int count);
   void remove_selection_multiline(const Position begin, const TextBlock & beginBlock, const Position end);
 
   void remove_block(int blocknum, TextBlock block);
 
-  // @TODO: rework the undo/redo system
-  void apply(const TextDiff& diff, bool inv = false);
-  void revert(const TextDiff& diff);
+  void apply_batch(const std::vector<TextDiff::Diff>& diffs);
 };
 
 } // namespace typewriter
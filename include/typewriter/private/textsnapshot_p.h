@@ -0,0 +1,74 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_TEXTSNAPSHOT_P_H
+#define TYPEWRITER_TEXTSNAPSHOT_P_H
+
+#include "typewriter/textsnapshot.h"
+
+#include <cstdint>
+
+namespace typewriter
+{
+
+class TextBlockImpl;
+
+// Node of a persistent treap keyed by line number.
+// A node can only be modified in place if it was created after the last 
+// snapshot was taken, i.e. if its generation is the current generation of 
+// the tree; otherwise it is copied.
+// The lines are shared with the blocks of the document, which copy them 
+// before modifying them (see TextBlockImpl::edit()).
+struct TextSnapshotNode
+{
+  std::shared_ptr<TextSnapshotNode> left;
+  std::shared_ptr<TextSnapshotNode> right;
+  std::shared_ptr<const std::string> line;
+  uint32_t priority = 0;
+  int count = 1; // number of lines in the subtree
+  size_t bytes = 0; // number of bytes in the subtree, newlines excluded
+  size_t generation = 0;
+};
+
+// The tree is only maintained while a snapshot exists, it is dropped by 
+// isActive() once the last snapshot has been destroyed.
+class SnapshotTree
+{
+public:
+  typedef std::shared_ptr<TextSnapshotNode> NodePtr;
+  typedef std::shared_ptr<const std::string> LinePtr;
+
+  bool isActive();
+
+  void build(const TextBlockImpl* first);
+  void reset();
+
+  size_t memoryUsage() const;
+
+  void setLine(int num, LinePtr text);
+  void insertLine(int num, LinePtr text);
+  void removeLine(int num);
+  void removeLines(int num, int count);
+
+  TextSnapshot snapshot();
+
+protected:
+  NodePtr create_node(LinePtr text);
+  NodePtr own(const NodePtr& node);
+  static void update(TextSnapshotNode& node);
+
+  NodePtr merge(NodePtr a, NodePtr b);
+  void split(NodePtr node, int n, NodePtr& left, NodePtr& right);
+  void set_line(NodePtr& node, int num, LinePtr text);
+
+private:
+  NodePtr m_root;
+  std::weak_ptr<void> m_snapshots; // shared by the existing snapshots
+  size_t m_generation = 1;
+  uint32_t m_seed = 0x2545F491;
+};
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_TEXTSNAPSHOT_P_H
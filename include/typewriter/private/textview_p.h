@@ -13,6 +13,7 @@
 #include "typewriter/textview.h"
 
 #include <list>
+#include <set>
 #include <unordered_map>
 #include <vector>
 
@@ -21,6 +22,120 @@ namespace typewriter
 
 class TextDocument;
 
+// Maps the lines of the view to the document and back.
+// Each block fragment (or tab) of the view is recorded with its block number
+// and its position in the view; fragments are in document order, which is
+// also the order of the view, so both directions are binary searches.
+class LineIndex
+{
+public:
+  struct Fragment
+  {
+    int row;
+    int block; // block number
+    int begin;
+    int length;
+    int x; // cells before the fragment on its row
+    const view::LineElement* element;
+  };
+
+  bool valid = false;
+  std::vector<std::list<view::Line>::const_iterator> rows;
+  std::vector<Fragment> fragments;
+
+  void build(const std::list<view::Line>& lines, TextBlock first);
+
+  view::Point map(const Position& pos) const;
+  Position hitTest(const view::Point& pt) const;
+};
+
+// The folds of a view, sorted by start position; a fold comes before the
+// folds nested in it. The folds that start inside a fold are hidden by it.
+// Folds are also indexed by id.
+class FoldTree
+{
+public:
+  struct Compare
+  {
+    const Position* probe; // the position of the null fold, see lower_bound()
+
+    bool operator()(const TextFold* lhs, const TextFold* rhs) const;
+  };
+
+  typedef std::set<const TextFold*, Compare>::const_iterator const_iterator;
+
+  FoldTree();
+  FoldTree(const FoldTree&) = delete;
+  ~FoldTree();
+
+  bool empty() const { return m_folds.empty(); }
+  size_t size() const { return m_folds.size(); }
+
+  const_iterator begin() const { return m_folds.begin(); }
+  const_iterator end() const { return m_folds.end(); }
+  const_iterator lower_bound(const Position& pos) const;
+
+  const TextFold* find(int id) const;
+
+  const TextFold& insert(TextFold fold);
+  void erase(int id);
+  void clear();
+
+  size_t memoryUsage() const;
+
+  FoldTree& operator=(const FoldTree&) = delete;
+
+private:
+  struct Node
+  {
+    TextFold fold;
+    std::set<const TextFold*, Compare>::iterator it;
+  };
+
+  mutable Position m_probe;
+  std::set<const TextFold*, Compare> m_folds;
+  std::unordered_map<int, Node> m_nodes;
+};
+
+// The inserts of a view grouped by block, the inserts of a block are sorted
+// by column. The groups follow the blocks when they are split or merged.
+template<typename T>
+class InsertIndex
+{
+public:
+  typedef std::vector<T> List;
+
+  bool empty() const { return m_blocks.empty(); }
+  size_t size() const { return m_size; }
+
+  const List& at(const TextBlock& block) const;
+
+  void insert(std::vector<T> inserts, std::vector<TextBlock>& changed);
+  void remove(const Position& begin, const Position& end, std::vector<TextBlock>& changed);
+  void clear(std::vector<TextBlock>& changed);
+  void clear();
+
+  void blockInserted(const TextBlock& newblock);
+  void blockDestroyed(const TextBlock& block);
+  void rebuild();
+  void removeGarbage();
+
+  std::vector<T> values() const;
+
+  size_t memoryUsage() const;
+  void shrink();
+
+private:
+  struct Entry
+  {
+    TextBlock block;
+    List inserts;
+  };
+
+  std::unordered_map<TextBlockImpl*, Entry> m_blocks;
+  size_t m_size = 0;
+};
+
 class TextViewImpl
 {
 public:
@@ -34,15 +149,20 @@ public:
   TextView::WrapMode wrapmode = TextView::WrapMode::NoWrap;
   int tabwidth = 4;
 
-  std::vector<TextFold> folds;
-  std::vector<view::Insert> inserts;
-  std::vector<view::InlineInsert> inline_inserts;
+  FoldTree folds;
+  InsertIndex<view::Insert> inserts;
+  InsertIndex<view::InlineInsert> inline_inserts;
+  TextDecorations* decorations = nullptr;
+
+  mutable LineIndex line_index;
 
 public:
   TextViewImpl(TextDocument *doc);
 
   void reset(TextDocument* doc);
 
+  const LineIndex& lineIndex() const;
+
   TextView::WrapMode computedWrapMode() const;
 
   void refreshLongestLineLength();
@@ -67,10 +187,13 @@ private:
   public:
     TextViewImpl* view = nullptr;
     TextView::WrapMode wrapmode = TextView::WrapMode::NoWrap;
-    std::vector<TextFold>::const_iterator folds;
+    FoldTree::const_iterator folds;
+    // the inserts of the current block
     std::vector<view::Insert>::const_iterator inserts;
+    std::vector<view::Insert>::const_iterator inserts_end;
     int insert_row = 0;
     std::vector<view::InlineInsert>::const_iterator inline_inserts;
+    std::vector<view::InlineInsert>::const_iterator inline_inserts_end;
     TextBlockIterator textblock;
     int line = 0;
     IteratorKind current = BlockIterator;
@@ -83,13 +206,17 @@ private:
     bool isTab() const;
 
     bool atEnd() const;
+    int currentLength() const;
     int currentWidth() const;
+    int currentWidth(int length) const;
 
     void seek(const view::Line& l);
     void seek(const TextBlock& b);
+    void seek(const TextBlock& b, int blocknum);
 
   protected:
     void update();
+    void seekInserts();
   };
 
 private:
@@ -113,10 +240,14 @@ public:
 
   void relayout(std::list<view::Line>::iterator it);
 
+  void relayout(const std::vector<TextBlock>& blocks);
+
   void handleBlockInsertion(const TextBlock& b);
   void handleBlockRemoval(const TextBlock& b);
+  void handleBlocksAppended(const TextBlock& b);
+  void handleBlocksReplaced(const TextBlock& b, int blocknum, int end);
 
-  void handleFoldInsertion(std::vector<TextFold>::iterator it);
+  void handleFoldInsertion(const TextFold& fold);
   void handleFoldRemoval(const TextCursor& sel);
 
 protected:
@@ -127,10 +258,11 @@ protected:
   std::list<view::Line>::iterator getLine(TextBlock b);
   void writeCurrentLine();
   void updateBlockLineIterator(TextBlock begin, TextBlock end);
-  view::LineElement createLineElement(const Iterator& it, int w = -1);
+  bool hasLines(const TextBlock& b) const;
+  view::LineElement createLineElement(const Iterator& it, int w = -1, int n = -1);
   view::LineElement createCarriageReturn();
   view::LineElement createLineIndent();
-  void appendToCurrentLine(const Iterator& it, int w = -1);
+  void appendToCurrentLine(const Iterator& it, int w = -1, int n = -1);
 };
 
 } // namespace typewriter
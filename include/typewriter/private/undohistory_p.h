@@ -0,0 +1,166 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_UNDOHISTORY_P_H
+#define TYPEWRITER_UNDOHISTORY_P_H
+
+#include "typewriter/textdiff.h"
+#include "typewriter/textdocument.h"
+
+#include <cassert>
+#include <cstdio>
+#include <deque>
+
+namespace typewriter
+{
+
+class Contributor;
+class TextCursor;
+
+// @TODO: rework the undo/redo system
+class Author
+{
+public:
+  Contributor* contributor = nullptr;
+  TextCursor* cursor = nullptr;
+
+  Author() = default;
+
+  Author(Contributor* c)
+    : contributor(c)
+  {
+
+  }
+
+  Author(TextCursor* c)
+    : cursor(c)
+  {
+
+  }
+
+  bool is_null() const
+  {
+    return contributor == nullptr && cursor == nullptr;
+  }
+};
+
+inline bool operator==(const Author& lhs, const Author& rhs)
+{
+  return lhs.contributor == rhs.contributor && lhs.cursor == rhs.cursor;
+}
+
+inline bool operator!=(const Author& lhs, const Author& rhs)
+{
+  return !(lhs == rhs);
+}
+
+struct Contribution
+{
+  Author author;
+  TextDiff delta;
+};
+
+inline bool from_same_author(const Contribution& lhs, const Contribution& rhs)
+{
+  return lhs.author == rhs.author;
+}
+
+inline Contribution merge(Contribution&& lhs, Contribution&& rhs)
+{
+  assert(from_same_author(lhs, rhs));
+
+  Contribution ret;
+  ret.author = lhs.author;
+  ret.delta = std::move(lhs.delta);
+  ret.delta << rhs.delta;
+  return ret;
+}
+
+struct UndoEntry
+{
+  enum State
+  {
+    Live,
+    Compressed,
+    Spilled,
+  };
+
+  Author author;
+  State state = Live;
+  TextDiff delta;
+  std::string data; // compressed delta
+  long offset = 0; // position of the data in the spill file
+  size_t size = 0; // size of the compressed data
+  size_t bytes = 0; // memory used by the entry
+};
+
+/*
+ * Stores the undo and redo stacks of a document.
+ * Consecutive edits may be coalesced, old entries are compressed and
+ * the history is kept within the limits of an UndoPolicy, either by
+ * discarding the oldest entries or by moving them to a temporary file.
+ */
+class UndoHistory
+{
+public:
+  UndoHistory();
+  UndoHistory(const UndoHistory&) = delete;
+  ~UndoHistory();
+
+  const UndoPolicy& policy() const { return m_policy; }
+  void setPolicy(const UndoPolicy& policy);
+
+  size_t undoCount() const { return m_undo.size(); }
+  size_t redoCount() const { return m_redo.size(); }
+  size_t undoCount(const Author& author) const;
+  size_t redoCount(const Author& author) const;
+
+  const Author& lastUndoAuthor() const { return m_undo.back().author; }
+  const Author& lastRedoAuthor() const { return m_redo.back().author; }
+
+  void push(Contribution c);
+
+  Contribution takeUndo();
+  Contribution takeRedo();
+  Contribution takeUndo(const Author& author);
+  Contribution takeRedo(const Author& author);
+  void pushUndo(Contribution c);
+  void pushRedo(Contribution c);
+
+  size_t memoryUsage() const { return m_bytes; }
+  UndoMemoryUsage memoryUsageDetails() const;
+  void shrink();
+
+  void clear();
+
+  UndoHistory& operator=(const UndoHistory&) = delete;
+
+protected:
+  UndoEntry make_entry(Contribution c) const;
+  Contribution take(std::deque<UndoEntry>& stack);
+  int find_last(const std::deque<UndoEntry>& stack, const Author& author) const;
+  void set_delta(UndoEntry& entry, TextDiff delta);
+  void add(std::deque<UndoEntry>& stack, Contribution c);
+  bool can_merge(const UndoEntry& entry, const Contribution& c) const;
+
+  void compress(UndoEntry& entry);
+  bool spill(UndoEntry& entry);
+  void load(UndoEntry& entry);
+  void load_in_place(UndoEntry& entry);
+  void enforce_policy();
+  void compress_old_entries(std::deque<UndoEntry>& stack);
+  bool spill_oldest(std::deque<UndoEntry>& stack);
+  void drop_oldest();
+
+private:
+  UndoPolicy m_policy;
+  std::deque<UndoEntry> m_undo;
+  std::deque<UndoEntry> m_redo;
+  size_t m_bytes = 0;
+  std::FILE* m_spill_file = nullptr;
+};
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_UNDOHISTORY_P_H
@@ -7,7 +7,7 @@
 
 #include "typewriter/typewriter-defs.h"
 
-#include <unicode/utf8.h>
+#include "typewriter/utils/utf8.h"
 
 namespace typewriter
 {
@@ -29,15 +29,7 @@ public:
 
   size_t length() const
   {
-    unicode::Utf8Iterator it = unicode::utf8::begin(m_str);
-    unicode::Utf8Iterator end = unicode::utf8::end(m_str+m_size);
-
-    size_t result = 0;
-
-    while (it != end)
-      ++result, ++it;
-
-    return result;
+    return utf8::count_codepoints(m_str, m_size);
   }
 };
 
@@ -9,6 +9,7 @@
 
 #include <unicode/utf8.h>
 
+#include <algorithm>
 #include <string>
 
 namespace typewriter
@@ -36,6 +37,12 @@ public:
   int length() const;
   size_t size() const;
 
+  size_t byteOffset(int column) const;
+  int columnAt(size_t offset) const;
+
+  int displayWidth(int column) const;
+  int columnAtDisplayWidth(int w) const;
+
   int blockNumber() const;
   int offset() const;
 
@@ -62,6 +69,129 @@ private:
   TextBlockImpl *mImpl;
 };
 
+/*!
+ * \class TextBlockView
+ * \brief a non-owning handle to a block
+ *
+ * Unlike TextBlock, a TextBlockView does not keep the block alive: it must 
+ * not outlive the block nor be used after the document was modified.
+ * It is meant for read-only loops over the document where updating the 
+ * reference count at each step would be wasteful.
+ */
+class TYPEWRITER_API TextBlockView
+{
+public:
+  TextBlockView() = default;
+  TextBlockView(const TextBlockView&) = default;
+  ~TextBlockView() = default;
+
+  TextBlockView(const TextBlock& block)
+    : mDocument(block.document()),
+      mImpl(block.impl())
+  {
+
+  }
+
+  TextBlockView(const TextDocument *doc, TextBlockImpl *impl)
+    : mDocument(doc),
+      mImpl(impl)
+  {
+
+  }
+
+  inline const TextDocument* document() const { return mDocument; }
+
+  inline bool isNull() const { return mImpl == nullptr; }
+  bool isValid() const;
+
+  const std::string& text() const;
+  int length() const;
+  size_t size() const;
+
+  size_t byteOffset(int column) const;
+  int columnAt(size_t offset) const;
+
+  int blockId() const;
+  int revision() const;
+
+  TextBlockView next() const;
+  TextBlockView previous() const;
+
+  TextBlock block() const { return mImpl ? TextBlock{ mDocument, mImpl } : TextBlock{}; }
+
+  inline TextBlockImpl* impl() const { return mImpl; }
+
+  TextBlockView& operator=(const TextBlockView&) = default;
+  bool operator==(const TextBlockView& other) const { return mImpl == other.mImpl; }
+  bool operator!=(const TextBlockView& other) const { return mImpl != other.mImpl; }
+
+private:
+  const TextDocument *mDocument = nullptr;
+  TextBlockImpl *mImpl = nullptr;
+};
+
+/*!
+ * \class TextBlockRange
+ * \brief a range of consecutive blocks
+ *
+ * Iterating over the range yields borrowed views of the blocks together 
+ * with their line number and byte offset in the document.
+ * As with TextBlockView, the document must not be modified during the iteration.
+ */
+class TYPEWRITER_API TextBlockRange
+{
+public:
+
+  struct Item
+  {
+    TextBlockView block;
+    int line;
+    size_t offset;
+
+    const std::string& text() const { return block.text(); }
+  };
+
+  class TYPEWRITER_API iterator
+  {
+  public:
+    iterator() = default;
+    iterator(const iterator&) = default;
+
+    iterator(const TextBlockView& block, int line, size_t offset)
+    {
+      m_item.block = block;
+      m_item.line = line;
+      m_item.offset = offset;
+    }
+
+    const Item& operator*() const { return m_item; }
+    const Item* operator->() const { return &m_item; }
+
+    iterator& operator++();
+
+    bool operator==(const iterator& other) const { return m_item.block == other.m_item.block; }
+    bool operator!=(const iterator& other) const { return m_item.block != other.m_item.block; }
+
+    iterator& operator=(const iterator&) = default;
+
+  private:
+    Item m_item = Item{ TextBlockView(), 0, 0 };
+  };
+
+  TextBlockRange(const iterator& begin, const iterator& end)
+    : m_begin(begin), m_end(end)
+  {
+
+  }
+
+  const iterator& begin() const { return m_begin; }
+  const iterator& end() const { return m_end; }
+
+private:
+  iterator m_begin;
+  iterator m_end;
+};
+
 class TYPEWRITER_API TextBlockIterator
 {
 public:
@@ -102,11 +232,11 @@ public:
 
   void seekColumn(int c)
   {
-    if (c < m_column)
-      *this = block().begin();
+    if (isNull() || c == m_column)
+      return;
 
-    while (!atEnd() && m_column != c)
-      ++(*this);
+    m_iterator = unicode::utf8::begin(m_block.text().data() + m_block.byteOffset(c));
+    m_column = std::min(std::max(c, 0), m_block.length());
   }
 
 
@@ -0,0 +1,79 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_TEXTDECORATIONS_H
+#define TYPEWRITER_TEXTDECORATIONS_H
+
+#include "typewriter/textblock.h"
+#include "typewriter/textdocument.h"
+#include "typewriter/view/formatrange.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace typewriter
+{
+
+struct SearchMatch;
+
+/*!
+ * \class TextDecorations
+ * \brief ranges of a document displayed with a format on top of the syntax formats
+ *
+ * Decorations are used for search matches, selections or diagnostics.
+ * They are stored per block as sorted, non-overlapping ranges: adding a
+ * decoration overwrites the parts of the decorations it overlaps.
+ * Ranges follow the edits of the document.
+ *
+ * A decoration layer can be shared by several views with TextView::setDecorations();
+ * changing it does not affect the layout of the views.
+ */
+class TYPEWRITER_API TextDecorations : public TextDocumentListener
+{
+public:
+  explicit TextDecorations(TextDocument* document);
+  TextDecorations(const TextDecorations&) = delete;
+  ~TextDecorations();
+
+  void add(const Position& begin, const Position& end, int format);
+  void add(const std::vector<SearchMatch>& matches, int format);
+  void remove(const Position& begin, const Position& end);
+  void remove(int format);
+  void clear();
+
+  bool isEmpty() const;
+  size_t count() const;
+
+  const std::vector<view::FormatRange>& ranges(const TextBlock& block) const;
+
+  size_t memoryUsage() const;
+
+  TextDecorations& operator=(const TextDecorations&) = delete;
+
+protected:
+  void blockInserted(const Position& pos, const TextBlock& newblock) override;
+  void blockDestroyed(int line, const TextBlock& block) override;
+  void contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded) override;
+  void blocksDiscarded(int count) override;
+  void blocksReplaced(int line, int count, int newCount) override;
+
+  TextBlock find_block(int line);
+  void paint(const Position& begin, const Position& end, int format);
+  void remove_garbage();
+
+private:
+  struct Entry
+  {
+    TextBlock block;
+    std::vector<view::FormatRange> ranges;
+  };
+
+  std::unordered_map<TextBlockImpl*, Entry> m_blocks;
+  TextBlock m_hint_block; // block located by the last call to find_block()
+  int m_hint_line = -1;
+};
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_TEXTDECORATIONS_H
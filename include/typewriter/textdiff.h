@@ -13,6 +13,8 @@
 namespace typewriter
 {
 
+class TextDocument;
+
 class TYPEWRITER_API TextRange
 {
 public:
@@ -40,18 +42,12 @@ public:
   TextRange& operator-=(const Range & other);
 
 private:
-
-  struct SeekHint
-  {
-    int index;
-    Position pos;
-  };
-
-  int seek(const Position & pos, SeekHint hint);
+  void update_end();
 
 private:
   Range m_range;
   std::string m_text;
+  std::vector<int> m_newlines; // offsets of the line feeds in m_text
 };
 
 class TYPEWRITER_API TextDiff
@@ -59,6 +55,7 @@ class TYPEWRITER_API TextDiff
 public:
   TextDiff() = default;
   TextDiff(const TextDiff &) = default;
+  TextDiff(TextDiff&&) = default;
   ~TextDiff() = default;
 
   enum Kind {
@@ -83,10 +80,12 @@ public:
     void mapTo(const Diff & other);
   };
 
-  inline const std::vector<Diff> & diffs() const { return mDiffs; }
-  inline std::vector<Diff> & diffs() { return mDiffs; }
+  const std::vector<Diff>& diffs() const;
+  void squeeze();
+
+  inline bool isEmpty() const { return m_root == -1; }
 
-  void clear() { mDiffs.clear(); }
+  void clear();
   
   Diff takeFirst();
 
@@ -97,15 +96,75 @@ public:
   TextDiff& operator<<(Diff d);
   TextDiff& operator<<(const TextDiff & other);
 
+  // Appends a diff expressed in the coordinates of the original text;
+  // it must be located after all the existing diffs.
+  TextDiff& append(Diff d);
+
+  TextDiff inverted() const;
+
+  TextDiff& operator=(const TextDiff&) = default;
+  TextDiff& operator=(TextDiff&&) = default;
+
 private:
-  TextDiff& add_insertion(Diff d);
-  TextDiff& add_removal(Diff d);
 
-  bool apply_removal(Diff& d, Diff& removal);
+  /*
+   * The diff is stored as a sequence of hunks, each one being made of
+   * an unchanged part of the original text (only its extent is stored),
+   * followed by the removed text and the text inserted in its place.
+   * Hunks are kept in a treap whose nodes aggregate the extents of their 
+   * subtree in both the original and the modified text so that edits can
+   * be located and composed in O(log n).
+   */
+  struct Hunk
+  {
+    Position gap;
+    std::string removed;
+    std::string inserted;
+    Position removed_extent;
+    Position inserted_extent;
+  };
+
+  struct Node
+  {
+    Hunk hunk;
+    int left;
+    int right;
+    unsigned int priority;
+    int count;
+    Position original_extent;
+    Position extent;
+  };
+
+  struct Location
+  {
+    int rank;
+    Position begin;
+  };
+
+  int create_node(Hunk h);
+  void release_node(int n);
+  void update(int n);
+  int merge(int a, int b);
+  void split(int t, int k, int& a, int& b);
+  int build(std::vector<Hunk>& hunks);
+  void collect(int t, std::vector<Hunk>& hunks);
+
+  Location locate_first_ending_at_or_after(const Position& pos) const;
+  Location locate_last_starting_at_or_before(const Position& pos) const;
+
+  void add_insertion(const Position& pos, const std::string& text);
+  void add_removal(const Position& pos, const std::string& text);
+
+  void invalidate();
 
 private:
-  int mAgent;
-  std::vector<Diff> mDiffs;
+  int mAgent = 0;
+  std::vector<Node> m_nodes;
+  int m_root = -1;
+  int m_free = -1;
+  unsigned int m_seed = 0x9E3779B9;
+  mutable bool m_dirty = false;
+  mutable std::vector<Diff> m_diffs;
 };
 
 namespace diff
@@ -114,6 +173,12 @@ namespace diff
 TextDiff::Diff insert(const Position& pos, const std::string& text);
 TextDiff::Diff remove(const Position& pos, const std::string& text);
 
+TYPEWRITER_API TextDiff compute(const std::string& from, const std::string& to);
+TYPEWRITER_API TextDiff compute(const TextDocument& from, const std::string& to);
+TYPEWRITER_API TextDiff compute(const TextDocument& from, const TextDocument& to);
+
+TYPEWRITER_API void transform(TextDiff& a, TextDiff& b);
+
 } // namespace diff
 
 bool operator==(const TextDiff::Diff& lhs, const TextDiff::Diff& rhs);
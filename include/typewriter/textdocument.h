@@ -7,6 +7,7 @@
 
 #include "typewriter/typewriter-defs.h"
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
@@ -14,8 +15,10 @@ namespace typewriter
 {
 
 class TextBlock;
+class TextBlockRange;
 class TextCursor;
 class TextDiff;
+class TextSnapshot;
 
 class TextDocumentImpl;
 
@@ -50,6 +53,71 @@ public:
   virtual void blockDestroyed(int line, const TextBlock& block);
   virtual void contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded);
   virtual void contentsChanged();
+
+  /*!
+   * \fn virtual void blocksAppended(int line, int count);
+   * \param line of the block that was the last block before the append
+   * \param number of blocks inserted after it
+   * \brief notifies that text was appended at the end of the document
+   *
+   * Text may also have been appended to the block at 'line'.
+   * This is sent once per call to TextDocument::append(), instead of 
+   * blockInserted() and contentsChange().
+   */
+  virtual void blocksAppended(int line, int count);
+
+  /*!
+   * \fn virtual void blocksDiscarded(int count);
+   * \param number of blocks removed at the beginning of the document
+   * \brief notifies that the first blocks were dropped to honor the maximum block count
+   */
+  virtual void blocksDiscarded(int count);
+
+  /*!
+   * \fn virtual void blocksReplaced(int line, int count, int newCount);
+   * \param line of the first modified block
+   * \param number of blocks, starting at 'line', that were covered by the edits
+   * \param number of blocks that now occupy that range
+   * \brief notifies that a large diff was applied in a single pass
+   *
+   * Blocks of the range may have been modified in place, removed (they are 
+   * then garbage) or inserted; blocks outside of the range are untouched.
+   * This is sent instead of blockInserted(), blockDestroyed() and 
+   * contentsChange() when a diff with many edits is applied.
+   */
+  virtual void blocksReplaced(int line, int count, int newCount);
+};
+
+struct UndoPolicy
+{
+  size_t max_bytes = 0; // memory budget of the history, 0 means unlimited
+  int max_steps = 0; // 0 means unlimited
+  bool merge_consecutive_edits = false; // whether consecutive edits of a cursor are undone together
+  int uncompressed_steps = 32; // number of recent steps that are never compressed
+  bool spill_to_disk = false; // whether steps over budget are moved to a temporary file instead of being discarded
+};
+
+struct UndoMemoryUsage
+{
+  size_t live = 0; // uncompressed steps
+  size_t compressed = 0;
+  size_t spilled = 0; // size of the steps moved to the temporary file, not part of total()
+  int steps = 0; // undo and redo steps
+
+  size_t total() const { return live + compressed; }
+};
+
+// Estimated heap memory used by a document, in bytes.
+struct DocumentMemoryUsage
+{
+  size_t document = 0; // the document itself, its cursor and listener lists
+  size_t blocks = 0; // block nodes, text excluded
+  size_t text = 0; // storage of the block contents
+  size_t column_indexes = 0;
+  size_t snapshots = 0; // the nodes of the snapshot tree, the lines are shared with the blocks
+  UndoMemoryUsage undo;
+
+  size_t total() const { return document + blocks + text + column_indexes + snapshots + undo.total(); }
 };
 
 class TYPEWRITER_API TextDocument
@@ -62,10 +130,14 @@ public:
   const std::string& text(int line) const;
   std::string toString() const;
   int lineCount() const;
+  size_t size() const;
 
   TextBlock firstBlock() const;
   TextBlock lastBlock() const;
   TextBlock findBlockByNumber(int num) const;
+  TextBlockRange blocks(int from = 0, int to = -1) const;
+
+  TextSnapshot snapshot() const;
 
   /// TODO: validate this candidate interface or (maybe?) remove
   int availableUndoSteps() const;
@@ -75,6 +147,21 @@ public:
   void undo();
   void redo();
 
+  const UndoPolicy& undoPolicy() const;
+  void setUndoPolicy(const UndoPolicy& policy);
+
+  void apply(const TextDiff& diff);
+  void reload(const std::string& text);
+
+  void append(const std::string& text);
+  bool isLoading() const;
+
+  int maximumBlockCount() const;
+  void setMaximumBlockCount(int n);
+
+  DocumentMemoryUsage memoryUsage() const;
+  void shrink();
+
   static void updatePositionOnInsert(Position & pos, const Position & insertpos, const TextBlock & newblock);
   static void updatePositionOnBlockDestroyed(Position & pos, int linenum, const TextBlock & block);
   static void updatePositionOnContentsChange(Position & pos, const TextBlock & block, const Position & editpos, int charsRemoved, int charsAdded);
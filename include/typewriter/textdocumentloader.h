@@ -0,0 +1,67 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_TEXTDOCUMENTLOADER_H
+#define TYPEWRITER_TEXTDOCUMENTLOADER_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace typewriter
+{
+
+class TextDocument;
+
+/*!
+ * \class TextDocumentLoader
+ * \brief incrementally appends text to a document
+ *
+ * Data is either pushed with feed() or pulled from a stream with loadChunk(),
+ * which is meant to be called repeatedly (e.g. from the event loop) so that
+ * the document can be displayed and edited before it is fully loaded.
+ * Each chunk is appended with TextDocument::append(); CRLF line endings
+ * are converted and incomplete UTF-8 sequences are held back until the
+ * next chunk.
+ *
+ * TextDocument::isLoading() returns true until finish() is called or the
+ * loader is destroyed.
+ */
+class TYPEWRITER_API TextDocumentLoader
+{
+public:
+  explicit TextDocumentLoader(TextDocument* document);
+  TextDocumentLoader(TextDocument* document, std::istream& input);
+  TextDocumentLoader(const TextDocumentLoader&) = delete;
+  ~TextDocumentLoader();
+
+  TextDocument* document() const { return m_document; }
+
+  size_t chunkSize() const { return m_chunk_size; }
+  void setChunkSize(size_t n);
+
+  void feed(const char* data, size_t size);
+  void feed(const std::string& data);
+
+  bool loadChunk();
+
+  bool isFinished() const { return m_document == nullptr; }
+  void finish();
+
+  TextDocumentLoader& operator=(const TextDocumentLoader&) = delete;
+
+private:
+  TextDocument* m_document;
+  std::istream* m_input = nullptr;
+  size_t m_chunk_size = 1024 * 1024;
+  std::string m_pending;
+  std::vector<char> m_buffer;
+};
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_TEXTDOCUMENTLOADER_H
@@ -0,0 +1,158 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_TEXTSEARCH_H
+#define TYPEWRITER_TEXTSEARCH_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace typewriter
+{
+
+class TextCursor;
+class TextDocument;
+class TextSearchIndex;
+class TextSnapshot;
+
+namespace regex
+{
+class Dfa;
+} // namespace regex
+
+struct SearchOptions
+{
+  bool case_sensitive = true; // case-insensitive searches only fold ASCII letters
+  bool regex = false;
+  int threads = 0; // maximum number of threads used by findAll() and replaceAll(), 0 means one per core
+};
+
+struct SearchMatch
+{
+  Position begin;
+  Position end;
+
+  SearchMatch()
+    : begin(-1, -1), end(-1, -1)
+  {
+
+  }
+
+  SearchMatch(const Position& b, const Position& e)
+    : begin(b), end(e)
+  {
+
+  }
+
+  bool isNull() const { return begin.line < 0; }
+};
+
+inline bool operator==(const SearchMatch& lhs, const SearchMatch& rhs) { return lhs.begin == rhs.begin && lhs.end == rhs.end; }
+inline bool operator!=(const SearchMatch& lhs, const SearchMatch& rhs) { return !(lhs == rhs); }
+
+/*!
+ * \class TextSearcher
+ * \brief a compiled search pattern
+ *
+ * Literal patterns may contain line feeds, regular expressions only match
+ * within a line (^ and $ match at the beginning and at the end of the lines).
+ * Regular expressions are run by a lazily built DFA, matches are
+ * leftmost-longest; an invalid expression throws std::runtime_error.
+ *
+ * A TextSearcher caches the DFA states and must not be used by several
+ * threads at the same time; copies do not share the cache.
+ */
+class TYPEWRITER_API TextSearcher
+{
+public:
+  explicit TextSearcher(const std::string& pattern, const SearchOptions& options = SearchOptions());
+  TextSearcher(const TextSearcher& other);
+  ~TextSearcher();
+
+  const std::string& pattern() const { return m_pattern; }
+  const SearchOptions& options() const { return m_options; }
+
+  bool isMultiline() const { return m_lines.size() > 1; }
+
+  // the offsets are in bytes
+  bool findInLine(const std::string& line, size_t from, size_t& begin, size_t& end) const;
+
+  // multiline patterns only, 'lines' must have lineCount() elements
+  size_t lineCount() const { return m_lines.size(); }
+  bool matchesLines(const std::vector<const std::string*>& lines, size_t& begin, size_t& end) const;
+
+  TextSearcher& operator=(const TextSearcher&) = delete;
+
+protected:
+  bool find_literal(const std::string& needle, const char* text, size_t size, size_t from, size_t& begin) const;
+  bool equals(const char* a, const char* b, size_t size) const;
+
+private:
+  std::string m_pattern;
+  SearchOptions m_options;
+  std::vector<std::string> m_lines; // the pattern split at the line feeds (literals only)
+  std::unique_ptr<regex::Dfa> m_dfa;
+};
+
+TYPEWRITER_API std::vector<SearchMatch> findAll(const TextDocument& document, const TextSearcher& searcher);
+TYPEWRITER_API std::vector<SearchMatch> findAll(const TextSnapshot& snapshot, const TextSearcher& searcher);
+TYPEWRITER_API std::vector<SearchMatch> findAll(TextSearchIndex& index, const TextSearcher& searcher);
+
+TYPEWRITER_API size_t replaceAll(TextDocument& document, const TextSearcher& searcher, const std::string& replacement);
+TYPEWRITER_API size_t replaceAll(TextCursor& cursor, const TextSearcher& searcher, const std::string& replacement);
+
+TYPEWRITER_API SearchMatch findNext(const TextDocument& document, const TextSearcher& searcher, const Position& from, bool wrap = true);
+TYPEWRITER_API SearchMatch findPrevious(const TextDocument& document, const TextSearcher& searcher, const Position& from, bool wrap = true);
+
+TYPEWRITER_API bool findNext(TextCursor& cursor, const TextSearcher& searcher, bool wrap = true);
+TYPEWRITER_API bool findPrevious(TextCursor& cursor, const TextSearcher& searcher, bool wrap = true);
+
+/*!
+ * \fn std::future<std::vector<SearchMatch>> findAllAsync(const TextDocument& document, const TextSearcher& searcher)
+ * \brief searches a snapshot of the document in a background thread
+ */
+TYPEWRITER_API std::future<std::vector<SearchMatch>> findAllAsync(const TextDocument& document, const TextSearcher& searcher);
+
+/*!
+ * \class SearchJob
+ * \brief searches a snapshot in a background thread and reports the matches in batches
+ *
+ * The callback is invoked from the background thread, with the matches in
+ * document order; the job is cancelled when destroyed.
+ */
+class TYPEWRITER_API SearchJob
+{
+public:
+  typedef std::function<void(const std::vector<SearchMatch>&)> Callback;
+
+  SearchJob(const TextSnapshot& snapshot, const TextSearcher& searcher, Callback callback, size_t batchSize = 1024);
+  SearchJob(const SearchJob&) = delete;
+  ~SearchJob();
+
+  void cancel();
+  void wait();
+
+  bool isFinished() const { return m_finished; }
+  bool isCancelled() const { return m_cancelled; }
+  size_t matchCount() const { return m_count; }
+
+  SearchJob& operator=(const SearchJob&) = delete;
+
+private:
+  std::atomic<bool> m_cancelled{ false };
+  std::atomic<bool> m_finished{ false };
+  std::atomic<size_t> m_count{ 0 };
+  std::thread m_thread;
+};
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_TEXTSEARCH_H
@@ -0,0 +1,118 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_TEXTSEARCHINDEX_H
+#define TYPEWRITER_TEXTSEARCHINDEX_H
+
+#include "typewriter/textdocument.h"
+
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace typewriter
+{
+
+class TextSearcher;
+
+/*!
+ * \class TextSearchIndex
+ * \brief a trigram index of a document, used to skip the lines that cannot match
+ *
+ * Lines are grouped into chunks of about ChunkLines lines; each chunk stores
+ * a Bloom filter of the trigrams of its lines (ASCII letters are folded to
+ * lowercase). A search only scans the chunks whose filter contains all the
+ * trigrams of the pattern, or of the longest literal required by a regular
+ * expression.
+ *
+ * The index listens to its document: modified chunks become dirty and are
+ * always scanned until update() or a rebuild indexes them again.
+ * The memory budget bounds the total size of the filters; 0 gives a quarter
+ * of the size of the document.
+ */
+class TYPEWRITER_API TextSearchIndex : public TextDocumentListener
+{
+public:
+  static const int ChunkLines = 64;
+
+  explicit TextSearchIndex(TextDocument* document, size_t memoryBudget = 0);
+  TextSearchIndex(const TextSearchIndex&) = delete;
+  ~TextSearchIndex();
+
+  size_t memoryBudget() const;
+  void setMemoryBudget(size_t bytes);
+
+  void rebuild();
+  void rebuildAsync();
+  bool isBuilding() const;
+  void wait();
+
+  void update();
+
+  int chunkCount() const;
+  int dirtyChunkCount() const;
+  size_t memoryUsage() const;
+
+  struct LineRange
+  {
+    int begin;
+    int end;
+
+    LineRange(int b, int e)
+      : begin(b), end(e)
+    {
+
+    }
+  };
+
+  std::vector<LineRange> candidates(const TextSearcher& searcher);
+
+  TextSearchIndex& operator=(const TextSearchIndex&) = delete;
+
+  struct Chunk
+  {
+    int lines;
+    bool dirty;
+    std::vector<uint64_t> bits; // empty if the chunk is dirty
+
+    explicit Chunk(int n = 0)
+      : lines(n), dirty(true)
+    {
+
+    }
+  };
+
+protected:
+  void blockInserted(const Position& pos, const TextBlock& newblock) override;
+  void blockDestroyed(int line, const TextBlock& block) override;
+  void contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded) override;
+  void blocksAppended(int line, int count) override;
+  void blocksDiscarded(int count) override;
+  void blocksReplaced(int line, int count, int newCount) override;
+
+  void replace_lines(int line, int count, int newCount);
+  void install();
+  double bits_per_byte() const;
+
+private:
+  size_t m_budget = 0;
+  std::vector<Chunk> m_chunks;
+  int m_hint_chunk = 0; // chunk located by the last edit
+  int m_hint_line = 0; // first line of that chunk
+
+  struct Edit
+  {
+    int line;
+    int count;
+    int new_count;
+  };
+
+  std::future<std::vector<Chunk>> m_build;
+  std::vector<Edit> m_edits_during_build;
+};
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_TEXTSEARCHINDEX_H
@@ -0,0 +1,82 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_TEXTSNAPSHOT_H
+#define TYPEWRITER_TEXTSNAPSHOT_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace typewriter
+{
+
+struct TextSnapshotNode;
+
+/*!
+ * \class TextSnapshot
+ * \brief an immutable version of a document
+ *
+ * Snapshots are obtained with TextDocument::snapshot() and share their lines
+ * with the document they were taken from.
+ * A snapshot is never modified by later edits of the document and may be
+ * read from any thread.
+ */
+class TYPEWRITER_API TextSnapshot
+{
+public:
+  TextSnapshot() = default;
+  TextSnapshot(const TextSnapshot&) = default;
+  TextSnapshot(TextSnapshot&&) = default;
+  ~TextSnapshot() = default;
+
+  explicit TextSnapshot(std::shared_ptr<const TextSnapshotNode> root);
+
+  bool isNull() const { return m_root == nullptr; }
+
+  int lineCount() const;
+  size_t length() const;
+
+  const std::string& text(int line) const;
+  std::string toString() const;
+
+  class TYPEWRITER_API const_iterator
+  {
+  public:
+    const_iterator() = default;
+    const_iterator(const const_iterator&) = default;
+
+    const std::string& operator*() const;
+    const std::string* operator->() const { return &(**this); }
+
+    const_iterator& operator++();
+
+    bool operator==(const const_iterator& other) const { return m_path == other.m_path; }
+    bool operator!=(const const_iterator& other) const { return m_path != other.m_path; }
+
+    const_iterator& operator=(const const_iterator&) = default;
+
+  protected:
+    friend class TextSnapshot;
+    void descend(const TextSnapshotNode* node);
+
+  private:
+    std::vector<const TextSnapshotNode*> m_path;
+  };
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  TextSnapshot& operator=(const TextSnapshot&) = default;
+  TextSnapshot& operator=(TextSnapshot&&) = default;
+
+private:
+  std::shared_ptr<const TextSnapshotNode> m_root;
+};
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_TEXTSNAPSHOT_H
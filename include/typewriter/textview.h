@@ -6,6 +6,7 @@
 #define TYPEWRITER_TEXTVIEW_H
 
 #include "typewriter/textdocument.h"
+#include "typewriter/textfold.h"
 #include "typewriter/view/inserts.h"
 #include "typewriter/view/line.h"
 #include "typewriter/utils/range.h"
@@ -24,8 +25,21 @@ class Block;
 class Line;
 } // namespace view
 
+class TextDecorations;
 class TextViewImpl;
 
+// Estimated heap memory used by a view, in bytes; the document is not included.
+struct ViewMemoryUsage
+{
+  size_t view = 0; // the view itself, its folds and inserts
+  size_t lines = 0; // lines and their elements
+  size_t blocks = 0; // per-block data, formats excluded
+  size_t formats = 0;
+  size_t line_index = 0;
+
+  size_t total() const { return view + lines + blocks + formats + line_index; }
+};
+
 class TYPEWRITER_API TextView : public TextDocumentListener
 {
 public:
@@ -48,6 +62,11 @@ public:
   const std::list<view::Line>& lines() const;
   const std::unordered_map<TextBlockImpl*, std::shared_ptr<view::Block>>& blocks() const;
 
+  std::list<view::Line>::const_iterator lineAt(int row) const;
+
+  view::Point map(const Position& pos) const;
+  Position hitTest(const view::Point& pt) const;
+
   enum class WrapMode
   {
     NoWrap,
@@ -60,24 +79,45 @@ public:
   void setWrapMode(WrapMode wm);
 
   void addFold(int id, TextCursor sel, int w = 3);
+  void addFolds(std::vector<TextFold> folds);
   void removeFold(int id);
+  void removeFolds(const std::vector<int>& ids);
   void clearFolds();
+  bool hasFold(int id) const;
+  int foldCount() const;
 
   void addInsert(view::Insert ins);
+  void addInserts(std::vector<view::Insert> inserts);
+  void removeInserts(const Position& begin, const Position& end);
+  void replaceInserts(const Position& begin, const Position& end, std::vector<view::Insert> inserts);
   void addInlineInsert(view::InlineInsert ins);
+  void addInlineInserts(std::vector<view::InlineInsert> inserts);
+  void removeInlineInserts(const Position& begin, const Position& end);
+  void replaceInlineInserts(const Position& begin, const Position& end, std::vector<view::InlineInsert> inserts);
   void clearInserts();
 
-  const std::vector<view::Insert>& inserts() const;
-  const std::vector<view::InlineInsert>& inlineInserts() const;
+  std::vector<view::Insert> inserts() const;
+  std::vector<view::InlineInsert> inlineInserts() const;
+  int insertCount() const;
+  int inlineInsertCount() const;
+
+  TextDecorations* decorations() const;
+  void setDecorations(TextDecorations* decorations);
 
   view::StyledFragments fragments(const view::Line& line, const view::LineElement& le) const;
 
+  ViewMemoryUsage memoryUsage() const;
+  void shrink();
+
   inline TextViewImpl* impl() const { return d.get(); }
 
 protected:
   void blockDestroyed(int line, const TextBlock & block) override;
   void blockInserted(const Position & pos, const TextBlock & block) override;
   void contentsChange(const TextBlock & block, const Position & pos, int charsRemoved, int charsAdded) override;
+  void blocksAppended(int line, int count) override;
+  void blocksDiscarded(int count) override;
+  void blocksReplaced(int line, int count, int newCount) override;
 
 private: 
   void init();
@@ -0,0 +1,57 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_TEXTWRITER_H
+#define TYPEWRITER_TEXTWRITER_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <future>
+#include <string>
+
+namespace typewriter
+{
+
+class TextDocument;
+class TextSnapshot;
+
+struct SaveOptions
+{
+  enum LineEnding
+  {
+    LF,
+    CRLF,
+    CR,
+  };
+
+  LineEnding line_ending = LF;
+  bool fsync = false; // whether the data is flushed to the disk before returning
+  bool atomic_replace = true; // whether a temporary file is written and then renamed over the destination
+};
+
+/*!
+ * \fn void save(const TextDocument& document, const std::string& path, const SaveOptions& options)
+ * \brief writes the document to a file
+ *
+ * Lines are written directly from the blocks, the document is never
+ * converted to a single string.
+ * Throws std::runtime_error on failure, in which case the destination is left
+ * untouched if atomic_replace is set.
+ */
+TYPEWRITER_API void save(const TextDocument& document, const std::string& path, const SaveOptions& options = SaveOptions());
+TYPEWRITER_API void save(const TextSnapshot& snapshot, const std::string& path, const SaveOptions& options = SaveOptions());
+
+/*!
+ * \fn std::future<void> saveAsync(const TextDocument& document, const std::string& path, const SaveOptions& options)
+ * \brief writes a snapshot of the document to a file in a background thread
+ *
+ * The document may be modified while the file is being written.
+ * The snapshot shares its lines with the document, only the lines edited 
+ * during the save are copied.
+ */
+TYPEWRITER_API std::future<void> saveAsync(const TextDocument& document, const std::string& path, const SaveOptions& options = SaveOptions());
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_TEXTWRITER_H
@@ -0,0 +1,47 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_UTILS_DISPLAYWIDTH_H
+#define TYPEWRITER_UTILS_DISPLAYWIDTH_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace typewriter
+{
+
+namespace display
+{
+
+// returns the number of cells used to display a code point:
+// 0 for combining marks and other zero-width characters,
+// 2 for East Asian wide and fullwidth characters (which include most emojis),
+// 1 otherwise
+TYPEWRITER_API int char_width(uint32_t c);
+
+// These functions work on UTF-8 text, 'from' and 'to' are byte offsets in 'text'.
+// A character following a zero width joiner, or an emoji modifier following
+// a wide character, is displayed together with the previous character and 
+// does not use any cell.
+
+// returns the number of cells used to display text[from, to)
+TYPEWRITER_API int width(const char* text, size_t from, size_t to);
+
+// returns the offset reached by advancing from 'from' as long as the characters
+// fit in 'w' cells; 'w' receives the number of cells that were not used
+TYPEWRITER_API size_t advance(const char* text, size_t from, size_t to, int& w);
+
+inline int width(const std::string& str)
+{
+  return width(str.data(), 0, str.size());
+}
+
+} // namespace display
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_UTILS_DISPLAYWIDTH_H
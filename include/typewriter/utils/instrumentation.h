@@ -0,0 +1,122 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_UTILS_INSTRUMENTATION_H
+#define TYPEWRITER_UTILS_INSTRUMENTATION_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace typewriter
+{
+
+namespace instrumentation
+{
+
+// A named timer or counter, e.g. "document.insertText" or "view.relayout".
+// The part of the name before the first '.' is the subsystem.
+// Probes are created by the TYPEWRITER_SCOPED_TIMER and TYPEWRITER_COUNT
+// macros, which expand to nothing unless TYPEWRITER_INSTRUMENTATION is defined;
+// each call site has its own probe, writeSummary() merges probes sharing a name.
+class TYPEWRITER_API Probe
+{
+public:
+  enum Kind
+  {
+    Timer, // values are durations in nanoseconds
+    Counter,
+  };
+
+  enum { BucketCount = 40 };
+
+  explicit Probe(const char* name, Kind k = Timer);
+  Probe(const Probe&) = delete;
+  ~Probe() = default;
+
+  const char* name() const { return m_name; }
+  std::string subsystem() const;
+  Kind kind() const { return m_kind; }
+
+  void record(uint64_t value);
+
+  uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+  uint64_t total() const { return m_total.load(std::memory_order_relaxed); }
+  uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+  // bucket i counts the values in [2^i, 2^(i+1)), 0 being counted in the first bucket
+  uint64_t bucket(int i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+  uint64_t percentile(double p) const;
+
+  void reset();
+
+  Probe& operator=(const Probe&) = delete;
+
+private:
+  const char* m_name;
+  Kind m_kind;
+  std::atomic<uint64_t> m_count{ 0 };
+  std::atomic<uint64_t> m_total{ 0 };
+  std::atomic<uint64_t> m_max{ 0 };
+  std::atomic<uint64_t> m_buckets[BucketCount];
+};
+
+TYPEWRITER_API std::vector<Probe*> probes();
+TYPEWRITER_API Probe* find(const std::string& name);
+TYPEWRITER_API void reset();
+
+TYPEWRITER_API void startTracing();
+TYPEWRITER_API void stopTracing();
+TYPEWRITER_API bool isTracing();
+TYPEWRITER_API void writeChromeTrace(std::ostream& out);
+
+TYPEWRITER_API void writeSummary(std::ostream& out);
+
+class TYPEWRITER_API ScopedTimer
+{
+public:
+  explicit ScopedTimer(Probe& p)
+    : m_probe(p),
+      m_start(std::chrono::steady_clock::now())
+  {
+
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ~ScopedTimer();
+
+private:
+  Probe& m_probe;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+} // namespace instrumentation
+
+} // namespace typewriter
+
+#if defined(TYPEWRITER_INSTRUMENTATION)
+
+#define TYPEWRITER_INSTRUMENTATION_CAT2(a, b) a##b
+#define TYPEWRITER_INSTRUMENTATION_CAT(a, b) TYPEWRITER_INSTRUMENTATION_CAT2(a, b)
+
+#define TYPEWRITER_SCOPED_TIMER(name) \
+  static typewriter::instrumentation::Probe TYPEWRITER_INSTRUMENTATION_CAT(tw_probe_, __LINE__){ name }; \
+  typewriter::instrumentation::ScopedTimer TYPEWRITER_INSTRUMENTATION_CAT(tw_timer_, __LINE__){ TYPEWRITER_INSTRUMENTATION_CAT(tw_probe_, __LINE__) }
+
+#define TYPEWRITER_COUNT(name, n) \
+  do { static typewriter::instrumentation::Probe tw_probe{ name, typewriter::instrumentation::Probe::Counter }; tw_probe.record(n); } while (false)
+
+#else
+
+#define TYPEWRITER_SCOPED_TIMER(name)
+#define TYPEWRITER_COUNT(name, n) do { } while (false)
+
+#endif // defined(TYPEWRITER_INSTRUMENTATION)
+
+#endif // !TYPEWRITER_UTILS_INSTRUMENTATION_H
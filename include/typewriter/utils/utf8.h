@@ -0,0 +1,49 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#ifndef TYPEWRITER_UTILS_UTF8_H
+#define TYPEWRITER_UTILS_UTF8_H
+
+#include "typewriter/typewriter-defs.h"
+
+#include <cstddef>
+#include <string>
+
+namespace typewriter
+{
+
+namespace utf8
+{
+
+// These functions are vectorized (SSE2, or AVX2 when the CPU supports it)
+// and fall back to scalar code on other architectures.
+
+TYPEWRITER_API bool validate(const char* data, size_t size);
+
+// returns the number of code points, i.e. the number of bytes that are not continuation bytes
+TYPEWRITER_API size_t count_codepoints(const char* data, size_t size);
+
+// returns the byte offset of the code point at index 'column', or 'size' if there is no such code point
+TYPEWRITER_API size_t byte_offset(const char* data, size_t size, size_t column);
+
+inline bool validate(const std::string& str)
+{
+  return validate(str.data(), str.size());
+}
+
+inline size_t count_codepoints(const std::string& str)
+{
+  return count_codepoints(str.data(), str.size());
+}
+
+inline size_t byte_offset(const std::string& str, size_t column)
+{
+  return byte_offset(str.data(), str.size(), column);
+}
+
+} // namespace utf8
+
+} // namespace typewriter
+
+#endif // !TYPEWRITER_UTILS_UTF8_H
@@ -34,8 +34,10 @@ public:
   inline bool isNull() const { return mView == nullptr; }
 
   int format() const;
+  int decoration() const;
   int position() const;
   int length() const;
+  int width() const;
 
   TextBlock block() const;
   std::string text() const;
@@ -50,7 +52,7 @@ protected:
   friend class TextView;
   friend class TextViewImpl;
 
-  StyledFragment(TextViewImpl const* view, const TextBlock& block, int begin, int end, std::vector<FormatRange>::const_iterator iter);
+  StyledFragment(const StyledFragment& other, int begin, std::vector<FormatRange>::const_iterator iter, std::vector<FormatRange>::const_iterator decoration);
 
 private:
   TextViewImpl const* mView = nullptr;
@@ -58,6 +60,8 @@ private:
   int mEnd = -1;
   std::shared_ptr<view::Block> m_block;
   std::vector<FormatRange>::const_iterator mIterator;
+  const std::vector<FormatRange>* mDecorations = nullptr;
+  std::vector<FormatRange>::const_iterator mDecoration;
 };
 
 class TYPEWRITER_API StyledFragments
@@ -38,7 +38,8 @@ struct LineElement
   Kind kind = LE_BlockFragment;
   TextBlock block;
   int begin = 0;
-  int width = 0;
+  int length = 0; // number of columns of the block covered by the element
+  int width = 0; // number of cells used to display the element
   int id = -1; // fold-id or insert-id or inline-insert-id
   int nbrow = 0;
 };
@@ -86,6 +87,19 @@ public:
   std::string displayedText() const;
 };
 
+// A location in the view: a line of the view and a number of cells from its start
+struct Point
+{
+  int row;
+  int x;
+
+  Point(int r = -1, int px = 0)
+    : row(r), x(px)
+  {
+
+  }
+};
+
 } // namespace view
 
 } // namespace typewriter
@@ -0,0 +1,285 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+// Headless rendering benchmark: scrolls through large documents and
+// measures the time spent highlighting and rendering each frame, either
+// with a counting renderer (view pipeline only) or with the QPainter
+// renderer drawing into a QImage.
+// Runs without a display, the 'offscreen' platform is used unless
+// QT_QPA_PLATFORM is set.
+
+#include "allocations.h"
+#include "corpus.h"
+
+#include "typewriter/qt/codeeditor-qt-common.h"
+#include "typewriter/textcursor.h"
+
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace typewriter;
+
+// every word gets one of 3 formats, depending on its first byte
+class WordHighlighter : public QTypewriterSyntaxHighlighter
+{
+public:
+  explicit WordHighlighter(QObject* parent = nullptr)
+    : QTypewriterSyntaxHighlighter(parent)
+  {
+
+  }
+
+protected:
+  void highlightBlock(const std::string& text) override
+  {
+    int column = 0;
+    int start = -1;
+    char first = 0;
+
+    for (size_t i(0); i <= text.size(); ++i)
+    {
+      if (i < text.size() && (static_cast<unsigned char>(text[i]) & 0xC0) == 0x80)
+        continue;
+
+      const bool space = i == text.size() || text[i] == ' ' || text[i] == '\t';
+
+      if (space && start != -1)
+      {
+        setFormat(start, column - start, 1 + static_cast<unsigned char>(first) % 3);
+        start = -1;
+      }
+      else if (!space && start == -1)
+      {
+        start = column;
+        first = text[i];
+      }
+
+      ++column;
+    }
+  }
+};
+
+// renderer that only walks the view, i.e. the cost of the pipeline without painting
+struct CountingRenderer
+{
+  size_t lines = 0;
+  size_t fragments = 0;
+  size_t characters = 0;
+
+  void beginLine(const QPoint&, const view::Line&) { ++lines; }
+  void endLine() { }
+  void drawFoldSymbol(const QPoint&, int) { }
+
+  void drawText(const QPoint&, const QString& text, const TextFormat&)
+  {
+    ++fragments;
+    characters += static_cast<size_t>(text.size());
+  }
+};
+
+// counts the fragments drawn by the painter renderer
+class CountingPainterRenderer : public QTypewriterPainterRenderer
+{
+public:
+  size_t fragments = 0;
+
+  CountingPainterRenderer(QTypewriterView& view, QPainter& p)
+    : QTypewriterPainterRenderer(view, p)
+  {
+
+  }
+
+  void drawText(const QPoint& offset, const QString& text, const TextFormat& format)
+  {
+    ++fragments;
+    QTypewriterPainterRenderer::drawText(offset, text, format);
+  }
+};
+
+struct Scenario
+{
+  const char* name;
+  bench::Corpus corpus;
+  bool folds;
+  TextView::WrapMode wrapmode;
+};
+
+struct FrameStats
+{
+  std::vector<double> times; // in microseconds
+  size_t fragments = 0;
+  size_t allocations = 0;
+};
+
+static double percentile(std::vector<double> values, double p)
+{
+  if (values.empty())
+    return 0;
+
+  std::sort(values.begin(), values.end());
+  const size_t i = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+  return values.at(i);
+}
+
+static void setup(QTypewriterView& view, const Scenario& s)
+{
+  view.resize(QSize(1024, 768));
+
+  for (int i(1); i <= 3; ++i)
+  {
+    TextFormat fmt;
+    fmt.text_color = QColor(60 * i, 0, 255 - 60 * i);
+    fmt.bold = (i == 2);
+    fmt.underline = (i == 3) ? TextFormat::WaveUnderline : TextFormat::NoUnderline;
+    view.setFormat(i, fmt);
+  }
+
+  if (s.wrapmode != TextView::WrapMode::NoWrap)
+  {
+    view.view().setWrapMode(s.wrapmode);
+    view.view().setCharactersPerLine(120);
+  }
+
+  if (s.folds)
+  {
+    TextDocument* document = view.document()->document();
+    TextCursor cursor{ document };
+
+    for (int i(20); i + 10 < document->lineCount(); i += 50)
+    {
+      cursor.setPosition(Position{ i, 4 });
+      cursor.setPosition(Position{ i + 10, 0 }, TextCursor::KeepAnchor);
+      view.view().addFold(i, cursor);
+    }
+  }
+}
+
+template<typename F>
+static FrameStats scroll(QTypewriterView& view, int frames, F&& render_frame)
+{
+  typedef std::chrono::steady_clock clock;
+
+  FrameStats stats;
+  const int step = std::max(1, view.displayedLineCount() / 2);
+
+  for (int i(0); i < frames; ++i)
+  {
+    view.setLineScroll((i * step) % std::max(1, view.maxLinescroll()));
+
+    const size_t allocations = bench::allocation_count();
+    const auto start = clock::now();
+
+    // runs the highlighting scheduled by the scroll
+    QCoreApplication::sendPostedEvents(&view);
+    stats.fragments += render_frame();
+
+    const auto end = clock::now();
+    stats.allocations += bench::allocation_count() - allocations;
+    stats.times.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+  }
+
+  return stats;
+}
+
+static void report(const std::string& name, const FrameStats& stats)
+{
+  const double n = static_cast<double>(stats.times.size());
+
+  std::printf("%-36s %10.1f %10.1f %10.1f %10.1f %14.1f %14.1f\n", name.c_str(),
+    percentile(stats.times, 0.5), percentile(stats.times, 0.9), percentile(stats.times, 0.99), percentile(stats.times, 1.0),
+    stats.fragments / n, stats.allocations / n);
+  std::fflush(stdout);
+}
+
+static std::unique_ptr<TextDocument> create_document(const Scenario& s, int lines)
+{
+  return std::unique_ptr<TextDocument>(new TextDocument(bench::generate(s.corpus, lines)));
+}
+
+int main(int argc, char* argv[])
+{
+  int frames = 500;
+  int lines = 50000;
+  const char* filter = nullptr;
+
+  for (int i(1); i < argc; ++i)
+  {
+    if (std::strncmp(argv[i], "--frames=", 9) == 0)
+      frames = std::max(1, std::atoi(argv[i] + 9));
+    else if (std::strncmp(argv[i], "--lines=", 8) == 0)
+      lines = std::max(1, std::atoi(argv[i] + 8));
+    else if (std::strncmp(argv[i], "--filter=", 9) == 0)
+      filter = argv[i] + 9;
+  }
+
+  if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+
+  QGuiApplication app{ argc, argv };
+
+  const Scenario scenarios[] = {
+    { "ShortLines", bench::Corpus::ShortLines, false, TextView::WrapMode::NoWrap },
+    { "ShortLines/Folds", bench::Corpus::ShortLines, true, TextView::WrapMode::NoWrap },
+    { "LongLines/Word", bench::Corpus::LongLines, false, TextView::WrapMode::Word },
+    { "Tabs/Folds", bench::Corpus::Tabs, true, TextView::WrapMode::NoWrap },
+    { "Unicode/Word", bench::Corpus::Unicode, false, TextView::WrapMode::Word },
+  };
+
+  std::printf("%d frames per scenario, times in microseconds\n", frames);
+  std::printf("%-36s %10s %10s %10s %10s %14s %14s\n", "Scenario", "p50", "p90", "p99", "max", "fragments/frame", "allocs/frame");
+
+  for (const Scenario& s : scenarios)
+  {
+    if (filter && std::string(s.name).find(filter) == std::string::npos)
+      continue;
+
+    {
+      QTypewriterDocument document{ create_document(s, lines) };
+      QTypewriterView view{ &document };
+      WordHighlighter highlighter;
+      setup(view, s);
+      view.install(&highlighter);
+
+      FrameStats stats = scroll(view, frames, [&view]() -> size_t {
+        CountingRenderer renderer;
+        render(view, renderer);
+        return renderer.fragments;
+        });
+
+      report(std::string(s.name) + " (counting)", stats);
+      view.uninstallSyntaxHighlighter();
+    }
+
+    {
+      QTypewriterDocument document{ create_document(s, lines) };
+      QTypewriterView view{ &document };
+      WordHighlighter highlighter;
+      setup(view, s);
+      view.install(&highlighter);
+
+      QImage image{ view.size(), QImage::Format_ARGB32_Premultiplied };
+
+      FrameStats stats = scroll(view, frames, [&view, &image]() -> size_t {
+        QPainter painter{ &image };
+        CountingPainterRenderer renderer{ view, painter };
+        render(view, renderer);
+        return renderer.fragments;
+        });
+
+      report(std::string(s.name) + " (QPainter)", stats);
+      view.uninstallSyntaxHighlighter();
+    }
+  }
+
+  return 0;
+}
@@ -8,9 +8,12 @@
 #include "typewriter/qt/codeeditor-qt-defs.h"
 
 #include "typewriter/contributor.h"
+#include "typewriter/textdecorations.h"
 #include "typewriter/textview.h"
 #include "typewriter/syntaxhighlighter.h"
 
+#include "typewriter/utils/instrumentation.h"
+
 #include <QObject>
 
 #include <QColor>
@@ -90,10 +93,10 @@ private:
 
 public:
 
-  QTypewriterVisibleLines(const list& lines, size_t b, size_t s)
+  QTypewriterVisibleLines(iterator b, size_t available, size_t s)
   {
-    m_begin = std::next(lines.begin(), b);
-    m_size = std::min({ lines.size() - b, s });
+    m_begin = b;
+    m_size = std::min({ available, s });
     m_end = std::next(m_begin, m_size);
   }
 
@@ -138,11 +141,16 @@ public:
   QString filepath() const;
   void setFilePath(const QString& filepath);
 
+  Q_INVOKABLE void reload();
+
   int lineCount() const;
 
   void notifyBlockDestroyed(int line);
   void notifyBlockInserted(const Position& pos, const TextBlock& block);
   void notifyContentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded);
+  void notifyBlocksAppended(int line, int count);
+  void notifyBlocksDiscarded(int count);
+  void notifyBlocksReplaced(int line, int count, int newCount);
 
 Q_SIGNALS:
   void filepathChanged();
@@ -171,6 +179,7 @@ class TYPEWRITER_QAPI QTypewriterView : public QObject, public typewriter::TextD
   Q_PROPERTY(int effectiveHeight READ effectiveHeight NOTIFY lineCountChanged)
   Q_PROPERTY(int hscroll READ hscroll WRITE setHScroll NOTIFY hscrollChanged)
   Q_PROPERTY(int linescroll READ linescroll WRITE setLineScroll NOTIFY linescrollChanged)
+  Q_PROPERTY(bool followTail READ followTail WRITE setFollowTail NOTIFY followTailChanged)
   Q_PROPERTY(QFont font READ font WRITE setFont NOTIFY fontChanged)
 public:
   explicit QTypewriterView(QObject* parent = nullptr);
@@ -204,6 +213,9 @@ public:
   int maxLinescroll() const;
   void setLineScroll(int linescroll);
 
+  bool followTail() const;
+  void setFollowTail(bool on);
+
   const QFont& font() const;
   void setFont(const QFont& font);
 
@@ -218,6 +230,10 @@ public:
   const BlockFormat& blockFormat(int id) const;
   void setBlockFormat(int id, BlockFormat fmt);
 
+  typewriter::TextDecorations* decorations() const;
+  void setDecorations(typewriter::TextDecorations* decorations);
+  void updateDecorations();
+
   typewriter::Position hitTest(const QPoint& pos) const;
   QPoint map(const typewriter::Position& pos) const;
   bool isVisible(const typewriter::Position& pos) const;
@@ -233,6 +249,7 @@ Q_SIGNALS:
   void sizeChanged();
   void hscrollChanged();
   void linescrollChanged();
+  void followTailChanged();
   void fontChanged();
   void blockDestroyed();
   void blockInserted(int line);
@@ -245,6 +262,9 @@ protected:
   void blockDestroyed(int line, const TextBlock& block) override;
   void blockInserted(const Position& pos, const TextBlock& block) override;
   void contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded) override;
+  void blocksAppended(int line, int count) override;
+  void blocksDiscarded(int count) override;
+  void blocksReplaced(int line, int count, int newCount) override;
 
 protected:
 
@@ -263,6 +283,7 @@ private:
   QSize m_size;
   int m_hscroll = 0;
   int m_linescroll = 0;
+  bool m_follow_tail = false;
   QFont m_font;
   QTypewriterSyntaxHighlighter* m_syntax_highlighter = nullptr;
   bool m_highlight_scheduled = false;
@@ -304,6 +325,21 @@ private:
 namespace viewrendering
 {
 
+// the background, border and underline of a decoration replace those of the syntax format
+inline TextFormat decorate(TextFormat format, const TextFormat& decoration)
+{
+  format.background_color = decoration.background_color;
+  format.border_pen = decoration.border_pen;
+
+  if (decoration.underline != TextFormat::NoUnderline)
+  {
+    format.underline = decoration.underline;
+    format.underline_color = decoration.underline_color;
+  }
+
+  return format;
+}
+
 template<typename R>
 void drawBlockFragment(QTypewriterView& view, R&& renderer, QPoint offset, const view::Line& line, const view::LineElement& fragment)
 {
@@ -314,8 +350,11 @@ void drawBlockFragment(QTypewriterView& view, R&& renderer, QPoint offset, const
     //QString text = QString::fromStdString(fragment.block.text().substr(fragment.begin, fragment.width));
     //drawText(painter, offset, text, m_context->default_format);
     QString text = QString::fromStdString(it.text());
-    renderer.drawText(offset, text, view.textFormat(it.format()));
-    offset.rx() += it.length() * view.metrics().charwidth;
+    if (it.decoration() != 0)
+      renderer.drawText(offset, text, decorate(view.textFormat(it.format()), view.textFormat(it.decoration())));
+    else
+      renderer.drawText(offset, text, view.textFormat(it.format()));
+    offset.rx() += it.width() * view.metrics().charwidth;
   }
 }
 
@@ -347,6 +386,10 @@ void drawLine(QTypewriterView& view, R&& renderer, const QPoint& offset, const v
       drawBlockFragment(view, std::forward<R>(renderer), pt, line, e);
       pt.rx() += e.width * view.metrics().charwidth;
     }
+    else if (e.kind == view::LineElement::LE_Tab)
+    {
+      pt.rx() += e.width * view.metrics().charwidth;
+    }
   }
 
   renderer.endLine();
@@ -357,7 +400,9 @@ void drawLine(QTypewriterView& view, R&& renderer, const QPoint& offset, const v
 template<typename R>
 void render(QTypewriterView& view, R&& renderer)
 {
-  auto begin = std::next(view.view().lines().begin(), view.linescroll());
+  TYPEWRITER_SCOPED_TIMER("qt.render");
+
+  auto begin = view.view().lineAt(view.linescroll());
 
   auto end = begin;
   int numline = 1 + view.size().height() / view.metrics().lineheight;
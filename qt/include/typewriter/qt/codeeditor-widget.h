@@ -167,7 +167,7 @@ protected:
 
 protected:
   void drawCursor(QPainter *painter, const TextCursor & c);
-  void drawSelection(QPainter *painter, TextBlock block, const Position & begin, const Position & end);
+  void drawSelection(QPainter *painter, const Position & begin, const Position & end);
 
 protected:
   QTypewriterView* m_view;
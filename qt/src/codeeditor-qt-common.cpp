@@ -104,6 +104,21 @@ public:
   {
     backref.notifyContentsChange(block, pos, charsRemoved, charsAdded);
   }
+
+  void blocksAppended(int line, int count)
+  {
+    backref.notifyBlocksAppended(line, count);
+  }
+
+  void blocksDiscarded(int count)
+  {
+    backref.notifyBlocksDiscarded(count);
+  }
+
+  void blocksReplaced(int line, int count, int newCount)
+  {
+    backref.notifyBlocksReplaced(line, count, newCount);
+  }
 };
 
 QTypewriterDocument::QTypewriterDocument(QObject* parent)
@@ -183,20 +198,20 @@ void QTypewriterDocument::setFilePath(const QString& filepath)
   if (m_filepath != filepath)
   {
     m_filepath = filepath;
+    reload();
+    Q_EMIT filepathChanged();
+  }
+}
 
-    QFile file{ filepath };
-
-    if (file.open(QIODevice::ReadOnly))
-    {
-      QByteArray data = file.readAll();
-
-      typewriter::TextCursor cursor{ document() };
-      cursor.setPosition({ lineCount() + 1, 0 }, typewriter::TextCursor::KeepAnchor);
-      cursor.removeSelectedText();
-      cursor.insertText(data.toStdString());
-    }
+void QTypewriterDocument::reload()
+{
+  QFile file{ m_filepath };
 
-    Q_EMIT filepathChanged();
+  if (file.open(QIODevice::ReadOnly))
+  {
+    QByteArray data = file.readAll();
+    // Only the regions that changed are patched
+    document()->reload(data.toStdString());
   }
 }
 
@@ -222,6 +237,24 @@ void QTypewriterDocument::notifyContentsChange(const TextBlock& block, const Pos
 
 }
 
+void QTypewriterDocument::notifyBlocksAppended(int line, int count)
+{
+  if (count > 0)
+    Q_EMIT lineCountChanged();
+}
+
+void QTypewriterDocument::notifyBlocksDiscarded(int count)
+{
+  if (count > 0)
+    Q_EMIT lineCountChanged();
+}
+
+void QTypewriterDocument::notifyBlocksReplaced(int line, int count, int newCount)
+{
+  if (count != newCount)
+    Q_EMIT lineCountChanged();
+}
+
 class HighlightEvent : public QEvent
 {
 public:
@@ -425,6 +458,28 @@ void QTypewriterView::setLineScroll(int linescroll)
   }
 }
 
+bool QTypewriterView::followTail() const
+{
+  return m_follow_tail;
+}
+
+/*!
+ * \fn void setFollowTail(bool on)
+ * \brief sets whether the view scrolls to the end of the document when text is appended
+ */
+void QTypewriterView::setFollowTail(bool on)
+{
+  if (m_follow_tail != on)
+  {
+    m_follow_tail = on;
+
+    if (on)
+      setLineScroll(lineCount() - displayedLineCount());
+
+    Q_EMIT followTailChanged();
+  }
+}
+
 const QFont& QTypewriterView::font() const
 {
   return m_font;
@@ -477,148 +532,51 @@ void QTypewriterView::setBlockFormat(int id, BlockFormat fmt)
   m_block_formats[id] = fmt;
 }
 
-Position QTypewriterView::hitTest(const QPoint& pos) const
+typewriter::TextDecorations* QTypewriterView::decorations() const
 {
-  const int line_offset = pos.y() / m_metrics.lineheight;
-  const int column_offset = std::round((pos.x() + hscroll()) / float(m_metrics.charwidth));
-
-  auto visible_lines = visibleLines();
-
-  /* Seek visible line */
-  auto it = std::next(visible_lines.begin(), line_offset);
-
-  /* Take into account tabulations & folds */
-  if (it->elements.size() > 1)
-  {
-    int target_block = 0;
-    int target_col = 0;
-    int counter = column_offset;
-
-    for (auto elem = it->elements.begin(); elem != it->elements.end(); ++elem)
-    {
-      if (elem->kind == view::LineElement::LE_Fold)
-      {
-        counter -= elem->width;
-        if (counter <= 0)
-          return Position{ target_block, target_col };
-      }
-      else
-      {
-        target_block = elem->block.blockNumber();
-        target_col = elem->begin;
-        const int count = elem->width;
-        for (int i(0); i < count; ++i)
-        {
-          // @TODO: handle tab
-          //if (elem.text().at(i) == QChar('\t'))
-          //{
-          //  counter -= tabSize();
-          //  target_col += counter <= -tabSize() / 2 ? 0 : 1;
-          //}
-          //else
-          //{
-          counter -= 1;
-          target_col += 1;
-          //}
-
-          if (counter <= 0)
-            return Position{ target_block, target_col };
-        }
-      }
-    }
+  return m_view.decorations();
+}
 
-    return Position{ target_block, target_col };
-  }
-  else
-  {
-    const std::string& text = it->block().text();
-    int col = 0;
-    for (int i(0), counter(column_offset); i < text.length() && counter > 0; ++i)
-    {
-      // @TODO: handle tabs
-
-      //if (text.at(i) == QChar('\t'))
-      //{
-      //  counter -= tabSize();
-      //  col += counter <= -tabSize() / 2 ? 0 : 1;
-      //}
-      //else
-      //{
-      counter -= 1;
-      col += 1;
-      //}
-    }
+/*!
+ * \fn void setDecorations(typewriter::TextDecorations* decorations)
+ * \brief sets the decorations drawn on top of the syntax formats
+ *
+ * Decoration ids are text format ids, see setFormat().
+ */
+void QTypewriterView::setDecorations(typewriter::TextDecorations* decorations)
+{
+  m_view.setDecorations(decorations);
+  Q_EMIT invalidated();
+}
 
-    return Position{ it->block().blockNumber(), col };
-  }
+/*!
+ * \fn void updateDecorations()
+ * \brief repaints the view after its decorations were modified
+ *
+ * Neither the layout nor the syntax highlighting are updated.
+ */
+void QTypewriterView::updateDecorations()
+{
+  Q_EMIT invalidated();
 }
 
-static bool map_pos_complex(const Position& pos, const view::Line& line, int& column_offset)
+Position QTypewriterView::hitTest(const QPoint& pos) const
 {
-  for (auto elem = line.elements.begin(); elem != line.elements.end(); ++elem)
-  {
-    if (elem->kind == view::LineElement::LE_BlockFragment)
-    {
-      if (elem->block.blockNumber() != pos.line)
-      {
-        if (elem->begin <= pos.column && pos.column <= elem->begin + elem->width)
-        {
-          int count = pos.column - elem->begin;
-          for (int i(0); i < count; ++i)
-            column_offset += /* @TODO: fixtme : view->ncol(elem.text().at(i)); */ 1;
-          return true;
-        }
-      }
-      else
-      {
-        column_offset += elem->width;
-      }
-    }
-    else
-    {
-      /* @TODO: fixme */
-      //const auto& fold_info = view->folds.at(elem.foldid());
-      //if (fold_info.start() < pos && pos < fold_info.end())
-      //  return true;
-      //column_offset += elem.colcount();
-    }
-  }
+  const int row = std::min(linescroll() + pos.y() / m_metrics.lineheight, view().height() - 1);
+  const int x = std::round((pos.x() + hscroll()) / float(m_metrics.charwidth));
 
-  return false;
+  return view().hitTest(view::Point{ row, std::max(x, 0) });
 }
 
 QPoint QTypewriterView::map(const Position& pos) const
 {
-  auto visible_lines = visibleLines();
+  const view::Point pt = view().map(pos);
 
-  if (pos.line < visible_lines.begin()->block().blockNumber())
+  if (pt.row < linescroll())
     return QPoint{ 0, -metrics().descent };
 
-  int line_offset = 0;
-  int column_offset = 0;
-
-  for (auto line = visible_lines.begin(); line_offset < visible_lines.size(); ++line, ++line_offset)
-  {
-    if (line->isInsert())
-      continue;
-
-    if (line->elements.size() > 1)
-    {
-      if (map_pos_complex(pos, *line, column_offset))
-        break;
-    }
-    else
-    {
-      if (line->block().blockNumber() == pos.line)
-      {
-        column_offset = pos.column;
-        break;
-      }
-    }
-  }
-
-  int dy = line_offset * metrics().lineheight + metrics().ascent;
-  int dx = column_offset * metrics().charwidth;
+  int dy = (pt.row - linescroll()) * metrics().lineheight + metrics().ascent;
+  int dx = pt.x * metrics().charwidth;
 
   return QPoint{ dx - hscroll(), dy };
 }
@@ -683,6 +641,56 @@ void QTypewriterView::blockInserted(const Position& pos, const TextBlock& block)
   Q_EMIT invalidated();
 }
 
+void QTypewriterView::blocksAppended(int line, int count)
+{
+  if (m_syntax_highlighter)
+  {
+    m_syntax_highlighter->m_last_highlighted_line = std::min(line - 1, m_syntax_highlighter->m_last_highlighted_line);
+    scheduleHighlight();
+  }
+
+  if (count > 0)
+    Q_EMIT lineCountChanged();
+
+  if (m_follow_tail)
+    setLineScroll(lineCount() - displayedLineCount());
+
+  // @TODO: only invalidate if the appended lines are visible
+  Q_EMIT invalidated();
+}
+
+void QTypewriterView::blocksDiscarded(int count)
+{
+  if (m_syntax_highlighter)
+  {
+    m_syntax_highlighter->m_last_highlighted_line = std::max(-1, m_syntax_highlighter->m_last_highlighted_line - count);
+  }
+
+  Q_EMIT lineCountChanged();
+
+  // @TODO: this is an approximation if lines are wrapped
+  if (m_follow_tail)
+    setLineScroll(lineCount() - displayedLineCount());
+  else
+    setLineScroll(m_linescroll - count);
+
+  Q_EMIT invalidated();
+}
+
+void QTypewriterView::blocksReplaced(int line, int count, int newCount)
+{
+  if (m_syntax_highlighter)
+  {
+    m_syntax_highlighter->m_last_highlighted_line = std::min(line - 1, m_syntax_highlighter->m_last_highlighted_line);
+    scheduleHighlight();
+  }
+
+  if (count != newCount)
+    Q_EMIT lineCountChanged();
+
+  Q_EMIT invalidated();
+}
+
 void QTypewriterView::contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded)
 {
   if (m_syntax_highlighter) 
@@ -698,7 +706,8 @@ void QTypewriterView::contentsChange(const TextBlock& block, const Position& pos
 details::QTypewriterVisibleLines QTypewriterView::visibleLines() const
 {
   size_t count = size().height() / metrics().lineheight;
-  return details::QTypewriterVisibleLines(view().lines(), linescroll(), count);
+  const int first = std::min(linescroll(), view().height());
+  return details::QTypewriterVisibleLines(view().lineAt(first), view().height() - first, count);
 }
 
 void QTypewriterView::scheduleHighlight()
@@ -712,6 +721,8 @@ void QTypewriterView::scheduleHighlight()
 
 void QTypewriterView::highlightView()
 {
+  TYPEWRITER_SCOPED_TIMER("qt.highlightView");
+
   m_highlight_scheduled = false;
 
   if (!m_syntax_highlighter)
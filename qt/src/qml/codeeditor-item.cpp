@@ -134,13 +134,13 @@ void QTypewriterGutterItem::mousePressEvent(QMouseEvent* e)
   {
     int line = e->pos().y() / d->metrics().lineheight;
 
-    auto it = std::next(d->view().lines().begin(), d->linescroll());
+    auto it = d->view().lineAt(d->linescroll());
 
     const int count = 1 + d->size().height() / d->metrics().lineheight;
 
     for (int i(0); i < count && it != d->view().lines().end(); ++i, ++it, --line)
     {
-      if (it->elements.empty() || !it->elements.front().block.isValid())
+      if (it->elements.empty() || !it->elements.front().block.isValid() || it->isInsert())
         continue;
 
       if (line == 0)
@@ -167,7 +167,7 @@ void QTypewriterGutterItem::paint(QPainter* painter_ptr)
 
   //painter.drawLine(this->width() - 1, 0, this->width() - 1, this->height());
 
-  auto it = std::next(d->view().lines().begin(), d->linescroll());
+  auto it = d->view().lineAt(d->linescroll());
   std::vector<Marker>::const_iterator marker_it = m_markers.cbegin();
 
   const int count = 1 + d->size().height() / d->metrics().lineheight;
@@ -176,7 +176,7 @@ void QTypewriterGutterItem::paint(QPainter* painter_ptr)
 
   for (int i(0); i < count && it != d->view().lines().end(); ++i, ++it)
   {
-    if (it->elements.empty() || !it->elements.front().block.isValid())
+    if (it->elements.empty() || !it->elements.front().block.isValid() || it->isInsert())
       continue;
 
     // @TODO: improve performance, avoid recomputing the block number every time
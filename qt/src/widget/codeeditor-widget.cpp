@@ -117,13 +117,13 @@ void QTypewriterGutter::mousePressEvent(QMouseEvent* e)
   {
     int line = e->pos().y() / d->metrics().lineheight;
 
-    auto it = std::next(d->view().lines().begin(), d->linescroll());
+    auto it = d->view().lineAt(d->linescroll());
 
     const int count = 1 + d->size().height() / d->metrics().lineheight;
 
     for (int i(0); i < count && it != d->view().lines().end(); ++i, ++it, --line)
     {
-      if (it->elements.empty() || !it->elements.front().block.isValid())
+      if (it->elements.empty() || !it->elements.front().block.isValid() || it->isInsert())
         continue;
 
       if (line == 0)
@@ -148,7 +148,7 @@ void QTypewriterGutter::paintEvent(QPaintEvent* e)
 
   painter.drawLine(this->width() - 1, 0, this->width() - 1, this->height());
 
-  auto it = std::next(d->view().lines().begin(), d->linescroll());
+  auto it = d->view().lineAt(d->linescroll());
   std::vector<Marker>::const_iterator marker_it = m_markers.cbegin();
 
   const int count = 1 + d->size().height() / d->metrics().lineheight;
@@ -157,7 +157,7 @@ void QTypewriterGutter::paintEvent(QPaintEvent* e)
 
   for (int i(0); i < count && it != d->view().lines().end(); ++i, ++it)
   {
-    if (it->elements.empty() || !it->elements.front().block.isValid())
+    if (it->elements.empty() || !it->elements.front().block.isValid() || it->isInsert())
       continue;
 
     // @TODO: improve performance, avoid recomputing the block number every time
@@ -761,17 +761,10 @@ void QTypewriter::showEvent(QShowEvent *e)
   QWidget::showEvent(e);
 }
 
-static TextBlock selection_start_block(const TextCursor & c)
-{
-  if (c.position() == c.selectionStart())
-    return c.block();
-  return prev(c.block(), c.selectionEnd().line - c.selectionStart().line);
-}
-
 void QTypewriter::drawCursor(QPainter *painter, const TextCursor & c)
 {
   if (c.hasSelection())
-    drawSelection(painter, selection_start_block(c), c.selectionStart(), c.selectionEnd());
+    drawSelection(painter, c.selectionStart(), c.selectionEnd());
 
   if (!m_cursor_blink)
     return;
@@ -784,7 +777,7 @@ void QTypewriter::drawCursor(QPainter *painter, const TextCursor & c)
   painter->drawLine(pt, pt + QPoint(0, metrics().lineheight));
 }
 
-void QTypewriter::drawSelection(QPainter *painter, TextBlock block, const Position & begin, const Position & end)
+void QTypewriter::drawSelection(QPainter *painter, const Position & begin, const Position & end)
 {
   // @TODO: to simplify selection drawing (if we want to change text color
   // and not just draw unicolor overlay):
@@ -795,42 +788,24 @@ void QTypewriter::drawSelection(QPainter *painter, TextBlock block, const Positi
   painter->setPen(Qt::NoPen);
   painter->setBrush(QBrush(QColor(100, 100, 255, 100)));
 
-  QPoint pt = map(begin);
-  pt.ry() -= metrics().ascent;
-
-  if (begin.line == end.line)
-  {
-    QPoint endpt = map(end);
-    endpt.ry() -= metrics().ascent;
+  const TextView& textview = m_view->view();
+  const view::Point first = textview.map(begin);
+  const view::Point last = textview.map(end);
 
-    const int colcount = end.column - begin.column;
-    painter->drawRect(QRect(pt, QSize(endpt.x() - pt.x(), metrics().lineheight)));
-  }
-  else
-  {
-    /// TODO: take tabulations into account
+  // only the visible rows are drawn, wrapped lines included
+  const int top = m_view->linescroll();
+  const int row_begin = std::max(first.row, top);
+  const int row_end = std::min(last.row, top + m_view->displayedLineCount());
 
-    // Drawing first line selection
-    int colcount = 1 + block.length() - begin.column;
-    painter->drawRect(QRect(pt, QSize(colcount * metrics().charwidth, metrics().lineheight)));
+  auto line = textview.lineAt(row_begin);
 
-    // Drawing middle lines
-    pt = map(Position{ begin.line, 0 });
-    pt.ry() -= metrics().ascent;
-    const int linecount = end.line - begin.line - 1;
-    for (int i(0); i < linecount; ++i)
-    {
-      block = block.next();
-      pt.ry() += metrics().lineheight;
-      colcount = 1 + block.length();
-      painter->drawRect(QRect(pt, QSize(colcount * metrics().charwidth, metrics().lineheight)));
-    }
+  for (int row = row_begin; row <= row_end && line != textview.lines().end(); ++row, ++line)
+  {
+    const int x0 = row == first.row ? first.x : 0;
+    const int x1 = row == last.row ? last.x : line->width() + 1;
 
-    // Drawing last line
-    block = block.next();
-    pt.ry() += metrics().lineheight;
-    colcount = end.column;
-    painter->drawRect(QRect(pt, QSize(colcount * metrics().charwidth, metrics().lineheight)));
+    QPoint pt{ x0 * metrics().charwidth - m_view->hscroll(), (row - top) * metrics().lineheight };
+    painter->drawRect(QRect(pt + viewport().topLeft(), QSize((x1 - x0) * metrics().charwidth, metrics().lineheight)));
   }
 }
 
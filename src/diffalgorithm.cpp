@@ -0,0 +1,632 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/textdiff.h"
+
+#include "typewriter/textdocument.h"
+#include "typewriter/private/textdocument_p.h"
+
+#include "typewriter/utils/utf8.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+namespace typewriter
+{
+
+namespace
+{
+
+/*
+ * The diff is computed in two passes.
+ * Lines are first hashed and compared using patience anchors (lines that
+ * appear exactly once on both sides) with Myers' algorithm used in-between;
+ * the changed line hunks are then refined at the character level.
+ * Myers' algorithm is given a cost limit so that the worst case stays bounded:
+ * when it is reached, the whole region is considered replaced.
+ */
+
+const int LineDiffCostLimit = 2048;
+const int CharDiffCostLimit = 512;
+const size_t CharDiffSizeLimit = 64 * 1024;
+
+struct LineRef
+{
+  const char* data;
+  int size;
+  uint64_t hash;
+
+  int length() const { return static_cast<int>(utf8::count_codepoints(data, size)); }
+};
+
+uint64_t hash_bytes(const char* data, size_t size)
+{
+  // FNV-1a over 8-byte words, with a final avalanche
+  uint64_t h = 0xcbf29ce484222325ull ^ size;
+
+  while (size >= 8)
+  {
+    uint64_t w;
+    std::memcpy(&w, data, 8);
+    h = (h ^ w) * 0x100000001b3ull;
+    h ^= h >> 29;
+    data += 8;
+    size -= 8;
+  }
+
+  while (size > 0)
+  {
+    h = (h ^ static_cast<unsigned char>(*data)) * 0x100000001b3ull;
+    ++data;
+    --size;
+  }
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
+
+inline LineRef make_line(const char* data, int size)
+{
+  return LineRef{ data, size, hash_bytes(data, size) };
+}
+
+inline bool operator==(const LineRef& lhs, const LineRef& rhs)
+{
+  return lhs.hash == rhs.hash && lhs.size == rhs.size && std::memcmp(lhs.data, rhs.data, lhs.size) == 0;
+}
+
+void split_lines(const std::string& text, bool strip_cr, std::vector<LineRef>& lines)
+{
+  const char* it = text.data();
+  const char* end = text.data() + text.size();
+
+  for (;;)
+  {
+    const char* lf = static_cast<const char*>(std::memchr(it, '\n', end - it));
+    const char* line_end = lf ? lf : end;
+    int size = static_cast<int>(line_end - it);
+
+    if (strip_cr && size > 0 && it[size - 1] == '\r')
+      --size;
+
+    lines.push_back(make_line(it, size));
+
+    if (!lf)
+      break;
+
+    it = lf + 1;
+  }
+}
+
+void split_lines(const TextDocument& doc, std::vector<LineRef>& lines)
+{
+  lines.reserve(doc.lineCount());
+
+  for (TextBlockImpl* it = doc.impl()->firstBlock.get(); it != nullptr; it = it->next.get())
+    lines.push_back(make_line(it->content().data(), static_cast<int>(it->content().size())));
+}
+
+enum EditOp : char
+{
+  Keep,
+  Delete,
+  Insert,
+};
+
+/*
+ * Greedy O((N+M)D) Myers algorithm.
+ * Appends the edit script to 'script' and returns true, or returns false
+ * if the edit distance exceeds 'max_d'.
+ */
+template<typename Eq>
+bool myers(int n, int m, Eq eq, int max_d, std::vector<EditOp>& script)
+{
+  const int max = std::min(n + m, max_d);
+  const int offset = max + 1;
+  std::vector<int> v(2 * max + 3, 0);
+  std::vector<std::vector<int>> trace;
+
+  int d_found = -1;
+
+  for (int d = 0; d <= max && d_found == -1; ++d)
+  {
+    for (int k = -d; k <= d; k += 2)
+    {
+      int x;
+
+      if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+        x = v[offset + k + 1];
+      else
+        x = v[offset + k - 1] + 1;
+
+      int y = x - k;
+
+      while (x < n && y < m && eq(x, y))
+        ++x, ++y;
+
+      v[offset + k] = x;
+
+      if (x >= n && y >= m)
+      {
+        d_found = d;
+        break;
+      }
+    }
+
+    trace.push_back(std::vector<int>(v.begin() + offset - d, v.begin() + offset + d + 1));
+  }
+
+  if (d_found == -1)
+    return false;
+
+  // Backtrack
+  std::vector<EditOp> reversed;
+  reversed.reserve(n + m);
+  int x = n, y = m;
+
+  for (int d = d_found; d > 0; --d)
+  {
+    const std::vector<int>& prev = trace[d - 1];
+    auto prev_v = [&prev, d](int k) -> int { return prev[k + d - 1]; };
+
+    const int k = x - y;
+    int prev_k;
+
+    if (k == -d || (k != d && prev_v(k - 1) < prev_v(k + 1)))
+      prev_k = k + 1;
+    else
+      prev_k = k - 1;
+
+    const int prev_x = prev_v(prev_k);
+    const int prev_y = prev_x - prev_k;
+
+    while (x > prev_x && y > prev_y)
+    {
+      reversed.push_back(Keep);
+      --x, --y;
+    }
+
+    reversed.push_back(x == prev_x ? Insert : Delete);
+    x = prev_x;
+    y = prev_y;
+  }
+
+  while (x > 0 && y > 0)
+  {
+    reversed.push_back(Keep);
+    --x, --y;
+  }
+
+  script.insert(script.end(), reversed.rbegin(), reversed.rend());
+  return true;
+}
+
+struct LineHunk
+{
+  int a_begin;
+  int a_count;
+  int b_begin;
+  int b_count;
+};
+
+class LineDiffer
+{
+public:
+  const std::vector<LineRef>& a;
+  const std::vector<LineRef>& b;
+  std::vector<LineHunk> hunks;
+
+  LineDiffer(const std::vector<LineRef>& from, const std::vector<LineRef>& to)
+    : a(from), b(to)
+  {
+
+  }
+
+  void run()
+  {
+    diff(0, static_cast<int>(a.size()), 0, static_cast<int>(b.size()));
+  }
+
+protected:
+  void add_hunk(int a0, int a1, int b0, int b1)
+  {
+    if (a0 == a1 && b0 == b1)
+      return;
+
+    if (!hunks.empty())
+    {
+      LineHunk& last = hunks.back();
+
+      if (last.a_begin + last.a_count == a0 && last.b_begin + last.b_count == b0)
+      {
+        last.a_count += a1 - a0;
+        last.b_count += b1 - b0;
+        return;
+      }
+    }
+
+    hunks.push_back(LineHunk{ a0, a1 - a0, b0, b1 - b0 });
+  }
+
+  void diff(int a0, int a1, int b0, int b1)
+  {
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0])
+      ++a0, ++b0;
+
+    while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1])
+      --a1, --b1;
+
+    if (a0 == a1 || b0 == b1)
+    {
+      add_hunk(a0, a1, b0, b1);
+      return;
+    }
+
+    std::vector<std::pair<int, int>> anchors = find_anchors(a0, a1, b0, b1);
+
+    if (anchors.empty())
+    {
+      diff_myers(a0, a1, b0, b1);
+      return;
+    }
+
+    for (const auto& anchor : anchors)
+    {
+      diff(a0, anchor.first, b0, anchor.second);
+      a0 = anchor.first + 1;
+      b0 = anchor.second + 1;
+    }
+
+    diff(a0, a1, b0, b1);
+  }
+
+  std::vector<std::pair<int, int>> find_anchors(int a0, int a1, int b0, int b1)
+  {
+    struct Entry
+    {
+      int a_count = 0;
+      int b_count = 0;
+      int a_index = -1;
+      int b_index = -1;
+    };
+
+    std::unordered_map<uint64_t, Entry> table;
+    table.reserve((a1 - a0) + (b1 - b0));
+
+    for (int i = a0; i < a1; ++i)
+    {
+      Entry& e = table[a[i].hash];
+
+      // A hash collision between different lines disqualifies the entry
+      if (e.a_count == 0 || a[e.a_index] == a[i])
+        e.a_count += 1;
+      else
+        e.a_count = 2;
+
+      e.a_index = i;
+    }
+
+    for (int i = b0; i < b1; ++i)
+    {
+      auto it = table.find(b[i].hash);
+
+      if (it == table.end())
+        continue;
+
+      Entry& e = it->second;
+      e.b_count += 1;
+      e.b_index = i;
+    }
+
+    std::vector<std::pair<int, int>> candidates;
+
+    for (int i = a0; i < a1; ++i)
+    {
+      const Entry& e = table[a[i].hash];
+
+      if (e.a_count == 1 && e.b_count == 1 && a[i] == b[e.b_index])
+        candidates.emplace_back(i, e.b_index);
+    }
+
+    return longest_increasing_subsequence(candidates);
+  }
+
+  static std::vector<std::pair<int, int>> longest_increasing_subsequence(const std::vector<std::pair<int, int>>& candidates)
+  {
+    // Patience sorting on the 'b' indices, candidates are sorted by 'a' index
+    std::vector<int> tails;
+    std::vector<int> predecessors(candidates.size(), -1);
+
+    for (int i = 0; i < static_cast<int>(candidates.size()); ++i)
+    {
+      auto it = std::lower_bound(tails.begin(), tails.end(), candidates[i].second, [&candidates](int index, int value) {
+        return candidates[index].second < value;
+        });
+
+      if (it != tails.begin())
+        predecessors[i] = *(it - 1);
+
+      if (it == tails.end())
+        tails.push_back(i);
+      else
+        *it = i;
+    }
+
+    std::vector<std::pair<int, int>> result(tails.size());
+    int index = tails.empty() ? -1 : tails.back();
+
+    for (size_t i = result.size(); i > 0; --i)
+    {
+      result[i - 1] = candidates[index];
+      index = predecessors[index];
+    }
+
+    return result;
+  }
+
+  void diff_myers(int a0, int a1, int b0, int b1)
+  {
+    std::vector<EditOp> script;
+
+    auto eq = [this, a0, b0](int x, int y) -> bool {
+      return a[a0 + x] == b[b0 + y];
+    };
+
+    if (!myers(a1 - a0, b1 - b0, eq, LineDiffCostLimit, script))
+    {
+      add_hunk(a0, a1, b0, b1);
+      return;
+    }
+
+    int x = a0, y = b0;
+    size_t i = 0;
+
+    while (i < script.size())
+    {
+      if (script[i] == Keep)
+      {
+        ++x, ++y, ++i;
+        continue;
+      }
+
+      const int hx = x, hy = y;
+
+      while (i < script.size() && script[i] != Keep)
+      {
+        if (script[i] == Delete)
+          ++x;
+        else
+          ++y;
+
+        ++i;
+      }
+
+      add_hunk(hx, x, hy, y);
+    }
+  }
+};
+
+std::string join(const std::vector<LineRef>& lines, int begin, int count)
+{
+  size_t size = count > 0 ? count - 1 : 0;
+
+  for (int i = begin; i < begin + count; ++i)
+    size += lines[i].size;
+
+  std::string result;
+  result.reserve(size);
+
+  for (int i = begin; i < begin + count; ++i)
+  {
+    if (i != begin)
+      result.push_back('\n');
+
+    result.append(lines[i].data, lines[i].size);
+  }
+
+  return result;
+}
+
+struct Token
+{
+  int offset;
+  int size;
+};
+
+void tokenize(const std::string& text, std::vector<Token>& tokens)
+{
+  tokens.reserve(text.size());
+
+  int i = 0;
+  const int n = static_cast<int>(text.size());
+
+  while (i < n)
+  {
+    // Tokens are UTF-8 code points
+    int size = 1;
+
+    while (static_cast<unsigned char>(text[i]) >= 0xC0 && i + size < n && (static_cast<unsigned char>(text[i + size]) & 0xC0) == 0x80)
+      ++size;
+
+    tokens.push_back(Token{ i, size });
+    i += size;
+  }
+}
+
+class DiffBuilder
+{
+public:
+  TextDiff result;
+
+  void remove(const Position& pos, std::string text)
+  {
+    if (!text.empty())
+      result.append(diff::remove(pos, text));
+  }
+
+  void insert(const Position& pos, std::string text)
+  {
+    if (!text.empty())
+      result.append(diff::insert(pos, text));
+  }
+
+  void replace(const Position& pos, const std::string& removed, const std::string& inserted)
+  {
+    if (removed.empty())
+    {
+      insert(pos, inserted);
+    }
+    else
+    {
+      TextRange range{ removed, pos };
+      result.append(TextDiff::Diff{ TextDiff::Removal, range });
+      insert(range.end(), inserted);
+    }
+  }
+
+  void refine(const Position& pos, const std::string& a, const std::string& b)
+  {
+    if (a.size() + b.size() > CharDiffSizeLimit)
+    {
+      replace(pos, a, b);
+      return;
+    }
+
+    std::vector<Token> ta, tb;
+    tokenize(a, ta);
+    tokenize(b, tb);
+
+    auto eq = [&](int x, int y) -> bool {
+      return ta[x].size == tb[y].size && std::memcmp(a.data() + ta[x].offset, b.data() + tb[y].offset, ta[x].size) == 0;
+    };
+
+    std::vector<EditOp> script;
+
+    if (!myers(static_cast<int>(ta.size()), static_cast<int>(tb.size()), eq, CharDiffCostLimit, script))
+    {
+      replace(pos, a, b);
+      return;
+    }
+
+    Position cur = pos;
+    size_t x = 0, y = 0, i = 0;
+
+    auto advance = [&](const Token& tok) {
+      if (a[tok.offset] == '\n')
+      {
+        cur.line += 1;
+        cur.column = 0;
+      }
+      else
+      {
+        cur.column += 1;
+      }
+    };
+
+    while (i < script.size())
+    {
+      if (script[i] == Keep)
+      {
+        advance(ta[x]);
+        ++x, ++y, ++i;
+        continue;
+      }
+
+      const Position hunk_begin = cur;
+      std::string removed, inserted;
+
+      while (i < script.size() && script[i] != Keep)
+      {
+        if (script[i] == Delete)
+        {
+          removed.append(a, ta[x].offset, ta[x].size);
+          advance(ta[x]);
+          ++x;
+        }
+        else
+        {
+          inserted.append(b, tb[y].offset, tb[y].size);
+          ++y;
+        }
+
+        ++i;
+      }
+
+      remove(hunk_begin, std::move(removed));
+      insert(cur, std::move(inserted));
+    }
+  }
+};
+
+TextDiff compute_diff(const std::vector<LineRef>& a, const std::vector<LineRef>& b)
+{
+  LineDiffer differ{ a, b };
+  differ.run();
+
+  DiffBuilder builder;
+  const int a_size = static_cast<int>(a.size());
+
+  for (const LineHunk& h : differ.hunks)
+  {
+    if (h.b_count == 0)
+    {
+      // Pure removal of whole lines
+      if (h.a_begin + h.a_count < a_size)
+        builder.remove(Position{ h.a_begin, 0 }, join(a, h.a_begin, h.a_count) + "\n");
+      else
+        builder.remove(Position{ h.a_begin - 1, a[h.a_begin - 1].length() }, "\n" + join(a, h.a_begin, h.a_count));
+    }
+    else if (h.a_count == 0)
+    {
+      // Pure insertion of whole lines
+      if (h.a_begin < a_size)
+        builder.insert(Position{ h.a_begin, 0 }, join(b, h.b_begin, h.b_count) + "\n");
+      else
+        builder.insert(Position{ h.a_begin - 1, a[h.a_begin - 1].length() }, "\n" + join(b, h.b_begin, h.b_count));
+    }
+    else
+    {
+      builder.refine(Position{ h.a_begin, 0 }, join(a, h.a_begin, h.a_count), join(b, h.b_begin, h.b_count));
+    }
+  }
+
+  return std::move(builder.result);
+}
+
+} // namespace
+
+namespace diff
+{
+
+TextDiff compute(const std::string& from, const std::string& to)
+{
+  std::vector<LineRef> a, b;
+  split_lines(from, false, a);
+  split_lines(to, false, b);
+  return compute_diff(a, b);
+}
+
+TextDiff compute(const TextDocument& from, const std::string& to)
+{
+  std::vector<LineRef> a, b;
+  split_lines(from, a);
+  split_lines(to, true, b);
+  return compute_diff(a, b);
+}
+
+TextDiff compute(const TextDocument& from, const TextDocument& to)
+{
+  std::vector<LineRef> a, b;
+  split_lines(from, a);
+  split_lines(to, b);
+  return compute_diff(a, b);
+}
+
+} // namespace diff
+
+} // namespace typewriter
@@ -0,0 +1,316 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/utils/instrumentation.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+namespace typewriter
+{
+
+namespace instrumentation
+{
+
+namespace
+{
+
+struct TraceEvent
+{
+  const char* name;
+  int64_t start; // in microseconds, relative to the start of the tracing
+  int64_t duration;
+  size_t thread;
+};
+
+struct Registry
+{
+  std::mutex mutex;
+  std::vector<Probe*> probes;
+
+  std::atomic<bool> tracing{ false };
+  std::chrono::steady_clock::time_point trace_start;
+  std::vector<TraceEvent> events;
+};
+
+// never destroyed, probes are function-local statics that may outlive a static registry
+Registry& registry()
+{
+  static Registry* r = new Registry;
+  return *r;
+}
+
+int bucket_index(uint64_t value)
+{
+  int i = 0;
+
+  while (value > 1 && i < Probe::BucketCount - 1)
+  {
+    value >>= 1;
+    ++i;
+  }
+
+  return i;
+}
+
+// upper bound of the bucket containing the p-th percentile
+uint64_t percentile_of(const uint64_t* buckets, uint64_t count, uint64_t max, double p)
+{
+  if (count == 0)
+    return 0;
+
+  const uint64_t rank = static_cast<uint64_t>(std::max(1.0, p * static_cast<double>(count) + 0.5));
+  uint64_t acc = 0;
+
+  for (int i(0); i < Probe::BucketCount; ++i)
+  {
+    acc += buckets[i];
+
+    if (acc >= rank)
+      return std::min(max, (uint64_t(2) << i) - 1);
+  }
+
+  return max;
+}
+
+// the probes of all the call sites sharing a name
+struct Summary
+{
+  const char* name;
+  Probe::Kind kind;
+  uint64_t count = 0;
+  uint64_t total = 0;
+  uint64_t max = 0;
+  uint64_t buckets[Probe::BucketCount] = {};
+
+  Summary(const Probe& p)
+    : name(p.name()),
+      kind(p.kind())
+  {
+
+  }
+
+  void add(const Probe& p)
+  {
+    count += p.count();
+    total += p.total();
+    max = std::max(max, p.max());
+
+    for (int i(0); i < Probe::BucketCount; ++i)
+      buckets[i] += p.bucket(i);
+  }
+};
+
+void write_json_string(std::ostream& out, const char* str)
+{
+  out << '"';
+
+  for (const char* c = str; *c; ++c)
+  {
+    if (*c == '"' || *c == '\\')
+      out << '\\';
+
+    out << *c;
+  }
+
+  out << '"';
+}
+
+} // namespace
+
+Probe::Probe(const char* name, Kind k)
+  : m_name(name),
+    m_kind(k)
+{
+  for (auto& b : m_buckets)
+    b.store(0, std::memory_order_relaxed);
+
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock{ r.mutex };
+  r.probes.push_back(this);
+}
+
+std::string Probe::subsystem() const
+{
+  const char* dot = std::strchr(m_name, '.');
+  return dot ? std::string(m_name, dot) : std::string(m_name);
+}
+
+void Probe::record(uint64_t value)
+{
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_total.fetch_add(value, std::memory_order_relaxed);
+  m_buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t cur = m_max.load(std::memory_order_relaxed);
+
+  while (value > cur && !m_max.compare_exchange_weak(cur, value, std::memory_order_relaxed));
+}
+
+/*!
+ * \fn uint64_t percentile(double p) const
+ * \brief returns an upper bound of the p-th percentile (p in [0, 1])
+ *
+ * The result is the upper bound of the histogram bucket containing the percentile.
+ */
+uint64_t Probe::percentile(double p) const
+{
+  uint64_t buckets[BucketCount];
+
+  for (int i(0); i < BucketCount; ++i)
+    buckets[i] = bucket(i);
+
+  return percentile_of(buckets, count(), max(), p);
+}
+
+void Probe::reset()
+{
+  m_count.store(0, std::memory_order_relaxed);
+  m_total.store(0, std::memory_order_relaxed);
+  m_max.store(0, std::memory_order_relaxed);
+
+  for (auto& b : m_buckets)
+    b.store(0, std::memory_order_relaxed);
+}
+
+std::vector<Probe*> probes()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock{ r.mutex };
+
+  std::vector<Probe*> result = r.probes;
+
+  std::sort(result.begin(), result.end(), [](const Probe* a, const Probe* b) {
+    return std::strcmp(a->name(), b->name()) < 0;
+    });
+
+  return result;
+}
+
+Probe* find(const std::string& name)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock{ r.mutex };
+
+  auto it = std::find_if(r.probes.begin(), r.probes.end(), [&name](const Probe* p) {
+    return name == p->name();
+    });
+
+  return it != r.probes.end() ? *it : nullptr;
+}
+
+void reset()
+{
+  for (Probe* p : probes())
+    p->reset();
+}
+
+void startTracing()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock{ r.mutex };
+  r.events.clear();
+  r.trace_start = std::chrono::steady_clock::now();
+  r.tracing = true;
+}
+
+void stopTracing()
+{
+  registry().tracing = false;
+}
+
+bool isTracing()
+{
+  return registry().tracing;
+}
+
+/*!
+ * \fn void writeChromeTrace(std::ostream& out)
+ * \brief writes the events recorded since the last call to startTracing()
+ *
+ * The output uses the Trace Event Format and can be loaded in chrome://tracing
+ * or Perfetto.
+ */
+void writeChromeTrace(std::ostream& out)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock{ r.mutex };
+
+  out << "{\"traceEvents\":[";
+
+  for (size_t i(0); i < r.events.size(); ++i)
+  {
+    const TraceEvent& e = r.events.at(i);
+    const char* dot = std::strchr(e.name, '.');
+
+    out << (i == 0 ? "\n" : ",\n") << "{\"name\":";
+    write_json_string(out, e.name);
+    out << ",\"cat\":";
+    write_json_string(out, dot ? std::string(e.name, dot).c_str() : e.name);
+    out << ",\"ph\":\"X\",\"ts\":" << e.start << ",\"dur\":" << e.duration << ",\"pid\":1,\"tid\":" << e.thread << "}";
+  }
+
+  out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void writeSummary(std::ostream& out)
+{
+  out << std::left << std::setw(40) << "probe" << std::right
+    << std::setw(12) << "count" << std::setw(16) << "total"
+    << std::setw(12) << "p50" << std::setw(12) << "p99" << std::setw(12) << "max" << "\n";
+
+  std::vector<Summary> summaries;
+
+  for (const Probe* p : probes())
+  {
+    if (summaries.empty() || std::strcmp(summaries.back().name, p->name()) != 0)
+      summaries.emplace_back(*p);
+
+    summaries.back().add(*p);
+  }
+
+  for (const Summary& s : summaries)
+  {
+    if (s.count == 0)
+      continue;
+
+    // durations are printed in microseconds
+    const double div = s.kind == Probe::Timer ? 1000.0 : 1.0;
+
+    out << std::left << std::setw(40) << s.name << std::right << std::fixed << std::setprecision(s.kind == Probe::Timer ? 1 : 0)
+      << std::setw(12) << s.count << std::setw(16) << (s.total / div)
+      << std::setw(12) << (percentile_of(s.buckets, s.count, s.max, 0.5) / div)
+      << std::setw(12) << (percentile_of(s.buckets, s.count, s.max, 0.99) / div)
+      << std::setw(12) << (s.max / div) << "\n";
+  }
+}
+
+ScopedTimer::~ScopedTimer()
+{
+  const auto end = std::chrono::steady_clock::now();
+  m_probe.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count()));
+
+  Registry& r = registry();
+
+  if (r.tracing)
+  {
+    std::lock_guard<std::mutex> lock{ r.mutex };
+
+    TraceEvent e;
+    e.name = m_probe.name();
+    e.start = std::chrono::duration_cast<std::chrono::microseconds>(m_start - r.trace_start).count();
+    e.duration = std::chrono::duration_cast<std::chrono::microseconds>(end - m_start).count();
+    e.thread = std::hash<std::thread::id>()(std::this_thread::get_id()) % 1000000;
+    r.events.push_back(e);
+  }
+}
+
+} // namespace instrumentation
+
+} // namespace typewriter
@@ -0,0 +1,1009 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/private/regex_p.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace typewriter
+{
+
+namespace regex
+{
+
+namespace
+{
+
+const int MaxRepetition = 1000;
+const size_t MaxNfaStates = 100000;
+const size_t MaxDfaStates = 2000;
+const int MaxRangeSize = 256; // number of code points of a non-ASCII range in a class
+
+struct Node
+{
+  enum Kind
+  {
+    Bytes,
+    Empty,
+    Concat,
+    Alternate,
+    Repeat,
+    LineStart,
+    LineEnd,
+  };
+
+  Kind kind = Empty;
+  std::bitset<256> bytes;
+  std::vector<Node> children;
+  int min = 0;
+  int max = -1; // -1 means unbounded
+
+  explicit Node(Kind k = Empty)
+    : kind(k)
+  {
+
+  }
+};
+
+Node byte_node(const std::bitset<256>& bytes)
+{
+  Node n{ Node::Bytes };
+  n.bytes = bytes;
+  return n;
+}
+
+Node byte_range(int lo, int hi)
+{
+  std::bitset<256> bytes;
+
+  for (int i = lo; i <= hi; ++i)
+    bytes.set(i);
+
+  return byte_node(bytes);
+}
+
+Node concat(Node a, Node b)
+{
+  Node n{ Node::Concat };
+  n.children.push_back(std::move(a));
+  n.children.push_back(std::move(b));
+  return n;
+}
+
+Node alternate(Node a, Node b)
+{
+  Node n{ Node::Alternate };
+  n.children.push_back(std::move(a));
+  n.children.push_back(std::move(b));
+  return n;
+}
+
+// any code point encoded with 2, 3 or 4 bytes (the validity of the sequence is not checked)
+Node any_multibyte()
+{
+  Node two = concat(byte_range(0xC2, 0xDF), byte_range(0x80, 0xBF));
+  Node three = concat(byte_range(0xE0, 0xEF), concat(byte_range(0x80, 0xBF), byte_range(0x80, 0xBF)));
+  Node four = concat(byte_range(0xF0, 0xF4), concat(byte_range(0x80, 0xBF), concat(byte_range(0x80, 0xBF), byte_range(0x80, 0xBF))));
+  return alternate(std::move(two), alternate(std::move(three), std::move(four)));
+}
+
+std::string encode(uint32_t cp)
+{
+  std::string r;
+
+  if (cp < 0x80)
+  {
+    r.push_back(static_cast<char>(cp));
+  }
+  else if (cp < 0x800)
+  {
+    r.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    r.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+  else if (cp < 0x10000)
+  {
+    r.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    r.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    r.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+  else
+  {
+    r.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    r.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    r.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    r.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+
+  return r;
+}
+
+Node sequence(const std::string& bytes)
+{
+  Node n{ Node::Concat };
+
+  for (char c : bytes)
+  {
+    std::bitset<256> b;
+    b.set(static_cast<unsigned char>(c));
+    n.children.push_back(byte_node(b));
+  }
+
+  return n;
+}
+
+class Parser
+{
+public:
+  Parser(const std::string& pattern, bool case_sensitive)
+    : m_pattern(pattern),
+      m_case_sensitive(case_sensitive)
+  {
+
+  }
+
+  Node parse()
+  {
+    Node n = parse_alternation();
+
+    if (m_pos != m_pattern.size())
+      error("unmatched ')'");
+
+    return n;
+  }
+
+protected:
+  [[noreturn]] void error(const std::string& what) const
+  {
+    throw std::runtime_error{ "Invalid regular expression '" + m_pattern + "': " + what };
+  }
+
+  bool at_end() const { return m_pos >= m_pattern.size(); }
+  char peek() const { return m_pattern[m_pos]; }
+
+  void fold(std::bitset<256>& bytes) const
+  {
+    if (m_case_sensitive)
+      return;
+
+    for (int c = 'a'; c <= 'z'; ++c)
+    {
+      if (bytes.test(c) || bytes.test(c - 'a' + 'A'))
+      {
+        bytes.set(c);
+        bytes.set(c - 'a' + 'A');
+      }
+    }
+  }
+
+  uint32_t read_codepoint()
+  {
+    const unsigned char c = static_cast<unsigned char>(m_pattern[m_pos++]);
+    int n = c < 0x80 ? 0 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+    uint32_t cp = n == 0 ? c : n == 1 ? (c & 0x1F) : n == 2 ? (c & 0x0F) : (c & 0x07);
+
+    for (; n > 0; --n)
+    {
+      if (at_end())
+        error("invalid UTF-8");
+
+      cp = (cp << 6) | (static_cast<unsigned char>(m_pattern[m_pos++]) & 0x3F);
+    }
+
+    return cp;
+  }
+
+  Node parse_alternation()
+  {
+    Node n = parse_concatenation();
+
+    while (!at_end() && peek() == '|')
+    {
+      ++m_pos;
+      n = alternate(std::move(n), parse_concatenation());
+    }
+
+    return n;
+  }
+
+  Node parse_concatenation()
+  {
+    Node n{ Node::Concat };
+
+    while (!at_end() && peek() != '|' && peek() != ')')
+      n.children.push_back(parse_repetition());
+
+    return n;
+  }
+
+  int parse_int()
+  {
+    int value = 0;
+    size_t start = m_pos;
+
+    while (!at_end() && peek() >= '0' && peek() <= '9')
+    {
+      value = 10 * value + (peek() - '0');
+
+      if (value > MaxRepetition)
+        error("repetition count too large");
+
+      ++m_pos;
+    }
+
+    if (m_pos == start)
+      error("expected a number");
+
+    return value;
+  }
+
+  Node parse_repetition()
+  {
+    Node n = parse_atom();
+
+    while (!at_end())
+    {
+      int min = 0;
+      int max = -1;
+
+      if (peek() == '*')
+      {
+        ++m_pos;
+      }
+      else if (peek() == '+')
+      {
+        min = 1;
+        ++m_pos;
+      }
+      else if (peek() == '?')
+      {
+        max = 1;
+        ++m_pos;
+      }
+      else if (peek() == '{')
+      {
+        ++m_pos;
+        min = parse_int();
+        max = min;
+
+        if (!at_end() && peek() == ',')
+        {
+          ++m_pos;
+          max = (!at_end() && peek() == '}') ? -1 : parse_int();
+        }
+
+        if (at_end() || peek() != '}')
+          error("missing '}'");
+
+        ++m_pos;
+
+        if (max != -1 && max < min)
+          error("invalid repetition range");
+      }
+      else
+      {
+        break;
+      }
+
+      if (n.kind == Node::LineStart || n.kind == Node::LineEnd)
+        error("nothing to repeat");
+
+      Node r{ Node::Repeat };
+      r.min = min;
+      r.max = max;
+      r.children.push_back(std::move(n));
+      n = std::move(r);
+    }
+
+    return n;
+  }
+
+  Node parse_atom()
+  {
+    const char c = peek();
+
+    switch (c)
+    {
+    case '(':
+    {
+      ++m_pos;
+
+      if (m_pattern.compare(m_pos, 2, "?:") == 0)
+        m_pos += 2;
+
+      Node n = parse_alternation();
+
+      if (at_end() || peek() != ')')
+        error("missing ')'");
+
+      ++m_pos;
+      return n;
+    }
+    case '[':
+      ++m_pos;
+      return parse_class();
+    case '.':
+      ++m_pos;
+      return alternate(byte_range(0x00, 0x7F), any_multibyte());
+    case '^':
+      ++m_pos;
+      return Node{ Node::LineStart };
+    case '$':
+      ++m_pos;
+      return Node{ Node::LineEnd };
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      error("nothing to repeat");
+    case '\\':
+    {
+      ++m_pos;
+      std::bitset<256> bytes;
+      bool negated = false;
+
+      if (parse_escape(bytes, negated))
+        return negated ? alternate(byte_node(~bytes & ascii()), any_multibyte()) : byte_node(bytes);
+
+      return literal(read_codepoint());
+    }
+    default:
+      return literal(read_codepoint());
+    }
+  }
+
+  static std::bitset<256> ascii()
+  {
+    std::bitset<256> r;
+
+    for (int i = 0; i < 0x80; ++i)
+      r.set(i);
+
+    return r;
+  }
+
+  Node literal(uint32_t cp)
+  {
+    if (cp < 0x80)
+    {
+      std::bitset<256> b;
+      b.set(cp);
+      fold(b);
+      return byte_node(b);
+    }
+
+    return sequence(encode(cp));
+  }
+
+  // returns true if the escape is a class (\d, \w...) or a tab, otherwise 
+  // the position is left on the escaped character
+  bool parse_escape(std::bitset<256>& bytes, bool& negated)
+  {
+    if (at_end())
+      error("trailing '\\'");
+
+    const char c = peek();
+
+    switch (c)
+    {
+    case 'd':
+    case 'D':
+      for (int i = '0'; i <= '9'; ++i)
+        bytes.set(i);
+      break;
+    case 'w':
+    case 'W':
+      for (int i = 0; i < 0x80; ++i)
+      {
+        if (std::isalnum(i) || i == '_')
+          bytes.set(i);
+      }
+      break;
+    case 's':
+    case 'S':
+      for (char s : { ' ', '\t', '\r', '\f', '\v' })
+        bytes.set(static_cast<unsigned char>(s));
+      break;
+    case 't':
+      bytes.set('\t');
+      ++m_pos;
+      return true;
+    case 'b':
+    case 'B':
+    case 'n':
+      error(std::string("unsupported escape '\\") + c + "'");
+    default:
+      if (std::isalnum(static_cast<unsigned char>(c)))
+        error(std::string("unknown escape '\\") + c + "'");
+      return false;
+    }
+
+    negated = (c == 'D' || c == 'W' || c == 'S');
+    ++m_pos;
+    return true;
+  }
+
+  Node parse_class()
+  {
+    bool negated = false;
+    std::bitset<256> bytes;
+    std::vector<std::pair<uint32_t, uint32_t>> ranges; // non-ASCII
+
+    if (!at_end() && peek() == '^')
+    {
+      negated = true;
+      ++m_pos;
+    }
+
+    bool first = true;
+
+    while (!at_end() && (peek() != ']' || first))
+    {
+      first = false;
+      uint32_t lo;
+
+      if (peek() == '\\')
+      {
+        ++m_pos;
+        std::bitset<256> escaped;
+        bool escaped_negated = false;
+
+        if (parse_escape(escaped, escaped_negated))
+        {
+          if (escaped_negated)
+            error("negated escape in a class");
+
+          bytes |= escaped;
+          continue;
+        }
+      }
+
+      lo = read_codepoint();
+      uint32_t hi = lo;
+
+      if (m_pattern.compare(m_pos, 1, "-") == 0 && m_pos + 1 < m_pattern.size() && m_pattern[m_pos + 1] != ']')
+      {
+        ++m_pos;
+
+        if (peek() == '\\')
+          ++m_pos;
+
+        hi = read_codepoint();
+
+        if (hi < lo)
+          error("invalid class range");
+      }
+
+      for (uint32_t cp = lo; cp <= std::min<uint32_t>(hi, 0x7F); ++cp)
+        bytes.set(cp);
+
+      if (hi >= 0x80)
+        ranges.push_back(std::make_pair(std::max<uint32_t>(lo, 0x80), hi));
+    }
+
+    if (at_end())
+      error("missing ']'");
+
+    ++m_pos;
+    fold(bytes);
+
+    if (negated)
+    {
+      if (!ranges.empty())
+        error("negated class with non-ASCII characters");
+
+      return alternate(byte_node(~bytes & ascii()), any_multibyte());
+    }
+
+    Node n = byte_node(bytes);
+
+    for (const auto& r : ranges)
+    {
+      if (r.second - r.first >= static_cast<uint32_t>(MaxRangeSize))
+        error("non-ASCII class range too large");
+
+      for (uint32_t cp = r.first; cp <= r.second; ++cp)
+        n = alternate(std::move(n), sequence(encode(cp)));
+    }
+
+    return n;
+  }
+
+private:
+  std::string m_pattern;
+  size_t m_pos = 0;
+  bool m_case_sensitive;
+};
+
+// Thompson construction, 'outs' are the dangling transitions of a fragment
+struct Fragment
+{
+  int start;
+  std::vector<std::pair<int, int>> outs; // (state, 0 for out and 1 for out1)
+};
+
+class Compiler
+{
+public:
+  explicit Compiler(Program& p)
+    : m_program(p)
+  {
+
+  }
+
+  Fragment compile(const Node& n)
+  {
+    switch (n.kind)
+    {
+    case Node::Bytes:
+    {
+      NfaState s;
+      s.kind = NfaState::ByteSet;
+      s.bytes = n.bytes;
+      const int id = add(s);
+      return Fragment{ id, { std::make_pair(id, 0) } };
+    }
+    case Node::LineStart:
+    case Node::LineEnd:
+    {
+      NfaState s;
+      s.kind = n.kind == Node::LineStart ? NfaState::LineStart : NfaState::LineEnd;
+      const int id = add(s);
+      return Fragment{ id, { std::make_pair(id, 0) } };
+    }
+    case Node::Concat:
+    {
+      if (n.children.empty())
+        return empty();
+
+      Fragment f = compile(n.children.front());
+
+      for (size_t i(1); i < n.children.size(); ++i)
+      {
+        Fragment next = compile(n.children.at(i));
+        patch(f, next.start);
+        f.outs = std::move(next.outs);
+      }
+
+      return f;
+    }
+    case Node::Alternate:
+    {
+      Fragment a = compile(n.children.front());
+      Fragment b = compile(n.children.back());
+      NfaState s;
+      s.out = a.start;
+      s.out1 = b.start;
+      Fragment f{ add(s), std::move(a.outs) };
+      f.outs.insert(f.outs.end(), b.outs.begin(), b.outs.end());
+      return f;
+    }
+    case Node::Repeat:
+      return repeat(n.children.front(), n.min, n.max);
+    case Node::Empty:
+    default:
+      return empty();
+    }
+  }
+
+  void patch(Fragment& f, int target)
+  {
+    for (const auto& o : f.outs)
+    {
+      if (o.second == 0)
+        m_program.states[o.first].out = target;
+      else
+        m_program.states[o.first].out1 = target;
+    }
+
+    f.outs.clear();
+  }
+
+protected:
+  int add(const NfaState& s)
+  {
+    if (m_program.states.size() >= MaxNfaStates)
+      throw std::runtime_error{ "Regular expression too large" };
+
+    m_program.states.push_back(s);
+    return static_cast<int>(m_program.states.size()) - 1;
+  }
+
+  Fragment empty()
+  {
+    const int id = add(NfaState());
+    return Fragment{ id, { std::make_pair(id, 0) } };
+  }
+
+  Fragment repeat(const Node& n, int min, int max)
+  {
+    Fragment result = empty();
+
+    auto append = [this, &result](Fragment f) {
+      patch(result, f.start);
+      result.outs = std::move(f.outs);
+    };
+
+    for (int i(0); i < min; ++i)
+      append(compile(n));
+
+    if (max == -1)
+    {
+      Fragment body = compile(n);
+      NfaState s;
+      s.out = body.start;
+      const int split = add(s);
+      patch(body, split);
+      append(Fragment{ split, { std::make_pair(split, 1) } });
+    }
+    else
+    {
+      // a?(a?(a?)) so that the optional copies are only tried in order
+      std::vector<std::pair<int, int>> skips;
+
+      for (int i(min); i < max; ++i)
+      {
+        Fragment body = compile(n);
+        NfaState s;
+        s.out = body.start;
+        const int split = add(s);
+        skips.push_back(std::make_pair(split, 1));
+        append(Fragment{ split, std::move(body.outs) });
+      }
+
+      result.outs.insert(result.outs.end(), skips.begin(), skips.end());
+    }
+
+    return result;
+  }
+
+private:
+  Program& m_program;
+};
+
+// Collects the runs of consecutive single bytes that every match of 'n'
+// contains; the longest one is kept in 'best'.
+void collect_literals(const Node& n, std::string& run, std::string& best)
+{
+  auto flush = [&run, &best]() {
+    if (run.size() > best.size())
+      best = run;
+
+    run.clear();
+  };
+
+  switch (n.kind)
+  {
+  case Node::Bytes:
+    if (n.bytes.count() == 1)
+    {
+      for (int i(0); i < 256; ++i)
+      {
+        if (n.bytes.test(i))
+          run.push_back(static_cast<char>(i));
+      }
+    }
+    else
+    {
+      flush();
+    }
+    break;
+  case Node::Concat:
+    for (const Node& child : n.children)
+      collect_literals(child, run, best);
+    break;
+  case Node::Repeat:
+    flush();
+
+    if (n.min > 0)
+    {
+      collect_literals(n.children.front(), run, best);
+      flush();
+    }
+    break;
+  case Node::LineStart:
+  case Node::LineEnd:
+    // zero-width, the bytes around remain adjacent
+    break;
+  default:
+    flush();
+    break;
+  }
+}
+
+} // namespace
+
+std::string required_literal(const std::string& pattern)
+{
+  std::string run;
+  std::string best;
+  collect_literals(Parser(pattern, true).parse(), run, best);
+  return run.size() > best.size() ? run : best;
+}
+
+std::shared_ptr<const Program> Program::compile(const std::string& pattern, bool case_sensitive)
+{
+  Node ast = Parser(pattern, case_sensitive).parse();
+
+  std::shared_ptr<Program> result = std::make_shared<Program>();
+  Compiler compiler{ *result };
+  Fragment f = compiler.compile(ast);
+
+  NfaState match;
+  match.kind = NfaState::Match;
+  result->states.push_back(match);
+  compiler.patch(f, static_cast<int>(result->states.size()) - 1);
+
+  result->start = f.start;
+  return result;
+}
+
+Dfa::Dfa(std::shared_ptr<const Program> prog)
+  : m_program(std::move(prog))
+{
+  m_marks.assign(m_program->states.size(), 0);
+  flush();
+
+  // bytes that can start a match
+  std::vector<int> set{ m_program->start };
+  closure(set, true, true);
+
+  for (int s : set)
+  {
+    const NfaState& state = m_program->states[s];
+
+    if (state.kind == NfaState::ByteSet)
+      m_first_bytes |= state.bytes;
+    else if (state.kind == NfaState::Match)
+      m_can_match_empty = true;
+  }
+}
+
+Dfa::Dfa(const Dfa& other)
+  : Dfa(other.m_program)
+{
+
+}
+
+void Dfa::flush()
+{
+  for (int i(0); i < 2; ++i)
+  {
+    m_states[i].clear();
+    m_ids[i].clear();
+    m_starts[i][0] = m_starts[i][1] = -2;
+  }
+}
+
+void Dfa::closure(std::vector<int>& set, bool at_start, bool at_end)
+{
+  if (++m_mark == 0)
+  {
+    std::fill(m_marks.begin(), m_marks.end(), 0);
+    m_mark = 1;
+  }
+
+  m_stack.assign(set.begin(), set.end());
+  set.clear();
+
+  while (!m_stack.empty())
+  {
+    const int id = m_stack.back();
+    m_stack.pop_back();
+
+    if (id < 0 || m_marks[id] == m_mark)
+      continue;
+
+    m_marks[id] = m_mark;
+    const NfaState& s = m_program->states[id];
+
+    switch (s.kind)
+    {
+    case NfaState::Split:
+      m_stack.push_back(s.out1);
+      m_stack.push_back(s.out);
+      break;
+    case NfaState::LineStart:
+      if (at_start)
+        m_stack.push_back(s.out);
+      break;
+    case NfaState::LineEnd:
+      // kept so that the match at the end of the line can be computed
+      set.push_back(id);
+      if (at_end)
+        m_stack.push_back(s.out);
+      break;
+    default:
+      set.push_back(id);
+      break;
+    }
+  }
+
+  std::sort(set.begin(), set.end());
+}
+
+int Dfa::add_state(bool unanchored, std::vector<int>& set)
+{
+  if (set.empty())
+    return -1;
+
+  auto& ids = m_ids[unanchored];
+  auto it = ids.find(set);
+
+  if (it != ids.end())
+    return it->second;
+
+  if (m_states[unanchored].size() >= MaxDfaStates)
+  {
+    // the caller only keeps the returned state
+    std::vector<int> copy = set;
+    flush();
+    return add_state(unanchored, copy);
+  }
+
+  State s;
+  s.nfa = set;
+  std::fill(std::begin(s.next), std::end(s.next), -2);
+
+  for (int id : set)
+  {
+    if (m_program->states[id].kind == NfaState::Match)
+      s.match = true;
+  }
+
+  std::vector<int> at_end = set;
+  closure(at_end, false, true);
+
+  for (int id : at_end)
+  {
+    if (m_program->states[id].kind == NfaState::Match)
+      s.match_at_end = true;
+  }
+
+  const int result = static_cast<int>(m_states[unanchored].size());
+  ids[set] = result;
+  m_states[unanchored].push_back(std::move(s));
+  return result;
+}
+
+int Dfa::start(bool unanchored, bool at_start)
+{
+  int& cached = m_starts[unanchored][at_start];
+
+  if (cached == -2)
+  {
+    std::vector<int> set{ m_program->start };
+    closure(set, at_start, false);
+    const int id = add_state(unanchored, set);
+    // add_state() may have flushed the cache
+    m_starts[unanchored][at_start] = id;
+  }
+
+  return m_starts[unanchored][at_start];
+}
+
+int Dfa::step(bool unanchored, int state, unsigned char c)
+{
+  const int cached = m_states[unanchored][state].next[c];
+
+  if (cached != -2)
+    return cached;
+
+  std::vector<int> set;
+
+  for (int id : m_states[unanchored][state].nfa)
+  {
+    const NfaState& s = m_program->states[id];
+
+    if (s.kind == NfaState::ByteSet && s.bytes.test(c))
+      set.push_back(s.out);
+  }
+
+  if (unanchored)
+    set.push_back(m_program->start);
+
+  closure(set, false, false);
+
+  const size_t count = m_states[unanchored].size();
+  const int result = add_state(unanchored, set);
+
+  // not cached if the cache was flushed
+  if (m_states[unanchored].size() >= count && static_cast<size_t>(state) < m_states[unanchored].size())
+    m_states[unanchored][state].next[c] = result;
+
+  return result;
+}
+
+size_t Dfa::earliestMatchEnd(const char* text, size_t size, size_t from)
+{
+  int s = start(true, from == 0);
+
+  // a pattern anchored at the start cannot match after it
+  if (s == -1)
+    return npos;
+
+  if (m_states[true][s].match)
+    return from;
+
+  for (size_t i = from; i < size; ++i)
+  {
+    const unsigned char c = static_cast<unsigned char>(text[i]);
+    const int next = m_states[true][s].next[c];
+    s = next != -2 ? next : step(true, s, c);
+
+    if (s == -1)
+      return npos;
+
+    if (m_states[true][s].match)
+      return i + 1;
+  }
+
+  return m_states[true][s].match_at_end ? size : npos;
+}
+
+size_t Dfa::longestMatchAt(const char* text, size_t size, size_t pos)
+{
+  int s = start(false, pos == 0);
+
+  if (s == -1)
+    return npos;
+
+  size_t last = m_states[false][s].match ? pos : npos;
+
+  for (size_t i = pos; i < size; ++i)
+  {
+    s = step(false, s, static_cast<unsigned char>(text[i]));
+
+    if (s == -1)
+      return last;
+
+    if (m_states[false][s].match)
+      last = i + 1;
+  }
+
+  return m_states[false][s].match_at_end ? size : last;
+}
+
+/*!
+ * \fn bool find(const char* text, size_t size, size_t from, size_t& begin, size_t& end)
+ * \brief finds the leftmost-longest match starting at or after 'from'
+ *
+ * A single pass over the line tells whether there is a match and where
+ * the earliest one ends; the start of the match is then searched among
+ * the offsets preceding that end.
+ */
+bool Dfa::find(const char* text, size_t size, size_t from, size_t& begin, size_t& end)
+{
+  const size_t e = earliestMatchEnd(text, size, from);
+
+  if (e == npos)
+    return false;
+
+  for (size_t i = from; i <= e; ++i)
+  {
+    if (i > from && i < size && (static_cast<unsigned char>(text[i]) & 0xC0) == 0x80)
+      continue;
+
+    if (!m_can_match_empty && (i == size || !m_first_bytes.test(static_cast<unsigned char>(text[i]))))
+      continue;
+
+    const size_t m = longestMatchAt(text, size, i);
+
+    if (m != npos)
+    {
+      begin = i;
+      end = m;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+} // namespace regex
+
+} // namespace typewriter
@@ -7,6 +7,12 @@
 
 #include "typewriter/textdocument.h"
 #include "typewriter/private/textdocument_p.h"
+#include "typewriter/private/memoryusage_p.h"
+
+#include "typewriter/utils/displaywidth.h"
+#include "typewriter/utils/utf8.h"
+
+#include <algorithm>
 
 namespace typewriter
 {
@@ -21,19 +27,19 @@ TextBlockRef::TextBlockRef(TextBlockImpl *data)
   : d(data)
 {
   if (d)
-    d->ref++;
+    d->addRef();
 }
 
 TextBlockRef::TextBlockRef(const TextBlockRef & other)
   : d(other.d)
 {
   if (d)
-    d->ref++;
+    d->addRef();
 }
 
 TextBlockRef::~TextBlockRef()
 {
-  if(d != nullptr && --d->ref == 0)
+  if (d != nullptr && d->deref())
     delete d;
 }
 
@@ -41,12 +47,12 @@ TextBlockRef & TextBlockRef::operator=(const TextBlockRef & other)
 {
   if (other.d)
   {
-    other.d->ref += 1;
+    other.d->addRef();
   }
 
   if (d)
   {
-    if (--d->ref == 0)
+    if (d->deref())
     {
       delete d;
     }
@@ -61,7 +67,7 @@ TextBlockRef & TextBlockRef::operator=(TextBlockRef && other)
 {
   if (d)
   {
-    if (--d->ref == 0)
+    if (d->deref())
     {
       delete d;
     }
@@ -77,14 +83,14 @@ TextBlockRef & TextBlockRef::operator=(TextBlockImpl *ptr)
 {
   if (d)
   {
-    if (--d->ref == 0)
+    if (d->deref())
     {
       delete d;
     }
   }
 
   d = ptr;
-  d->ref += 1;
+  d->addRef();
 
   return *this;
 }
@@ -93,7 +99,7 @@ TextBlockRef & TextBlockRef::operator=(nullptr_t)
 {
   if (d)
   {
-    if (--d->ref == 0)
+    if (d->deref())
     {
       delete d;
     }
@@ -112,6 +118,7 @@ bool TextBlockRef::isValid() const
 TextBlockImpl::TextBlockImpl()
   : ref(0)
   , revision(0)
+  , m_content(std::make_shared<std::string>())
 {
 
 }
@@ -119,9 +126,17 @@ TextBlockImpl::TextBlockImpl()
 TextBlockImpl::TextBlockImpl(const std::string& text)
   : ref(0)
   , revision(0)
-  , content(text)
+  , m_content(std::make_shared<std::string>(text))
 {
+  m_column_index.build(content());
+}
 
+std::string& TextBlockImpl::edit()
+{
+  if (m_content.use_count() > 1)
+    m_content = std::make_shared<std::string>(*m_content);
+
+  return *m_content;
 }
 
 void TextBlockImpl::setGarbage()
@@ -129,6 +144,124 @@ void TextBlockImpl::setGarbage()
   this->revision = -1;
 }
 
+void TextBlockImpl::contentChanged()
+{
+  this->revision += 1;
+  m_column_index.build(content());
+}
+
+void ColumnIndex::build(const std::string& text)
+{
+  m_length = static_cast<int>(utf8::count_codepoints(text));
+  m_ascii = static_cast<size_t>(m_length) == text.size();
+  m_width = m_length;
+  m_offsets.clear();
+  m_widths.clear();
+
+  if (m_ascii)
+    return;
+
+  // m_offsets[i] is the offset of the code point at column i * Stride,
+  // m_widths[i] is the display width of the text before it
+  m_offsets.reserve(m_length / Stride + 1);
+  m_widths.reserve(m_length / Stride + 1);
+  m_width = 0;
+
+  for (size_t offset = 0; offset < text.size(); )
+  {
+    m_offsets.push_back(offset);
+    m_widths.push_back(m_width);
+
+    const size_t next = offset + utf8::byte_offset(text.data() + offset, text.size() - offset, Stride);
+    m_width += display::width(text.data(), offset, next);
+    offset = next;
+  }
+}
+
+size_t ColumnIndex::byteOffset(const std::string& text, int column) const
+{
+  if (column <= 0)
+    return 0;
+  else if (column >= m_length)
+    return text.size();
+  else if (m_ascii)
+    return static_cast<size_t>(column);
+
+  const size_t from = m_offsets[column / Stride];
+  return from + utf8::byte_offset(text.data() + from, text.size() - from, column % Stride);
+}
+
+int ColumnIndex::columnAt(const std::string& text, size_t offset) const
+{
+  if (offset >= text.size())
+    return m_length;
+  else if (m_ascii)
+    return static_cast<int>(offset);
+
+  auto it = std::upper_bound(m_offsets.begin(), m_offsets.end(), offset) - 1;
+  const int column = static_cast<int>(std::distance(m_offsets.begin(), it)) * Stride;
+  return column + static_cast<int>(utf8::count_codepoints(text.data() + *it, offset - *it));
+}
+
+int ColumnIndex::displayWidth(const std::string& text, int column) const
+{
+  if (column <= 0)
+    return 0;
+  else if (column >= m_length)
+    return m_width;
+  else if (m_ascii)
+    return column;
+
+  const int i = column / Stride;
+  return m_widths[i] + display::width(text.data(), m_offsets[i], byteOffset(text, column));
+}
+
+// returns the last column whose display width does not exceed 'w'
+int ColumnIndex::columnAtDisplayWidth(const std::string& text, int w) const
+{
+  if (w <= 0 && (m_ascii || m_length == 0))
+    return 0;
+  else if (w >= m_width)
+    return m_length;
+  else if (m_ascii)
+    return w;
+
+  auto it = std::upper_bound(m_widths.begin(), m_widths.end(), std::max(w, 0)) - 1;
+  const size_t i = std::distance(m_widths.begin(), it);
+
+  int remaining = w - *it;
+  const size_t offset = display::advance(text.data(), m_offsets[i], text.size(), remaining);
+  return static_cast<int>(i) * Stride + static_cast<int>(utf8::count_codepoints(text.data() + m_offsets[i], offset - m_offsets[i]));
+}
+
+size_t ColumnIndex::memoryUsage() const
+{
+  return memory::heap_size(m_offsets) + memory::heap_size(m_widths);
+}
+
+void ColumnIndex::shrink()
+{
+  if (m_ascii)
+  {
+    std::vector<size_t>().swap(m_offsets);
+    std::vector<int>().swap(m_widths);
+  }
+  else
+  {
+    m_offsets.shrink_to_fit();
+    m_widths.shrink_to_fit();
+  }
+}
+
+void TextBlockImpl::shrink()
+{
+  // the text shared with a snapshot is left as is
+  if (m_content.use_count() == 1)
+    m_content->shrink_to_fit();
+
+  m_column_index.shrink();
+}
+
 TextBlock::TextBlock()
   : mDocument(nullptr)
   , mImpl(nullptr)
@@ -141,7 +274,7 @@ TextBlock::TextBlock(const TextBlock & other)
   , mImpl(other.mImpl)
 {
   if (mImpl)
-    mImpl->ref += 1;
+    mImpl->addRef();
 }
 
 TextBlock::TextBlock(const TextDocument *doc, TextBlockImpl *impl)
@@ -150,7 +283,7 @@ TextBlock::TextBlock(const TextDocument *doc, TextBlockImpl *impl)
 {
   if (mImpl)
   {
-    mImpl->ref += 1;
+    mImpl->addRef();
   }
 }
 
@@ -159,7 +292,7 @@ TextBlock::~TextBlock()
   if (!mImpl)
     return;
 
-  if (--mImpl->ref == 0)
+  if (mImpl->deref())
     delete mImpl;
 }
 
@@ -170,18 +303,65 @@ bool TextBlock::isValid() const
 
 const std::string& TextBlock::text() const
 {
-  return mImpl->content;
+  return mImpl->content();
 }
 
+/*!
+ * \fn int length() const
+ * \brief returns the number of columns (i.e. code points) of the block
+ *
+ * Use size() to get the number of bytes.
+ */
 int TextBlock::length() const
 {
-  // @TODO: return number of unicode char
-  return mImpl->content.length();
+  return mImpl->length();
 }
 
 size_t TextBlock::size() const
 {
-  return mImpl->content.size();
+  return mImpl->content().size();
+}
+
+/*!
+ * \fn size_t byteOffset(int column) const
+ * \brief returns the offset in bytes of the character at the given column
+ *
+ * This is O(1) if the block only contains ASCII characters.
+ */
+size_t TextBlock::byteOffset(int column) const
+{
+  return mImpl->byteOffset(column);
+}
+
+/*!
+ * \fn int columnAt(size_t offset) const
+ * \brief returns the column of the character starting at the given byte offset
+ */
+int TextBlock::columnAt(size_t offset) const
+{
+  return mImpl->columnAt(offset);
+}
+
+/*!
+ * \fn int displayWidth(int column) const
+ * \brief returns the number of cells used to display the first characters of the block
+ * \param the number of characters
+ *
+ * Wide characters use two cells and combining marks do not use any.
+ * Tabulations are counted as one cell as their width depends on the view.
+ */
+int TextBlock::displayWidth(int column) const
+{
+  return mImpl->displayWidth(column);
+}
+
+/*!
+ * \fn int columnAtDisplayWidth(int w) const
+ * \brief returns the number of characters that can be displayed in 'w' cells
+ */
+int TextBlock::columnAtDisplayWidth(int w) const
+{
+  return mImpl->columnAtDisplayWidth(w);
 }
 
 int TextBlock::blockNumber() const
@@ -248,7 +428,7 @@ TextBlock & TextBlock::operator=(const TextBlock & other)
 
   if (mImpl != nullptr)
   {
-    if (--mImpl->ref == 0)
+    if (mImpl->deref())
     {
       delete mImpl;
     }
@@ -258,7 +438,7 @@ TextBlock & TextBlock::operator=(const TextBlock & other)
   mImpl = other.mImpl;
   if (mImpl)
   {
-    mImpl->ref++;
+    mImpl->addRef();
   }
 
   return *this;
@@ -279,17 +459,84 @@ bool TextBlock::operator<(const TextBlock & other) const
   return document() < other.document() || (document() == other.document() && blockNumber() < other.blockNumber());
 }
 
+bool TextBlockView::isValid() const
+{
+  return !isNull() && !mImpl->isGarbage();
+}
+
+const std::string& TextBlockView::text() const
+{
+  return mImpl->content();
+}
+
+int TextBlockView::length() const
+{
+  return mImpl->length();
+}
+
+size_t TextBlockView::size() const
+{
+  return mImpl->content().size();
+}
+
+size_t TextBlockView::byteOffset(int column) const
+{
+  return mImpl->byteOffset(column);
+}
+
+int TextBlockView::columnAt(size_t offset) const
+{
+  return mImpl->columnAt(offset);
+}
+
+int TextBlockView::blockId() const
+{
+  return mImpl->id;
+}
+
+int TextBlockView::revision() const
+{
+  return mImpl->revision;
+}
+
+TextBlockView TextBlockView::next() const
+{
+  if (mImpl == nullptr)
+    return *this;
+
+  return TextBlockView{ mDocument, mImpl->next.get() };
+}
+
+TextBlockView TextBlockView::previous() const
+{
+  if (mImpl == nullptr)
+    return *this;
+
+  return TextBlockView{ mDocument, mImpl->previous.get() };
+}
+
+TextBlockRange::iterator& TextBlockRange::iterator::operator++()
+{
+  m_item.offset += m_item.block.impl()->content().size() + 1;
+  m_item.line += 1;
+  m_item.block = TextBlockView{ m_item.block.document(), m_item.block.impl()->next.get() };
+  return *this;
+}
+
 TextBlock next(TextBlock block, int n)
 {
   if (n < 0)
     return prev(block, -n);
 
-  while (n > 0)
+  TextBlockView it{ block };
+
+  while (n > 0 && !it.isNull())
   {
-    block = block.next();
+    it = it.next();
     --n;
   }
-  return block;
+
+  return it.block();
 }
 
 TextBlock prev(TextBlock block, int n)
@@ -297,12 +544,15 @@ TextBlock prev(TextBlock block, int n)
   if (n < 0)
     return next(block, -n);
 
-  while (n > 0)
+  TextBlockView it{ block };
+
+  while (n > 0 && !it.isNull())
   {
-    block = block.previous();
+    it = it.previous();
     --n;
   }
-  return block;
+
+  return it.block();
 }
 
 } // namespace typewriter
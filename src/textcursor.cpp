@@ -120,9 +120,13 @@ const Position & TextCursor::position() const
   return m_pos;
 }
 
+/*!
+ * \fn int offset() const
+ * \brief returns the offset in bytes of the cursor in the document
+ */
 int TextCursor::offset() const
 {
-  return position().column + document()->impl()->blockOffset(block().impl());
+  return static_cast<int>(block().byteOffset(position().column)) + document()->impl()->blockOffset(block().impl());
 }
 
 const Position & TextCursor::anchor() const
@@ -315,11 +319,14 @@ std::string TextCursor::selectedText() const
   auto end = selectionEnd();
 
   if (start.line == end.line)
-    return block().text().substr(start.column, end.column - start.column);
+  {
+    const size_t from = block().byteOffset(start.column);
+    return block().text().substr(from, block().byteOffset(end.column) - from);
+  }
 
-  TextBlock b = start == position() ? block() : prev(block(), end.line - start.line);
+  TextBlockView b = start == position() ? block() : prev(block(), end.line - start.line);
 
-  std::string result = b.text().substr(start.column);
+  std::string result = b.text().substr(b.byteOffset(start.column));
 
   for (int i(start.line + 1); i < end.line; ++i)
   {
@@ -330,7 +337,7 @@ std::string TextCursor::selectedText() const
 
   b = b.next();
   result.push_back('\n');
-  result.insert(result.end(), b.text().end() - end.column, b.text().end());
+  result.append(b.text(), 0, b.byteOffset(end.column));
 
   return result;
 }
@@ -0,0 +1,381 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/textdecorations.h"
+
+#include "typewriter/textsearch.h"
+#include "typewriter/private/memoryusage_p.h"
+
+#include "typewriter/utils/instrumentation.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace typewriter
+{
+
+namespace
+{
+
+typedef std::vector<view::FormatRange> Ranges;
+
+view::FormatRange make_range(int format, int start, int end)
+{
+  view::FormatRange r;
+  r.format_id = format;
+  r.start = start;
+  r.length = end - start;
+  return r;
+}
+
+// sets the format of the columns [begin, end) of a block, 0 removes the decorations
+void paint_block(Ranges& ranges, int begin, int end, int format)
+{
+  // the first range ending after 'begin'
+  auto first = std::lower_bound(ranges.begin(), ranges.end(), begin, [](const view::FormatRange& r, int col) {
+    return r.start + r.length <= col;
+    });
+
+  auto last = first;
+  view::FormatRange replacement[3];
+  int n = 0;
+
+  if (last != ranges.end() && last->start < begin)
+    replacement[n++] = make_range(last->format_id, last->start, begin);
+
+  if (format != 0)
+    replacement[n++] = make_range(format, begin, end);
+
+  while (last != ranges.end() && last->start < end)
+    ++last;
+
+  if (last != first && (last - 1)->start + (last - 1)->length > end)
+    replacement[n++] = make_range((last - 1)->format_id, end, (last - 1)->start + (last - 1)->length);
+
+  // overwrites the removed ranges before inserting or erasing the others
+  const int removed = static_cast<int>(last - first);
+  std::copy(replacement, replacement + std::min(n, removed), first);
+
+  if (n > removed)
+    ranges.insert(first + removed, replacement + removed, replacement + n);
+  else
+    ranges.erase(first + n, last);
+}
+
+// maps a column through the removal of [pos, pos + removed) and the insertion of 'added' columns at pos;
+// text inserted at the boundary of a range is not part of it
+int map_begin(int col, int pos, int removed, int added)
+{
+  if (col > pos)
+    col = std::max(pos, col - removed);
+
+  return col >= pos ? col + added : col;
+}
+
+int map_end(int col, int pos, int removed, int added)
+{
+  if (col > pos)
+    col = std::max(pos, col - removed);
+
+  return col > pos ? col + added : col;
+}
+
+} // namespace
+
+TextDecorations::TextDecorations(TextDocument* document)
+{
+  document->addListener(this);
+}
+
+TextDecorations::~TextDecorations()
+{
+  if (document())
+    document()->removeListener(this);
+}
+
+/*!
+ * \fn void add(const Position& begin, const Position& end, int format)
+ * \brief decorates the text between two positions
+ *
+ * The format id must not be 0; line feeds are not decorated.
+ */
+void TextDecorations::add(const Position& begin, const Position& end, int format)
+{
+  if (format != 0)
+    paint(begin, end, format);
+}
+
+/*!
+ * \fn void add(const std::vector<SearchMatch>& matches, int format)
+ * \brief decorates the matches of a search
+ *
+ * Adding the matches in document order is linear in the distance between them.
+ */
+void TextDecorations::add(const std::vector<SearchMatch>& matches, int format)
+{
+  TYPEWRITER_SCOPED_TIMER("decorations.add");
+
+  for (const SearchMatch& m : matches)
+    add(m.begin, m.end, format);
+}
+
+/*!
+ * \fn void remove(const Position& begin, const Position& end)
+ * \brief removes the decorations between two positions
+ */
+void TextDecorations::remove(const Position& begin, const Position& end)
+{
+  paint(begin, end, 0);
+}
+
+/*!
+ * \fn void remove(int format)
+ * \brief removes all the decorations with the given format
+ *
+ * Decorations that were partially overwritten by the removed ones are not restored.
+ */
+void TextDecorations::remove(int format)
+{
+  for (auto it = m_blocks.begin(); it != m_blocks.end(); )
+  {
+    Ranges& ranges = it->second.ranges;
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [format](const view::FormatRange& r) {
+      return r.format_id == format;
+      }), ranges.end());
+
+    if (ranges.empty())
+      it = m_blocks.erase(it);
+    else
+      ++it;
+  }
+}
+
+void TextDecorations::clear()
+{
+  m_blocks.clear();
+}
+
+bool TextDecorations::isEmpty() const
+{
+  return m_blocks.empty();
+}
+
+/*!
+ * \fn size_t count() const
+ * \brief returns the number of ranges
+ *
+ * A decoration spanning several lines has one range per line.
+ */
+size_t TextDecorations::count() const
+{
+  size_t result = 0;
+
+  for (const auto& e : m_blocks)
+    result += e.second.ranges.size();
+
+  return result;
+}
+
+/*!
+ * \fn const std::vector<view::FormatRange>& ranges(const TextBlock& block) const
+ * \brief returns the sorted decorations of a block
+ */
+const std::vector<view::FormatRange>& TextDecorations::ranges(const TextBlock& block) const
+{
+  static const Ranges empty;
+  auto it = m_blocks.find(block.impl());
+  return it != m_blocks.end() ? it->second.ranges : empty;
+}
+
+size_t TextDecorations::memoryUsage() const
+{
+  size_t result = sizeof(TextDecorations) + m_blocks.bucket_count() * sizeof(void*);
+
+  for (const auto& e : m_blocks)
+    result += memory::node_size<std::pair<TextBlockImpl* const, Entry>>() + memory::heap_size(e.second.ranges);
+
+  return result;
+}
+
+// the block at the position is split, the decorations after the position move to the new block
+void TextDecorations::blockInserted(const Position& pos, const TextBlock& newblock)
+{
+  m_hint_line = -1;
+
+  auto it = m_blocks.find(newblock.previous().impl());
+
+  if (it == m_blocks.end())
+    return;
+
+  Ranges& ranges = it->second.ranges;
+  const int col = pos.column;
+
+  auto first = std::lower_bound(ranges.begin(), ranges.end(), col, [](const view::FormatRange& r, int c) {
+    return r.start + r.length <= c;
+    });
+
+  if (first == ranges.end())
+    return;
+
+  Ranges moved;
+  moved.reserve(ranges.end() - first);
+
+  for (auto r = first; r != ranges.end(); ++r)
+    moved.push_back(make_range(r->format_id, std::max(r->start, col) - col, r->start + r->length - col));
+
+  if (first->start < col)
+  {
+    first->length = col - first->start;
+    ++first;
+  }
+
+  ranges.erase(first, ranges.end());
+
+  if (ranges.empty())
+    m_blocks.erase(it);
+
+  Entry& entry = m_blocks[newblock.impl()];
+  entry.block = newblock;
+  entry.ranges = std::move(moved);
+}
+
+// the block was merged into the previous one
+void TextDecorations::blockDestroyed(int line, const TextBlock& block)
+{
+  m_hint_line = -1;
+
+  auto it = m_blocks.find(block.impl());
+
+  if (it == m_blocks.end())
+    return;
+
+  Ranges moved = std::move(it->second.ranges);
+  m_blocks.erase(it);
+
+  TextBlock prev = block.previous();
+  const int offset = prev.length() - block.length();
+
+  for (view::FormatRange& r : moved)
+    r.start += offset;
+
+  Entry& entry = m_blocks[prev.impl()];
+  entry.block = prev;
+  entry.ranges.insert(entry.ranges.end(), moved.begin(), moved.end());
+}
+
+void TextDecorations::contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded)
+{
+  auto it = m_blocks.find(block.impl());
+
+  if (it == m_blocks.end())
+    return;
+
+  Ranges& ranges = it->second.ranges;
+  const int col = pos.column;
+
+  for (view::FormatRange& r : ranges)
+  {
+    const int begin = map_begin(r.start, col, charsRemoved, charsAdded);
+    const int end = map_end(r.start + r.length, col, charsRemoved, charsAdded);
+    r.start = begin;
+    r.length = end - begin;
+  }
+
+  ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](const view::FormatRange& r) {
+    return r.length <= 0;
+    }), ranges.end());
+
+  if (ranges.empty())
+    m_blocks.erase(it);
+}
+
+void TextDecorations::blocksDiscarded(int count)
+{
+  m_hint_line = -1;
+  remove_garbage();
+}
+
+// the edits are unknown, the decorations of the new lines are removed
+void TextDecorations::blocksReplaced(int line, int count, int newCount)
+{
+  m_hint_line = -1;
+
+  if (count != newCount)
+    remove_garbage();
+
+  if (m_blocks.empty())
+    return;
+
+  TextBlock block = document()->findBlockByNumber(line);
+
+  for (int i(0); i < newCount && block.isValid(); ++i, block = block.next())
+    m_blocks.erase(block.impl());
+}
+
+// returns the block at 'line', walking from the last block that was located
+TextBlock TextDecorations::find_block(int line)
+{
+  if (m_hint_line < 0 || !m_hint_block.isValid() || std::abs(m_hint_line - line) > line)
+  {
+    m_hint_block = document()->firstBlock();
+    m_hint_line = 0;
+  }
+
+  for (; m_hint_line < line && m_hint_block.isValid(); ++m_hint_line)
+    m_hint_block = m_hint_block.next();
+
+  for (; m_hint_line > line && m_hint_block.isValid(); --m_hint_line)
+    m_hint_block = m_hint_block.previous();
+
+  if (!m_hint_block.isValid())
+    m_hint_line = -1;
+
+  return m_hint_block;
+}
+
+void TextDecorations::paint(const Position& begin, const Position& end, int format)
+{
+  if (!(begin < end))
+    return;
+
+  TextBlock block = find_block(begin.line);
+
+  for (int line = begin.line; line <= end.line && block.isValid(); ++line, block = block.next())
+  {
+    const int from = line == begin.line ? std::min(begin.column, block.length()) : 0;
+    const int to = line == end.line ? std::min(end.column, block.length()) : block.length();
+
+    if (from >= to)
+      continue;
+
+    auto it = m_blocks.find(block.impl());
+
+    if (it == m_blocks.end())
+    {
+      if (format == 0)
+        continue;
+
+      it = m_blocks.insert(std::make_pair(block.impl(), Entry())).first;
+      it->second.block = block;
+    }
+
+    paint_block(it->second.ranges, from, to, format);
+
+    if (it->second.ranges.empty())
+      m_blocks.erase(it);
+  }
+}
+
+void TextDecorations::remove_garbage()
+{
+  for (auto it = m_blocks.begin(); it != m_blocks.end(); )
+  {
+    if (it->second.block.isValid())
+      ++it;
+    else
+      it = m_blocks.erase(it);
+  }
+}
+
+} // namespace typewriter
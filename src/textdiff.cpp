@@ -4,17 +4,44 @@
 
 #include "typewriter/textdiff.h"
 
+#include "typewriter/utils/utf8.h"
+
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 
 namespace typewriter
 {
 
+namespace
+{
+
+void index_newlines(const std::string& text, size_t from, size_t to, int shift, std::vector<int>& newlines)
+{
+  const char* data = text.data();
+  const char* it = data + from;
+  const char* end = data + to;
+
+  while (it < end)
+  {
+    const char* lf = static_cast<const char*>(std::memchr(it, '\n', end - it));
+
+    if (!lf)
+      break;
+
+    newlines.push_back(static_cast<int>(lf - data) + shift);
+    it = lf + 1;
+  }
+}
+
+} // namespace
+
 TextRange::TextRange(const std::string& text, const Position& start) :
-  m_range(start, TextRange::end(start, text)),
+  m_range(start, start),
   m_text(text)
 {
-
+  index_newlines(m_text, 0, m_text.size(), 0, m_newlines);
+  update_end();
 }
 
 const Position & TextRange::begin() const
@@ -34,13 +61,28 @@ void TextRange::move(const Position & start)
 
 Position TextRange::end(const Position & start, const std::string& text)
 {
-  const int line_count = std::count(text.begin(), text.end(), '\n');
+  const char* data = text.data();
+  const char* it = data;
+  const char* end = data + text.size();
+  const char* last_lf = nullptr;
+  int line_count = 0;
+
+  while (it < end)
+  {
+    const char* lf = static_cast<const char*>(std::memchr(it, '\n', end - it));
+
+    if (!lf)
+      break;
+
+    ++line_count;
+    last_lf = lf;
+    it = lf + 1;
+  }
 
   if (line_count == 0)
-    return Position{ start.line, start.column + static_cast<int>(text.size()) };
+    return Position{ start.line, start.column + static_cast<int>(utf8::count_codepoints(data, text.size())) };
 
-  const int last_lf = text.find_last_of('\n');
-  return Position{ start.line + line_count, static_cast<int>(text.length()) - 1 - last_lf };
+  return Position{ start.line + line_count, static_cast<int>(utf8::count_codepoints(last_lf + 1, end - last_lf - 1)) };
 }
 
 TextRange& TextRange::operator+=(const TextRange & other)
@@ -49,11 +91,25 @@ TextRange& TextRange::operator+=(const TextRange & other)
     return *this;
 
   const int insert_pos = seek(other.begin());
+  const int size = static_cast<int>(other.text().size());
 
   m_text.insert(insert_pos, other.text());
 
-  /// TODO: compute this more efficiently
-  m_range = Range(begin(), TextRange::end(begin(), m_text));
+  auto it = std::lower_bound(m_newlines.begin(), m_newlines.end(), insert_pos);
+  const size_t index = std::distance(m_newlines.begin(), it);
+
+  for (auto jt = it; jt != m_newlines.end(); ++jt)
+    *jt += size;
+
+  std::vector<int> inserted;
+  inserted.reserve(other.m_newlines.size());
+
+  for (int lf : other.m_newlines)
+    inserted.push_back(lf + insert_pos);
+
+  m_newlines.insert(m_newlines.begin() + index, inserted.begin(), inserted.end());
+
+  update_end();
 
   return *this;
 }
@@ -66,69 +122,61 @@ TextRange& TextRange::operator-=(const Range & other)
   const Position p0 = std::max(begin(), other.begin());
   const Position p1 = std::min(end(), other.end());
 
-  SeekHint hint{ 0, begin() };
-  const int erase_begin = seek(p0, hint);
-  hint.pos = p0;
-  hint.index = erase_begin;
-  const int erase_end = seek(p1, hint);
+  const int erase_begin = seek(p0);
+  const int erase_end = seek(p1);
 
   m_text.erase(erase_begin, erase_end - erase_begin);
 
-  /// TODO: compute this more efficiently
-  m_range = Range(begin(), TextRange::end(begin(), m_text));
+  auto first = std::lower_bound(m_newlines.begin(), m_newlines.end(), erase_begin);
+  auto last = std::lower_bound(first, m_newlines.end(), erase_end);
+
+  for (auto it = last; it != m_newlines.end(); ++it)
+    *it -= erase_end - erase_begin;
+
+  m_newlines.erase(first, last);
+
+  update_end();
 
   return *this;
 }
 
-
 int TextRange::seek(const Position & pos)
 {
-  SeekHint hint{ 0, begin() };
-  return seek(pos, hint);
+  const int line = pos.line - begin().line;
+
+  if (line == 0)
+    return static_cast<int>(utf8::byte_offset(m_text, pos.column - begin().column));
+
+  const size_t start = m_newlines.at(line - 1) + 1;
+  return static_cast<int>(start + utf8::byte_offset(m_text.data() + start, m_text.size() - start, pos.column));
 }
 
-int TextRange::seek(const Position & pos, SeekHint hint)
+Position TextRange::map(int offset) const
 {
-  while (hint.pos != pos)
-  {
-    char c = m_text.at(hint.index);
-    if (c == '\n')
-    {
-      hint.pos.line += 1;
-      hint.pos.column = 0;
-    }
-    else
-    {
-      hint.pos.column += 1;
-    }
+  const int line = static_cast<int>(std::distance(m_newlines.begin(), std::lower_bound(m_newlines.begin(), m_newlines.end(), offset)));
 
-    hint.index += 1;
-  }
+  if (line == 0)
+    return Position{ begin().line, begin().column + static_cast<int>(utf8::count_codepoints(m_text.data(), offset)) };
 
-  return hint.index;
+  const int start = m_newlines.at(line - 1) + 1;
+  return Position{ begin().line + line, static_cast<int>(utf8::count_codepoints(m_text.data() + start, offset - start)) };
 }
 
-Position TextRange::map(int offset) const
+void TextRange::update_end()
 {
-  Position ret = begin();
-  int i = 0;
+  Position end;
 
-  while (i < offset)
+  if (m_newlines.empty())
   {
-    const char c = m_text.at(i++);
-
-    if (c == '\n')
-    {
-      ret.line += 1;
-      ret.column = 0;
-    }
-    else
-    {
-      ret.column += 1;
-    }
+    end = Position{ begin().line, begin().column + static_cast<int>(utf8::count_codepoints(m_text)) };
+  }
+  else
+  {
+    const size_t start = m_newlines.back() + 1;
+    end = Position{ begin().line + static_cast<int>(m_newlines.size()), static_cast<int>(utf8::count_codepoints(m_text.data() + start, m_text.size() - start)) };
   }
 
-  return ret;
+  m_range = Range(begin(), end);
 }
 
 void TextDiff::Diff::clear()
@@ -178,284 +226,757 @@ void TextDiff::Diff::mapTo(const Diff & other)
   }
 }
 
+namespace
+{
+
+// Extents are stored as positions relative to the origin.
+
+inline Position advance(const Position& pos, const Position& extent)
+{
+  if (extent.line == 0)
+    return Position{ pos.line, pos.column + extent.column };
+  else
+    return Position{ pos.line + extent.line, extent.column };
+}
+
+inline Position distance(const Position& from, const Position& to)
+{
+  if (from.line == to.line)
+    return Position{ 0, to.column - from.column };
+  else
+    return Position{ to.line - from.line, to.column };
+}
+
+inline Position extent_of(const std::string& text)
+{
+  return TextRange::end(Position{ 0, 0 }, text);
+}
+
+// Returns the offset in 'text' reached by covering 'extent' from offset 'from'
+size_t skip(const std::string& text, size_t from, const Position& extent)
+{
+  for (int i(0); i < extent.line; ++i)
+  {
+    from = text.find('\n', from);
+    assert(from != std::string::npos);
+    from += 1;
+  }
+
+  return from + utf8::byte_offset(text.data() + from, text.size() - from, extent.column);
+}
+
+} // namespace
+
+const std::vector<TextDiff::Diff>& TextDiff::diffs() const
+{
+  if (!m_dirty)
+    return m_diffs;
+
+  m_diffs.clear();
+  m_dirty = false;
+
+  std::vector<int> stack;
+  Position pos{ 0, 0 };
+  int t = m_root;
+
+  while (t != -1 || !stack.empty())
+  {
+    while (t != -1)
+    {
+      stack.push_back(t);
+      t = m_nodes[t].left;
+    }
+
+    t = stack.back();
+    stack.pop_back();
+
+    const Hunk& h = m_nodes[t].hunk;
+    pos = advance(pos, h.gap);
+
+    if (!h.removed.empty())
+      m_diffs.push_back(diff::remove(pos, h.removed));
+
+    pos = advance(pos, h.removed_extent);
+
+    if (!h.inserted.empty())
+      m_diffs.push_back(diff::insert(pos, h.inserted));
+
+    t = m_nodes[t].right;
+  }
+
+  return m_diffs;
+}
+
+void TextDiff::squeeze()
+{
+  // Releases the list returned by diffs()
+  std::vector<Diff>().swap(m_diffs);
+  m_dirty = !isEmpty();
+}
+
+void TextDiff::clear()
+{
+  m_nodes.clear();
+  m_root = -1;
+  m_free = -1;
+  m_diffs.clear();
+  m_dirty = false;
+}
+
 TextDiff::Diff TextDiff::takeFirst()
 {
-  Diff ret = std::move(mDiffs.front());
-  mDiffs.erase(mDiffs.begin());
-  ret.kind = ret.isInsertion() ? Removal : Insertion;
-  for (auto & d : mDiffs)
+  assert(!isEmpty());
+
+  int first, rest;
+  split(m_root, 1, first, rest);
+
+  Hunk& h = m_nodes[first].hunk;
+  Position gap;
+
+  invalidate();
+
+  if (!h.removed.empty())
   {
-    d.mapTo(ret);
+    Diff ret = diff::remove(h.gap, h.removed);
+    h.removed.clear();
+    h.removed_extent = Position{ 0, 0 };
+
+    if (!h.inserted.empty())
+    {
+      update(first);
+      m_root = merge(first, rest);
+      return ret;
+    }
+
+    gap = h.gap;
+    release_node(first);
+    m_root = rest;
+
+    if (m_root != -1)
+    {
+      int next;
+      split(m_root, 1, next, rest);
+      m_nodes[next].hunk.gap = advance(gap, m_nodes[next].hunk.gap);
+      update(next);
+      m_root = merge(next, rest);
+    }
+
+    return ret;
+  }
+  else
+  {
+    Diff ret = diff::insert(h.gap, h.inserted);
+    gap = advance(h.gap, h.inserted_extent);
+    release_node(first);
+    m_root = rest;
+
+    if (m_root != -1)
+    {
+      int next;
+      split(m_root, 1, next, rest);
+      m_nodes[next].hunk.gap = advance(gap, m_nodes[next].hunk.gap);
+      update(next);
+      m_root = merge(next, rest);
+    }
+
+    return ret;
   }
-  ret.kind = ret.isInsertion() ? Removal : Insertion;
-  return ret;
 }
 
 void TextDiff::simplify()
 {
-  if (mDiffs.size() <= 1)
-    return;
+  std::vector<Hunk> hunks;
+  collect(m_root, hunks);
+  clear();
 
-  for (int i(0); i < mDiffs.size() - 1; ++i)
-  {
-    if (!mDiffs[i].isRemoval() || !mDiffs[i + 1].isInsertion() || mDiffs[i].end() != mDiffs[i + 1].begin())
-      continue;
+  std::vector<Hunk> result;
+  result.reserve(hunks.size());
+
+  Position pending_gap{ 0, 0 };
 
-    auto& rm = mDiffs[i];
-    auto& ins = mDiffs[i + 1];
+  for (Hunk& h : hunks)
+  {
+    h.gap = advance(pending_gap, h.gap);
+    pending_gap = Position{ 0, 0 };
 
-    const int s = std::min(rm.content.text().length(), ins.content.text().length());
-    int nb_common = 0;
+    const size_t s = std::min(h.removed.size(), h.inserted.size());
+    size_t nb_common = 0;
 
-    while (nb_common < s && rm.content.text().at(nb_common) == ins.content.text().at(nb_common))
+    while (nb_common < s && h.removed[nb_common] == h.inserted[nb_common])
       ++nb_common;
 
-    if (nb_common == 0)
-      continue;
+    // do not split a code point
+    while (nb_common > 0 && nb_common < h.removed.size() && (static_cast<unsigned char>(h.removed[nb_common]) & 0xC0) == 0x80)
+      --nb_common;
 
-    const Position new_begin = rm.content.map(nb_common);
-    ins.content = TextRange(ins.text().substr(nb_common), ins.begin());
-    rm.content = TextRange(rm.text().substr(nb_common), new_begin);
+    if (nb_common > 0)
+    {
+      h.gap = advance(h.gap, extent_of(h.removed.substr(0, nb_common)));
+      h.removed.erase(0, nb_common);
+      h.inserted.erase(0, nb_common);
+      h.removed_extent = extent_of(h.removed);
+      h.inserted_extent = extent_of(h.inserted);
+    }
 
-    if (ins.isEmpty())
-      mDiffs.erase(mDiffs.begin() + i + 1);
+    if (h.removed.empty() && h.inserted.empty())
+    {
+      pending_gap = h.gap;
+      continue;
+    }
 
-    if (rm.isEmpty())
-      mDiffs.erase(mDiffs.begin() + i);
+    result.push_back(std::move(h));
   }
+
+  m_root = build(result);
+  invalidate();
 }
 
 TextDiff& TextDiff::operator<<(Diff d)
 {
-  if (mDiffs.empty())
-  {
-    mDiffs.push_back(std::move(d));
-    return *(this);
-  }
+  if (d.text().empty())
+    return *this;
 
   if (d.isInsertion())
-    return add_insertion(d);
+    add_insertion(d.begin(), d.text());
   else
-    return add_removal(d);
+    add_removal(d.begin(), d.text());
+
+  invalidate();
+
+  return *this;
 }
 
 TextDiff& TextDiff::operator<<(const TextDiff & other)
 {
-  TextDiff temp = other;
-  while (!temp.diffs().empty())
+  if (&other == this)
   {
-    auto diff = temp.takeFirst();
-    (*this) << diff;
+    TextDiff copy{ other };
+    return (*this) << copy;
   }
 
+  // Diffs are applied from the last one so that positions remain valid
+  const std::vector<Diff>& diffs = other.diffs();
+
+  for (auto it = diffs.rbegin(); it != diffs.rend(); ++it)
+    (*this) << *it;
+
   return *this;
 }
 
-TextDiff& TextDiff::add_insertion(Diff d)
+TextDiff& TextDiff::append(Diff d)
 {
-  assert(d.isInsertion());
+  if (d.text().empty())
+    return *this;
 
-  int index = 0;
-  while (index < mDiffs.size())
+  const Position end = isEmpty() ? Position{ 0, 0 } : m_nodes[m_root].original_extent;
+  assert(end <= d.begin());
+
+  invalidate();
+
+  if (d.begin() == end && !isEmpty())
   {
-    Diff & current_diff = mDiffs[index];
-    if (d.begin() < current_diff.begin())
-    {
-      mDiffs.insert(mDiffs.begin() + index, d);
-      return *(this);
-    }
-    else if (d.begin() == current_diff.begin()) 
-    {
-      if (current_diff.kind == Insertion)
-      {
-        current_diff.content.move(d.end());
-        std::swap(current_diff, d);
-        current_diff.content += d.content;
-        return *(this);
-      }
-      else
-      {
-        d.content.move(current_diff.end());
-      }
-    }
-    else if (d.begin() < current_diff.end())
-    {
-      if (current_diff.isInsertion())
-      {
-        current_diff.content += d.content;
-        return *(this);
-      }
-      else
-      {
-        d.mapTo(current_diff);
-      }
-    }
-    else if (d.begin() == current_diff.end())
+    int left, last;
+    split(m_root, m_nodes[m_root].count - 1, left, last);
+
+    Hunk& h = m_nodes[last].hunk;
+
+    if (d.isInsertion())
     {
-      if (current_diff.isInsertion())
-      {
-        current_diff.content += d.content;
-        return *(this);
-      }
-      else
-      {
-        d.mapTo(current_diff);
-      }
+      h.inserted += d.text();
+      h.inserted_extent = advance(h.inserted_extent, extent_of(d.text()));
     }
     else
     {
-      assert(d.begin() > current_diff.end());
-
-      if (current_diff.isInsertion())
-      {
-        d.mapTo(current_diff);
-      }
-      else
-      {
-        d.mapTo(current_diff);
-      }
+      h.removed += d.text();
+      h.removed_extent = advance(h.removed_extent, extent_of(d.text()));
     }
 
-    ++index;
+    update(last);
+    m_root = merge(left, last);
+    return *this;
+  }
+
+  Hunk h;
+  h.gap = distance(end, d.begin());
+
+  if (d.isInsertion())
+  {
+    h.inserted = d.text();
+    h.inserted_extent = extent_of(h.inserted);
+  }
+  else
+  {
+    h.removed = d.text();
+    h.removed_extent = extent_of(h.removed);
   }
 
-  mDiffs.push_back(d);
+  m_root = merge(m_root, create_node(std::move(h)));
   return *this;
 }
 
-TextDiff& TextDiff::add_removal(Diff rm)
+TextDiff TextDiff::inverted() const
 {
-  assert(rm.isRemoval());
+  TextDiff ret{ *this };
 
-  // Modify existing diff to take into account the removal
-  for (auto& d : mDiffs)
+  for (Node& n : ret.m_nodes)
   {
-    if (apply_removal(d, rm))
-      break;
+    std::swap(n.hunk.removed, n.hunk.inserted);
+    std::swap(n.hunk.removed_extent, n.hunk.inserted_extent);
+    std::swap(n.original_extent, n.extent);
+  }
+
+  ret.invalidate();
+
+  return ret;
+}
+
+int TextDiff::create_node(Hunk h)
+{
+  // xorshift
+  m_seed ^= m_seed << 13;
+  m_seed ^= m_seed >> 17;
+  m_seed ^= m_seed << 5;
+
+  Node node;
+  node.hunk = std::move(h);
+  node.left = -1;
+  node.right = -1;
+  node.priority = m_seed;
+
+  int index;
+
+  if (m_free != -1)
+  {
+    index = m_free;
+    m_free = m_nodes[index].left;
+    m_nodes[index] = std::move(node);
+  }
+  else
+  {
+    index = static_cast<int>(m_nodes.size());
+    m_nodes.push_back(std::move(node));
+  }
+
+  update(index);
+  return index;
+}
+
+void TextDiff::release_node(int n)
+{
+  m_nodes[n].hunk = Hunk();
+  m_nodes[n].left = m_free;
+  m_nodes[n].right = -1;
+  m_free = n;
+}
+
+void TextDiff::update(int n)
+{
+  Node& node = m_nodes[n];
+
+  node.count = 1;
+  node.original_extent = advance(node.hunk.gap, node.hunk.removed_extent);
+  node.extent = advance(node.hunk.gap, node.hunk.inserted_extent);
+
+  if (node.left != -1)
+  {
+    const Node& l = m_nodes[node.left];
+    node.count += l.count;
+    node.original_extent = advance(l.original_extent, node.original_extent);
+    node.extent = advance(l.extent, node.extent);
   }
 
-  // Insert the removal into the list & remove empty diffs
-  bool inserted = false;
-  for (int i(0); i < mDiffs.size(); ++i)
+  if (node.right != -1)
   {
-    if (mDiffs.at(i).isEmpty())
+    const Node& r = m_nodes[node.right];
+    node.count += r.count;
+    node.original_extent = advance(node.original_extent, r.original_extent);
+    node.extent = advance(node.extent, r.extent);
+  }
+}
+
+int TextDiff::merge(int a, int b)
+{
+  if (a == -1)
+    return b;
+  else if (b == -1)
+    return a;
+
+  if (m_nodes[a].priority > m_nodes[b].priority)
+  {
+    const int r = merge(m_nodes[a].right, b);
+    m_nodes[a].right = r;
+    update(a);
+    return a;
+  }
+  else
+  {
+    const int l = merge(a, m_nodes[b].left);
+    m_nodes[b].left = l;
+    update(b);
+    return b;
+  }
+}
+
+void TextDiff::split(int t, int k, int& a, int& b)
+{
+  if (t == -1)
+  {
+    a = b = -1;
+    return;
+  }
+
+  const int left_count = m_nodes[t].left != -1 ? m_nodes[m_nodes[t].left].count : 0;
+
+  if (k <= left_count)
+  {
+    int l;
+    split(m_nodes[t].left, k, a, l);
+    m_nodes[t].left = l;
+    b = t;
+  }
+  else
+  {
+    int r;
+    split(m_nodes[t].right, k - left_count - 1, r, b);
+    m_nodes[t].right = r;
+    a = t;
+  }
+
+  update(t);
+}
+
+int TextDiff::build(std::vector<Hunk>& hunks)
+{
+  std::vector<int> stack;
+  std::vector<int> order;
+  order.reserve(hunks.size());
+
+  for (Hunk& h : hunks)
+  {
+    const int n = create_node(std::move(h));
+    order.push_back(n);
+
+    int last = -1;
+
+    while (!stack.empty() && m_nodes[stack.back()].priority < m_nodes[n].priority)
+    {
+      last = stack.back();
+      stack.pop_back();
+    }
+
+    m_nodes[n].left = last;
+
+    if (!stack.empty())
+      m_nodes[stack.back()].right = n;
+
+    stack.push_back(n);
+  }
+
+  if (stack.empty())
+    return -1;
+
+  // Update the aggregates, children first
+  std::vector<std::pair<int, bool>> pending;
+  pending.emplace_back(stack.front(), false);
+
+  while (!pending.empty())
+  {
+    const std::pair<int, bool> p = pending.back();
+    pending.pop_back();
+
+    if (p.second)
     {
-      mDiffs.erase(mDiffs.begin() + i);
-      --i;
+      update(p.first);
     }
     else
     {
-      if (rm.begin() < mDiffs.at(i).begin())
-      {
-        if (!rm.isEmpty() && !inserted)
-        {
-          mDiffs.insert(mDiffs.begin() + i, rm);
-          ++i;
-        }
+      pending.emplace_back(p.first, true);
 
-        inserted = true;
-      }
+      if (m_nodes[p.first].left != -1)
+        pending.emplace_back(m_nodes[p.first].left, false);
+
+      if (m_nodes[p.first].right != -1)
+        pending.emplace_back(m_nodes[p.first].right, false);
     }
   }
 
-  if (!inserted && !rm.isEmpty())
+  return stack.front();
+}
+
+void TextDiff::collect(int t, std::vector<Hunk>& hunks)
+{
+  std::vector<int> stack;
+
+  while (t != -1 || !stack.empty())
   {
-    mDiffs.push_back(rm);
-  }
+    while (t != -1)
+    {
+      stack.push_back(t);
+      t = m_nodes[t].left;
+    }
 
-  return *this;
+    t = stack.back();
+    stack.pop_back();
+
+    const int right = m_nodes[t].right;
+    hunks.push_back(std::move(m_nodes[t].hunk));
+    release_node(t);
+    t = right;
+  }
 }
 
-bool TextDiff::apply_removal(Diff& d, Diff& removal)
+TextDiff::Location TextDiff::locate_first_ending_at_or_after(const Position& pos) const
 {
-  const Range::ComparisonResult rcomp = Range::comp(d.content, removal.content);
+  Location result{ 0, Position{ 0, 0 } };
 
-  if (d.isInsertion())
+  if (m_root == -1)
+    return result;
+
+  result = Location{ m_nodes[m_root].count, m_nodes[m_root].extent };
+
+  Location current{ 0, Position{ 0, 0 } };
+  int t = m_root;
+
+  while (t != -1)
   {
-    auto& cinsert = d;
+    const Node& n = m_nodes[t];
+    const int left_count = n.left != -1 ? m_nodes[n.left].count : 0;
+    const Position begin = n.left != -1 ? advance(current.begin, m_nodes[n.left].extent) : current.begin;
+    const Position end = advance(advance(begin, n.hunk.gap), n.hunk.inserted_extent);
 
-    switch (rcomp)
-    {
-    case Range::C:
+    if (end >= pos)
     {
-      d.clear();
-      removal.clear();
-      return true;
+      result = Location{ current.rank + left_count, begin };
+      t = n.left;
     }
-    case Range::AB:
-    case Range::A_B:
+    else
     {
-      removal.mapTo(cinsert);
-      return false;
+      current.rank += left_count + 1;
+      current.begin = end;
+      t = n.right;
     }
-    case Range::BA:
-    case Range::B_A:
+  }
+
+  return result;
+}
+
+TextDiff::Location TextDiff::locate_last_starting_at_or_before(const Position& pos) const
+{
+  Location result{ -1, Position{ 0, 0 } };
+  Location current{ 0, Position{ 0, 0 } };
+  int t = m_root;
+
+  while (t != -1)
+  {
+    const Node& n = m_nodes[t];
+    const int left_count = n.left != -1 ? m_nodes[n.left].count : 0;
+    const Position begin = n.left != -1 ? advance(current.begin, m_nodes[n.left].extent) : current.begin;
+    const Position hunk_begin = advance(begin, n.hunk.gap);
+
+    if (hunk_begin <= pos)
     {
-      return true;
+      result = Location{ current.rank + left_count, begin };
+      current.rank += left_count + 1;
+      current.begin = advance(hunk_begin, n.hunk.inserted_extent);
+      t = n.right;
     }
-    case Range::CA:
-    case Range::AC:
-    case Range::BC:
-    case Range::CB:
-    case Range::ACA:
-    case Range::ACB:
-    case Range::BCA:
-    case Range::BCB:
+    else
     {
-      Range overlap = cinsert.content & removal.content;
-      removal.content -= overlap;
-      cinsert.content -= overlap;
+      t = n.left;
+    }
+  }
+
+  return result;
+}
 
-      removal.content.move(std::min(removal.begin(), cinsert.begin()));
-      cinsert.content.move(removal.end());
+void TextDiff::add_insertion(const Position& pos, const std::string& text)
+{
+  const Location loc = locate_first_ending_at_or_after(pos);
+  const Position text_extent = extent_of(text);
 
-      return false;
-    }
-    default:
-      return false;
-    }
+  if (isEmpty() || loc.rank == m_nodes[m_root].count)
+  {
+    Hunk h;
+    h.gap = distance(loc.begin, pos);
+    h.inserted = text;
+    h.inserted_extent = text_extent;
+    m_root = merge(m_root, create_node(std::move(h)));
+    return;
+  }
+
+  int left, mid, right;
+  split(m_root, loc.rank, left, right);
+  split(right, 1, mid, right);
+
+  Hunk& h = m_nodes[mid].hunk;
+  const Position hunk_begin = advance(loc.begin, h.gap);
+
+  if (pos < hunk_begin)
+  {
+    // Split the unchanged part of the text
+    h.gap = distance(pos, hunk_begin);
+    update(mid);
+
+    Hunk new_hunk;
+    new_hunk.gap = distance(loc.begin, pos);
+    new_hunk.inserted = text;
+    new_hunk.inserted_extent = text_extent;
+    mid = merge(create_node(std::move(new_hunk)), mid);
   }
   else
   {
-    auto& crm = d;
+    const Position hunk_end = advance(hunk_begin, h.inserted_extent);
+    const Position prefix = distance(hunk_begin, pos);
+    const size_t offset = skip(h.inserted, 0, prefix);
+    h.inserted.insert(offset, text);
+    h.inserted_extent = advance(advance(prefix, text_extent), distance(pos, hunk_end));
+    update(mid);
+  }
 
-    switch (rcomp)
-    {
-    case Range::C:
-    case Range::CA:
-    case Range::CB:
+  m_root = merge(merge(left, mid), right);
+}
+
+void TextDiff::add_removal(const Position& pos, const std::string& text)
+{
+  const Position end = advance(pos, extent_of(text));
+  const Location first = locate_first_ending_at_or_after(pos);
+  const Location last = locate_last_starting_at_or_before(end);
+
+  if (first.rank > last.rank)
+  {
+    // The removal only affects an unchanged part of the text
+    Hunk h;
+    h.gap = distance(first.begin, pos);
+    h.removed = text;
+    h.removed_extent = extent_of(text);
+
+    if (isEmpty() || first.rank == m_nodes[m_root].count)
     {
-      removal.content = TextRange(crm.text() + removal.text(), crm.begin());
-      crm.clear();
-      return false;
+      m_root = merge(m_root, create_node(std::move(h)));
+      return;
     }
-    case Range::BA:
+
+    int left, mid, right;
+    split(m_root, first.rank, left, right);
+    split(right, 1, mid, right);
+
+    m_nodes[mid].hunk.gap = distance(end, advance(first.begin, m_nodes[mid].hunk.gap));
+    update(mid);
+
+    const int n = create_node(std::move(h));
+    m_root = merge(merge(left, n), merge(mid, right));
+    return;
+  }
+
+  // All the hunks touched by the removal are merged into one
+  int left, mid, right;
+  split(m_root, first.rank, left, right);
+  split(right, last.rank - first.rank + 1, mid, right);
+
+  std::vector<Hunk> hunks;
+  collect(mid, hunks);
+
+  Hunk result;
+  Position cur = first.begin;
+  size_t text_offset = 0;
+  Position inserted_suffix;
+
+  for (size_t i(0); i < hunks.size(); ++i)
+  {
+    Hunk& h = hunks[i];
+    const Position hunk_begin = advance(cur, h.gap);
+    const Position hunk_end = advance(hunk_begin, h.inserted_extent);
+
+    if (i == 0)
     {
-      removal.content = TextRange(removal.text() + crm.text(), removal.begin());
-      crm.clear();
-      return false;
+      if (pos < hunk_begin)
+      {
+        result.gap = distance(cur, pos);
+        text_offset = skip(text, 0, distance(pos, hunk_begin));
+        result.removed.assign(text, 0, text_offset);
+        result.removed_extent = distance(pos, hunk_begin);
+      }
+      else
+      {
+        result.gap = h.gap;
+      }
     }
-    case Range::BC:
-    case Range::BCB:
-    case Range::BCA:
+    else
     {
-      removal.content += crm.content;
-      crm.clear();
+      const size_t n = skip(text, text_offset, h.gap);
+      result.removed.append(text, text_offset, n - text_offset);
+      result.removed_extent = advance(result.removed_extent, h.gap);
+      text_offset = n;
     }
-    case Range::A_B:
-    case Range::AB:
-    case Range::ACB:
-    case Range::ACA:
-    case Range::AC:
+
+    result.removed += h.removed;
+    result.removed_extent = advance(result.removed_extent, h.removed_extent);
+
+    // Only the inserted text outside of the removal is kept
+    const Position removal_begin = std::max(hunk_begin, pos);
+    const Position removal_end = std::min(hunk_end, end);
+    const size_t i0 = skip(h.inserted, 0, distance(hunk_begin, removal_begin));
+    const size_t i1 = skip(h.inserted, i0, distance(removal_begin, removal_end));
+
+    text_offset += i1 - i0;
+
+    if (i == 0)
     {
-      removal.mapTo(crm);
-      return false;
+      result.inserted_extent = distance(hunk_begin, removal_begin);
+
+      if (i + 1 == hunks.size())
+      {
+        h.inserted.erase(i0, i1 - i0);
+        result.inserted_extent = advance(result.inserted_extent, distance(removal_end, hunk_end));
+      }
+      else
+      {
+        h.inserted.erase(i0);
+      }
+
+      result.inserted = std::move(h.inserted);
     }
-    case Range::B_A:
-    default:
-      return false;
+    else if (i + 1 == hunks.size())
+    {
+      result.inserted.append(h.inserted, i1, std::string::npos);
+      result.inserted_extent = advance(result.inserted_extent, distance(removal_end, hunk_end));
     }
+
+    cur = hunk_end;
+  }
+
+  if (end > cur)
+  {
+    result.removed.append(text, text_offset, std::string::npos);
+    result.removed_extent = advance(result.removed_extent, distance(cur, end));
   }
+
+  const bool vanished = result.removed.empty() && result.inserted.empty();
+
+  if (right != -1 && (end > cur || vanished))
+  {
+    int next;
+    split(right, 1, next, right);
+
+    Hunk& h = m_nodes[next].hunk;
+
+    if (end > cur)
+      h.gap = distance(end, advance(cur, h.gap));
+
+    if (vanished)
+      h.gap = advance(result.gap, h.gap);
+
+    update(next);
+    right = merge(next, right);
+  }
+
+  mid = vanished ? -1 : create_node(std::move(result));
+  m_root = merge(merge(left, mid), right);
+}
+
+void TextDiff::invalidate()
+{
+  m_dirty = true;
 }
 
 namespace diff
@@ -471,6 +992,182 @@ TextDiff::Diff remove(const Position& pos, const std::string& text)
   return TextDiff::Diff{ TextDiff::Removal, TextRange{ text, pos } };
 }
 
+namespace
+{
+
+/*
+ * Diffs are converted to sequences of retain/insert/delete operations
+ * over the original text so that they can be transformed against each
+ * other. Lengths are extents, the last operation is implicitly followed
+ * by an infinite retain.
+ */
+
+struct Operation
+{
+  enum Type
+  {
+    Retain,
+    Insert,
+    Delete,
+  };
+
+  Type type;
+  Position extent;
+  std::string text;
+};
+
+std::vector<Operation> to_operations(const TextDiff& diff)
+{
+  std::vector<Operation> ops;
+  Position cursor{ 0, 0 };
+
+  for (const TextDiff::Diff& d : diff.diffs())
+  {
+    if (cursor < d.begin())
+      ops.push_back(Operation{ Operation::Retain, distance(cursor, d.begin()), std::string() });
+
+    if (d.isRemoval())
+    {
+      ops.push_back(Operation{ Operation::Delete, distance(d.begin(), d.end()), d.text() });
+      cursor = d.end();
+    }
+    else
+    {
+      ops.push_back(Operation{ Operation::Insert, distance(d.begin(), d.end()), d.text() });
+      cursor = d.begin();
+    }
+  }
+
+  return ops;
+}
+
+class OperationBuilder
+{
+public:
+  TextDiff result;
+  Position cursor{ 0, 0 };
+
+  void retain(const Position& extent)
+  {
+    cursor = advance(cursor, extent);
+  }
+
+  void insert(const std::string& text)
+  {
+    result.append(diff::insert(cursor, text));
+  }
+
+  void remove(const std::string& text)
+  {
+    TextDiff::Diff d = diff::remove(cursor, text);
+    cursor = d.end();
+    result.append(std::move(d));
+  }
+};
+
+// Splits the first 'extent' of a retain or delete operation
+Operation take_front(Operation& op, const Position& extent)
+{
+  Operation front{ op.type, extent, std::string() };
+
+  if (op.type == Operation::Delete)
+  {
+    const size_t n = skip(op.text, 0, extent);
+    front.text = op.text.substr(0, n);
+    op.text.erase(0, n);
+  }
+
+  op.extent = distance(extent, op.extent);
+  return front;
+}
+
+} // namespace
+
+void transform(TextDiff& a, TextDiff& b)
+{
+  // Insertions of 'a' are placed first when both diffs insert at the same position.
+  std::vector<Operation> ops_a = to_operations(a);
+  std::vector<Operation> ops_b = to_operations(b);
+
+  OperationBuilder out_a, out_b;
+
+  size_t i = 0, j = 0;
+  const Position zero{ 0, 0 };
+
+  while (i < ops_a.size() || j < ops_b.size())
+  {
+    Operation* op1 = i < ops_a.size() ? &ops_a[i] : nullptr;
+    Operation* op2 = j < ops_b.size() ? &ops_b[j] : nullptr;
+
+    if (op1 && op1->type == Operation::Insert)
+    {
+      out_a.insert(op1->text);
+      out_b.retain(op1->extent);
+      ++i;
+      continue;
+    }
+
+    if (op2 && op2->type == Operation::Insert)
+    {
+      out_a.retain(op2->extent);
+      out_b.insert(op2->text);
+      ++j;
+      continue;
+    }
+
+    if (!op1)
+    {
+      if (op2->type == Operation::Delete)
+        out_b.remove(op2->text);
+      else
+        out_a.retain(op2->extent), out_b.retain(op2->extent);
+
+      ++j;
+      continue;
+    }
+
+    if (!op2)
+    {
+      if (op1->type == Operation::Delete)
+        out_a.remove(op1->text);
+      else
+        out_a.retain(op1->extent), out_b.retain(op1->extent);
+
+      ++i;
+      continue;
+    }
+
+    const Position extent = std::min(op1->extent, op2->extent);
+    const Operation part1 = take_front(*op1, extent);
+    const Operation part2 = take_front(*op2, extent);
+
+    if (part1.type == Operation::Retain && part2.type == Operation::Retain)
+    {
+      out_a.retain(extent);
+      out_b.retain(extent);
+    }
+    else if (part1.type == Operation::Delete && part2.type == Operation::Retain)
+    {
+      out_a.remove(part1.text);
+    }
+    else if (part1.type == Operation::Retain && part2.type == Operation::Delete)
+    {
+      out_b.remove(part2.text);
+    }
+
+    // Both removed the same text: nothing left to do
+
+    if (op1->extent == zero)
+      ++i;
+
+    if (op2->extent == zero)
+      ++j;
+  }
+
+  a = std::move(out_a.result);
+  b = std::move(out_b.result);
+}
+
 } // namespace diff
 
 bool operator==(const TextDiff::Diff& lhs, const TextDiff::Diff& rhs)
@@ -4,14 +4,22 @@
 
 #include "typewriter/textdocument.h"
 #include "typewriter/private/textdocument_p.h"
+#include "typewriter/private/memoryusage_p.h"
 
 #include "typewriter/textblock.h"
 #include "typewriter/textcursor.h"
 #include "typewriter/textdiff.h"
+#include "typewriter/textsnapshot.h"
+
+#include "typewriter/utils/instrumentation.h"
+#include "typewriter/utils/utf8.h"
 
 #include <unicode/utf8.h>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 
 namespace typewriter
 {
@@ -19,6 +27,7 @@ namespace typewriter
 TextDocumentImpl::TextDocumentImpl(TextDocument *doc)
   : document(doc)
   , lineCount(1)
+  , byteCount(0)
   , firstBlock(new TextBlockImpl())
   , lastBlock(firstBlock)
   , idgen(0)
@@ -55,7 +64,7 @@ int TextDocumentImpl::blockOffset(TextBlockImpl *block) const
   TextBlockImpl *it = firstBlock.get();
   while (it != nullptr && block != it)
   {
-    n += it->content.length() + 1;
+    n += it->content().length() + 1;
     it = it->next.get();
   }
 
@@ -70,9 +79,10 @@ void TextDocumentImpl::register_cursor(TextCursor* c)
   this->cursors.push_back(c);
 }
 
+// recently created cursors are looked up first, they are usually the ones being moved or destroyed
 void TextDocumentImpl::swap_cursor(TextCursor* existing_cursor, TextCursor* new_cursor) noexcept
 {
-  for (size_t i(0); i < this->cursors.size(); ++i)
+  for (size_t i(this->cursors.size()); i-- > 0; )
   {
     if (this->cursors[i] == existing_cursor)
     {
@@ -84,15 +94,43 @@ void TextDocumentImpl::swap_cursor(TextCursor* existing_cursor, TextCursor* new_
 
 void TextDocumentImpl::deregister_cursor(TextCursor* c) noexcept
 {
-  auto it = std::find(this->cursors.begin(), this->cursors.end(), c);
+  auto it = std::find(this->cursors.rbegin(), this->cursors.rend(), c);
+
+  if (it != this->cursors.rend())
+    this->cursors.erase(std::next(it).base());
+}
+
+// deregisters many cursors in a single pass, they are detached from the document
+void TextDocumentImpl::deregister_cursors(std::vector<TextCursor*> list)
+{
+  std::sort(list.begin(), list.end());
+
+  this->cursors.erase(std::remove_if(this->cursors.begin(), this->cursors.end(), [&list](TextCursor* c) {
+    return std::binary_search(list.begin(), list.end(), c);
+    }), this->cursors.end());
 
-  if (it != this->cursors.end())
-    this->cursors.erase(it);
+  for (TextCursor* c : list)
+    c->m_document = nullptr;
+}
+
+// registers cursors that were detached by deregister_cursors()
+void TextDocumentImpl::register_cursors(const std::vector<TextCursor*>& list)
+{
+  this->cursors.reserve(this->cursors.size() + list.size());
+
+  for (TextCursor* c : list)
+  {
+    c->m_document = this->document;
+    this->cursors.push_back(c);
+  }
 }
 
 void TextDocumentImpl::insertBlock(Position pos, const TextBlock & block)
 {
-  TextBlockImpl *newblock = new TextBlockImpl{ block.text().substr(pos.column) };
+  TYPEWRITER_SCOPED_TIMER("document.insertBlock");
+
+  const size_t offset = block.byteOffset(pos.column);
+  TextBlockImpl *newblock = new TextBlockImpl{ block.text().substr(offset) };
   newblock->id = idgen++;
 
   newblock->previous = block.impl();
@@ -111,14 +149,23 @@ void TextDocumentImpl::insertBlock(Position pos, const TextBlock & block)
   }
 
   this->lineCount += 1;
+  this->byteCount += 1;
 
-  block.impl()->content.erase(block.impl()->content.begin() + pos.column, block.impl()->content.end());
-  block.impl()->revision += 1;
+  block.impl()->edit().erase(offset);
+  block.impl()->contentChanged();
+
+  if (this->snapshots.isActive())
+  {
+    this->snapshots.setLine(pos.line, block.impl()->sharedContent());
+    this->snapshots.insertLine(pos.line + 1, newblock->sharedContent());
+  }
 
   if (this->transaction.is_active())
     this->transaction.delta << diff::insert(pos, "\n");
 
   // Update cursors
+  TYPEWRITER_COUNT("document.cursorUpdates", this->cursors.size());
+
   for (size_t i(0); i < this->cursors.size(); ++i)
   {
     TextCursor *c = this->cursors[i];
@@ -145,6 +192,8 @@ void TextDocumentImpl::insertBlock(Position pos, const TextBlock & block)
     }
   }
 
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
   for (const auto& l : listeners)
   {
     l->blockInserted(pos, TextBlock{ document, newblock });
@@ -155,14 +204,22 @@ void TextDocumentImpl::insertBlock(Position pos, const TextBlock & block)
 
 void TextDocumentImpl::insertChar(Position pos, const TextBlock & block, unicode::Character c)
 {
-  // TODO: not correct, we need to take into account the 1 character != 1 char
+  TYPEWRITER_SCOPED_TIMER("document.insertChar");
+
   unicode::Utf8Char u8c{ c };
-  block.impl()->content.insert(pos.column, u8c.data());
-  block.impl()->revision += 1;
+  const size_t size = block.impl()->content().size();
+  block.impl()->edit().insert(block.byteOffset(pos.column), u8c.data());
+  block.impl()->contentChanged();
+  this->byteCount += block.impl()->content().size() - size;
+
+  if (this->snapshots.isActive())
+    this->snapshots.setLine(pos.line, block.impl()->sharedContent());
 
   if (this->transaction.is_active())
     this->transaction.delta << diff::insert(pos, u8c.data());
 
+  TYPEWRITER_COUNT("document.cursorUpdates", this->cursors.size());
+
   for (size_t i(0); i < this->cursors.size(); ++i)
   {
     auto *c = this->cursors[i];
@@ -170,6 +227,8 @@ void TextDocumentImpl::insertChar(Position pos, const TextBlock & block, unicode
     TextDocument::updatePositionOnContentsChange(c->m_anchor, block, pos, 0, 1);
   }
 
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
   for (const auto& l : listeners)
   {
     l->contentsChange(block, pos, 0, 1);
@@ -179,33 +238,45 @@ void TextDocumentImpl::insertChar(Position pos, const TextBlock & block, unicode
 
 void TextDocumentImpl::insertText(Position pos, const TextBlock & block, const std::string& str)
 {
+  TYPEWRITER_SCOPED_TIMER("document.insertText");
+
   // @TODO: try to make it a precondition
   if (str.empty())
     return;
 
-  // TODO: not correct, we need to take into account the 1 character != 1 char
-  block.impl()->content.insert(pos.column, str);
-  block.impl()->revision += 1;
+  const int length = static_cast<int>(utf8::count_codepoints(str));
+  block.impl()->edit().insert(block.byteOffset(pos.column), str);
+  block.impl()->contentChanged();
+  this->byteCount += str.size();
+
+  if (this->snapshots.isActive())
+    this->snapshots.setLine(pos.line, block.impl()->sharedContent());
 
   if (this->transaction.is_active())
     this->transaction.delta << diff::insert(pos, str);
 
+  TYPEWRITER_COUNT("document.cursorUpdates", this->cursors.size());
+
   for (size_t i(0); i < this->cursors.size(); ++i)
   {
     auto *c = this->cursors[i];
-    TextDocument::updatePositionOnContentsChange(c->m_pos, block, pos, 0, str.length());
-    TextDocument::updatePositionOnContentsChange(c->m_anchor, block, pos, 0, str.length());
+    TextDocument::updatePositionOnContentsChange(c->m_pos, block, pos, 0, length);
+    TextDocument::updatePositionOnContentsChange(c->m_anchor, block, pos, 0, length);
   }
 
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
   for (const auto& l : listeners)
   {
-    l->contentsChange(block, pos, 0, str.length());
+    l->contentsChange(block, pos, 0, length);
     l->contentsChanged();
   }
 }
 
 void TextDocumentImpl::deleteChar(Position pos, const TextBlock & block)
 {
+  TYPEWRITER_SCOPED_TIMER("document.deleteChar");
+
   if (pos.column == block.length())
   {
     if (block == document->lastBlock())
@@ -218,6 +289,8 @@ void TextDocumentImpl::deleteChar(Position pos, const TextBlock & block)
     remove_selection_singleline(pos, block, 1);
   }
 
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
   for (const auto& l : listeners)
   {
     l->contentsChanged();
@@ -226,6 +299,8 @@ void TextDocumentImpl::deleteChar(Position pos, const TextBlock & block)
 
 void TextDocumentImpl::deletePreviousChar(Position pos, const TextBlock & block)
 {
+  TYPEWRITER_SCOPED_TIMER("document.deletePreviousChar");
+
   if (pos.column == 0)
   {
     if (block == document->firstBlock())
@@ -238,6 +313,8 @@ void TextDocumentImpl::deletePreviousChar(Position pos, const TextBlock & block)
     remove_selection_singleline(Position{ pos.line, pos.column - 1 }, block, 1);
   }
 
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
   for (const auto& l : listeners)
   {
     l->contentsChanged();
@@ -246,6 +323,8 @@ void TextDocumentImpl::deletePreviousChar(Position pos, const TextBlock & block)
 
 void TextDocumentImpl::removeSelection(const Position begin, const TextBlock & beginBlock, const Position end)
 {
+  TYPEWRITER_SCOPED_TIMER("document.removeSelection");
+
   if (begin == end)
     return;
 
@@ -266,8 +345,138 @@ void TextDocumentImpl::removeSelection(const Position begin, const TextBlock & b
     remove_selection_multiline(end, prev(beginBlock, begin.line - end.line), begin);
   }
 
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
+  for (const auto& l : listeners)
+  {
+    l->contentsChanged();
+  }
+}
+
+// Appended text is not part of the undo history and does not move the cursors:
+// everything that precedes it is left unchanged.
+void TextDocumentImpl::append(const char* begin, const char* end)
+{
+  TYPEWRITER_SCOPED_TIMER("document.append");
+
+  if (begin == end)
+    return;
+
+  if (this->transaction.is_active())
+    throw std::runtime_error{ "Cannot append text during a transaction" };
+
+  const size_t size = end - begin;
+  const int line = this->lineCount - 1;
+  TextBlockImpl* last = this->lastBlock.get();
+
+  const char* nl = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+  const char* segment_end = nl ? nl : end;
+
+  if (segment_end != begin)
+  {
+    last->edit().append(begin, segment_end);
+    last->contentChanged();
+  }
+
+  if (this->snapshots.isActive())
+    this->snapshots.setLine(line, last->sharedContent());
+
+  int count = 0;
+
+  while (nl)
+  {
+    begin = nl + 1;
+    nl = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+    segment_end = nl ? nl : end;
+
+    TextBlockImpl* newblock = new TextBlockImpl{ std::string(begin, segment_end) };
+    newblock->id = idgen++;
+    newblock->previous = this->lastBlock;
+    this->lastBlock.get()->next = newblock;
+    this->lastBlock = newblock;
+
+    if (this->snapshots.isActive())
+      this->snapshots.insertLine(line + count + 1, newblock->sharedContent());
+
+    ++count;
+  }
+
+  this->lineCount += count;
+  this->byteCount += size;
+
+  {
+    TYPEWRITER_SCOPED_TIMER("document.notify");
+
+    for (const auto& l : listeners)
+    {
+      l->blocksAppended(line, count);
+
+      if (count > 0)
+        l->blockCountChanged(this->lineCount);
+
+      l->contentsChanged();
+    }
+  }
+
+  if (this->maximumBlockCount > 0 && this->lineCount > this->maximumBlockCount)
+    discard_blocks(this->lineCount - this->maximumBlockCount);
+}
+
+// Removes the first blocks of the document.
+// Positions in the history would no longer be valid, so it is cleared.
+void TextDocumentImpl::discard_blocks(int count)
+{
+  TYPEWRITER_SCOPED_TIMER("document.discardBlocks");
+
+  assert(count < this->lineCount);
+
+  for (int i(0); i < count; ++i)
+  {
+    TextBlockRef block = this->firstBlock;
+    this->byteCount -= block.get()->content().size() + 1;
+    this->firstBlock = block.get()->next;
+    // unlinking both ends avoids a recursive destruction of the discarded blocks
+    block.get()->previous = nullptr;
+    block.get()->next = nullptr;
+    block.get()->setGarbage();
+  }
+
+  this->firstBlock.get()->previous = nullptr;
+  this->lineCount -= count;
+
+  if (this->snapshots.isActive())
+    this->snapshots.removeLines(0, count);
+
+  this->history.clear();
+
+  TYPEWRITER_COUNT("document.cursorUpdates", this->cursors.size());
+
+  for (size_t i(0); i < this->cursors.size(); ++i)
+  {
+    TextCursor* c = this->cursors[i];
+
+    if (c->m_pos.line < count)
+    {
+      c->m_pos = Position{ 0, 0 };
+      c->m_block = TextBlock{ this->document, this->firstBlock.get() };
+    }
+    else
+    {
+      c->m_pos.line -= count;
+    }
+
+    if (c->m_anchor.line < count)
+      c->m_anchor = Position{ 0, 0 };
+    else
+      c->m_anchor.line -= count;
+  }
+
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
   for (const auto& l : listeners)
   {
+    l->blocksDiscarded(count);
+    l->blockCountChanged(this->lineCount);
     l->contentsChanged();
   }
 }
@@ -294,52 +503,38 @@ void TextDocumentImpl::endTransaction(Author author)
   if (transaction.depth != 0)
     return;
 
-  m_redo_stack.clear();
-
   Contribution contrib;
   contrib.author = author;
   contrib.delta = std::move(transaction.delta);
 
   transaction.delta.clear();
 
-  m_undo_stack.push_back(std::move(contrib));
-  m_redo_stack.clear();
+  history.push(std::move(contrib));
 }
 
 void TextDocumentImpl::undo(Author author)
 {
-  if (m_undo_stack.empty())
+  TYPEWRITER_SCOPED_TIMER("document.undo");
+
+  if (history.undoCount() == 0)
     throw std::runtime_error{ "Undo stack is empty" };
 
-  if (m_undo_stack.back().author == author)
-  {
-    revert(m_undo_stack.back().delta);
-    m_redo_stack.push_back(std::move(m_undo_stack.back()));
-    m_undo_stack.pop_back();
-  }
-  else
-  {
-    // @TODO: try to solve undo
-    throw std::runtime_error{ "Do not own last undo action" };
-  }
+  // Contributions of other authors made since then are preserved
+  Contribution contrib = history.lastUndoAuthor() == author ? history.takeUndo() : history.takeUndo(author);
+  revert(contrib.delta);
+  history.pushRedo(std::move(contrib));
 }
 
 void TextDocumentImpl::redo(Author author)
 {
-  if (m_redo_stack.empty())
+  TYPEWRITER_SCOPED_TIMER("document.redo");
+
+  if (history.redoCount() == 0)
     throw std::runtime_error{ "Redo stack is empty" };
 
-  if (m_redo_stack.back().author == author)
-  {
-    apply(m_redo_stack.back().delta);
-    m_undo_stack.push_back(std::move(m_redo_stack.back()));
-    m_redo_stack.pop_back();
-  }
-  else
-  {
-    // @TODO: try to solve undo
-    throw std::runtime_error{ "Do not own last redo action" };
-  }
+  Contribution contrib = history.lastRedoAuthor() == author ? history.takeRedo() : history.takeRedo(author);
+  apply(contrib.delta);
+  history.pushUndo(std::move(contrib));
 }
 
 void TextDocumentImpl::remove_selection_singleline(const Position begin, const TextBlock & beginBlock, int count)
@@ -348,15 +543,25 @@ void TextDocumentImpl::remove_selection_singleline(const Position begin, const T
   if (count == 0)
     return;
 
+  const size_t from = beginBlock.byteOffset(begin.column);
+  const size_t to = beginBlock.byteOffset(begin.column + count);
+
   if (this->transaction.is_active())
   {
-    std::string removed = beginBlock.impl()->content.substr(begin.column, count);
+    std::string removed = beginBlock.impl()->content().substr(from, to - from);
     this->transaction.delta << diff::remove(begin, std::move(removed));
   }
 
-  beginBlock.impl()->content.erase(begin.column, count);
+  beginBlock.impl()->edit().erase(from, to - from);
+  beginBlock.impl()->contentChanged();
+  this->byteCount -= to - from;
+
+  if (this->snapshots.isActive())
+    this->snapshots.setLine(begin.line, beginBlock.impl()->sharedContent());
 
   // update cursors
+  TYPEWRITER_COUNT("document.cursorUpdates", this->cursors.size());
+
   for (size_t i(0); i < this->cursors.size(); ++i)
   {
     TextCursor *c = this->cursors[i];
@@ -364,6 +569,8 @@ void TextDocumentImpl::remove_selection_singleline(const Position begin, const T
     TextDocument::updatePositionOnContentsChange(c->m_anchor, beginBlock, begin, count, 0);
   }
 
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
   for (const auto& l : listeners)
   {
     l->contentsChange(beginBlock, begin, count, 0);
@@ -384,7 +591,7 @@ void TextDocumentImpl::remove_selection_multiline(const Position begin, const Te
   for (int i(1); i < count; ++i)
   {
     TextBlock nextBlock = beginBlock.next();
-    charsRemoved = nextBlock.text().length();
+    charsRemoved = nextBlock.length();
     remove_selection_singleline(Position{ begin.line + 1, 0 }, nextBlock, nextBlock.length());
     remove_block(begin.line + 1, nextBlock);
   }
@@ -399,10 +606,12 @@ void TextDocumentImpl::remove_selection_multiline(const Position begin, const Te
 void TextDocumentImpl::remove_block(int blocknum, TextBlock block)
 {
   TextBlock prev = block.previous();
-  prev.impl()->content.append(block.text());
 
   if (this->transaction.is_active())
-    this->transaction.delta << diff::remove(Position{ blocknum, prev.length() }, "\n");
+    this->transaction.delta << diff::remove(Position{ blocknum - 1, prev.length() }, "\n");
+
+  prev.impl()->edit().append(block.text());
+  prev.impl()->contentChanged();
 
   if (this->lastBlock == block.impl())
   {
@@ -416,7 +625,15 @@ void TextDocumentImpl::remove_block(int blocknum, TextBlock block)
     next.impl()->previous = prev.impl();
   }
 
+  if (this->snapshots.isActive())
+  {
+    this->snapshots.setLine(blocknum - 1, prev.impl()->sharedContent());
+    this->snapshots.removeLine(blocknum);
+  }
+
   // update cursors
+  TYPEWRITER_COUNT("document.cursorUpdates", this->cursors.size());
+
   for (size_t i(0); i < this->cursors.size(); ++i)
   {
     TextCursor *c = this->cursors[i];
@@ -429,6 +646,9 @@ void TextDocumentImpl::remove_block(int blocknum, TextBlock block)
   // @TODO: it causes a crash if we call setGarbage() here
   // block.impl()->setGarbage();
   this->lineCount -= 1;
+  this->byteCount -= 1;
+
+  TYPEWRITER_SCOPED_TIMER("document.notify");
 
   for (const auto& l : listeners)
   {
@@ -439,13 +659,124 @@ void TextDocumentImpl::remove_block(int blocknum, TextBlock block)
   block.impl()->setGarbage();
 }
 
+namespace
+{
+
+// Maps positions expressed in the coordinates of the original document 
+// to the coordinates of the document after the diffs have been applied.
+// Diffs must be processed in order.
+class DiffPositionMapper
+{
+public:
+  Position map(const Position& pos) const
+  {
+    if (pos.line == m_line && pos.column >= m_column)
+      return Position{ pos.line + m_line_delta, pos.column - m_column + m_mapped_column };
+    else
+      return Position{ pos.line + m_line_delta, pos.column };
+  }
+
+  void advance(const TextDiff::Diff& d, const Position& mapped_begin)
+  {
+    if (d.isInsertion())
+    {
+      const Position mapped_end = TextRange::end(mapped_begin, d.text());
+      m_line_delta += mapped_end.line - mapped_begin.line;
+      m_line = d.begin().line;
+      m_column = d.begin().column;
+      m_mapped_column = mapped_end.column;
+    }
+    else
+    {
+      m_line_delta -= d.end().line - d.begin().line;
+      m_line = d.end().line;
+      m_column = d.end().column;
+      m_mapped_column = mapped_begin.column;
+    }
+  }
+
+private:
+  int m_line_delta = 0;
+  int m_line = -1;
+  int m_column = 0;
+  int m_mapped_column = 0;
+};
+
+// A removal and the text inserted in its place, in the coordinates of the 
+// document before the edit.
+struct BatchEdit
+{
+  Position begin;
+  Position end;
+  const std::string* text;
+  Position mapped_end; // end of the inserted text, in the coordinates of the edited document
+};
+
+std::vector<BatchEdit> make_batch_edits(const std::vector<TextDiff::Diff>& diffs)
+{
+  static const std::string empty;
+
+  std::vector<BatchEdit> edits;
+  edits.reserve(diffs.size());
+
+  for (size_t i(0); i < diffs.size(); ++i)
+  {
+    const TextDiff::Diff& d = diffs.at(i);
+
+    BatchEdit e;
+    e.begin = d.begin();
+    e.end = d.isRemoval() ? d.end() : d.begin();
+    e.text = d.isRemoval() ? &empty : &d.text();
+
+    if (d.isRemoval() && i + 1 < diffs.size() && diffs.at(i + 1).isInsertion() && diffs.at(i + 1).begin() == e.end)
+      e.text = &diffs.at(++i).text();
+
+    edits.push_back(e);
+  }
+
+  return edits;
+}
+
+Position map_position(const std::vector<BatchEdit>& edits, const Position& pos)
+{
+  auto it = std::upper_bound(edits.begin(), edits.end(), pos, [](const Position& p, const BatchEdit& e) {
+    return p < e.begin;
+    });
+
+  if (it == edits.begin())
+    return pos;
+
+  const BatchEdit& e = *std::prev(it);
+
+  if (pos <= e.end)
+    return e.mapped_end;
+  else if (pos.line == e.end.line)
+    return Position{ e.mapped_end.line, e.mapped_end.column + pos.column - e.end.column };
+  else
+    return Position{ pos.line + e.mapped_end.line - e.end.line, pos.column };
+}
+
+} // namespace
+
 void TextDocumentImpl::apply(const TextDiff& diff, bool inv)
 {
+  TYPEWRITER_SCOPED_TIMER("document.apply");
+
   const std::vector<TextDiff::Diff>& diffs = diff.diffs();
 
   if (diffs.size() == 0)
     return;
 
+  if (diffs.size() >= BatchThreshold && !this->transaction.is_active())
+  {
+    if (inv)
+      apply_batch(diff.inverted().diffs());
+    else
+      apply_batch(diffs);
+
+    return;
+  }
+
   // @TODO: use RAII
   this->cursors_are_ghosts = true;
 
@@ -453,15 +784,26 @@ void TextDocumentImpl::apply(const TextDiff& diff, bool inv)
   std::vector<TextCursor> cursors;
   cursors.reserve(diffs.size());
 
+  // Diffs are expressed in the coordinates of the document before the edit,
+  // they need to be mapped when reverting.
+  DiffPositionMapper mapper;
+
   // Create edit cursors
   for (const auto& d : diff.diffs())
   {
-    c.setPosition(d.begin());
+    const Position begin = inv ? mapper.map(d.begin()) : d.begin();
+
+    c.setPosition(begin);
 
-    if(d.kind == TextDiff::Removal || (d.kind == TextDiff::Insertion && inv))
+    if (d.kind == TextDiff::Removal && !inv)
       c.setPosition(d.end(), TextCursor::KeepAnchor);
+    else if (d.kind == TextDiff::Insertion && inv)
+      c.setPosition(TextRange::end(begin, d.text()), TextCursor::KeepAnchor);
 
     cursors.push_back(c);
+
+    if (inv)
+      mapper.advance(d, begin);
   }
 
   // Apply diff
@@ -484,8 +826,225 @@ void TextDocumentImpl::apply(const TextDiff& diff, bool inv)
   this->cursors_are_ghosts = false;
 }
 
+/*
+ * Applies the diffs in a single pass over the blocks.
+ * The lines touched by a group of consecutive edits are rebuilt in place, 
+ * cursors are mapped once and listeners receive a single blocksReplaced().
+ */
+void TextDocumentImpl::apply_batch(const std::vector<TextDiff::Diff>& diffs)
+{
+  TYPEWRITER_SCOPED_TIMER("document.applyBatch");
+
+  std::vector<BatchEdit> edits = make_batch_edits(diffs);
+
+  // updating the snapshot tree line by line is slower than rebuilding it 
+  // when most of the lines are modified
+  const bool update_snapshots = this->snapshots.isActive() && edits.size() < static_cast<size_t>(this->lineCount) / 16;
+
+  const int first_line = edits.front().begin.line;
+  TextBlockImpl* first_block = nullptr;
+
+  TextBlockImpl* block = this->firstBlock.get();
+  int line = 0; // line of 'block' in the original document
+  int line_delta = 0;
+  std::string text;
+  size_t i = 0;
+
+  while (i < edits.size())
+  {
+    for (; line < edits[i].begin.line; ++line)
+      block = block->next.get();
+
+    TextBlockImpl* const first = block;
+    const int old_begin = line;
+    const int new_begin = line + line_delta;
+    size_t old_bytes = 0;
+
+    if (!first_block)
+      first_block = first;
+
+    // the new text of the lines, and the position reached in it
+    text.assign(block->content(), 0, block->byteOffset(edits[i].begin.column));
+    int out_line = new_begin;
+    int out_column = 0;
+    size_t counted = 0;
+
+    auto count_columns = [&]() {
+      const char* lf;
+
+      while ((lf = static_cast<const char*>(std::memchr(text.data() + counted, '\n', text.size() - counted))) != nullptr)
+      {
+        out_line += 1;
+        out_column = 0;
+        counted = lf - text.data() + 1;
+      }
+
+      out_column += static_cast<int>(utf8::count_codepoints(text.data() + counted, text.size() - counted));
+      counted = text.size();
+    };
+
+    // edits on the same line are grouped
+    for (;;)
+    {
+      BatchEdit& e = edits[i];
+      text += *e.text;
+      count_columns();
+      e.mapped_end = Position{ out_line, out_column };
+
+      for (; line < e.end.line; ++line)
+      {
+        old_bytes += block->content().size() + 1;
+        block = block->next.get();
+      }
+
+      const size_t offset = block->byteOffset(e.end.column);
+
+      if (++i < edits.size() && edits[i].begin.line == line)
+      {
+        text.append(block->content(), offset, block->byteOffset(edits[i].begin.column) - offset);
+        count_columns();
+      }
+      else
+      {
+        text.append(block->content(), offset, std::string::npos);
+        old_bytes += block->content().size() + 1;
+        break;
+      }
+    }
+
+    const int old_count = line - old_begin + 1;
+
+    // rewrites the blocks of the group, inserting new ones if needed
+    TextBlockImpl* current = first;
+    TextBlockImpl* prev = nullptr;
+    int new_count = 0;
+    size_t start = 0;
+
+    for (;;)
+    {
+      const size_t lf = text.find('\n', start);
+      const size_t len = (lf == std::string::npos ? text.size() : lf) - start;
+
+      if (new_count < old_count)
+      {
+        current->edit().assign(text, start, len);
+        current->contentChanged();
+        prev = current;
+        current = current->next.get();
+
+        if (update_snapshots)
+          this->snapshots.setLine(new_begin + new_count, prev->sharedContent());
+      }
+      else
+      {
+        TextBlockImpl* newblock = new TextBlockImpl{ text.substr(start, len) };
+        newblock->id = idgen++;
+        newblock->previous = prev;
+        newblock->next = prev->next;
+
+        if (prev->next.isNull())
+          this->lastBlock = newblock;
+        else
+          prev->next.get()->previous = newblock;
+
+        prev->next = newblock;
+        prev = newblock;
+
+        if (update_snapshots)
+          this->snapshots.insertLine(new_begin + new_count, prev->sharedContent());
+      }
+
+      ++new_count;
+
+      if (lf == std::string::npos)
+        break;
+
+      start = lf + 1;
+    }
+
+    // removes the blocks that were not reused
+    if (new_count < old_count)
+    {
+      TextBlockRef removed{ current };
+      TextBlockRef after = block->next;
+      prev->next = after;
+
+      if (after.isNull())
+        this->lastBlock = prev;
+      else
+        after.get()->previous = prev;
+
+      for (int k(new_count); k < old_count; ++k)
+      {
+        // unlinking both ends avoids a recursive destruction of the removed blocks
+        TextBlockRef next = removed.get()->next;
+        removed.get()->previous = nullptr;
+        removed.get()->next = nullptr;
+        removed.get()->setGarbage();
+        removed = next;
+      }
+
+      if (update_snapshots)
+        this->snapshots.removeLines(new_begin + new_count, old_count - new_count);
+    }
+
+    this->byteCount = this->byteCount + text.size() + 1 - old_bytes;
+    line_delta += new_count - old_count;
+    block = prev;
+  }
+
+  const int count = line - first_line + 1;
+  this->lineCount += line_delta;
+
+  if (this->snapshots.isActive() && !update_snapshots)
+    this->snapshots.build(this->firstBlock.get());
+
+  // update cursors
+  TYPEWRITER_COUNT("document.cursorUpdates", this->cursors.size());
+
+  std::vector<TextCursor*> moved;
+
+  for (TextCursor* c : this->cursors)
+  {
+    c->m_pos = map_position(edits, c->m_pos);
+    c->m_anchor = map_position(edits, c->m_anchor);
+
+    if (c->m_pos.line >= first_line)
+      moved.push_back(c);
+  }
+
+  std::sort(moved.begin(), moved.end(), [](const TextCursor* a, const TextCursor* b) {
+    return a->m_pos.line < b->m_pos.line;
+    });
+
+  block = first_block;
+  line = first_line;
+
+  for (TextCursor* c : moved)
+  {
+    for (; line < c->m_pos.line; ++line)
+      block = block->next.get();
+
+    c->m_block = TextBlock{ this->document, block };
+  }
+
+  TYPEWRITER_SCOPED_TIMER("document.notify");
+
+  for (const auto& l : listeners)
+  {
+    l->blocksReplaced(first_line, count, count + line_delta);
+
+    if (line_delta != 0)
+      l->blockCountChanged(this->lineCount);
+
+    l->contentsChanged();
+  }
+}
+
 void TextDocumentImpl::revert(const TextDiff& diff)
 {
+  TYPEWRITER_SCOPED_TIMER("document.revert");
+
   apply(diff, true);
 }
 
@@ -530,6 +1089,21 @@ void TextDocumentListener::contentsChanged()
 
 }
 
+void TextDocumentListener::blocksAppended(int line, int count)
+{
+
+}
+
+void TextDocumentListener::blocksDiscarded(int count)
+{
+
+}
+
+void TextDocumentListener::blocksReplaced(int line, int count, int newCount)
+{
+
+}
+
 
 TextDocument::TextDocument()
   : d(new TextDocumentImpl(this))
@@ -557,29 +1131,16 @@ const std::string& TextDocument::text(int line) const
 
 std::string TextDocument::toString() const
 {
-  size_t total_length = 0;
-
-  auto it = firstBlock();
-  do
-  {
-    total_length += it.text().length() + 1;
-    it = it.next();
-  } while (it.isValid());
-
   std::string result;
-  result.reserve(total_length);
+  result.reserve(d->byteCount);
 
-  it = firstBlock();
-  do
+  for (const TextBlockRange::Item& b : blocks())
   {
-    result.insert(result.end(), it.text().begin(), it.text().end());
-    result.push_back('\n');
-    it = it.next();
-  } while (it.isValid());
+    if (b.line > 0)
+      result.push_back('\n');
 
-
-  if(!result.empty())
-   result.pop_back();
+    result.append(b.text());
+  }
 
   return result;
 }
@@ -609,22 +1170,84 @@ TextBlock TextDocument::findBlockByNumber(int num) const
   return TextBlock{ this, it };
 }
 
+/*!
+ * \fn TextSnapshot snapshot() const
+ * \brief returns an immutable version of the document
+ *
+ * The first call indexes the lines of the document; afterwards taking a snapshot
+ * is O(1) and edits only copy the lines they touch.
+ */
+TextSnapshot TextDocument::snapshot() const
+{
+  if (!d->snapshots.isActive())
+    d->snapshots.build(d->firstBlock.get());
+
+  return d->snapshots.snapshot();
+}
+
+/*!
+ * \fn TextBlockRange blocks(int from, int to) const
+ * \brief returns the blocks from line 'from' to line 'to' (excluded)
+ *
+ * If 'to' is negative, the range extends to the end of the document.
+ */
+TextBlockRange TextDocument::blocks(int from, int to) const
+{
+  TextBlockImpl* it = d->firstBlock.get();
+  size_t offset = 0;
+  int line = 0;
+
+  while (it != nullptr && line < from)
+  {
+    offset += it->content().size() + 1;
+    it = it->next.get();
+    ++line;
+  }
+
+  TextBlockRange::iterator begin{ TextBlockView{ this, it }, line, offset };
+
+  if (to < 0)
+    return TextBlockRange{ begin, TextBlockRange::iterator() };
+
+  while (it != nullptr && line < to)
+  {
+    it = it->next.get();
+    ++line;
+  }
+
+  return TextBlockRange{ begin, TextBlockRange::iterator{ TextBlockView{ this, it }, line, 0 } };
+}
+
+/*!
+ * \fn int availableUndoSteps() const
+ * \brief returns the number of edits made through the document that can be undone
+ *
+ * These are the edits of apply(), reload() and of the functions taking the 
+ * document instead of a cursor; the edits of the cursors are undone with 
+ * TextCursor::undo().
+ */
 int TextDocument::availableUndoSteps() const
 {
-  return 0;
+  return static_cast<int>(d->history.undoCount(Author()));
 }
 
 int TextDocument::availableRedoSteps() const
 {
-  return 0;
+  return static_cast<int>(d->history.redoCount(Author()));
 }
 
+/*!
+ * \fn void undo()
+ * \brief undoes the last edit made through the document
+ *
+ * The edits of the cursors made since then are preserved.
+ */
 void TextDocument::undo()
 {
   if (!isUndoAvailable())
     return;
 
-  throw std::runtime_error{ "Not implemented" };
+  d->undo(Author());
 }
 
 void TextDocument::redo()
@@ -632,7 +1255,140 @@ void TextDocument::redo()
   if (!isRedoAvailable())
     return;
 
-  throw std::runtime_error{ "Not implemented" };
+  d->redo(Author());
+}
+
+const UndoPolicy& TextDocument::undoPolicy() const
+{
+  return d->history.policy();
+}
+
+void TextDocument::setUndoPolicy(const UndoPolicy& policy)
+{
+  d->history.setPolicy(policy);
+}
+
+/*!
+ * \fn void apply(const TextDiff& diff)
+ * \brief applies a diff to the document
+ *
+ * The edit can be undone with undo().
+ */
+void TextDocument::apply(const TextDiff& diff)
+{
+  if (d->transaction.is_active())
+    throw std::runtime_error{ "Cannot apply a diff during a transaction" };
+
+  if (diff.diffs().empty())
+    return;
+
+  d->apply(diff);
+
+  Contribution contrib;
+  contrib.delta = diff;
+  d->history.push(std::move(contrib));
+}
+
+/*!
+ * \fn void reload(const std::string& text)
+ * \brief replaces the text of the document, only patching the lines that changed
+ *
+ * The blocks and the cursors of the unchanged lines are preserved and the 
+ * edit can be undone with undo().
+ */
+void TextDocument::reload(const std::string& text)
+{
+  apply(diff::compute(*this, text));
+}
+
+/*!
+ * \fn void append(const std::string& text)
+ * \brief appends text at the end of the document
+ *
+ * Appending is not recorded in the undo history and the cursors are not moved.
+ * Listeners receive a single blocksAppended() notification.
+ */
+void TextDocument::append(const std::string& text)
+{
+  d->append(text.data(), text.data() + text.size());
+}
+
+/*!
+ * \fn bool isLoading() const
+ * \brief returns whether a TextDocumentLoader is appending to the document
+ */
+bool TextDocument::isLoading() const
+{
+  return d->loader != nullptr;
+}
+
+int TextDocument::maximumBlockCount() const
+{
+  return d->maximumBlockCount;
+}
+
+/*!
+ * \fn void setMaximumBlockCount(int n)
+ * \brief limits the number of blocks of the document
+ *
+ * When text is appended with append(), the oldest blocks are dropped so that 
+ * the document has no more than 'n' blocks; this also clears the undo history.
+ * A value of 0 means no limit.
+ */
+void TextDocument::setMaximumBlockCount(int n)
+{
+  d->maximumBlockCount = std::max(n, 0);
+
+  if (d->maximumBlockCount > 0 && d->lineCount > d->maximumBlockCount)
+  {
+    if (d->transaction.is_active())
+      throw std::runtime_error{ "Cannot discard blocks during a transaction" };
+
+    d->discard_blocks(d->lineCount - d->maximumBlockCount);
+  }
+}
+
+DocumentMemoryUsage TextDocument::memoryUsage() const
+{
+  DocumentMemoryUsage result;
+
+  result.document = sizeof(TextDocument) + sizeof(TextDocumentImpl)
+    + memory::heap_size(d->cursors) + memory::heap_size(d->listeners);
+
+  for (const TextBlockImpl* it = d->firstBlock.get(); it != nullptr; it = it->next.get())
+  {
+    result.blocks += sizeof(TextBlockImpl);
+    result.text += memory::heap_size(it->content());
+    result.column_indexes += it->columnIndexMemoryUsage();
+  }
+
+  result.snapshots = d->snapshots.memoryUsage();
+  result.undo = d->history.memoryUsageDetails();
+
+  return result;
+}
+
+/*!
+ * \fn void shrink()
+ * \brief releases the memory that is not needed by the document
+ *
+ * The capacity of the blocks is trimmed to their content and the snapshot tree 
+ * is dropped; it is rebuilt by the next call to snapshot(), existing snapshots 
+ * remain valid.
+ * This is mostly useful after large deletions.
+ */
+void TextDocument::shrink()
+{
+  TYPEWRITER_SCOPED_TIMER("document.shrink");
+
+  d->snapshots.reset();
+
+  for (TextBlockImpl* it = d->firstBlock.get(); it != nullptr; it = it->next.get())
+    it->shrink();
+
+  d->history.shrink();
+  d->cursors.shrink_to_fit();
+  d->listeners.shrink_to_fit();
 }
 
 void TextDocument::updatePositionOnInsert(Position & pos, const Position & insertpos, const TextBlock & newblock)
@@ -701,4 +1457,9 @@ int TextDocument::lineCount() const
   return d->lineCount;
 }
 
+size_t TextDocument::size() const
+{
+  return d->byteCount;
+}
+
 } // namespace typewriter
@@ -0,0 +1,159 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/textdocumentloader.h"
+
+#include "typewriter/textdocument.h"
+#include "typewriter/private/textdocument_p.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace typewriter
+{
+
+TextDocumentLoader::TextDocumentLoader(TextDocument* document)
+  : m_document(document)
+{
+  if (document->impl()->loader != nullptr)
+    throw std::runtime_error{ "The document is already being loaded" };
+
+  document->impl()->loader = this;
+}
+
+TextDocumentLoader::TextDocumentLoader(TextDocument* document, std::istream& input)
+  : TextDocumentLoader(document)
+{
+  m_input = &input;
+}
+
+TextDocumentLoader::~TextDocumentLoader()
+{
+  if (isFinished())
+    return;
+
+  try
+  {
+    finish();
+  }
+  catch (...)
+  {
+    m_document->impl()->loader = nullptr;
+  }
+}
+
+void TextDocumentLoader::setChunkSize(size_t n)
+{
+  m_chunk_size = n > 0 ? n : 1;
+}
+
+void TextDocumentLoader::feed(const char* data, size_t size)
+{
+  if (isFinished())
+    throw std::runtime_error{ "Loading is finished" };
+
+  std::string text;
+  text.reserve(m_pending.size() + size);
+  text.append(m_pending);
+  text.append(data, size);
+
+  size_t cut = text.size();
+
+  if (cut > 0 && text[cut - 1] == '\r')
+  {
+    // may be the first half of a CRLF
+    cut -= 1;
+  }
+  else
+  {
+    // holds back an incomplete UTF-8 sequence
+    size_t i = cut;
+    int continuation_bytes = 0;
+
+    while (i > 0 && continuation_bytes < 3 && (static_cast<unsigned char>(text[i - 1]) & 0xC0) == 0x80)
+    {
+      --i;
+      ++continuation_bytes;
+    }
+
+    if (i > 0)
+    {
+      const unsigned char lead = static_cast<unsigned char>(text[i - 1]);
+      const int len = lead >= 0xF0 ? 4 : (lead >= 0xE0 ? 3 : (lead >= 0xC0 ? 2 : 1));
+
+      if (len > continuation_bytes + 1)
+        cut = i - 1;
+    }
+  }
+
+  m_pending.assign(text, cut, std::string::npos);
+
+  if (std::memchr(text.data(), '\r', cut) != nullptr)
+  {
+    size_t w = 0;
+
+    for (size_t r(0); r < cut; ++r)
+    {
+      if (text[r] == '\r' && r + 1 < cut && text[r + 1] == '\n')
+        continue;
+
+      text[w++] = text[r];
+    }
+
+    cut = w;
+  }
+
+  m_document->impl()->append(text.data(), text.data() + cut);
+}
+
+void TextDocumentLoader::feed(const std::string& data)
+{
+  feed(data.data(), data.size());
+}
+
+/*!
+ * \fn bool loadChunk()
+ * \brief reads and appends the next chunk of the input stream
+ *
+ * Returns false once the end of the stream is reached, in which case
+ * the loading is finished.
+ */
+bool TextDocumentLoader::loadChunk()
+{
+  if (isFinished() || m_input == nullptr)
+    return false;
+
+  m_buffer.resize(m_chunk_size);
+  m_input->read(m_buffer.data(), m_buffer.size());
+
+  const std::streamsize n = m_input->gcount();
+
+  if (n > 0)
+    feed(m_buffer.data(), static_cast<size_t>(n));
+
+  if (!*m_input)
+  {
+    finish();
+    return false;
+  }
+
+  return true;
+}
+
+void TextDocumentLoader::finish()
+{
+  if (isFinished())
+    return;
+
+  TextDocument* document = m_document;
+
+  document->impl()->append(m_pending.data(), m_pending.data() + m_pending.size());
+  m_pending.clear();
+
+  document->impl()->loader = nullptr;
+  m_document = nullptr;
+  m_buffer = std::vector<char>();
+}
+
+} // namespace typewriter
@@ -0,0 +1,844 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/textsearch.h"
+
+#include "typewriter/textblock.h"
+#include "typewriter/textcursor.h"
+#include "typewriter/textdiff.h"
+#include "typewriter/textdocument.h"
+#include "typewriter/textsearchindex.h"
+#include "typewriter/textsnapshot.h"
+#include "typewriter/private/regex_p.h"
+#include "typewriter/private/textdocument_p.h"
+
+#include "typewriter/utils/instrumentation.h"
+#include "typewriter/utils/utf8.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace typewriter
+{
+
+namespace
+{
+
+inline char to_lower(char c)
+{
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool is_regex_literal(const std::string& pattern)
+{
+  return pattern.find_first_of(".^$|()[]{}*+?\\") == std::string::npos;
+}
+
+size_t next_codepoint(const std::string& text, size_t offset)
+{
+  do
+  {
+    ++offset;
+  } while (offset < text.size() && (static_cast<unsigned char>(text[offset]) & 0xC0) == 0x80);
+
+  return offset;
+}
+
+// converts increasing byte offsets of a line to columns
+class ColumnCounter
+{
+public:
+  explicit ColumnCounter(const std::string& text)
+    : m_text(text)
+  {
+
+  }
+
+  int operator()(size_t offset)
+  {
+    if (offset < m_offset)
+    {
+      m_offset = 0;
+      m_column = 0;
+    }
+
+    m_column += static_cast<int>(utf8::count_codepoints(m_text.data() + m_offset, offset - m_offset));
+    m_offset = offset;
+    return m_column;
+  }
+
+private:
+  const std::string& m_text;
+  size_t m_offset = 0;
+  int m_column = 0;
+};
+
+/*
+ * Calls emit(match, end) for the matches beginning on the line at 'it'
+ * at or after the byte offset 'from', 'end' being the byte offset of the end
+ * of the match in its last line.
+ * Returns false if emit() returned false.
+ */
+template<typename Iterator, typename F>
+bool search_line(const TextSearcher& searcher, Iterator it, Iterator end, int line, size_t from, F&& emit)
+{
+  const std::string& text = *it;
+  ColumnCounter columns{ text };
+
+  if (!searcher.isMultiline())
+  {
+    size_t b, e;
+
+    while (from <= text.size() && searcher.findInLine(text, from, b, e))
+    {
+      const int begin_column = columns(b);
+
+      if (!emit(SearchMatch(Position(line, begin_column), Position(line, columns(e))), e))
+        return false;
+
+      if (e > b)
+        from = e;
+      else if (b < text.size())
+        from = next_codepoint(text, b);
+      else
+        break;
+    }
+
+    return true;
+  }
+
+  std::vector<const std::string*> lines;
+
+  for (Iterator i = it; lines.size() < searcher.lineCount() && i != end; ++i)
+    lines.push_back(&(*i));
+
+  size_t b, e;
+
+  if (lines.size() < searcher.lineCount() || !searcher.matchesLines(lines, b, e) || b < from)
+    return true;
+
+  const int last = line + static_cast<int>(lines.size()) - 1;
+  const int end_column = static_cast<int>(utf8::count_codepoints(lines.back()->data(), e));
+  return emit(SearchMatch(Position(line, columns(b)), Position(last, end_column)), e);
+}
+
+/*
+ * Calls emit(match, end) for the matches beginning on the lines in [begin, stop),
+ * 'line' being the number of the line at 'begin'.
+ * Multiline matches may extend up to 'end'.
+ */
+template<typename Iterator, typename Cancelled, typename F>
+void search_lines(const TextSearcher& searcher, Iterator begin, Iterator stop, Iterator end, int line, Cancelled&& cancelled, F&& emit)
+{
+  // a multiline match may end on the line where the next match begins
+  int resume_line = -1;
+  size_t resume_offset = 0;
+
+  for (Iterator it = begin; it != stop && !cancelled(); ++it, ++line)
+  {
+    // the line is inside the previous match
+    if (line < resume_line)
+      continue;
+
+    const size_t from = line == resume_line ? resume_offset : 0;
+
+    search_line(searcher, it, end, line, from, [&](const SearchMatch& m, size_t e) -> bool {
+      emit(m, e);
+      resume_line = m.end.line;
+      resume_offset = e;
+      return true;
+      });
+  }
+}
+
+template<typename Iterator, typename Cancelled, typename F>
+void search_all(const TextSearcher& searcher, Iterator begin, Iterator end, Cancelled&& cancelled, F&& emit)
+{
+  search_lines(searcher, begin, end, end, 0, std::forward<Cancelled>(cancelled), std::forward<F>(emit));
+}
+
+// the matches found in a range of lines, with the byte offsets of their ends
+struct ChunkMatches
+{
+  std::vector<SearchMatch> matches;
+  std::vector<size_t> ends;
+
+  void push_back(const SearchMatch& m, size_t e)
+  {
+    matches.push_back(m);
+    ends.push_back(e);
+  }
+};
+
+/*
+ * Appends to 'result' the matches of the lines in [begin, stop), which were
+ * searched independently of the previous lines; 'line' is the number of the
+ * line at 'begin'.
+ * If the last match of 'result' extends into these lines, they are searched
+ * again after its end until both searches are past their last match.
+ */
+template<typename Iterator>
+void merge_chunk(const TextSearcher& searcher, Iterator begin, Iterator stop, Iterator end, int line, const ChunkMatches& chunk, ChunkMatches& result)
+{
+  size_t k = 0;
+
+  if (!result.matches.empty() && result.matches.back().end.line >= line)
+  {
+    int resume_line = result.matches.back().end.line;
+    size_t resume_offset = result.ends.back();
+    bool synchronized = false;
+
+    for (Iterator it = begin; it != stop; ++it, ++line)
+    {
+      while (k < chunk.matches.size() && chunk.matches[k].begin.line < line)
+        ++k;
+
+      if (resume_line < line && (k == 0 || chunk.matches[k - 1].end.line < line))
+      {
+        synchronized = true;
+        break;
+      }
+
+      if (line < resume_line)
+        continue;
+
+      search_line(searcher, it, end, line, line == resume_line ? resume_offset : 0, [&](const SearchMatch& m, size_t e) -> bool {
+        result.push_back(m, e);
+        resume_line = m.end.line;
+        resume_offset = e;
+        return true;
+        });
+    }
+
+    // the matches of the chunk were all replaced
+    if (!synchronized)
+      return;
+  }
+
+  for (; k < chunk.matches.size(); ++k)
+    result.push_back(chunk.matches[k], chunk.ends[k]);
+}
+
+// minimum number of bytes searched by each thread of find_all()
+const size_t ParallelSearchMinBytes = 256 * 1024;
+
+/*
+ * Finds all the matches, the lines being split into chunks of similar sizes 
+ * searched by different threads.
+ */
+template<typename Iterator>
+std::vector<SearchMatch> find_all(const TextSearcher& searcher, Iterator begin, Iterator end, size_t bytes)
+{
+  std::vector<SearchMatch> result;
+
+  auto never = []() { return false; };
+
+  const size_t cores = searcher.options().threads > 0 ? searcher.options().threads : std::max(std::thread::hardware_concurrency(), 1u);
+  const size_t threads = std::min(cores, bytes / ParallelSearchMinBytes);
+
+  if (threads <= 1)
+  {
+    search_all(searcher, begin, end, never, [&result](const SearchMatch& m, size_t) {
+      result.push_back(m);
+      });
+
+    return result;
+  }
+
+  struct Chunk
+  {
+    Iterator begin;
+    int line;
+    ChunkMatches found;
+
+    Chunk(Iterator it, int l)
+      : begin(it), line(l)
+    {
+
+    }
+  };
+
+  std::vector<Chunk> chunks;
+  chunks.emplace_back(begin, 0);
+
+  const size_t chunk_size = bytes / threads + 1;
+  size_t chunk_bytes = 0;
+  int line = 0;
+
+  for (Iterator it = begin; it != end; ++it, ++line)
+  {
+    if (chunk_bytes >= chunk_size)
+    {
+      chunks.emplace_back(it, line);
+      chunk_bytes = 0;
+    }
+
+    chunk_bytes += (*it).size() + 1;
+  }
+
+  auto chunk_end = [&chunks, &end](size_t k) {
+    return k + 1 < chunks.size() ? chunks[k + 1].begin : end;
+  };
+
+  // the DFA of a searcher cannot be shared, the calling thread uses the original
+  auto search_chunk = [&](size_t k, const TextSearcher& s) {
+    Chunk& c = chunks[k];
+
+    search_lines(s, c.begin, chunk_end(k), end, c.line, never, [&c](const SearchMatch& m, size_t e) {
+      c.found.push_back(m, e);
+      });
+  };
+
+  std::vector<std::thread> workers;
+
+  for (size_t k(1); k < chunks.size(); ++k)
+  {
+    workers.emplace_back([&search_chunk, &searcher, k]() {
+      TextSearcher copy{ searcher };
+      search_chunk(k, copy);
+      });
+  }
+
+  search_chunk(0, searcher);
+
+  for (std::thread& t : workers)
+    t.join();
+
+  size_t count = 0;
+
+  for (const Chunk& c : chunks)
+    count += c.found.matches.size();
+
+  ChunkMatches merged;
+  merged.matches.reserve(count);
+  merged.ends.reserve(count);
+
+  // a multiline match may span the beginning of the next chunk
+  for (size_t k(0); k < chunks.size(); ++k)
+    merge_chunk(searcher, chunks[k].begin, chunk_end(k), end, chunks[k].line, chunks[k].found, merged);
+
+  return std::move(merged.matches);
+}
+
+SearchMatch first_match(const TextSearcher& searcher, BlockLines it, int line, size_t from)
+{
+  SearchMatch result;
+
+  search_line(searcher, it, BlockLines{ nullptr }, line, from, [&result](const SearchMatch& m, size_t) -> bool {
+    result = m;
+    return false;
+    });
+
+  return result;
+}
+
+// the last match beginning before 'before' on the line
+SearchMatch last_match(const TextSearcher& searcher, BlockLines it, int line, const Position& before)
+{
+  SearchMatch result;
+
+  search_line(searcher, it, BlockLines{ nullptr }, line, 0, [&result, &before](const SearchMatch& m, size_t) -> bool {
+    if (m.begin >= before)
+      return false;
+
+    result = m;
+    return true;
+    });
+
+  return result;
+}
+
+size_t replace_all(TextDocument& document, const TextSearcher& searcher, const std::string& replacement, Author author)
+{
+  TYPEWRITER_SCOPED_TIMER("search.replaceAll");
+
+  TextDocumentImpl* d = document.impl();
+
+  if (d->transaction.is_active())
+    throw std::runtime_error{ "Cannot replace text during a transaction" };
+
+  const std::vector<SearchMatch> matches = findAll(document, searcher);
+
+  if (matches.empty())
+    return 0;
+
+  TextDiff delta;
+  std::string removed;
+  const TextBlockImpl* block = d->firstBlock.get();
+  int line = 0;
+  size_t count = 0;
+  Position previous_end;
+
+  for (const SearchMatch& m : matches)
+  {
+    // the changes of a diff cannot overlap
+    if (m.begin < previous_end)
+      continue;
+
+    previous_end = m.end;
+
+    for (; line < m.begin.line; ++line)
+      block = block->next.get();
+
+    const size_t offset = block->byteOffset(m.begin.column);
+
+    if (m.end.line == m.begin.line)
+    {
+      removed.assign(block->content(), offset, block->byteOffset(m.end.column) - offset);
+    }
+    else
+    {
+      const TextBlockImpl* it = block;
+      removed.assign(block->content(), offset, std::string::npos);
+
+      for (int l(m.begin.line + 1); l < m.end.line; ++l)
+      {
+        it = it->next.get();
+        removed += '\n';
+        removed += it->content();
+      }
+
+      it = it->next.get();
+      removed += '\n';
+      removed.append(it->content(), 0, it->byteOffset(m.end.column));
+    }
+
+    delta.append(diff::remove(m.begin, removed));
+    delta.append(diff::insert(m.end, replacement));
+    ++count;
+  }
+
+  // large diffs are applied in a single pass by TextDocumentImpl::apply()
+  d->apply(delta);
+
+  Contribution contrib;
+  contrib.author = author;
+  contrib.delta = std::move(delta);
+  d->history.push(std::move(contrib));
+
+  return count;
+}
+
+} // namespace
+
+TextSearcher::TextSearcher(const std::string& pattern, const SearchOptions& options)
+  : m_pattern(pattern),
+    m_options(options)
+{
+  if (options.regex && !is_regex_literal(pattern))
+  {
+    m_dfa.reset(new regex::Dfa(regex::Program::compile(pattern, options.case_sensitive)));
+    m_lines.push_back(pattern);
+    return;
+  }
+
+  size_t start = 0;
+
+  for (;;)
+  {
+    const size_t lf = pattern.find('\n', start);
+    m_lines.push_back(pattern.substr(start, lf == std::string::npos ? std::string::npos : lf - start));
+
+    if (lf == std::string::npos)
+      break;
+
+    start = lf + 1;
+  }
+
+  if (!options.case_sensitive)
+  {
+    for (std::string& l : m_lines)
+      std::transform(l.begin(), l.end(), l.begin(), to_lower);
+  }
+}
+
+TextSearcher::TextSearcher(const TextSearcher& other)
+  : m_pattern(other.m_pattern),
+    m_options(other.m_options),
+    m_lines(other.m_lines)
+{
+  if (other.m_dfa)
+    m_dfa.reset(new regex::Dfa(*other.m_dfa));
+}
+
+TextSearcher::~TextSearcher()
+{
+
+}
+
+/*!
+ * \fn bool findInLine(const std::string& line, size_t from, size_t& begin, size_t& end) const
+ * \brief finds the first match beginning at or after 'from' in a line
+ *
+ * Empty literals never match; multiline patterns never match within a line.
+ */
+bool TextSearcher::findInLine(const std::string& line, size_t from, size_t& begin, size_t& end) const
+{
+  if (m_dfa)
+    return m_dfa->find(line.data(), line.size(), from, begin, end);
+
+  if (isMultiline() || m_lines.front().empty())
+    return false;
+
+  const std::string& needle = m_lines.front();
+
+  if (!find_literal(needle, line.data(), line.size(), from, begin))
+    return false;
+
+  end = begin + needle.size();
+  return true;
+}
+
+bool TextSearcher::matchesLines(const std::vector<const std::string*>& lines, size_t& begin, size_t& end) const
+{
+  const std::string& first = *lines.front();
+  const std::string& last = *lines.back();
+
+  if (first.size() < m_lines.front().size() || last.size() < m_lines.back().size())
+    return false;
+
+  begin = first.size() - m_lines.front().size();
+
+  if (!equals(first.data() + begin, m_lines.front().data(), m_lines.front().size()))
+    return false;
+
+  for (size_t i(1); i + 1 < m_lines.size(); ++i)
+  {
+    if (lines.at(i)->size() != m_lines.at(i).size() || !equals(lines.at(i)->data(), m_lines.at(i).data(), m_lines.at(i).size()))
+      return false;
+  }
+
+  end = m_lines.back().size();
+  return equals(last.data(), m_lines.back().data(), end);
+}
+
+// the needle is lowercase if the search is case-insensitive
+bool TextSearcher::find_literal(const std::string& needle, const char* text, size_t size, size_t from, size_t& begin) const
+{
+  if (from > size || size - from < needle.size())
+    return false;
+
+  // last offset at which the needle fits
+  const char* const last = text + size - needle.size();
+  const char first = needle.front();
+  const bool fold = !m_options.case_sensitive && first >= 'a' && first <= 'z';
+
+  // memchr() is vectorized by the C library
+  const char* lower = static_cast<const char*>(std::memchr(text + from, first, last - (text + from) + 1));
+  const char* upper = fold ? static_cast<const char*>(std::memchr(text + from, first - 'a' + 'A', last - (text + from) + 1)) : nullptr;
+
+  while (lower || upper)
+  {
+    const char* candidate = (!upper || (lower && lower < upper)) ? lower : upper;
+
+    if (equals(candidate + 1, needle.data() + 1, needle.size() - 1))
+    {
+      begin = static_cast<size_t>(candidate - text);
+      return true;
+    }
+
+    if (candidate == lower)
+      lower = candidate == last ? nullptr : static_cast<const char*>(std::memchr(candidate + 1, first, last - candidate));
+    else
+      upper = candidate == last ? nullptr : static_cast<const char*>(std::memchr(candidate + 1, first - 'a' + 'A', last - candidate));
+  }
+
+  return false;
+}
+
+bool TextSearcher::equals(const char* a, const char* b, size_t size) const
+{
+  if (m_options.case_sensitive)
+    return std::memcmp(a, b, size) == 0;
+
+  for (size_t i(0); i < size; ++i)
+  {
+    if (to_lower(a[i]) != b[i])
+      return false;
+  }
+
+  return true;
+}
+
+/*!
+ * \fn std::vector<SearchMatch> findAll(const TextDocument& document, const TextSearcher& searcher)
+ * \brief returns all the matches, in document order
+ *
+ * Large documents are searched by several threads, see SearchOptions::threads.
+ */
+std::vector<SearchMatch> findAll(const TextDocument& document, const TextSearcher& searcher)
+{
+  TYPEWRITER_SCOPED_TIMER("search.findAll");
+
+  return find_all(searcher, BlockLines{ document.impl()->firstBlock.get() }, BlockLines{ nullptr }, document.size());
+}
+
+std::vector<SearchMatch> findAll(const TextSnapshot& snapshot, const TextSearcher& searcher)
+{
+  TYPEWRITER_SCOPED_TIMER("search.findAll");
+
+  return find_all(searcher, snapshot.begin(), snapshot.end(), snapshot.length());
+}
+
+/*!
+ * \fn std::vector<SearchMatch> findAll(TextSearchIndex& index, const TextSearcher& searcher)
+ * \brief returns all the matches, only scanning the lines selected by the index
+ */
+std::vector<SearchMatch> findAll(TextSearchIndex& index, const TextSearcher& searcher)
+{
+  TYPEWRITER_SCOPED_TIMER("search.findAllIndexed");
+
+  ChunkMatches result;
+  BlockLines it{ index.document()->impl()->firstBlock.get() };
+  int line = 0;
+
+  for (const TextSearchIndex::LineRange& r : index.candidates(searcher))
+  {
+    for (; line < r.begin; ++line)
+      ++it;
+
+    BlockLines stop = it;
+
+    for (; line < r.end; ++line)
+      ++stop;
+
+    ChunkMatches found;
+
+    search_lines(searcher, it, stop, BlockLines{ nullptr }, r.begin, []() { return false; }, [&found](const SearchMatch& m, size_t e) {
+      found.push_back(m, e);
+      });
+
+    // a multiline match may span the beginning of the range
+    merge_chunk(searcher, it, stop, BlockLines{ nullptr }, r.begin, found, result);
+
+    it = stop;
+  }
+
+  return std::move(result.matches);
+}
+
+/*!
+ * \fn size_t replaceAll(TextDocument& document, const TextSearcher& searcher, const std::string& replacement)
+ * \brief replaces all the matches with a text
+ *
+ * The replacement is inserted as is. All the replacements are applied 
+ * as a single diff, which is undone in one step.
+ * Returns the number of replacements.
+ */
+size_t replaceAll(TextDocument& document, const TextSearcher& searcher, const std::string& replacement)
+{
+  return replace_all(document, searcher, replacement, Author());
+}
+
+/*!
+ * \fn size_t replaceAll(TextCursor& cursor, const TextSearcher& searcher, const std::string& replacement)
+ * \brief replaces all the matches in the document of the cursor
+ *
+ * The edit is attributed to the cursor and can be undone with TextCursor::undo().
+ */
+size_t replaceAll(TextCursor& cursor, const TextSearcher& searcher, const std::string& replacement)
+{
+  return replace_all(*cursor.document(), searcher, replacement, Author(&cursor));
+}
+
+/*!
+ * \fn SearchMatch findNext(const TextDocument& document, const TextSearcher& searcher, const Position& from, bool wrap)
+ * \brief returns the first match beginning at or after 'from'
+ *
+ * If 'wrap' is true, the search continues from the beginning of the document.
+ * Returns a null match if nothing was found.
+ */
+SearchMatch findNext(const TextDocument& document, const TextSearcher& searcher, const Position& from, bool wrap)
+{
+  TYPEWRITER_SCOPED_TIMER("search.findNext");
+
+  const int startline = std::max(0, std::min(from.line, document.lineCount() - 1));
+  const TextBlock startblock = document.findBlockByNumber(startline);
+  size_t offset = 0;
+
+  if (from.line == startline)
+    offset = startblock.impl()->byteOffset(from.column);
+  else if (from.line > startline)
+    offset = startblock.impl()->content().size();
+
+  int line = startline;
+
+  for (BlockLines it{ startblock.impl() }; it != BlockLines{ nullptr }; ++it, ++line)
+  {
+    SearchMatch m = first_match(searcher, it, line, line == startline ? offset : 0);
+
+    if (!m.isNull())
+      return m;
+  }
+
+  if (!wrap)
+    return SearchMatch();
+
+  line = 0;
+
+  for (BlockLines it{ document.impl()->firstBlock.get() }; line <= startline; ++it, ++line)
+  {
+    SearchMatch m = first_match(searcher, it, line, 0);
+
+    if (!m.isNull())
+      return line < startline || m.begin < from ? m : SearchMatch();
+  }
+
+  return SearchMatch();
+}
+
+/*!
+ * \fn SearchMatch findPrevious(const TextDocument& document, const TextSearcher& searcher, const Position& from, bool wrap)
+ * \brief returns the last match beginning before 'from'
+ *
+ * If 'wrap' is true, the search continues from the end of the document.
+ * Returns a null match if nothing was found.
+ */
+SearchMatch findPrevious(const TextDocument& document, const TextSearcher& searcher, const Position& from, bool wrap)
+{
+  TYPEWRITER_SCOPED_TIMER("search.findPrevious");
+
+  const int startline = std::max(0, std::min(from.line, document.lineCount() - 1));
+  const TextBlockImpl* startblock = document.findBlockByNumber(startline).impl();
+  int line = startline;
+
+  for (const TextBlockImpl* b = startblock; b != nullptr; b = b->previous.get(), --line)
+  {
+    SearchMatch m = last_match(searcher, BlockLines{ b }, line, line == startline ? from : Position(line + 1, 0));
+
+    if (!m.isNull())
+      return m;
+  }
+
+  if (!wrap)
+    return SearchMatch();
+
+  line = document.lineCount() - 1;
+
+  for (const TextBlockImpl* b = document.impl()->lastBlock.get(); line >= startline; b = b->previous.get(), --line)
+  {
+    SearchMatch m = last_match(searcher, BlockLines{ b }, line, Position(line + 1, 0));
+
+    if (!m.isNull())
+      return line > startline || m.begin >= from ? m : SearchMatch();
+  }
+
+  return SearchMatch();
+}
+
+/*!
+ * \fn bool findNext(TextCursor& cursor, const TextSearcher& searcher, bool wrap)
+ * \brief selects the next match after the selection of the cursor
+ *
+ * An empty match at the position of the cursor is skipped, so that
+ * repeated calls move forward.
+ * Returns false if nothing was found, in which case the cursor is not moved.
+ */
+bool findNext(TextCursor& cursor, const TextSearcher& searcher, bool wrap)
+{
+  const TextDocument& document = *cursor.document();
+  Position from = cursor.selectionEnd();
+  SearchMatch m = findNext(document, searcher, from, wrap);
+
+  if (!m.isNull() && m.begin == m.end && m.begin == from)
+  {
+    if (from.column < cursor.block().length())
+      from.column += 1;
+    else if (from.line + 1 < document.lineCount())
+      from = Position(from.line + 1, 0);
+    else if (wrap)
+      from = Position(0, 0);
+    else
+      return false;
+
+    m = findNext(document, searcher, from, wrap);
+  }
+
+  if (m.isNull())
+    return false;
+
+  cursor.setPosition(m.begin);
+  cursor.setPosition(m.end, TextCursor::KeepAnchor);
+  return true;
+}
+
+/*!
+ * \fn bool findPrevious(TextCursor& cursor, const TextSearcher& searcher, bool wrap)
+ * \brief selects the previous match before the selection of the cursor
+ */
+bool findPrevious(TextCursor& cursor, const TextSearcher& searcher, bool wrap)
+{
+  SearchMatch m = findPrevious(*cursor.document(), searcher, cursor.selectionStart(), wrap);
+
+  if (m.isNull())
+    return false;
+
+  cursor.setPosition(m.begin);
+  cursor.setPosition(m.end, TextCursor::KeepAnchor);
+  return true;
+}
+
+std::future<std::vector<SearchMatch>> findAllAsync(const TextDocument& document, const TextSearcher& searcher)
+{
+  TextSnapshot snapshot = document.snapshot();
+  std::shared_ptr<TextSearcher> copy{ new TextSearcher(searcher) };
+
+  return std::async(std::launch::async, [snapshot, copy]() {
+    return findAll(snapshot, *copy);
+    });
+}
+
+SearchJob::SearchJob(const TextSnapshot& snapshot, const TextSearcher& searcher, Callback callback, size_t batchSize)
+{
+  std::shared_ptr<TextSearcher> copy{ new TextSearcher(searcher) };
+  batchSize = std::max<size_t>(batchSize, 1);
+
+  m_thread = std::thread([this, snapshot, copy, callback, batchSize]() {
+    std::vector<SearchMatch> batch;
+    batch.reserve(batchSize);
+
+    auto cancelled = [this]() -> bool {
+      return m_cancelled.load(std::memory_order_relaxed);
+    };
+
+    search_all(*copy, snapshot.begin(), snapshot.end(), cancelled, [&](const SearchMatch& m, size_t) {
+      batch.push_back(m);
+
+      if (batch.size() == batchSize && !cancelled())
+      {
+        m_count += batch.size();
+        callback(batch);
+        batch.clear();
+      }
+      });
+
+    if (!batch.empty() && !cancelled())
+    {
+      m_count += batch.size();
+      callback(batch);
+    }
+
+    m_finished = true;
+    });
+}
+
+SearchJob::~SearchJob()
+{
+  cancel();
+  wait();
+}
+
+void SearchJob::cancel()
+{
+  m_cancelled = true;
+}
+
+void SearchJob::wait()
+{
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+} // namespace typewriter
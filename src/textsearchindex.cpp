@@ -0,0 +1,421 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/textsearchindex.h"
+
+#include "typewriter/textsearch.h"
+#include "typewriter/textsnapshot.h"
+#include "typewriter/private/memoryusage_p.h"
+#include "typewriter/private/regex_p.h"
+#include "typewriter/private/textdocument_p.h"
+
+#include "typewriter/utils/instrumentation.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace typewriter
+{
+
+namespace
+{
+
+typedef TextSearchIndex::Chunk Chunk;
+
+const size_t MaxChunkWords = 16 * 1024; // 1M bits
+
+inline uint32_t fold(char c)
+{
+  return (c >= 'A' && c <= 'Z') ? static_cast<uint32_t>(c - 'A' + 'a') : static_cast<unsigned char>(c);
+}
+
+// each trigram sets two bits of the filter
+inline uint32_t first_hash(uint32_t trigram) { return trigram * 0x9E3779B1u; }
+inline uint32_t second_hash(uint32_t trigram) { return trigram * 0x85EBCA77u; }
+
+template<typename F>
+void for_each_trigram(const std::string& text, F&& f)
+{
+  if (text.size() < 3)
+    return;
+
+  uint32_t t = (fold(text[0]) << 8) | fold(text[1]);
+
+  for (size_t i(2); i < text.size(); ++i)
+  {
+    t = ((t << 8) | fold(text[i])) & 0xFFFFFF;
+    f(t);
+  }
+}
+
+// indexes the chunk.lines lines starting at 'it'
+template<typename Iterator>
+void index_chunk(Chunk& chunk, Iterator& it, double bits_per_byte)
+{
+  std::vector<const std::string*> lines;
+  lines.reserve(chunk.lines);
+  size_t bytes = 0;
+
+  for (int i(0); i < chunk.lines; ++i, ++it)
+  {
+    lines.push_back(&(*it));
+    bytes += lines.back()->size();
+  }
+
+  const size_t words = std::min(MaxChunkWords, static_cast<size_t>(bytes * bits_per_byte / 64) + 1);
+  chunk.bits.assign(words, 0);
+
+  const uint32_t nbits = static_cast<uint32_t>(words * 64);
+  uint64_t* bits = chunk.bits.data();
+
+  for (const std::string* l : lines)
+  {
+    for_each_trigram(*l, [bits, nbits](uint32_t t) {
+      const uint32_t a = first_hash(t) % nbits;
+      const uint32_t b = second_hash(t) % nbits;
+      bits[a / 64] |= uint64_t(1) << (a % 64);
+      bits[b / 64] |= uint64_t(1) << (b % 64);
+      });
+  }
+
+  chunk.dirty = false;
+}
+
+template<typename Iterator>
+std::vector<Chunk> build_chunks(Iterator begin, int line_count, double bits_per_byte)
+{
+  TYPEWRITER_SCOPED_TIMER("searchIndex.build");
+
+  std::vector<Chunk> chunks;
+  chunks.reserve(line_count / TextSearchIndex::ChunkLines + 1);
+
+  Iterator it = begin;
+
+  for (int line(0); line < line_count; line += TextSearchIndex::ChunkLines)
+  {
+    chunks.emplace_back(std::min(TextSearchIndex::ChunkLines, line_count - line));
+    index_chunk(chunks.back(), it, bits_per_byte);
+  }
+
+  return chunks;
+}
+
+bool may_contain(const Chunk& chunk, const std::vector<uint32_t>& trigrams)
+{
+  const uint32_t nbits = static_cast<uint32_t>(chunk.bits.size() * 64);
+  const uint64_t* bits = chunk.bits.data();
+
+  for (uint32_t t : trigrams)
+  {
+    const uint32_t a = first_hash(t) % nbits;
+    const uint32_t b = second_hash(t) % nbits;
+
+    if (!(bits[a / 64] & (uint64_t(1) << (a % 64))) || !(bits[b / 64] & (uint64_t(1) << (b % 64))))
+      return false;
+  }
+
+  return true;
+}
+
+// a text contained in the first line of every match
+std::string searched_literal(const TextSearcher& searcher)
+{
+  std::string literal = searcher.options().regex ? regex::required_literal(searcher.pattern()) : searcher.pattern();
+  return literal.substr(0, literal.find('\n'));
+}
+
+} // namespace
+
+const int TextSearchIndex::ChunkLines;
+
+TextSearchIndex::TextSearchIndex(TextDocument* document, size_t memoryBudget)
+  : m_budget(memoryBudget)
+{
+  document->addListener(this);
+
+  // the whole document is dirty until the first build
+  for (int line(0); line < document->lineCount(); line += ChunkLines)
+    m_chunks.emplace_back(std::min(ChunkLines, document->lineCount() - line));
+}
+
+TextSearchIndex::~TextSearchIndex()
+{
+  if (m_build.valid())
+    m_build.wait();
+
+  if (document())
+    document()->removeListener(this);
+}
+
+size_t TextSearchIndex::memoryBudget() const
+{
+  return m_budget;
+}
+
+/*!
+ * \fn void setMemoryBudget(size_t bytes)
+ * \brief sets the maximum size of the filters
+ *
+ * The new budget is used by the next rebuild.
+ */
+void TextSearchIndex::setMemoryBudget(size_t bytes)
+{
+  m_budget = bytes;
+}
+
+double TextSearchIndex::bits_per_byte() const
+{
+  const size_t size = std::max<size_t>(document()->size(), 1);
+  const size_t budget = m_budget > 0 ? m_budget : size / 4;
+  // the vectors of the chunks are part of the budget
+  const size_t overhead = m_chunks.size() * sizeof(Chunk);
+  return budget > overhead ? static_cast<double>(budget - overhead) * 8 / size : 0.;
+}
+
+void TextSearchIndex::rebuild()
+{
+  wait();
+
+  m_chunks = build_chunks(BlockLines{ document()->impl()->firstBlock.get() }, document()->lineCount(), bits_per_byte());
+  m_hint_chunk = 0;
+  m_hint_line = 0;
+}
+
+/*!
+ * \fn void rebuildAsync()
+ * \brief rebuilds the index from a snapshot of the document in a background thread
+ *
+ * The document may be modified in the meantime; the new index replaces the
+ * current one when wait() is called or at the first search that follows
+ * the end of the build.
+ */
+void TextSearchIndex::rebuildAsync()
+{
+  if (isBuilding())
+    return;
+
+  TextSnapshot snapshot = document()->snapshot();
+  const double bpb = bits_per_byte();
+
+  m_edits_during_build.clear();
+  m_build = std::async(std::launch::async, [snapshot, bpb]() {
+    return build_chunks(snapshot.begin(), snapshot.lineCount(), bpb);
+    });
+}
+
+bool TextSearchIndex::isBuilding() const
+{
+  return m_build.valid();
+}
+
+void TextSearchIndex::wait()
+{
+  if (m_build.valid())
+    install();
+}
+
+// replaces the index by the one built in the background
+void TextSearchIndex::install()
+{
+  m_chunks = m_build.get();
+  m_hint_chunk = 0;
+  m_hint_line = 0;
+
+  for (const Edit& e : m_edits_during_build)
+    replace_lines(e.line, e.count, e.new_count);
+
+  std::vector<Edit>().swap(m_edits_during_build);
+}
+
+/*!
+ * \fn void update()
+ * \brief indexes the dirty chunks
+ */
+void TextSearchIndex::update()
+{
+  TYPEWRITER_SCOPED_TIMER("searchIndex.update");
+
+  const double bpb = bits_per_byte();
+  BlockLines it{ document()->impl()->firstBlock.get() };
+
+  for (Chunk& c : m_chunks)
+  {
+    if (c.dirty)
+    {
+      index_chunk(c, it, bpb);
+    }
+    else
+    {
+      for (int i(0); i < c.lines; ++i)
+        ++it;
+    }
+  }
+}
+
+int TextSearchIndex::chunkCount() const
+{
+  return static_cast<int>(m_chunks.size());
+}
+
+int TextSearchIndex::dirtyChunkCount() const
+{
+  return static_cast<int>(std::count_if(m_chunks.begin(), m_chunks.end(), [](const Chunk& c) { return c.dirty; }));
+}
+
+size_t TextSearchIndex::memoryUsage() const
+{
+  size_t result = sizeof(TextSearchIndex) + memory::heap_size(m_chunks) + memory::heap_size(m_edits_during_build);
+
+  for (const Chunk& c : m_chunks)
+    result += memory::heap_size(c.bits);
+
+  return result;
+}
+
+/*!
+ * \fn std::vector<LineRange> candidates(const TextSearcher& searcher)
+ * \brief returns the ranges of lines in which a match may begin
+ *
+ * Ranges are sorted and do not overlap; dirty chunks are always included.
+ */
+std::vector<TextSearchIndex::LineRange> TextSearchIndex::candidates(const TextSearcher& searcher)
+{
+  if (m_build.valid() && m_build.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    install();
+
+  std::vector<uint32_t> trigrams;
+  for_each_trigram(searched_literal(searcher), [&trigrams](uint32_t t) {
+    trigrams.push_back(t);
+    });
+
+  std::vector<LineRange> result;
+  int line = 0;
+
+  for (const Chunk& c : m_chunks)
+  {
+    if (c.dirty || may_contain(c, trigrams))
+    {
+      if (!result.empty() && result.back().end == line)
+        result.back().end += c.lines;
+      else
+        result.emplace_back(line, line + c.lines);
+    }
+
+    line += c.lines;
+  }
+
+  return result;
+}
+
+void TextSearchIndex::blockInserted(const Position& pos, const TextBlock& newblock)
+{
+  replace_lines(pos.line, 1, 2);
+}
+
+void TextSearchIndex::blockDestroyed(int line, const TextBlock& block)
+{
+  replace_lines(line - 1, 2, 1);
+}
+
+void TextSearchIndex::contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded)
+{
+  replace_lines(pos.line, 1, 1);
+}
+
+void TextSearchIndex::blocksAppended(int line, int count)
+{
+  replace_lines(line, 1, count + 1);
+}
+
+void TextSearchIndex::blocksDiscarded(int count)
+{
+  replace_lines(0, count, 0);
+}
+
+void TextSearchIndex::blocksReplaced(int line, int count, int newCount)
+{
+  replace_lines(line, count, newCount);
+}
+
+// 'count' lines starting at 'line' were replaced by 'newCount' lines
+void TextSearchIndex::replace_lines(int line, int count, int newCount)
+{
+  if (m_build.valid())
+  {
+    Edit e;
+    e.line = line;
+    e.count = count;
+    e.new_count = newCount;
+    m_edits_during_build.push_back(e);
+  }
+
+  // locates the chunk, starting from the one of the previous edit
+  int c = m_hint_chunk;
+  int first = m_hint_line;
+
+  while (c > 0 && first > line)
+    first -= m_chunks[--c].lines;
+
+  while (c + 1 < static_cast<int>(m_chunks.size()) && first + m_chunks[c].lines <= line)
+    first += m_chunks[c++].lines;
+
+  // the removed lines may span several chunks, the new lines go to the first one
+  int last = c;
+  int offset = line - first;
+  int remaining = count;
+
+  for (; remaining > 0 && last < static_cast<int>(m_chunks.size()); ++last)
+  {
+    const int n = std::min(remaining, m_chunks[last].lines - offset);
+    m_chunks[last].lines -= n;
+    m_chunks[last].dirty = true;
+    remaining -= n;
+    offset = 0;
+  }
+
+  last = std::min(std::max(last, c + 1), static_cast<int>(m_chunks.size()));
+
+  m_chunks[c].lines += newCount;
+  m_chunks[c].dirty = true;
+
+  // chunks of the range that became empty are removed, large ones are split
+  std::vector<Chunk> range;
+
+  for (int i(c); i < last; ++i)
+  {
+    Chunk& chunk = m_chunks[i];
+
+    if (chunk.dirty)
+      std::vector<uint64_t>().swap(chunk.bits);
+
+    if (chunk.lines == 0)
+      continue;
+
+    if (chunk.lines <= 2 * ChunkLines)
+    {
+      range.push_back(std::move(chunk));
+      continue;
+    }
+
+    for (int n(chunk.lines); n > 0; n -= ChunkLines)
+      range.emplace_back(std::min(n, static_cast<int>(ChunkLines)));
+  }
+
+  if (range.empty() && m_chunks.size() == static_cast<size_t>(last - c))
+    range.emplace_back(1);
+
+  m_chunks.erase(m_chunks.begin() + c, m_chunks.begin() + last);
+  m_chunks.insert(m_chunks.begin() + c, std::make_move_iterator(range.begin()), std::make_move_iterator(range.end()));
+
+  if (c == static_cast<int>(m_chunks.size()))
+  {
+    c = 0;
+    first = 0;
+  }
+
+  m_hint_chunk = c;
+  m_hint_line = first;
+}
+
+} // namespace typewriter
@@ -0,0 +1,338 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/textsnapshot.h"
+#include "typewriter/private/textsnapshot_p.h"
+
+#include "typewriter/private/memoryusage_p.h"
+#include "typewriter/private/textblock_p.h"
+
+#include <stdexcept>
+
+namespace typewriter
+{
+
+TextSnapshot::TextSnapshot(std::shared_ptr<const TextSnapshotNode> root)
+  : m_root(std::move(root))
+{
+
+}
+
+int TextSnapshot::lineCount() const
+{
+  return m_root ? m_root->count : 0;
+}
+
+/*!
+ * \fn size_t length() const
+ * \brief returns the number of bytes of the text, newlines included
+ */
+size_t TextSnapshot::length() const
+{
+  return m_root ? m_root->bytes + m_root->count - 1 : 0;
+}
+
+const std::string& TextSnapshot::text(int line) const
+{
+  if (line < 0 || line >= lineCount())
+    throw std::runtime_error{ "Line out of range" };
+
+  const TextSnapshotNode* node = m_root.get();
+
+  for (;;)
+  {
+    const int left_count = node->left ? node->left->count : 0;
+
+    if (line < left_count)
+    {
+      node = node->left.get();
+    }
+    else if (line == left_count)
+    {
+      return *node->line;
+    }
+    else
+    {
+      line -= left_count + 1;
+      node = node->right.get();
+    }
+  }
+}
+
+std::string TextSnapshot::toString() const
+{
+  std::string result;
+  result.reserve(length());
+
+  for (const_iterator it = begin(); it != end(); ++it)
+  {
+    result.append(*it);
+    result.push_back('\n');
+  }
+
+  if (!result.empty())
+    result.pop_back();
+
+  return result;
+}
+
+TextSnapshot::const_iterator TextSnapshot::begin() const
+{
+  const_iterator it;
+  it.descend(m_root.get());
+  return it;
+}
+
+TextSnapshot::const_iterator TextSnapshot::end() const
+{
+  return const_iterator();
+}
+
+const std::string& TextSnapshot::const_iterator::operator*() const
+{
+  return *m_path.back()->line;
+}
+
+TextSnapshot::const_iterator& TextSnapshot::const_iterator::operator++()
+{
+  const TextSnapshotNode* node = m_path.back();
+  m_path.pop_back();
+  descend(node->right.get());
+  return *this;
+}
+
+void TextSnapshot::const_iterator::descend(const TextSnapshotNode* node)
+{
+  while (node)
+  {
+    m_path.push_back(node);
+    node = node->left.get();
+  }
+}
+
+void SnapshotTree::build(const TextBlockImpl* first)
+{
+  std::vector<NodePtr> stack;
+
+  for (const TextBlockImpl* it = first; it != nullptr; it = it->next.get())
+  {
+    NodePtr node = create_node(it->sharedContent());
+    NodePtr last;
+
+    while (!stack.empty() && stack.back()->priority < node->priority)
+    {
+      last = std::move(stack.back());
+      stack.pop_back();
+      update(*last);
+    }
+
+    node->left = std::move(last);
+
+    if (!stack.empty())
+      stack.back()->right = node;
+
+    stack.push_back(std::move(node));
+  }
+
+  while (!stack.empty())
+  {
+    update(*stack.back());
+    m_root = std::move(stack.back());
+    stack.pop_back();
+  }
+}
+
+bool SnapshotTree::isActive()
+{
+  if (m_root && m_snapshots.expired())
+    reset();
+
+  return m_root != nullptr;
+}
+
+void SnapshotTree::reset()
+{
+  m_root.reset();
+}
+
+// nodes shared with the snapshots are counted, lines are owned by the blocks
+size_t SnapshotTree::memoryUsage() const
+{
+  size_t bytes = 0;
+  std::vector<const TextSnapshotNode*> stack;
+
+  if (m_root && !m_snapshots.expired())
+    stack.push_back(m_root.get());
+
+  while (!stack.empty())
+  {
+    const TextSnapshotNode* node = stack.back();
+    stack.pop_back();
+
+    bytes += memory::shared_node_size<TextSnapshotNode>();
+
+    if (node->left)
+      stack.push_back(node->left.get());
+
+    if (node->right)
+      stack.push_back(node->right.get());
+  }
+
+  return bytes;
+}
+
+void SnapshotTree::setLine(int num, LinePtr text)
+{
+  set_line(m_root, num, std::move(text));
+}
+
+void SnapshotTree::insertLine(int num, LinePtr text)
+{
+  NodePtr left, right;
+  split(std::move(m_root), num, left, right);
+  m_root = merge(merge(std::move(left), create_node(std::move(text))), std::move(right));
+}
+
+void SnapshotTree::removeLine(int num)
+{
+  removeLines(num, 1);
+}
+
+void SnapshotTree::removeLines(int num, int count)
+{
+  NodePtr left, middle, right;
+  split(std::move(m_root), num, left, right);
+  split(std::move(right), count, middle, right);
+  m_root = merge(std::move(left), std::move(right));
+}
+
+TextSnapshot SnapshotTree::snapshot()
+{
+  std::shared_ptr<void> token = m_snapshots.lock();
+
+  if (!token)
+  {
+    token = std::make_shared<char>();
+    m_snapshots = token;
+  }
+
+  // the root of the snapshot also owns the token
+  auto handle = std::make_shared<std::pair<std::shared_ptr<void>, NodePtr>>(std::move(token), m_root);
+  TextSnapshot result{ std::shared_ptr<const TextSnapshotNode>(handle, handle->second.get()) };
+
+  // Every node reachable from the snapshot is now frozen
+  ++m_generation;
+  return result;
+}
+
+SnapshotTree::NodePtr SnapshotTree::create_node(LinePtr text)
+{
+  // xorshift32
+  m_seed ^= m_seed << 13;
+  m_seed ^= m_seed >> 17;
+  m_seed ^= m_seed << 5;
+
+  auto node = std::make_shared<TextSnapshotNode>();
+  node->bytes = text->size();
+  node->line = std::move(text);
+  node->priority = m_seed;
+  node->generation = m_generation;
+  return node;
+}
+
+SnapshotTree::NodePtr SnapshotTree::own(const NodePtr& node)
+{
+  if (node->generation == m_generation)
+    return node;
+
+  auto copy = std::make_shared<TextSnapshotNode>(*node);
+  copy->generation = m_generation;
+  return copy;
+}
+
+void SnapshotTree::update(TextSnapshotNode& node)
+{
+  node.count = 1;
+  node.bytes = node.line->size();
+
+  if (node.left)
+  {
+    node.count += node.left->count;
+    node.bytes += node.left->bytes;
+  }
+
+  if (node.right)
+  {
+    node.count += node.right->count;
+    node.bytes += node.right->bytes;
+  }
+}
+
+SnapshotTree::NodePtr SnapshotTree::merge(NodePtr a, NodePtr b)
+{
+  if (!a)
+    return b;
+  else if (!b)
+    return a;
+
+  if (a->priority > b->priority)
+  {
+    a = own(a);
+    a->right = merge(std::move(a->right), std::move(b));
+    update(*a);
+    return a;
+  }
+  else
+  {
+    b = own(b);
+    b->left = merge(std::move(a), std::move(b->left));
+    update(*b);
+    return b;
+  }
+}
+
+void SnapshotTree::split(NodePtr node, int n, NodePtr& left, NodePtr& right)
+{
+  if (!node)
+  {
+    left = nullptr;
+    right = nullptr;
+    return;
+  }
+
+  node = own(node);
+
+  const int left_count = node->left ? node->left->count : 0;
+
+  if (n <= left_count)
+  {
+    split(std::move(node->left), n, left, node->left);
+    update(*node);
+    right = std::move(node);
+  }
+  else
+  {
+    split(std::move(node->right), n - left_count - 1, node->right, right);
+    update(*node);
+    left = std::move(node);
+  }
+}
+
+void SnapshotTree::set_line(NodePtr& node, int num, LinePtr text)
+{
+  node = own(node);
+
+  const int left_count = node->left ? node->left->count : 0;
+
+  if (num < left_count)
+    set_line(node->left, num, std::move(text));
+  else if (num == left_count)
+    node->line = std::move(text);
+  else
+    set_line(node->right, num - left_count - 1, std::move(text));
+
+  update(*node);
+}
+
+} // namespace typewriter
@@ -4,13 +4,20 @@
 
 #include "typewriter/textview.h"
 #include "typewriter/private/textview_p.h"
+#include "typewriter/private/memoryusage_p.h"
+#include "typewriter/private/textdocument_p.h"
 
+#include "typewriter/textdecorations.h"
 #include "typewriter/view/fragment.h"
 #include "typewriter/view/line.h"
 
+#include "typewriter/utils/instrumentation.h"
+
 #include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <limits>
+#include <unordered_set>
 
 namespace typewriter
 {
@@ -26,14 +33,8 @@ std::string Line::displayedText() const
   {
     if (e.kind == LineElement::LE_BlockFragment)
     {
-      TextBlockIterator it = e.block.begin();
-      it.seekColumn(e.begin);
-
-      for (int i(0); i < e.width; ++i)
-      {
-        r += unicode::Utf8Char(it.current()).data();
-        ++it;
-      }
+      const size_t begin = e.block.byteOffset(e.begin);
+      r.append(e.block.text(), begin, e.block.byteOffset(e.begin + e.length) - begin);
     }
   }
 
@@ -66,17 +67,50 @@ StyledFragment::~StyledFragment()
 }
 
 StyledFragment::StyledFragment(TextViewImpl const* view, Line const* /* line */, LineElement elem)
-  : StyledFragment(view, elem.block, elem.begin, elem.begin + elem.width)
+  : StyledFragment(view, elem.block, elem.begin, elem.begin + elem.length)
 {
 
 }
 
+namespace
+{
+
+const std::vector<FormatRange>& decorations_of(TextViewImpl const* view, const TextBlock& block)
+{
+  static const std::vector<FormatRange> empty;
+  return view->decorations ? view->decorations->ranges(block) : empty;
+}
+
+// the column at which the fragment starting at 'column' ends because of the range 'it'
+int range_boundary(std::vector<FormatRange>::const_iterator it, std::vector<FormatRange>::const_iterator end, int column, int fallback)
+{
+  if (it == end)
+    return fallback;
+
+  return std::min(fallback, column < it->start ? it->start : it->start + it->length);
+}
+
+// Line::block() cannot be used once the block has been discarded
+bool is_line_of(const Line& l, const TextBlockImpl* block)
+{
+  for (const LineElement& e : l.elements)
+  {
+    if (!e.block.isNull())
+      return e.block.impl() == block;
+  }
+
+  return false;
+}
+
+} // namespace
+
 StyledFragment::StyledFragment(TextViewImpl const* view, const TextBlock& block, int begin, int end)
   : mView(view)
   , mColumn(begin)
   , mEnd(end)
   , m_block(view->blocks.at(block.impl()))
   , mIterator(m_block->formats.end())
+  , mDecorations(&decorations_of(view, block))
 {
   auto it = std::find_if(m_block->formats.begin(), m_block->formats.end(), [&](const view::FormatRange& fr) {
     return (mColumn >= fr.start && mColumn < (fr.start + fr.length))
@@ -85,14 +119,21 @@ StyledFragment::StyledFragment(TextViewImpl const* view, const TextBlock& block,
 
   if (it != m_block->formats.end() && mEnd > it->start)
     mIterator = it;
+
+  // the first decoration ending after the beginning of the fragment
+  mDecoration = std::lower_bound(mDecorations->begin(), mDecorations->end(), mColumn, [](const view::FormatRange& r, int col) {
+    return r.start + r.length <= col;
+    });
 }
 
-StyledFragment::StyledFragment(TextViewImpl const* view, const TextBlock& block, int begin, int end, std::vector<FormatRange>::const_iterator iter)
-  : mView(view)
+StyledFragment::StyledFragment(const StyledFragment& other, int begin, std::vector<FormatRange>::const_iterator iter, std::vector<FormatRange>::const_iterator decoration)
+  : mView(other.mView)
   , mColumn(begin)
-  , mEnd(end)
-  , m_block(view->blocks.at(block.impl()))
+  , mEnd(other.mEnd)
+  , m_block(other.m_block)
   , mIterator(iter)
+  , mDecorations(other.mDecorations)
+  , mDecoration(decoration)
 {
 
 }
@@ -102,6 +143,17 @@ int StyledFragment::format() const
   return (mIterator == m_block->formats.end() || mColumn < mIterator->start) ? 0 : mIterator->format_id;
 }
 
+/*!
+ * \fn int decoration() const
+ * \brief returns the format of the decoration of the fragment, 0 if there is none
+ *
+ * Fragments are split at the boundaries of both the formats and the decorations.
+ */
+int StyledFragment::decoration() const
+{
+  return (mDecoration == mDecorations->end() || mColumn < mDecoration->start) ? 0 : mDecoration->format_id;
+}
+
 int StyledFragment::position() const
 {
   return mColumn;
@@ -109,17 +161,16 @@ int StyledFragment::position() const
 
 int StyledFragment::length() const
 {
-  if (mColumn == mEnd || mIterator == m_block->formats.end())
-  {
-    return mEnd - mColumn;
-  }
-  else
-  {
-    if (mColumn < mIterator->start)
-      return std::min({ mIterator->start - mColumn, mEnd - mColumn });
-    else
-      return std::min({ mIterator->start + mIterator->length - mColumn, mEnd - mColumn });
-  }
+  int end = range_boundary(mIterator, m_block->formats.end(), mColumn, mEnd);
+  end = range_boundary(mDecoration, mDecorations->end(), mColumn, end);
+  return end - mColumn;
+}
+
+// returns the number of cells used to display the fragment
+int StyledFragment::width() const
+{
+  const TextBlock& block = m_block->block;
+  return block.displayWidth(position() + length()) - block.displayWidth(position());
 }
 
 TextBlock StyledFragment::block() const
@@ -129,41 +180,32 @@ TextBlock StyledFragment::block() const
 
 std::string StyledFragment::text() const
 {
-  // @TODO: support utf8
-  return m_block->block.text().substr(position(), length());
+  const TextBlock& block = m_block->block;
+  const size_t from = block.byteOffset(position());
+  return block.text().substr(from, block.byteOffset(position() + length()) - from);
 }
 
 StyledFragment StyledFragment::next() const
 {
-  if (mIterator == m_block->formats.end())
-  {
-    return StyledFragment(mView, m_block->block, mEnd, mEnd, m_block->formats.end());
-  }
-  else if (mColumn < mIterator->start)
-  {
-    if (mEnd < mIterator->start) // @TODO: this case should never happen
-      return StyledFragment(mView, m_block->block, mEnd, mEnd, m_block->formats.end());
-    else
-      return StyledFragment(mView, m_block->block, mIterator->start, mEnd, mIterator);
-  }
-  else
-  {
-    assert(mColumn >= mIterator->start && (mColumn < mIterator->start + mIterator->length));
+  const int column = mColumn + length();
 
-    if (mEnd <= mIterator->start + mIterator->length)
-    {
-      return StyledFragment(mView, m_block->block, mEnd, mEnd, m_block->formats.end());
-    }
-    else
-    {
-      auto next = mIterator + 1;
+  if (column >= mEnd)
+    return StyledFragment(*this, mEnd, m_block->formats.end(), mDecorations->end());
 
-      if (next == m_block->formats.end() || mEnd <= next->start)
-        return StyledFragment(mView, m_block->block, mIterator->start + mIterator->length, mEnd, m_block->formats.end());
-      else
-        return StyledFragment(mView, m_block->block, mIterator->start + mIterator->length, mEnd, next);
-    }
-  }
+  auto it = mIterator;
+
+  while (it != m_block->formats.end() && it->start + it->length <= column)
+    ++it;
+
+  if (it != m_block->formats.end() && mEnd <= it->start)
+    it = m_block->formats.end();
+
+  auto decoration = mDecoration;
+
+  while (decoration != mDecorations->end() && decoration->start + decoration->length <= column)
+    ++decoration;
+
+  return StyledFragment(*this, column, it, decoration);
 }
 
 bool StyledFragment::operator==(const StyledFragment& other) const
@@ -181,7 +223,7 @@ StyledFragments::StyledFragments(TextViewImpl const* view, Line const* line, Lin
     m_line(line),
     m_block(elem.block),
     m_begin(elem.begin),
-    m_end(elem.begin + elem.width)
+    m_end(elem.begin + elem.length)
 {
 
 }
@@ -198,19 +240,597 @@ StyledFragment StyledFragments::end() const
 
 } // namespace view
 
+void LineIndex::build(const std::list<view::Line>& lines, TextBlock first)
+{
+  TYPEWRITER_SCOPED_TIMER("view.buildLineIndex");
+
+  rows.clear();
+  fragments.clear();
+  rows.reserve(lines.size());
+
+  TextBlockView block = first;
+  int number = 0;
+  int row = 0;
+
+  for (auto it = lines.begin(); it != lines.end(); ++it, ++row)
+  {
+    rows.push_back(it);
+
+    int x = 0;
+
+    for (const view::LineElement& e : it->elements)
+    {
+      if (e.kind == view::LineElement::LE_BlockFragment || e.kind == view::LineElement::LE_Tab)
+      {
+        // blocks hidden by a fold are skipped
+        while (!block.isNull() && block.impl() != e.block.impl())
+        {
+          block = block.next();
+          ++number;
+        }
+
+        fragments.push_back(Fragment{ row, number, e.begin, e.length, x, &e });
+      }
+
+      x += e.width;
+    }
+  }
+
+  valid = true;
+}
+
+view::Point LineIndex::map(const Position& pos) const
+{
+  auto it = std::upper_bound(fragments.begin(), fragments.end(), pos, [](const Position& p, const Fragment& f) {
+    return p.line < f.block || (p.line == f.block && p.column < f.begin);
+    });
+
+  if (it == fragments.begin())
+    return view::Point{};
+
+  const Fragment& frag = *std::prev(it);
+
+  if (frag.block != pos.line || pos.column > frag.begin + frag.length)
+  {
+    // the position is hidden by a fold that starts after the fragment
+    return view::Point{ frag.row, frag.x + frag.element->width };
+  }
+
+  int dx = 0;
+
+  if (frag.element->kind == view::LineElement::LE_Tab)
+    dx = pos.column > frag.begin ? frag.element->width : 0;
+  else
+    dx = frag.element->block.displayWidth(pos.column) - frag.element->block.displayWidth(frag.begin);
+
+  return view::Point{ frag.row, frag.x + dx };
+}
+
+Position LineIndex::hitTest(const view::Point& pt) const
+{
+  if (fragments.empty())
+    return Position{ 0, 0 };
+
+  auto it = std::upper_bound(fragments.begin(), fragments.end(), pt, [](const view::Point& p, const Fragment& f) {
+    return p.row < f.row || (p.row == f.row && p.x < f.x);
+    });
+
+  if (it == fragments.begin())
+    return Position{ it->block, it->begin };
+
+  if (std::prev(it)->row != pt.row)
+  {
+    // nothing before 'x' on the row (e.g. an insert), the position
+    // is the start of the next fragment
+    if (it != fragments.end())
+      return Position{ it->block, it->begin };
+
+    --it;
+    return Position{ it->block, it->begin + it->length };
+  }
+
+  const Fragment& frag = *std::prev(it);
+  const int dx = pt.x - frag.x;
+
+  if (dx >= frag.element->width)
+    return Position{ frag.block, frag.begin + frag.length };
+
+  if (frag.element->kind == view::LineElement::LE_Tab)
+    return Position{ frag.block, 2 * dx <= frag.element->width ? frag.begin : frag.begin + 1 };
+
+  const TextBlock& block = frag.element->block;
+  const int col = block.columnAtDisplayWidth(block.displayWidth(frag.begin) + dx);
+  return Position{ frag.block, std::min(col, frag.begin + frag.length) };
+}
+
+bool FoldTree::Compare::operator()(const TextFold* lhs, const TextFold* rhs) const
+{
+  // the null fold comes before the folds starting at the probe position
+  if (!lhs)
+    return !(rhs->cursor.selectionStart() < *probe);
+  else if (!rhs)
+    return lhs->cursor.selectionStart() < *probe;
+
+  const Position lhs_start = lhs->cursor.selectionStart();
+  const Position rhs_start = rhs->cursor.selectionStart();
+
+  if (lhs_start != rhs_start)
+    return lhs_start < rhs_start;
+
+  const Position lhs_end = lhs->cursor.selectionEnd();
+  const Position rhs_end = rhs->cursor.selectionEnd();
+
+  if (lhs_end != rhs_end)
+    return rhs_end < lhs_end;
+
+  return lhs->id < rhs->id;
+}
+
+FoldTree::FoldTree()
+  : m_folds(Compare{ &m_probe })
+{
+
+}
+
+FoldTree::~FoldTree()
+{
+  clear();
+}
+
+// returns the first fold starting at or after 'pos'
+FoldTree::const_iterator FoldTree::lower_bound(const Position& pos) const
+{
+  m_probe = pos;
+  return m_folds.lower_bound(nullptr);
+}
+
+const TextFold* FoldTree::find(int id) const
+{
+  auto it = m_nodes.find(id);
+  return it != m_nodes.end() ? &it->second.fold : nullptr;
+}
+
+// the fold replaces the fold with the same id
+const TextFold& FoldTree::insert(TextFold fold)
+{
+  erase(fold.id);
+
+  Node& node = m_nodes[fold.id];
+  node.fold.cursor = std::move(fold.cursor);
+  node.fold.width = fold.width;
+  node.fold.id = fold.id;
+  node.it = m_folds.insert(&node.fold).first;
+
+  return node.fold;
+}
+
+void FoldTree::erase(int id)
+{
+  auto it = m_nodes.find(id);
+
+  if (it == m_nodes.end())
+    return;
+
+  m_folds.erase(it->second.it);
+  m_nodes.erase(it);
+}
+
+void FoldTree::clear()
+{
+  if (m_nodes.empty())
+    return;
+
+  // removing the cursors one by one from the document would be quadratic
+  std::vector<TextCursor*> cursors;
+  cursors.reserve(m_nodes.size());
+  TextDocument* document = nullptr;
+
+  for (auto& entry : m_nodes)
+  {
+    if (entry.second.fold.cursor.document())
+    {
+      document = entry.second.fold.cursor.document();
+      cursors.push_back(&entry.second.fold.cursor);
+    }
+  }
+
+  if (document)
+    document->impl()->deregister_cursors(std::move(cursors));
+
+  m_folds.clear();
+  m_nodes.clear();
+}
+
+size_t FoldTree::memoryUsage() const
+{
+  return m_folds.size() * memory::node_size<const TextFold*>() + m_nodes.size() * memory::node_size<std::pair<const int, Node>>()
+    + m_nodes.bucket_count() * sizeof(void*);
+}
+
+namespace
+{
+
+template<typename T>
+bool insert_less(const T& lhs, const T& rhs)
+{
+  return lhs.cursor.position() < rhs.cursor.position();
+}
+
+// Moving a registered cursor looks it up among all the cursors of the document,
+// so the cursors are detached while many inserts are sorted or moved.
+template<typename T>
+void collect_cursors(std::vector<T>& inserts, std::vector<TextCursor*>& cursors, TextDocument*& document)
+{
+  for (T& ins : inserts)
+  {
+    if (ins.cursor.document())
+    {
+      document = ins.cursor.document();
+      cursors.push_back(&ins.cursor);
+    }
+  }
+}
+
+template<typename T>
+void collect_detached_cursors(std::vector<T>& inserts, std::vector<TextCursor*>& cursors)
+{
+  for (T& ins : inserts)
+    cursors.push_back(&ins.cursor);
+}
+
+} // namespace
+
+// returns the inserts of a block, sorted by column
+template<typename T>
+const typename InsertIndex<T>::List& InsertIndex<T>::at(const TextBlock& block) const
+{
+  static const List empty_list;
+  auto it = m_blocks.find(block.impl());
+  return it != m_blocks.end() ? it->second.inserts : empty_list;
+}
+
+// the blocks whose inserts changed are appended to 'changed'
+template<typename T>
+void InsertIndex<T>::insert(std::vector<T> inserts, std::vector<TextBlock>& changed)
+{
+  if (inserts.empty())
+    return;
+
+  if (inserts.size() == 1 && inserts.front().cursor.document() && at(inserts.front().cursor.block()).empty())
+  {
+    Entry& entry = m_blocks[inserts.front().cursor.block().impl()];
+    entry.block = inserts.front().cursor.block();
+    entry.inserts.push_back(std::move(inserts.front()));
+    changed.push_back(entry.block);
+    m_size += 1;
+    return;
+  }
+
+  // the blocks are read before the cursors are detached
+  std::vector<TextBlock> blocks;
+  blocks.reserve(inserts.size());
+
+  std::vector<TextCursor*> cursors;
+  TextDocument* document = nullptr;
+  collect_cursors(inserts, cursors, document);
+
+  if (!document)
+    return;
+
+  for (const T& ins : inserts)
+  {
+    const bool same_block = !blocks.empty() && blocks.back() == ins.cursor.block();
+    blocks.push_back(ins.cursor.block());
+
+    auto entry = m_blocks.find(blocks.back().impl());
+
+    // a cursor listed twice is only detached once
+    if (entry != m_blocks.end() && !same_block)
+      collect_cursors(entry->second.inserts, cursors, document);
+  }
+
+  document->impl()->deregister_cursors(cursors);
+  cursors.clear();
+
+  std::vector<size_t> order(inserts.size());
+
+  for (size_t i(0); i < order.size(); ++i)
+    order[i] = i;
+
+  std::stable_sort(order.begin(), order.end(), [&inserts](size_t a, size_t b) {
+    return insert_less(inserts[a], inserts[b]);
+    });
+
+  for (auto it = order.begin(); it != order.end(); )
+  {
+    const TextBlock& block = blocks[*it];
+    auto last = std::find_if(it, order.end(), [&blocks, &block](size_t i) { return blocks[i] != block; });
+
+    Entry& entry = m_blocks[block.impl()];
+    entry.block = block;
+
+    // among inserts at the same column, the new ones come last
+    List merged;
+    merged.reserve(entry.inserts.size() + (last - it));
+    auto existing = entry.inserts.begin();
+
+    for (; it != last; ++it)
+    {
+      T& ins = inserts[*it];
+
+      while (existing != entry.inserts.end() && !insert_less(ins, *existing))
+        merged.push_back(std::move(*existing++));
+
+      merged.push_back(std::move(ins));
+    }
+
+    std::move(existing, entry.inserts.end(), std::back_inserter(merged));
+    entry.inserts = std::move(merged);
+
+    collect_detached_cursors(entry.inserts, cursors);
+    changed.push_back(block);
+  }
+
+  m_size += inserts.size();
+  document->impl()->register_cursors(cursors);
+}
+
+// removes the inserts positioned in [begin, end)
+template<typename T>
+void InsertIndex<T>::remove(const Position& begin, const Position& end, std::vector<TextBlock>& changed)
+{
+  auto in_range = [&begin, &end](const T& ins) {
+    const Position pos = ins.cursor.position();
+    return !(pos < begin) && pos < end;
+  };
+
+  std::vector<Entry*> entries;
+  std::vector<TextCursor*> cursors;
+  TextDocument* document = nullptr;
+
+  for (auto& e : m_blocks)
+  {
+    if (std::any_of(e.second.inserts.begin(), e.second.inserts.end(), in_range))
+    {
+      entries.push_back(&e.second);
+      collect_cursors(e.second.inserts, cursors, document);
+    }
+  }
+
+  if (!document)
+    return;
+
+  document->impl()->deregister_cursors(cursors);
+  cursors.clear();
+
+  for (Entry* e : entries)
+  {
+    const size_t count = e->inserts.size();
+    e->inserts.erase(std::remove_if(e->inserts.begin(), e->inserts.end(), in_range), e->inserts.end());
+    m_size -= count - e->inserts.size();
+
+    collect_detached_cursors(e->inserts, cursors);
+    changed.push_back(e->block);
+
+    if (e->inserts.empty())
+      m_blocks.erase(e->block.impl());
+  }
+
+  document->impl()->register_cursors(cursors);
+}
+
+template<typename T>
+void InsertIndex<T>::clear(std::vector<TextBlock>& changed)
+{
+  for (const auto& e : m_blocks)
+    changed.push_back(e.second.block);
+
+  clear();
+}
+
+template<typename T>
+void InsertIndex<T>::clear()
+{
+  std::vector<TextCursor*> cursors;
+  TextDocument* document = nullptr;
+
+  for (auto& e : m_blocks)
+    collect_cursors(e.second.inserts, cursors, document);
+
+  if (document)
+    document->impl()->deregister_cursors(std::move(cursors));
+
+  m_blocks.clear();
+  m_size = 0;
+}
+
+// the block before 'newblock' was split, the inserts after the split move to the new block
+template<typename T>
+void InsertIndex<T>::blockInserted(const TextBlock& newblock)
+{
+  auto it = m_blocks.find(newblock.previous().impl());
+
+  if (it == m_blocks.end())
+    return;
+
+  List& inserts = it->second.inserts;
+
+  auto first = std::find_if(inserts.begin(), inserts.end(), [&newblock](const T& ins) {
+    return ins.cursor.block() == newblock;
+    });
+
+  if (first == inserts.end())
+    return;
+
+  Entry& entry = m_blocks[newblock.impl()];
+  entry.block = newblock;
+  entry.inserts.assign(std::make_move_iterator(first), std::make_move_iterator(inserts.end()));
+  inserts.erase(first, inserts.end());
+
+  if (inserts.empty())
+    m_blocks.erase(newblock.previous().impl());
+}
+
+// the block was merged into the previous one
+template<typename T>
+void InsertIndex<T>::blockDestroyed(const TextBlock& block)
+{
+  auto it = m_blocks.find(block.impl());
+
+  if (it == m_blocks.end())
+    return;
+
+  List moved = std::move(it->second.inserts);
+  m_blocks.erase(it);
+
+  Entry& entry = m_blocks[block.previous().impl()];
+  entry.block = block.previous();
+  entry.inserts.insert(entry.inserts.end(), std::make_move_iterator(moved.begin()), std::make_move_iterator(moved.end()));
+}
+
+// regroups the inserts by the block of their cursor, after blocks were replaced
+template<typename T>
+void InsertIndex<T>::rebuild()
+{
+  std::vector<TextBlock> blocks;
+  blocks.reserve(m_size);
+
+  std::vector<TextCursor*> cursors;
+  TextDocument* document = nullptr;
+
+  for (auto& e : m_blocks)
+  {
+    collect_cursors(e.second.inserts, cursors, document);
+
+    for (const T& ins : e.second.inserts)
+      blocks.push_back(ins.cursor.block());
+  }
+
+  if (!document)
+    return;
+
+  document->impl()->deregister_cursors(cursors);
+  cursors.clear();
+
+  std::unordered_map<TextBlockImpl*, Entry> entries;
+  entries.swap(m_blocks);
+  auto block = blocks.begin();
+
+  for (auto& e : entries)
+  {
+    for (T& ins : e.second.inserts)
+    {
+      Entry& entry = m_blocks[block->impl()];
+      entry.block = *block++;
+      entry.inserts.push_back(std::move(ins));
+    }
+  }
+
+  for (auto& e : m_blocks)
+  {
+    std::stable_sort(e.second.inserts.begin(), e.second.inserts.end(), insert_less<T>);
+    collect_detached_cursors(e.second.inserts, cursors);
+  }
+
+  document->impl()->register_cursors(cursors);
+}
+
+// removes the inserts of the blocks that were discarded
+template<typename T>
+void InsertIndex<T>::removeGarbage()
+{
+  std::vector<TextCursor*> cursors;
+  TextDocument* document = nullptr;
+
+  for (auto& e : m_blocks)
+  {
+    if (!e.second.block.isValid())
+      collect_cursors(e.second.inserts, cursors, document);
+  }
+
+  if (document)
+    document->impl()->deregister_cursors(std::move(cursors));
+
+  for (auto it = m_blocks.begin(); it != m_blocks.end(); )
+  {
+    if (it->second.block.isValid())
+    {
+      ++it;
+    }
+    else
+    {
+      m_size -= it->second.inserts.size();
+      it = m_blocks.erase(it);
+    }
+  }
+}
+
+// returns all the inserts, in document order
+template<typename T>
+std::vector<T> InsertIndex<T>::values() const
+{
+  std::vector<const Entry*> entries;
+  entries.reserve(m_blocks.size());
+
+  for (const auto& e : m_blocks)
+    entries.push_back(&e.second);
+
+  std::sort(entries.begin(), entries.end(), [](const Entry* lhs, const Entry* rhs) {
+    return insert_less(lhs->inserts.front(), rhs->inserts.front());
+    });
+
+  std::vector<T> result;
+  result.reserve(m_size);
+
+  for (const Entry* e : entries)
+    result.insert(result.end(), e->inserts.begin(), e->inserts.end());
+
+  return result;
+}
+
+template<typename T>
+size_t InsertIndex<T>::memoryUsage() const
+{
+  size_t result = m_blocks.bucket_count() * sizeof(void*);
+
+  for (const auto& e : m_blocks)
+    result += memory::node_size<std::pair<TextBlockImpl* const, Entry>>() + memory::heap_size(e.second.inserts);
+
+  return result;
+}
+
+template<typename T>
+void InsertIndex<T>::shrink()
+{
+  for (auto& e : m_blocks)
+    e.second.inserts.shrink_to_fit();
+
+  m_blocks.rehash(0);
+}
+
 TextViewImpl::TextViewImpl(TextDocument *doc)
   : document(doc)
 {
   reset(doc);
 }
 
+const LineIndex& TextViewImpl::lineIndex() const
+{
+  if (!line_index.valid)
+    line_index.build(lines, document ? document->firstBlock() : TextBlock());
+
+  return line_index;
+}
+
 void TextViewImpl::reset(TextDocument* doc)
 {
+  this->line_index.valid = false;
   this->blocks.clear();
   this->lines.clear();
   this->inline_inserts.clear();
   this->inserts.clear();
   this->folds.clear();
+  this->decorations = nullptr;
 
   this->document = doc;
 
@@ -250,6 +870,8 @@ TextView::WrapMode TextViewImpl::computedWrapMode() const
 
 void TextViewImpl::refreshLongestLineLength()
 {
+  TYPEWRITER_SCOPED_TIMER("view.refreshLongestLineLength");
+
   this->longest_line_length = 0;
 
   for (auto& l : this->lines)
@@ -264,9 +886,8 @@ void Composer::Iterator::init(TextViewImpl* v)
   wrapmode = v->computedWrapMode();
 
   folds = v->folds.begin();
-  inline_inserts = v->inline_inserts.begin();
-  inserts = v->inserts.begin();
   textblock = v->document->firstBlock().begin();
+  seekInserts();
 
   update();
 }
@@ -276,26 +897,50 @@ void Composer::Iterator::update()
 {
   if (current == BlockIterator)
   {
-    if (folds != view->folds.end() && folds->cursor.selectionStart() == Position{ line, textblock.column() })
-      current = FoldIterator;
-    else if (inserts != view->inserts.end() && inserts->cursor.block() == textblock.block())
+    if (inserts != inserts_end)
       current = InsertIterator;
-    else if (inline_inserts != view->inline_inserts.end() && inline_inserts->cursor.block() == textblock.block() && inline_inserts->cursor.position().column == textblock.column())
+    else if (inline_inserts != inline_inserts_end && inline_inserts->cursor.position().column == textblock.column())
       current = InlineInsertIterator;
+    else if (folds != view->folds.end() && (*folds)->cursor.selectionStart() == Position{ line, textblock.column() })
+      current = FoldIterator;
   }
 }
 
+// points to the inserts of the current block that are after the current column,
+// the inserts displayed above a block are skipped if it is entered in the middle
+void Composer::Iterator::seekInserts()
+{
+  const std::vector<view::Insert>& block_inserts = view->inserts.at(textblock.block());
+  inserts = textblock.column() == 0 ? block_inserts.begin() : block_inserts.end();
+  inserts_end = block_inserts.end();
+  insert_row = 0;
+
+  const std::vector<view::InlineInsert>& block_inline_inserts = view->inline_inserts.at(textblock.block());
+  inline_inserts = std::lower_bound(block_inline_inserts.begin(), block_inline_inserts.end(), textblock.column(), [](const view::InlineInsert& lhs, int column) -> bool {
+    return lhs.cursor.position().column < column;
+    });
+  inline_inserts_end = block_inline_inserts.end();
+}
+
 void Composer::Iterator::advance()
 {
   if (current == FoldIterator)
   {
-    const auto& fold = *folds;
-    ++folds;
+    const TextFold& fold = **folds;
+    const Position end = fold.cursor.selectionEnd();
+
+    // the folds nested in the fold are hidden
+    while (folds != view->folds.end() && (*folds)->cursor.selectionStart() < end)
+      ++folds;
 
-    assert(fold.cursor.position() == fold.cursor.selectionEnd());
+    assert(fold.cursor.position() == end);
     textblock = fold.cursor.block().begin();
-    line = fold.cursor.selectionEnd().line;
-    textblock.seekColumn(fold.cursor.selectionEnd().column);
+    line = end.line;
+    textblock.seekColumn(end.column);
+
+    // the first line of the block is hidden, and so are the inserts above it
+    seekInserts();
+    inserts = inserts_end;
 
     current = BlockIterator;
   }
@@ -351,30 +996,32 @@ void Composer::Iterator::advance()
       }
     }
 
-    if (folds != view->folds.end() && folds->cursor.selectionStart().line == line)
+    if (folds != view->folds.end() && (*folds)->cursor.selectionStart().line == line)
     {
-      fold_column = folds->cursor.selectionStart().column;
+      fold_column = (*folds)->cursor.selectionStart().column;
     }
 
-    if (inline_inserts != view->inline_inserts.end() && inline_inserts->cursor.block() == textblock.block())
+    if (inline_inserts != inline_inserts_end)
     {
       inline_insert_column = inline_inserts->cursor.position().column;
     }
 
-    if (fold_column != -1 && (fold_column < inline_insert_column || inline_insert_column == -1) && fold_column < block_column)
-    {
-      textblock.seekColumn(fold_column);
-      current = FoldIterator;
-    }
-    else if (inline_insert_column != -1 && (inline_insert_column < fold_column || fold_column == -1) && inline_insert_column < block_column)
+    // an inline insert is displayed before a fold starting at the same column
+    if (inline_insert_column != -1 && (inline_insert_column <= fold_column || fold_column == -1) && inline_insert_column < block_column)
     {
       textblock.seekColumn(inline_insert_column);
       current = InlineInsertIterator;
     }
+    else if (fold_column != -1 && fold_column < block_column)
+    {
+      textblock.seekColumn(fold_column);
+      current = FoldIterator;
+    }
     else
     {
       textblock.seekColumn(block_column);
-      current = textblock.atEnd() ? LineFeedIterator : BlockIterator;
+      // a fold may start at the end of the line, see update()
+      current = textblock.atEnd() && fold_column != block_column ? LineFeedIterator : BlockIterator;
     }
   }
   else
@@ -384,6 +1031,7 @@ void Composer::Iterator::advance()
     textblock =  textblock.block().next().begin();
     line += 1;
     current = BlockIterator;
+    seekInserts();
   }
 
   update();
@@ -404,11 +1052,31 @@ bool Composer::Iterator::atEnd() const
   return current == BlockIterator && !textblock.block().isValid();
 }
 
+// returns the number of columns of the block covered by the current item
+int Composer::Iterator::currentLength() const
+{
+  if (current != BlockIterator)
+    return 0;
+
+  Iterator copy{ *this };
+  copy.advance();
+
+  if (copy.line == line)
+    return copy.textblock.column() - textblock.column();
+  else
+    return textblock.block().length() - textblock.column();
+}
+
 int Composer::Iterator::currentWidth() const
+{
+  return currentWidth(currentLength());
+}
+
+int Composer::Iterator::currentWidth(int length) const
 {
   if (current == FoldIterator)
   {
-    return folds->width;
+    return (*folds)->width;
   }
   else if (current == InsertIterator)
   {
@@ -422,13 +1090,8 @@ int Composer::Iterator::currentWidth() const
   {
     assert(current == BlockIterator);
 
-    Iterator copy{ *this };
-    copy.advance();
-
-    if (copy.line == line)
-      return copy.textblock.column() - textblock.column();
-    else
-      return textblock.block().length() - textblock.column();
+    const TextBlock& block = textblock.block();
+    return block.displayWidth(textblock.column() + length) - block.displayWidth(textblock.column());
   }
 }
 
@@ -438,36 +1101,36 @@ void Composer::Iterator::seek(const view::Line& l)
 }
 
 void Composer::Iterator::seek(const TextBlock& b)
+{
+  seek(b, b.blockNumber()); // @TODO: (performance) if relayout is needed after an edit, we could pass the line number with cursor.position()
+}
+
+void Composer::Iterator::seek(const TextBlock& b, int blocknum)
 {
   textblock = b.begin();
-  line = b.blockNumber(); // @TODO: (performance) if relayout is needed after an edit, we could pass the line number with cursor.position()
+  line = blocknum;
 
   Position pos{ line, textblock.column() };
 
-  folds = std::lower_bound(view->folds.begin(), view->folds.end(), pos, [](const TextFold& lhs, const Position& rhs) -> bool {
-    return lhs.cursor.selectionStart().line < rhs.line
-      || (lhs.cursor.selectionStart().line == rhs.line && lhs.cursor.selectionStart().column < rhs.column);
-    });
+  folds = view->folds.lower_bound(pos);
 
-  inserts = std::lower_bound(view->inserts.begin(), view->inserts.end(), pos, [](const view::Insert& lhs, const Position& rhs) -> bool {
-    return lhs.cursor.selectionStart().line < rhs.line
-      || (lhs.cursor.selectionStart().line == rhs.line && lhs.cursor.selectionStart().column < rhs.column);
-    });
+  seekInserts();
 
-  inline_inserts = std::lower_bound(view->inline_inserts.begin(), view->inline_inserts.end(), pos, [](const view::InlineInsert& lhs, const Position& rhs) -> bool {
-    return lhs.cursor.selectionStart().line < rhs.line
-      || (lhs.cursor.selectionStart().line == rhs.line && lhs.cursor.selectionStart().column < rhs.column);
-    });
+  current = BlockIterator;
+  update();
 }
 
 Composer::Composer(TextViewImpl* v)
   : view(v)
 {
+  view->line_index.valid = false;
   iterator.init(v);
 }
 
 void Composer::relayout()
 {
+  TYPEWRITER_SCOPED_TIMER("view.relayout");
+
   for (auto& entry : view->blocks)
     entry.second->line = view->lines.end();
 
@@ -491,6 +1154,8 @@ void Composer::relayout()
 
 void Composer::relayoutBlock()
 {
+  TYPEWRITER_COUNT("view.relayoutBlock", 1);
+
   int cpl = view->cpl <= 0 ? std::numeric_limits<int>::max() : view->cpl;
 
   if (view->wrapmode == TextView::WrapMode::NoWrap)
@@ -506,17 +1171,39 @@ void Composer::relayoutBlock()
       continue;
     }
 
-    // @TODO @Speed this is expensive as currentWith() calls advance()
-    int cur_width = iterator.currentWidth();
+    // @TODO @Speed this is expensive as currentLength() calls advance()
+    const int cur_length = iterator.currentLength();
+    const int cur_width = iterator.currentWidth(cur_length);
 
     if (current_line_width + cur_width <= cpl)
     {
-      appendToCurrentLine(iterator, cur_width);
+      appendToCurrentLine(iterator, cur_width, cur_length);
       iterator.advance();
     }
     else
     {
-      if ((view->wrapmode == TextView::WrapMode::WordBoundaryOrAnywhere && iterator.current == Composer::BlockIterator) || cur_width > cpl)
+      if (iterator.current == Composer::BlockIterator && (view->wrapmode == TextView::WrapMode::WordBoundaryOrAnywhere || cur_width > cpl))
+      {
+        // breaks the text at the last character that fits on the line
+        const TextBlock& block = iterator.textblock.block();
+        const int column = iterator.textblock.column();
+        int n = block.columnAtDisplayWidth(block.displayWidth(column) + cpl - current_line_width) - column;
+        n = std::min(n, cur_length);
+
+        // a wide character on a line that is too narrow for it
+        if (n == 0 && current_line_width == 0)
+          n = 1;
+
+        if (n > 0)
+          appendToCurrentLine(iterator, -1, n);
+
+        current_line.push_back(createCarriageReturn());
+        writeCurrentLine();
+        current_line.push_back(createLineIndent());
+
+        iterator.textblock.seekColumn(column + n);
+      }
+      else if (cur_width > cpl)
       {
         int diff = cpl - current_line_width;
         appendToCurrentLine(iterator, diff);
@@ -546,17 +1233,16 @@ void Composer::relayoutBlock()
     line_iterator = view->lines.erase(line_iterator);
   }
 
+  TextBlock hidden = current_block.next();
+
   updateBlockLineIterator(current_block, iterator.textblock.block());
   current_block = iterator.textblock.block();
 
-  // A fold may have hidden some lines that need to be destroyed,
-  // it may also (if deleted) have restored some lines
-  // TODO: we need to have more information, i.e. know if a fold was added or removed
-  while (line_iterator != view->lines.end())
+  // A fold may have hidden some blocks whose lines need to be destroyed;
+  // the lines of the blocks that were already hidden do not exist
+  while (line_iterator != view->lines.end() && line_iterator->block() != current_block && hidden != current_block)
   {
-    TextBlock block = line_iterator->block();
-
-    if (block != current_block)
+    if (line_iterator->block() == hidden)
     {
       if (line_iterator->width() == view->longest_line_length)
         has_invalidate_longest_line = true;
@@ -565,7 +1251,7 @@ void Composer::relayoutBlock()
     }
     else
     {
-      break;
+      hidden = hidden.next();
     }
   }
 }
@@ -596,7 +1282,7 @@ void Composer::writeCurrentLine()
 
     std::swap(line_iterator->elements, current_line);
 
-    if(line_iterator->elements.front().id != view::LineElement::LE_LineIndent)
+    if(line_iterator->elements.front().kind != view::LineElement::LE_LineIndent)
       view->blocks[current_block.impl()]->line = line_iterator;
 
     ++line_iterator;
@@ -607,7 +1293,7 @@ void Composer::writeCurrentLine()
 
     line_iterator = view->lines.insert(line_iterator, view::Line{ std::move(current_line) });
 
-    if (line_iterator->elements.front().id != view::LineElement::LE_LineIndent)
+    if (line_iterator->elements.front().kind != view::LineElement::LE_LineIndent)
     {
       auto& blockinfo = view->blocks[current_block.impl()];
       assert(blockinfo != nullptr);
@@ -621,11 +1307,21 @@ void Composer::writeCurrentLine()
   current_line_width = 0;
 }
 
+// returns whether the next line to be laid out already belongs to 'b'
+bool Composer::hasLines(const TextBlock& b) const
+{
+  return line_iterator != view->lines.end() && line_iterator->block() == b;
+}
+
 void Composer::updateBlockLineIterator(TextBlock begin, TextBlock end)
 {
   auto lit = std::prev(line_iterator);
 
-  while (lit->elements.front().id == view::LineElement::LE_LineIndent)
+  while (lit->elements.front().kind == view::LineElement::LE_LineIndent)
+    --lit;
+
+  // the lines of a block start with its inserts
+  while (lit != view->lines.begin() && std::prev(lit)->isInsert() && std::prev(lit)->block() == begin)
     --lit;
 
   std::shared_ptr<view::Block> info = view->blocks[begin.impl()];
@@ -662,20 +1358,69 @@ std::list<view::Line>::iterator Composer::getLine(TextBlock b)
   return info->line;
 }
 
-void Composer::relayout(std::list<view::Line>::iterator it)
-{
-  line_iterator = it;
-  current_block = line_iterator->block();
+void Composer::relayout(std::list<view::Line>::iterator it)
+{
+  TYPEWRITER_SCOPED_TIMER("view.relayoutLine");
+
+  line_iterator = it;
+  current_block = line_iterator->block();
+
+  iterator.seek(*line_iterator);
+
+  relayoutBlock();
+
+  // the blocks hidden by a fold that is now hidden by another fold are displayed again
+  while (current_block.isValid() && !hasLines(current_block))
+  {
+    relayoutBlock();
+  }
+
+  checkLongestLine();
+}
+
+// relayouts several blocks, in document order
+void Composer::relayout(const std::vector<TextBlock>& blocks)
+{
+  TYPEWRITER_SCOPED_TIMER("view.relayoutBlocks");
+
+  // the relayout of a block starts with the first block of its line
+  std::unordered_set<TextBlockImpl*> starts;
+
+  for (const TextBlock& b : blocks)
+  {
+    auto it = getLine(b);
+
+    if (it != view->lines.end())
+      starts.insert(it->block().impl());
+  }
+
+  if (starts.size() > view->blocks.size() / 2)
+  {
+    relayout();
+    return;
+  }
 
-  iterator.seek(*line_iterator);
+  // the block numbers are computed in a single pass
+  int blocknum = 0;
 
-  relayoutBlock();
+  for (TextBlock b = view->document->firstBlock(); b.isValid() && !starts.empty(); b = b.next(), ++blocknum)
+  {
+    if (starts.erase(b.impl()) == 0)
+      continue;
+
+    line_iterator = getLine(b);
+    current_block = b;
+    iterator.seek(b, blocknum);
+    relayoutBlock();
+  }
 
   checkLongestLine();
 }
 
 void Composer::handleBlockInsertion(const TextBlock& b)
 {
+  TYPEWRITER_SCOPED_TIMER("view.handleBlockInsertion");
+
   auto it = getLine(b.previous());
   auto next = it;
 
@@ -704,11 +1449,14 @@ void Composer::handleBlockInsertion(const TextBlock& b)
     }
   }
 
-  checkLongestLine();
+  // the previous block was split
+  relayout(b.previous());
 }
 
 void Composer::handleBlockRemoval(const TextBlock& b)
 {
+  TYPEWRITER_SCOPED_TIMER("view.handleBlockRemoval");
+
   auto it = getLine(b);
 
   while (it != view->lines.end() && it->block() == b)
@@ -719,23 +1467,63 @@ void Composer::handleBlockRemoval(const TextBlock& b)
   relayout(b.previous());
 }
 
-void Composer::handleFoldInsertion(std::vector<TextFold>::iterator it)
+// relayouts 'b' and all the blocks after it
+void Composer::handleBlocksAppended(const TextBlock& b)
+{
+  TYPEWRITER_SCOPED_TIMER("view.handleBlocksAppended");
+
+  iterator.seek(b);
+  current_block = b;
+  line_iterator = getLine(b);
+
+  while (current_block.isValid())
+  {
+    relayoutBlock();
+  }
+
+  checkLongestLine();
+}
+
+// relayouts the blocks from 'b', the block number 'blocknum', up to the 
+// block number 'end'; the lines of the blocks in between are outdated or 
+// do not exist
+void Composer::handleBlocksReplaced(const TextBlock& b, int blocknum, int end)
+{
+  TYPEWRITER_SCOPED_TIMER("view.handleBlocksReplaced");
+
+  current_block = b;
+  line_iterator = blocknum > 0 ? getLine(b) : view->lines.begin();
+  iterator.seek(b, blocknum);
+
+  while (current_block.isValid() && (iterator.line < end || !hasLines(current_block)))
+  {
+    relayoutBlock();
+  }
+
+  checkLongestLine();
+}
+
+void Composer::handleFoldInsertion(const TextFold& fold)
 {
-  TextBlock start_block = prev(it->cursor.block(), it->cursor.position().line - it->cursor.anchor().line);
+  TYPEWRITER_SCOPED_TIMER("view.handleFoldInsertion");
+
+  TextBlock start_block = prev(fold.cursor.block(), fold.cursor.position().line - fold.cursor.anchor().line);
   relayout(start_block);
 }
 
 void Composer::handleFoldRemoval(const TextCursor& sel)
 {
-  TextBlock start_block = prev(sel.block(), sel.position().line - sel.anchor().line);
-  TextBlock end_block = sel.block().next();
+  TYPEWRITER_SCOPED_TIMER("view.handleFoldRemoval");
 
-  iterator.seek(start_block);
-  current_block = start_block;
+  TextBlock start_block = prev(sel.block(), sel.position().line - sel.anchor().line);
 
+  // the relayout starts with the line displaying the start of the fold,
+  // which may be inside a fold that still hides it
   line_iterator = getLine(start_block);
+  current_block = line_iterator->block();
+  iterator.seek(*line_iterator);
 
-  while (current_block != end_block)
+  while (current_block.isValid() && (iterator.line <= sel.position().line || !hasLines(current_block)))
   {
     relayoutBlock();
   }
@@ -743,11 +1531,19 @@ void Composer::handleFoldRemoval(const TextCursor& sel)
   checkLongestLine();
 }
 
-view::LineElement Composer::createLineElement(const Iterator& it, int w)
+view::LineElement Composer::createLineElement(const Iterator& it, int w, int n)
 {
   view::LineElement e;
 
-  w = w == -1 ? it.currentWidth() : w;
+  if (it.current == BlockIterator)
+  {
+    n = n == -1 ? it.currentLength() : n;
+    w = w == -1 ? it.currentWidth(n) : w;
+  }
+  else
+  {
+    w = w == -1 ? it.currentWidth() : w;
+  }
 
   switch (it.current)
   {
@@ -755,7 +1551,10 @@ view::LineElement Composer::createLineElement(const Iterator& it, int w)
   {
     e.kind = view::LineElement::LE_Fold;
     e.width = w;
-    e.id = it.folds->id;
+    e.id = (*it.folds)->id;
+    // the block in which the fold starts, a line may begin with a fold
+    e.block = it.textblock.block();
+    e.begin = it.textblock.column();
   }
   break;
   case InsertIterator:
@@ -763,12 +1562,16 @@ view::LineElement Composer::createLineElement(const Iterator& it, int w)
     e.kind = view::LineElement::LE_Insert;
     e.width = w;
     e.nbrow = it.insert_row;
+    // the block displayed below the insert
+    e.block = it.textblock.block();
   }
   break;
   case InlineInsertIterator:
   {
     e.kind = view::LineElement::LE_InlineInsert;
     e.width = w;
+    e.block = it.textblock.block();
+    e.begin = it.textblock.column();
   }
   break;
   case BlockIterator:
@@ -776,8 +1579,9 @@ view::LineElement Composer::createLineElement(const Iterator& it, int w)
     e.kind = view::LineElement::LE_BlockFragment;
     e.block = it.textblock.block();
     e.begin = it.textblock.column();
+    e.length = n;
 
-    if (w == 1 && it.isTab())
+    if (n == 1 && it.isTab())
     {
       e.kind = view::LineElement::LE_Tab;
       e.width = view->tabwidth - (current_line_width % view->tabwidth);
@@ -809,14 +1613,15 @@ view::LineElement Composer::createLineIndent()
   return e;
 }
 
-void Composer::appendToCurrentLine(const Iterator& it, int w)
+void Composer::appendToCurrentLine(const Iterator& it, int w, int n)
 {
-  view::LineElement elem = createLineElement(iterator, w);
+  view::LineElement elem = createLineElement(iterator, w, n);
 
   if (!current_line.empty() && current_line.back().kind == view::LineElement::LE_BlockFragment && elem.kind == view::LineElement::LE_BlockFragment)
   {
-    if (current_line.back().begin + current_line.back().width == elem.begin)
+    if (current_line.back().begin + current_line.back().length == elem.begin)
     {
+      current_line.back().length += elem.length;
       current_line.back().width += elem.width;
       current_line_width += elem.width;
     }
@@ -920,6 +1725,41 @@ const std::unordered_map<TextBlockImpl*, std::shared_ptr<view::Block>>& TextView
   return d->blocks;
 }
 
+/*!
+ * \fn std::list<view::Line>::const_iterator lineAt(int row) const
+ * \brief returns an iterator to the line at the given row, or lines().end()
+ */
+std::list<view::Line>::const_iterator TextView::lineAt(int row) const
+{
+  const LineIndex& index = d->lineIndex();
+
+  if (row < 0 || row >= static_cast<int>(index.rows.size()))
+    return d->lines.end();
+
+  return index.rows[row];
+}
+
+/*!
+ * \fn view::Point map(const Position& pos) const
+ * \brief returns the location of a document position in the view
+ *
+ * A position hidden by a fold is mapped to the start of the fold.
+ * The row of the result is -1 if the position is before the first block of the view.
+ */
+view::Point TextView::map(const Position& pos) const
+{
+  return d->lineIndex().map(pos);
+}
+
+/*!
+ * \fn Position hitTest(const view::Point& pt) const
+ * \brief returns the document position that is the closest to a location in the view
+ */
+Position TextView::hitTest(const view::Point& pt) const
+{
+  return d->lineIndex().hitTest(pt);
+}
+
 TextView::WrapMode TextView::wrapMode() const
 {
   return d->wrapmode;
@@ -936,6 +1776,13 @@ void TextView::setWrapMode(WrapMode wm)
   }
 }
 
+/*!
+ * \fn void addFold(int id, TextCursor sel, int w)
+ * \brief hides the selected text behind a fold of width 'w'
+ *
+ * A fold replaces the fold with the same id. Folds may be nested: the folds
+ * that start inside a fold are hidden until it is removed.
+ */
 void TextView::addFold(int id, TextCursor sel, int w)
 {
   if (sel.anchor() > sel.position())
@@ -947,105 +1794,247 @@ void TextView::addFold(int id, TextCursor sel, int w)
 
   assert(sel.anchor() < sel.position());
 
-  auto it = std::lower_bound(d->folds.begin(), d->folds.end(), sel.anchor(), [](const TextFold& lhs, const Position& rhs) -> bool {
-    return lhs.cursor.anchor() < rhs;
-    });
+  removeFold(id);
 
   TextFold stf;
-  stf.cursor = sel;
+  stf.cursor = std::move(sel);
   stf.id = id;
   stf.width = w;
 
-  it = d->folds.insert(it, stf);
+  const TextFold& fold = d->folds.insert(std::move(stf));
+
+  Composer composer{ d.get() };
+  composer.handleFoldInsertion(fold);
+}
+
+/*!
+ * \fn void addFolds(std::vector<TextFold> folds)
+ * \brief adds several folds with a single relayout of the view
+ */
+void TextView::addFolds(std::vector<TextFold> folds)
+{
+  TYPEWRITER_SCOPED_TIMER("view.addFolds");
+
+  for (TextFold& f : folds)
+  {
+    if (f.cursor.anchor() > f.cursor.position())
+    {
+      auto p = f.cursor.anchor();
+      f.cursor.setPosition(f.cursor.position(), TextCursor::MoveAnchor);
+      f.cursor.setPosition(p, TextCursor::KeepAnchor);
+    }
+
+    assert(f.cursor.anchor() < f.cursor.position());
+
+    d->folds.insert(std::move(f));
+  }
 
   Composer composer{ d.get() };
-  composer.handleFoldInsertion(it);
+  composer.relayout();
 }
 
 void TextView::removeFold(int id)
 {
-  auto it = std::find_if(d->folds.begin(), d->folds.end(), [id](const TextFold& f) -> bool {
-    return f.id == id;
-    });
+  const TextFold* fold = d->folds.find(id);
 
-  if (it == d->folds.end())
+  if (!fold)
     return;
 
-  TextFold fold = *it;
+  TextCursor sel = fold->cursor;
 
-  d->folds.erase(it);
+  d->folds.erase(id);
 
   Composer composer{ d.get() };
-  composer.handleFoldRemoval(fold.cursor);
+  composer.handleFoldRemoval(sel);
 }
 
-void TextView::clearFolds()
+/*!
+ * \fn void removeFolds(const std::vector<int>& ids)
+ * \brief removes several folds with a single relayout of the view
+ */
+void TextView::removeFolds(const std::vector<int>& ids)
 {
-  while (!d->folds.empty())
-  {
-    TextFold f = d->folds.back();
-    d->folds.pop_back();
+  TYPEWRITER_SCOPED_TIMER("view.removeFolds");
+
+  const size_t count = d->folds.size();
+
+  for (int id : ids)
+    d->folds.erase(id);
 
+  if (d->folds.size() != count)
+  {
     Composer composer{ d.get() };
-    composer.handleFoldRemoval(f.cursor);
+    composer.relayout();
   }
 }
 
+void TextView::clearFolds()
+{
+  if (d->folds.empty())
+    return;
+
+  d->folds.clear();
+
+  Composer composer{ d.get() };
+  composer.relayout();
+}
+
+bool TextView::hasFold(int id) const
+{
+  return d->folds.find(id) != nullptr;
+}
+
+int TextView::foldCount() const
+{
+  return static_cast<int>(d->folds.size());
+}
+
 void TextView::addInsert(view::Insert ins)
 {
-  auto it = std::lower_bound(d->inserts.begin(), d->inserts.end(), ins, 
-    [](const view::Insert& lhs, const view::Insert& rhs) -> bool {
-      return lhs.cursor.position() < rhs.cursor.position();
-    });
+  addInserts(std::vector<view::Insert>{ std::move(ins) });
+}
+
+/*!
+ * \fn void addInserts(std::vector<view::Insert> inserts)
+ * \brief adds several inserts, only the blocks that receive an insert are relayouted
+ */
+void TextView::addInserts(std::vector<view::Insert> inserts)
+{
+  TYPEWRITER_SCOPED_TIMER("view.addInserts");
+
+  std::vector<TextBlock> blocks;
+  d->inserts.insert(std::move(inserts), blocks);
+
+  Composer composer{ d.get() };
+  composer.relayout(blocks);
+}
+
+/*!
+ * \fn void removeInserts(const Position& begin, const Position& end)
+ * \brief removes the inserts positioned between two positions
+ *
+ * The inserts at 'end' are kept.
+ */
+void TextView::removeInserts(const Position& begin, const Position& end)
+{
+  std::vector<TextBlock> blocks;
+  d->inserts.remove(begin, end, blocks);
+
+  Composer composer{ d.get() };
+  composer.relayout(blocks);
+}
 
-  it = d->inserts.insert(it, ins);
+/*!
+ * \fn void replaceInserts(const Position& begin, const Position& end, std::vector<view::Insert> inserts)
+ * \brief replaces the inserts positioned between two positions with a single relayout
+ */
+void TextView::replaceInserts(const Position& begin, const Position& end, std::vector<view::Insert> inserts)
+{
+  TYPEWRITER_SCOPED_TIMER("view.replaceInserts");
+
+  std::vector<TextBlock> blocks;
+  d->inserts.remove(begin, end, blocks);
+  d->inserts.insert(std::move(inserts), blocks);
 
   Composer composer{ d.get() };
-  composer.relayout(ins.cursor.block());
+  composer.relayout(blocks);
 }
 
 void TextView::addInlineInsert(view::InlineInsert ins)
 {
-  auto it = std::lower_bound(d->inline_inserts.begin(), d->inline_inserts.end(), ins, 
-    [](const view::InlineInsert& lhs, const view::InlineInsert& rhs) -> bool {
-      return lhs.cursor.position() < rhs.cursor.position();
-    });
+  addInlineInserts(std::vector<view::InlineInsert>{ std::move(ins) });
+}
+
+/*!
+ * \fn void addInlineInserts(std::vector<view::InlineInsert> inserts)
+ * \brief adds several inline inserts, only the blocks that receive an insert are relayouted
+ */
+void TextView::addInlineInserts(std::vector<view::InlineInsert> inserts)
+{
+  TYPEWRITER_SCOPED_TIMER("view.addInlineInserts");
+
+  std::vector<TextBlock> blocks;
+  d->inline_inserts.insert(std::move(inserts), blocks);
+
+  Composer composer{ d.get() };
+  composer.relayout(blocks);
+}
+
+void TextView::removeInlineInserts(const Position& begin, const Position& end)
+{
+  std::vector<TextBlock> blocks;
+  d->inline_inserts.remove(begin, end, blocks);
+
+  Composer composer{ d.get() };
+  composer.relayout(blocks);
+}
+
+void TextView::replaceInlineInserts(const Position& begin, const Position& end, std::vector<view::InlineInsert> inserts)
+{
+  TYPEWRITER_SCOPED_TIMER("view.replaceInlineInserts");
 
-  it = d->inline_inserts.insert(it, ins);
+  std::vector<TextBlock> blocks;
+  d->inline_inserts.remove(begin, end, blocks);
+  d->inline_inserts.insert(std::move(inserts), blocks);
 
   Composer composer{ d.get() };
-  composer.relayout(ins.cursor.block());
+  composer.relayout(blocks);
 }
 
 void TextView::clearInserts()
 {
-  while (!d->inserts.empty())
-  {
-    view::Insert ins = d->inserts.back();
-    d->inserts.pop_back();
+  std::vector<TextBlock> blocks;
+  d->inserts.clear(blocks);
+  d->inline_inserts.clear(blocks);
 
-    Composer composer{ d.get() };
-    composer.relayout(ins.cursor.block());
-  }
+  Composer composer{ d.get() };
+  composer.relayout(blocks);
+}
 
-  while (!d->inline_inserts.empty())
-  {
-    view::InlineInsert ins = d->inline_inserts.back();
-    d->inline_inserts.pop_back();
+/*!
+ * \fn std::vector<view::Insert> inserts() const
+ * \brief returns a copy of the inserts, in document order
+ */
+std::vector<view::Insert> TextView::inserts() const
+{
+  return d->inserts.values();
+}
 
-    Composer composer{ d.get() };
-    composer.relayout(ins.cursor.block());
-  }
+/*!
+ * \fn std::vector<view::InlineInsert> inlineInserts() const
+ * \brief returns a copy of the inline inserts, in document order
+ */
+std::vector<view::InlineInsert> TextView::inlineInserts() const
+{
+  return d->inline_inserts.values();
+}
+
+int TextView::insertCount() const
+{
+  return static_cast<int>(d->inserts.size());
+}
+
+int TextView::inlineInsertCount() const
+{
+  return static_cast<int>(d->inline_inserts.size());
 }
 
-const std::vector<view::Insert>& TextView::inserts() const
+TextDecorations* TextView::decorations() const
 {
-  return d->inserts;
+  return d->decorations;
 }
 
-const std::vector<view::InlineInsert>& TextView::inlineInserts() const
+/*!
+ * \fn void setDecorations(TextDecorations* decorations)
+ * \brief sets the decorations displayed by the view
+ *
+ * The view does not take ownership of the decorations, which must be those of its document.
+ * The layout is not affected.
+ */
+void TextView::setDecorations(TextDecorations* decorations)
 {
-  return d->inline_inserts;
+  assert(!decorations || decorations->document() == document());
+  d->decorations = decorations;
 }
 
 view::StyledFragments TextView::fragments(const view::Line& line, const view::LineElement& le) const
@@ -1053,8 +2042,58 @@ view::StyledFragments TextView::fragments(const view::Line& line, const view::Li
   return view::StyledFragments(d.get(), &line, le);
 }
 
+ViewMemoryUsage TextView::memoryUsage() const
+{
+  ViewMemoryUsage result;
+
+  result.view = sizeof(TextView) + sizeof(TextViewImpl) + d->folds.memoryUsage()
+    + d->inserts.memoryUsage() + d->inline_inserts.memoryUsage();
+
+  for (const view::Line& l : d->lines)
+    result.lines += memory::node_size<view::Line>() + memory::heap_size(l.elements);
+
+  result.blocks = d->blocks.bucket_count() * sizeof(void*);
+
+  for (const auto& entry : d->blocks)
+  {
+    result.blocks += memory::node_size<std::pair<TextBlockImpl* const, std::shared_ptr<view::Block>>>()
+      + memory::shared_node_size<view::Block>();
+    result.formats += memory::heap_size(entry.second->formats);
+  }
+
+  result.line_index = memory::heap_size(d->line_index.rows) + memory::heap_size(d->line_index.fragments);
+
+  return result;
+}
+
+/*!
+ * \fn void shrink()
+ * \brief releases the memory that is not needed by the view
+ *
+ * The line index is dropped and rebuilt when needed.
+ */
+void TextView::shrink()
+{
+  for (view::Line& l : d->lines)
+    l.elements.shrink_to_fit();
+
+  for (const auto& entry : d->blocks)
+    entry.second->formats.shrink_to_fit();
+
+  d->blocks.rehash(0);
+  d->inserts.shrink();
+  d->inline_inserts.shrink();
+
+  d->line_index.valid = false;
+  std::vector<std::list<view::Line>::const_iterator>().swap(d->line_index.rows);
+  std::vector<LineIndex::Fragment>().swap(d->line_index.fragments);
+}
+
 void TextView::blockDestroyed(int line, const TextBlock & block)
 {
+  d->inserts.blockDestroyed(block);
+  d->inline_inserts.blockDestroyed(block);
+
   Composer cmp{ d.get() };
   cmp.handleBlockRemoval(block);
 
@@ -1078,9 +2117,7 @@ void TextView::blockInserted(const Position & pos, const TextBlock & block)
   auto info = std::make_shared<view::Block>(block, d->lines.end());
   d->blocks[block.impl()] = info;
 
-  Composer cmp{ d.get() };
-  cmp.handleBlockInsertion(block);
-
+  // the block must be linked before the relayout, which walks the chain of blocks
   auto prev_info = d->blocks[block.previous().impl()];
 
   auto next_info = prev_info->next.lock();
@@ -1093,6 +2130,12 @@ void TextView::blockInserted(const Position & pos, const TextBlock & block)
 
   prev_info->next = info;
   info->prev = prev_info;
+
+  d->inserts.blockInserted(block);
+  d->inline_inserts.blockInserted(block);
+
+  Composer cmp{ d.get() };
+  cmp.handleBlockInsertion(block);
 }
 
 void TextView::contentsChange(const TextBlock& block, const Position& pos, int charsRemoved, int charsAdded)
@@ -1101,4 +2144,176 @@ void TextView::contentsChange(const TextBlock& block, const Position& pos, int c
   cmp.relayout(block);
 }
 
+void TextView::blocksAppended(int line, int count)
+{
+  TextBlock block = prev(document()->lastBlock(), count);
+
+  std::shared_ptr<view::Block> prev_info = d->blocks[block.impl()];
+
+  for (TextBlockView it = block.next(); !it.isNull(); it = it.next())
+  {
+    auto info = std::make_shared<view::Block>(it.block(), d->lines.end());
+    d->blocks[it.impl()] = info;
+
+    prev_info->next = info;
+    info->prev = prev_info;
+    prev_info = info;
+  }
+
+  Composer cmp{ d.get() };
+  cmp.handleBlocksAppended(block);
+}
+
+void TextView::blocksDiscarded(int count)
+{
+  d->inserts.removeGarbage();
+  d->inline_inserts.removeGarbage();
+
+  if (!d->folds.empty())
+  {
+    // the cursors in the discarded blocks were moved to the first block:
+    // the folds ending there are removed, the others start at (0, 0)
+    std::vector<TextFold> folds;
+
+    for (const TextFold* f : d->folds)
+    {
+      if (f->cursor.anchor() < f->cursor.position())
+        folds.push_back(*f);
+    }
+
+    d->folds.clear();
+
+    for (TextFold& f : folds)
+      d->folds.insert(std::move(f));
+
+    for (auto it = d->blocks.begin(); it != d->blocks.end(); )
+    {
+      if (it->second->block.isValid())
+        ++it;
+      else
+        it = d->blocks.erase(it);
+    }
+
+    Composer cmp{ d.get() };
+    cmp.relayout();
+    return;
+  }
+
+  d->line_index.valid = false;
+
+  std::shared_ptr<view::Block> first = d->blocks[document()->firstBlock().impl()];
+
+  int longest_removed_line = 0;
+
+  for (auto it = d->lines.begin(); it != first->line; it = d->lines.erase(it))
+    longest_removed_line = std::max(longest_removed_line, it->width());
+
+  std::shared_ptr<view::Block> info = first->prev.lock();
+
+  while (info)
+  {
+    std::shared_ptr<view::Block> prev_info = info->prev.lock();
+    d->blocks.erase(info->block.impl());
+    info = prev_info;
+  }
+
+  first->prev.reset();
+
+  if (longest_removed_line >= d->longest_line_length)
+    d->refreshLongestLineLength();
+}
+
+void TextView::blocksReplaced(int line, int count, int newCount)
+{
+  const TextBlock before = line > 0 ? document()->findBlockByNumber(line - 1) : TextBlock();
+  TextBlock block = line > 0 ? before.next() : document()->firstBlock();
+  const TextBlock end = block.isValid() ? next(block, newCount) : TextBlock();
+
+  std::shared_ptr<view::Block> prev_info = line > 0 ? d->blocks[before.impl()] : nullptr;
+  std::shared_ptr<view::Block> end_info = end.isValid() ? d->blocks[end.impl()] : nullptr;
+
+  // the lines of the blocks are only contiguous if there are no folds
+  const bool partial = d->folds.empty() && (prev_info || end_info);
+  int longest_removed_line = 0;
+
+  if (partial)
+  {
+    // the entries of the blocks that were in the range, still linked together
+    std::vector<std::shared_ptr<view::Block>> old_infos;
+
+    if (prev_info)
+    {
+      for (auto info = prev_info->next.lock(); info && info != end_info; info = info->next.lock())
+        old_infos.push_back(info);
+    }
+    else
+    {
+      for (auto info = end_info->prev.lock(); info; info = info->prev.lock())
+        old_infos.push_back(info);
+    }
+
+    for (const std::shared_ptr<view::Block>& info : old_infos)
+    {
+      if (info->block.isValid())
+        continue;
+
+      for (auto it = info->line; it != d->lines.end() && view::is_line_of(*it, info->block.impl()); it = d->lines.erase(it))
+        longest_removed_line = std::max(longest_removed_line, it->width());
+
+      d->blocks.erase(info->block.impl());
+    }
+  }
+  else if (count != newCount)
+  {
+    for (auto it = d->blocks.begin(); it != d->blocks.end(); )
+    {
+      if (it->second->block.isValid())
+        ++it;
+      else
+        it = d->blocks.erase(it);
+    }
+  }
+
+  prev_info = line > 0 ? d->blocks[before.impl()] : nullptr;
+
+  // the block following the range is relinked too
+  for (int i(0); i <= newCount && block.isValid(); ++i, block = block.next())
+  {
+    std::shared_ptr<view::Block>& info = d->blocks[block.impl()];
+
+    if (!info)
+      info = std::make_shared<view::Block>(block, d->lines.end());
+
+    info->prev = prev_info;
+
+    if (prev_info)
+      prev_info->next = info;
+
+    prev_info = info;
+  }
+
+  if (!block.isValid())
+    prev_info->next.reset();
+
+  d->inserts.rebuild();
+  d->inline_inserts.rebuild();
+
+  Composer cmp{ d.get() };
+
+  if (!partial)
+  {
+    cmp.relayout();
+    return;
+  }
+
+  // the block before the range is laid out again to find where the lines go
+  if (line > 0)
+    cmp.handleBlocksReplaced(before, line - 1, line + newCount);
+  else
+    cmp.handleBlocksReplaced(document()->firstBlock(), 0, newCount);
+
+  if (longest_removed_line >= d->longest_line_length)
+    d->refreshLongestLineLength();
+}
+
 } // namespace typewriter
@@ -0,0 +1,359 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/textwriter.h"
+
+#include "typewriter/textblock.h"
+#include "typewriter/textdocument.h"
+#include "typewriter/textsnapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace typewriter
+{
+
+namespace
+{
+
+const std::string& line_separator(SaveOptions::LineEnding le)
+{
+  static const std::string lf = "\n";
+  static const std::string crlf = "\r\n";
+  static const std::string cr = "\r";
+
+  switch (le)
+  {
+  case SaveOptions::CRLF:
+    return crlf;
+  case SaveOptions::CR:
+    return cr;
+  default:
+    return lf;
+  }
+}
+
+#if defined(_WIN32)
+
+// Fallback relying on the buffering of the C library
+class FileWriter
+{
+public:
+  FileWriter(const std::string& path, const SaveOptions& options)
+    : m_path(path),
+      m_options(options)
+  {
+    m_file_path = options.atomic_replace ? path + ".tmp" : path;
+    m_file = std::fopen(m_file_path.c_str(), "wb");
+
+    if (!m_file)
+      throw std::runtime_error{ "Could not open file for writing" };
+  }
+
+  ~FileWriter()
+  {
+    if (m_file)
+    {
+      std::fclose(m_file);
+
+      if (m_options.atomic_replace)
+        std::remove(m_file_path.c_str());
+    }
+  }
+
+  void write(const char* data, size_t size)
+  {
+    if (size > 0 && std::fwrite(data, 1, size, m_file) != size)
+      throw std::runtime_error{ "Could not write file" };
+  }
+
+  void commit()
+  {
+    if (std::fflush(m_file) != 0 || (m_options.fsync && _commit(_fileno(m_file)) != 0))
+      throw std::runtime_error{ "Could not write file" };
+
+    std::fclose(m_file);
+    m_file = nullptr;
+
+    if (m_options.atomic_replace)
+    {
+      std::remove(m_path.c_str());
+
+      if (std::rename(m_file_path.c_str(), m_path.c_str()) != 0)
+      {
+        std::remove(m_file_path.c_str());
+        throw std::runtime_error{ "Could not replace file" };
+      }
+    }
+  }
+
+private:
+  std::string m_path;
+  SaveOptions m_options;
+  std::string m_file_path;
+  FILE* m_file = nullptr;
+};
+
+#else
+
+// Gathers the lines and their separators in batches written with writev().
+// Short pieces are copied into a staging buffer so that each iovec carries
+// a reasonable amount of data, long lines are written from where they are.
+class FileWriter
+{
+public:
+  FileWriter(const std::string& path, const SaveOptions& options)
+    : m_path(path),
+      m_options(options)
+  {
+    if (options.atomic_replace)
+    {
+      std::vector<char> tmp_path{ path.begin(), path.end() };
+      const char suffix[] = ".XXXXXX";
+      tmp_path.insert(tmp_path.end(), suffix, suffix + sizeof(suffix));
+
+      m_fd = mkstemp(tmp_path.data());
+
+      if (m_fd == -1)
+        throw std::runtime_error{ "Could not open file for writing" };
+
+      m_file_path = tmp_path.data();
+
+      // mkstemp() creates the file with 0600 permissions,
+      // keep the permissions of the file being replaced
+      struct stat st;
+      fchmod(m_fd, stat(path.c_str(), &st) == 0 ? (st.st_mode & 07777) : 0644);
+    }
+    else
+    {
+      m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+      if (m_fd == -1)
+        throw std::runtime_error{ "Could not open file for writing" };
+
+      m_file_path = path;
+    }
+
+#if defined(IOV_MAX)
+    m_max_iov = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#endif
+
+    m_iov.reserve(m_max_iov);
+    m_buffer.resize(BufferSize);
+  }
+
+  ~FileWriter()
+  {
+    if (m_fd != -1)
+    {
+      close(m_fd);
+
+      if (m_options.atomic_replace)
+        unlink(m_file_path.c_str());
+    }
+  }
+
+  // the data must stay valid until the next flush
+  void write(const char* data, size_t size)
+  {
+    if (size == 0)
+      return;
+
+    if (m_iov.size() == m_max_iov)
+      flush();
+
+    if (size < SmallWriteSize)
+    {
+      if (m_buffer_used + size > m_buffer.size())
+        flush();
+
+      char* dest = m_buffer.data() + m_buffer_used;
+      std::memcpy(dest, data, size);
+      m_buffer_used += size;
+
+      if (!m_iov.empty() && static_cast<char*>(m_iov.back().iov_base) + m_iov.back().iov_len == dest)
+      {
+        m_iov.back().iov_len += size;
+        return;
+      }
+
+      data = dest;
+    }
+
+    struct iovec v;
+    v.iov_base = const_cast<char*>(data);
+    v.iov_len = size;
+    m_iov.push_back(v);
+  }
+
+  void commit()
+  {
+    flush();
+
+    if (m_options.fsync && fsync(m_fd) != 0)
+      throw std::runtime_error{ "Could not write file" };
+
+    const int fd = m_fd;
+    m_fd = -1;
+
+    if (close(fd) != 0)
+    {
+      if (m_options.atomic_replace)
+        unlink(m_file_path.c_str());
+
+      throw std::runtime_error{ "Could not write file" };
+    }
+
+    if (m_options.atomic_replace)
+    {
+      if (rename(m_file_path.c_str(), m_path.c_str()) != 0)
+      {
+        unlink(m_file_path.c_str());
+        throw std::runtime_error{ "Could not replace file" };
+      }
+
+      if (m_options.fsync)
+        sync_directory();
+    }
+  }
+
+protected:
+  void flush()
+  {
+    struct iovec* it = m_iov.data();
+    int count = static_cast<int>(m_iov.size());
+
+    while (count > 0)
+    {
+      ssize_t n = writev(m_fd, it, count);
+
+      if (n < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        throw std::runtime_error{ "Could not write file" };
+      }
+
+      // handle partial writes
+      while (count > 0 && static_cast<size_t>(n) >= it->iov_len)
+      {
+        n -= it->iov_len;
+        ++it;
+        --count;
+      }
+
+      if (count > 0)
+      {
+        it->iov_base = static_cast<char*>(it->iov_base) + n;
+        it->iov_len -= n;
+      }
+    }
+
+    m_iov.clear();
+    m_buffer_used = 0;
+  }
+
+  // makes the rename durable
+  void sync_directory()
+  {
+    const size_t sep = m_path.rfind('/');
+    const std::string dir = sep == std::string::npos ? std::string(".") : m_path.substr(0, sep + 1);
+
+    const int fd = open(dir.c_str(), O_RDONLY);
+
+    if (fd != -1)
+    {
+      fsync(fd);
+      close(fd);
+    }
+  }
+
+private:
+  enum
+  {
+    BufferSize = 64 * 1024,
+    SmallWriteSize = 1024,
+  };
+
+  std::string m_path;
+  SaveOptions m_options;
+  std::string m_file_path;
+  int m_fd = -1;
+  std::vector<struct iovec> m_iov;
+  size_t m_max_iov = 1024;
+  std::vector<char> m_buffer;
+  size_t m_buffer_used = 0;
+};
+
+#endif // defined(_WIN32)
+
+const std::string& text_of(const TextBlockRange::Item& item)
+{
+  return item.text();
+}
+
+const std::string& text_of(const std::string& line)
+{
+  return line;
+}
+
+template<typename Range>
+void write_lines(const Range& lines, const std::string& path, const SaveOptions& options)
+{
+  const std::string& separator = line_separator(options.line_ending);
+
+  FileWriter writer{ path, options };
+
+  bool first = true;
+
+  for (const auto& line : lines)
+  {
+    if (!first)
+      writer.write(separator.data(), separator.size());
+
+    const std::string& text = text_of(line);
+    writer.write(text.data(), text.size());
+
+    first = false;
+  }
+
+  writer.commit();
+}
+
+} // namespace
+
+void save(const TextDocument& document, const std::string& path, const SaveOptions& options)
+{
+  write_lines(document.blocks(), path, options);
+}
+
+void save(const TextSnapshot& snapshot, const std::string& path, const SaveOptions& options)
+{
+  write_lines(snapshot, path, options);
+}
+
+std::future<void> saveAsync(const TextDocument& document, const std::string& path, const SaveOptions& options)
+{
+  TextSnapshot snapshot = document.snapshot();
+
+  return std::async(std::launch::async, [snapshot, path, options]() {
+    save(snapshot, path, options);
+    });
+}
+
+} // namespace typewriter
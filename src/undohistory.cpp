@@ -0,0 +1,640 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/private/undohistory_p.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace typewriter
+{
+
+namespace
+{
+
+void write_varint(std::string& out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+
+  out.push_back(static_cast<char>(value));
+}
+
+uint64_t read_varint(const std::string& in, size_t& pos)
+{
+  uint64_t value = 0;
+  int shift = 0;
+
+  for (;;)
+  {
+    if (pos >= in.size())
+      throw std::runtime_error{ "Corrupted undo history" };
+
+    const unsigned char c = static_cast<unsigned char>(in[pos++]);
+    value |= static_cast<uint64_t>(c & 0x7F) << shift;
+
+    if (!(c & 0x80))
+      return value;
+
+    shift += 7;
+  }
+}
+
+std::string serialize(const TextDiff& delta)
+{
+  std::string out;
+  const std::vector<TextDiff::Diff>& diffs = delta.diffs();
+
+  write_varint(out, diffs.size());
+
+  for (const TextDiff::Diff& d : diffs)
+  {
+    out.push_back(d.isInsertion() ? 'i' : 'r');
+    write_varint(out, d.begin().line);
+    write_varint(out, d.begin().column);
+    write_varint(out, d.text().size());
+    out += d.text();
+  }
+
+  return out;
+}
+
+TextDiff deserialize(const std::string& in)
+{
+  TextDiff delta;
+  size_t pos = 0;
+  const size_t count = read_varint(in, pos);
+
+  for (size_t i(0); i < count; ++i)
+  {
+    const char kind = in.at(pos++);
+    Position p;
+    p.line = static_cast<int>(read_varint(in, pos));
+    p.column = static_cast<int>(read_varint(in, pos));
+    const size_t size = read_varint(in, pos);
+    std::string text = in.substr(pos, size);
+    pos += size;
+
+    delta.append(kind == 'i' ? diff::insert(p, text) : diff::remove(p, text));
+  }
+
+  return delta;
+}
+
+/*
+ * LZ77 compression using a hash table of 4-byte sequences.
+ * The output is the size of the input followed by a series of
+ * (literal count, literals, match length, match offset), the last one
+ * having no match.
+ */
+
+const size_t MinMatch = 4;
+const int HashBits = 14;
+
+inline uint32_t read32(const char* p)
+{
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint32_t hash4(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - HashBits);
+}
+
+std::string compress_bytes(const std::string& input)
+{
+  std::string out;
+  out.reserve(input.size() / 2 + 16);
+  write_varint(out, input.size());
+
+  const char* data = input.data();
+  const size_t n = input.size();
+  std::vector<int> table(size_t(1) << HashBits, -1);
+  size_t anchor = 0;
+  size_t i = 0;
+
+  while (i + MinMatch <= n)
+  {
+    const uint32_t v = read32(data + i);
+    const uint32_t h = hash4(v);
+    const int candidate = table[h];
+    table[h] = static_cast<int>(i);
+
+    if (candidate < 0 || read32(data + candidate) != v)
+    {
+      ++i;
+      continue;
+    }
+
+    size_t length = MinMatch;
+
+    while (i + length < n && data[candidate + length] == data[i + length])
+      ++length;
+
+    write_varint(out, i - anchor);
+    out.append(data + anchor, i - anchor);
+    write_varint(out, length - MinMatch);
+    write_varint(out, i - candidate);
+
+    i += length;
+    anchor = i;
+  }
+
+  write_varint(out, n - anchor);
+  out.append(data + anchor, n - anchor);
+
+  return out;
+}
+
+std::string decompress_bytes(const std::string& input)
+{
+  size_t pos = 0;
+  const size_t size = read_varint(input, pos);
+
+  std::string out;
+  out.reserve(size);
+
+  for (;;)
+  {
+    const size_t literals = read_varint(input, pos);
+
+    if (pos + literals > input.size())
+      throw std::runtime_error{ "Corrupted undo history" };
+
+    out.append(input, pos, literals);
+    pos += literals;
+
+    if (out.size() >= size)
+      break;
+
+    const size_t length = read_varint(input, pos) + MinMatch;
+    const size_t offset = read_varint(input, pos);
+
+    if (offset == 0 || offset > out.size())
+      throw std::runtime_error{ "Corrupted undo history" };
+
+    // the match may overlap the bytes being written
+    size_t from = out.size() - offset;
+
+    for (size_t i(0); i < length; ++i)
+      out.push_back(out[from + i]);
+  }
+
+  return out;
+}
+
+size_t estimate_memory_usage(const TextDiff& delta)
+{
+  size_t bytes = sizeof(UndoEntry);
+
+  for (const TextDiff::Diff& d : delta.diffs())
+    bytes += sizeof(TextDiff::Diff) + d.text().size();
+
+  return bytes;
+}
+
+bool is_single_line(const TextDiff::Diff& d)
+{
+  return d.text().find('\n') == std::string::npos;
+}
+
+} // namespace
+
+UndoHistory::UndoHistory()
+{
+
+}
+
+UndoHistory::~UndoHistory()
+{
+  clear();
+}
+
+void UndoHistory::setPolicy(const UndoPolicy& policy)
+{
+  m_policy = policy;
+  enforce_policy();
+}
+
+void UndoHistory::push(Contribution c)
+{
+  if (c.delta.isEmpty())
+    return;
+
+  for (const UndoEntry& e : m_redo)
+    m_bytes -= e.bytes;
+
+  m_redo.clear();
+
+  if (m_policy.merge_consecutive_edits && !m_undo.empty())
+  {
+    UndoEntry& top = m_undo.back();
+    const bool merge = can_merge(top, c);
+    top.delta.squeeze();
+
+    if (merge)
+    {
+      m_bytes -= top.bytes;
+      top.delta << c.delta;
+      top.bytes = estimate_memory_usage(top.delta);
+      top.delta.squeeze();
+      m_bytes += top.bytes;
+      return;
+    }
+  }
+
+  add(m_undo, std::move(c));
+  enforce_policy();
+}
+
+size_t UndoHistory::undoCount(const Author& author) const
+{
+  return std::count_if(m_undo.begin(), m_undo.end(), [&author](const UndoEntry& e) { return e.author == author; });
+}
+
+size_t UndoHistory::redoCount(const Author& author) const
+{
+  return std::count_if(m_redo.begin(), m_redo.end(), [&author](const UndoEntry& e) { return e.author == author; });
+}
+
+Contribution UndoHistory::takeUndo()
+{
+  return take(m_undo);
+}
+
+Contribution UndoHistory::takeRedo()
+{
+  return take(m_redo);
+}
+
+/*
+ * Selective undo: the last contribution of the author is removed from the
+ * history even if other authors edited the text since then.
+ * Its inverse is transformed through the later contributions, which are
+ * themselves rebased so that they no longer depend on it.
+ * The returned contribution is the one that would have produced the 
+ * current text if it had been made last, so that reverting it undoes 
+ * the original contribution.
+ */
+Contribution UndoHistory::takeUndo(const Author& author)
+{
+  const int k = find_last(m_undo, author);
+
+  if (k == -1)
+    throw std::runtime_error{ "No undo action for this author" };
+
+  load_in_place(m_undo[k]);
+  TextDiff inverse = m_undo[k].delta.inverted();
+
+  for (size_t j = k + 1; j < m_undo.size(); ++j)
+  {
+    load_in_place(m_undo[j]);
+    TextDiff later = std::move(m_undo[j].delta);
+    diff::transform(inverse, later);
+    set_delta(m_undo[j], std::move(later));
+  }
+
+  m_bytes -= m_undo[k].bytes;
+  m_undo.erase(m_undo.begin() + k);
+
+  // Rebased contributions that became empty are dropped
+  for (size_t j = k; j < m_undo.size(); )
+  {
+    if (m_undo[j].delta.isEmpty())
+    {
+      m_bytes -= m_undo[j].bytes;
+      m_undo.erase(m_undo.begin() + j);
+    }
+    else
+    {
+      ++j;
+    }
+  }
+
+  Contribution c;
+  c.author = author;
+  c.delta = inverse.inverted();
+  return c;
+}
+
+/*
+ * Selective redo: the entries above in the redo stack were undone after
+ * the author's entry, so the latter is transformed through their inverses.
+ */
+Contribution UndoHistory::takeRedo(const Author& author)
+{
+  const int k = find_last(m_redo, author);
+
+  if (k == -1)
+    throw std::runtime_error{ "No redo action for this author" };
+
+  load_in_place(m_redo[k]);
+  TextDiff delta = std::move(m_redo[k].delta);
+
+  for (size_t j = k + 1; j < m_redo.size(); ++j)
+  {
+    load_in_place(m_redo[j]);
+    TextDiff undone = m_redo[j].delta.inverted();
+    diff::transform(delta, undone);
+    set_delta(m_redo[j], undone.inverted());
+  }
+
+  m_bytes -= m_redo[k].bytes;
+  m_redo.erase(m_redo.begin() + k);
+
+  for (size_t j = k; j < m_redo.size(); )
+  {
+    if (m_redo[j].delta.isEmpty())
+    {
+      m_bytes -= m_redo[j].bytes;
+      m_redo.erase(m_redo.begin() + j);
+    }
+    else
+    {
+      ++j;
+    }
+  }
+
+  Contribution c;
+  c.author = author;
+  c.delta = std::move(delta);
+  return c;
+}
+
+void UndoHistory::pushUndo(Contribution c)
+{
+  add(m_undo, std::move(c));
+  enforce_policy();
+}
+
+void UndoHistory::pushRedo(Contribution c)
+{
+  add(m_redo, std::move(c));
+  enforce_policy();
+}
+
+UndoMemoryUsage UndoHistory::memoryUsageDetails() const
+{
+  UndoMemoryUsage result;
+  result.steps = static_cast<int>(m_undo.size() + m_redo.size());
+
+  for (const std::deque<UndoEntry>* stack : { &m_undo, &m_redo })
+  {
+    for (const UndoEntry& e : *stack)
+    {
+      if (e.state == UndoEntry::Live)
+        result.live += e.bytes;
+      else
+        result.compressed += e.bytes;
+
+      if (e.state == UndoEntry::Spilled)
+        result.spilled += e.size;
+    }
+  }
+
+  return result;
+}
+
+void UndoHistory::shrink()
+{
+  m_undo.shrink_to_fit();
+  m_redo.shrink_to_fit();
+
+  // the spill file only grows, it is only worth closing once nothing refers to it
+  if (m_spill_file && m_undo.empty() && m_redo.empty())
+  {
+    std::fclose(m_spill_file);
+    m_spill_file = nullptr;
+  }
+}
+
+void UndoHistory::clear()
+{
+  m_undo.clear();
+  m_redo.clear();
+  m_bytes = 0;
+
+  if (m_spill_file)
+  {
+    std::fclose(m_spill_file);
+    m_spill_file = nullptr;
+  }
+}
+
+UndoEntry UndoHistory::make_entry(Contribution c) const
+{
+  UndoEntry entry;
+  entry.author = c.author;
+  entry.delta = std::move(c.delta);
+  entry.bytes = estimate_memory_usage(entry.delta);
+  entry.delta.squeeze();
+  return entry;
+}
+
+Contribution UndoHistory::take(std::deque<UndoEntry>& stack)
+{
+  assert(!stack.empty());
+
+  UndoEntry entry = std::move(stack.back());
+  stack.pop_back();
+  m_bytes -= entry.bytes;
+
+  load(entry);
+
+  Contribution c;
+  c.author = entry.author;
+  c.delta = std::move(entry.delta);
+  return c;
+}
+
+int UndoHistory::find_last(const std::deque<UndoEntry>& stack, const Author& author) const
+{
+  for (int i = static_cast<int>(stack.size()) - 1; i >= 0; --i)
+  {
+    if (stack[i].author == author)
+      return i;
+  }
+
+  return -1;
+}
+
+void UndoHistory::set_delta(UndoEntry& entry, TextDiff delta)
+{
+  m_bytes -= entry.bytes;
+  entry.delta = std::move(delta);
+  entry.bytes = estimate_memory_usage(entry.delta);
+  entry.delta.squeeze();
+  m_bytes += entry.bytes;
+}
+
+void UndoHistory::add(std::deque<UndoEntry>& stack, Contribution c)
+{
+  c.delta.squeeze();
+  stack.push_back(make_entry(std::move(c)));
+  m_bytes += stack.back().bytes;
+}
+
+bool UndoHistory::can_merge(const UndoEntry& entry, const Contribution& c) const
+{
+  if (entry.state != UndoEntry::Live || entry.author != c.author)
+    return false;
+
+  const std::vector<TextDiff::Diff>& previous = entry.delta.diffs();
+  const std::vector<TextDiff::Diff>& next = c.delta.diffs();
+
+  if (previous.size() != 1 || next.size() != 1)
+    return false;
+
+  const TextDiff::Diff& a = previous.front();
+  const TextDiff::Diff& b = next.front();
+
+  if (a.kind != b.kind || !is_single_line(a) || !is_single_line(b))
+    return false;
+
+  if (a.isInsertion())
+    return b.begin() == a.end();
+  else
+    return b.end() == a.begin() || b.begin() == a.begin();
+}
+
+void UndoHistory::compress(UndoEntry& entry)
+{
+  entry.data = compress_bytes(serialize(entry.delta));
+  entry.data.shrink_to_fit();
+  entry.delta.clear();
+  entry.state = UndoEntry::Compressed;
+
+  m_bytes -= entry.bytes;
+  entry.bytes = sizeof(UndoEntry) + entry.data.size();
+  m_bytes += entry.bytes;
+}
+
+bool UndoHistory::spill(UndoEntry& entry)
+{
+  assert(entry.state == UndoEntry::Compressed);
+
+  if (!m_spill_file)
+    m_spill_file = std::tmpfile();
+
+  if (!m_spill_file || std::fseek(m_spill_file, 0, SEEK_END) != 0)
+    return false;
+
+  entry.offset = std::ftell(m_spill_file);
+  entry.size = entry.data.size();
+
+  if (std::fwrite(entry.data.data(), 1, entry.size, m_spill_file) != entry.size)
+    return false;
+
+  std::string().swap(entry.data);
+  entry.state = UndoEntry::Spilled;
+
+  m_bytes -= entry.bytes;
+  entry.bytes = sizeof(UndoEntry);
+  m_bytes += entry.bytes;
+
+  return true;
+}
+
+void UndoHistory::load(UndoEntry& entry)
+{
+  if (entry.state == UndoEntry::Spilled)
+  {
+    entry.data.resize(entry.size);
+
+    if (std::fseek(m_spill_file, entry.offset, SEEK_SET) != 0
+      || std::fread(&entry.data[0], 1, entry.size, m_spill_file) != entry.size)
+      throw std::runtime_error{ "Could not read undo history" };
+
+    entry.state = UndoEntry::Compressed;
+  }
+
+  if (entry.state == UndoEntry::Compressed)
+  {
+    entry.delta = deserialize(decompress_bytes(entry.data));
+    std::string().swap(entry.data);
+    entry.state = UndoEntry::Live;
+    entry.bytes = estimate_memory_usage(entry.delta);
+    entry.delta.squeeze();
+  }
+}
+
+void UndoHistory::load_in_place(UndoEntry& entry)
+{
+  m_bytes -= entry.bytes;
+  load(entry);
+  m_bytes += entry.bytes;
+}
+
+void UndoHistory::enforce_policy()
+{
+  compress_old_entries(m_undo);
+  compress_old_entries(m_redo);
+
+  // The most recent step is always kept
+  if (m_policy.max_steps > 0)
+  {
+    while (m_undo.size() + m_redo.size() > std::max<size_t>(1, m_policy.max_steps))
+      drop_oldest();
+  }
+
+  if (m_policy.max_bytes > 0)
+  {
+    while (m_bytes > m_policy.max_bytes)
+    {
+      if (m_policy.spill_to_disk && (spill_oldest(m_undo) || spill_oldest(m_redo)))
+        continue;
+
+      if (m_undo.size() + m_redo.size() <= 1)
+        break;
+
+      drop_oldest();
+    }
+  }
+}
+
+void UndoHistory::compress_old_entries(std::deque<UndoEntry>& stack)
+{
+  const int uncompressed = std::max(0, m_policy.uncompressed_steps);
+
+  for (int i = static_cast<int>(stack.size()) - 1 - uncompressed; i >= 0; --i)
+  {
+    if (stack[i].state != UndoEntry::Live)
+      break;
+
+    compress(stack[i]);
+  }
+}
+
+bool UndoHistory::spill_oldest(std::deque<UndoEntry>& stack)
+{
+  for (UndoEntry& e : stack)
+  {
+    if (e.state == UndoEntry::Compressed)
+      return spill(e);
+  }
+
+  return false;
+}
+
+void UndoHistory::drop_oldest()
+{
+  std::deque<UndoEntry>& stack = (m_undo.size() > 1 || m_redo.empty()) ? m_undo : m_redo;
+  m_bytes -= stack.front().bytes;
+  stack.pop_front();
+
+  if (m_undo.empty() && m_redo.empty() && m_spill_file)
+  {
+    std::fclose(m_spill_file);
+    m_spill_file = nullptr;
+  }
+}
+
+} // namespace typewriter
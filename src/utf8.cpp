@@ -0,0 +1,329 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "typewriter/utils/utf8.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TYPEWRITER_UTF8_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is selected at runtime, this requires support for the 'target' attribute
+#if defined(TYPEWRITER_UTF8_SSE2) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TYPEWRITER_UTF8_AVX2
+#include <immintrin.h>
+#endif
+
+namespace typewriter
+{
+
+namespace utf8
+{
+
+namespace
+{
+
+inline bool is_continuation_byte(char c)
+{
+  return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+inline int popcount(unsigned int x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcount(x);
+#else
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return static_cast<int>((x * 0x01010101) >> 24);
+#endif
+}
+
+size_t count_scalar(const char* data, size_t size)
+{
+  size_t result = 0;
+
+  for (size_t i(0); i < size; ++i)
+    result += !is_continuation_byte(data[i]);
+
+  return result;
+}
+
+size_t offset_scalar(const char* data, size_t size, size_t column)
+{
+  for (size_t i(0); i < size; ++i)
+  {
+    if (!is_continuation_byte(data[i]))
+    {
+      if (column == 0)
+        return i;
+
+      --column;
+    }
+  }
+
+  return size;
+}
+
+size_t skip_ascii_scalar(const char* data, size_t size)
+{
+  size_t i = 0;
+
+  while (i < size && static_cast<unsigned char>(data[i]) < 0x80)
+    ++i;
+
+  return i;
+}
+
+#if defined(TYPEWRITER_UTF8_SSE2)
+
+// A byte is not a continuation byte (0x80-0xBF) iff, as a signed integer, it is greater than -65 (0xBF).
+
+size_t count_sse2(const char* data, size_t size)
+{
+  const __m128i threshold = _mm_set1_epi8(-65);
+
+  size_t result = 0;
+  size_t i = 0;
+
+  for (; i + 16 <= size; i += 16)
+  {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    result += popcount(static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, threshold))));
+  }
+
+  return result + count_scalar(data + i, size - i);
+}
+
+size_t offset_sse2(const char* data, size_t size, size_t column)
+{
+  const __m128i threshold = _mm_set1_epi8(-65);
+
+  size_t i = 0;
+
+  for (; i + 16 <= size; i += 16)
+  {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    const size_t n = popcount(static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, threshold))));
+
+    if (n > column)
+      break;
+
+    column -= n;
+  }
+
+  return i + offset_scalar(data + i, size - i, column);
+}
+
+size_t skip_ascii_sse2(const char* data, size_t size)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= size; i += 16)
+  {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+
+    if (_mm_movemask_epi8(v) != 0)
+      break;
+  }
+
+  return i + skip_ascii_scalar(data + i, size - i);
+}
+
+#endif // defined(TYPEWRITER_UTF8_SSE2)
+
+#if defined(TYPEWRITER_UTF8_AVX2)
+
+__attribute__((target("avx2")))
+size_t count_avx2(const char* data, size_t size)
+{
+  const __m256i threshold = _mm256_set1_epi8(-65);
+
+  size_t result = 0;
+  size_t i = 0;
+
+  for (; i + 32 <= size; i += 32)
+  {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    result += popcount(static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, threshold))));
+  }
+
+  return result + count_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+size_t offset_avx2(const char* data, size_t size, size_t column)
+{
+  const __m256i threshold = _mm256_set1_epi8(-65);
+
+  size_t i = 0;
+
+  for (; i + 32 <= size; i += 32)
+  {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    const size_t n = popcount(static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, threshold))));
+
+    if (n > column)
+      break;
+
+    column -= n;
+  }
+
+  return i + offset_sse2(data + i, size - i, column);
+}
+
+__attribute__((target("avx2")))
+size_t skip_ascii_avx2(const char* data, size_t size)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= size; i += 32)
+  {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+
+    if (_mm256_movemask_epi8(v) != 0)
+      break;
+  }
+
+  return i + skip_ascii_sse2(data + i, size - i);
+}
+
+bool has_avx2()
+{
+  static const bool result = []() -> bool {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }();
+
+  return result;
+}
+
+#endif // defined(TYPEWRITER_UTF8_AVX2)
+
+size_t skip_ascii(const char* data, size_t size)
+{
+#if defined(TYPEWRITER_UTF8_AVX2)
+  if (has_avx2())
+    return skip_ascii_avx2(data, size);
+#endif
+
+#if defined(TYPEWRITER_UTF8_SSE2)
+  return skip_ascii_sse2(data, size);
+#else
+  return skip_ascii_scalar(data, size);
+#endif
+}
+
+// validates the multi-byte sequence at 'i', returns its length or 0 if it is invalid
+size_t validate_sequence(const unsigned char* s, size_t size, size_t i)
+{
+  const unsigned char lead = s[i];
+  size_t len = 0;
+  unsigned char min = 0x80;
+  unsigned char max = 0xBF;
+
+  if (lead < 0xC2)
+  {
+    return 0;
+  }
+  else if (lead < 0xE0)
+  {
+    len = 2;
+  }
+  else if (lead < 0xF0)
+  {
+    len = 3;
+
+    if (lead == 0xE0)
+      min = 0xA0; // overlong
+    else if (lead == 0xED)
+      max = 0x9F; // surrogates
+  }
+  else if (lead < 0xF5)
+  {
+    len = 4;
+
+    if (lead == 0xF0)
+      min = 0x90; // overlong
+    else if (lead == 0xF4)
+      max = 0x8F; // > U+10FFFF
+  }
+  else
+  {
+    return 0;
+  }
+
+  if (i + len > size)
+    return 0;
+
+  if (s[i + 1] < min || s[i + 1] > max)
+    return 0;
+
+  for (size_t k(2); k < len; ++k)
+  {
+    if (!is_continuation_byte(static_cast<char>(s[i + k])))
+      return 0;
+  }
+
+  return len;
+}
+
+} // namespace
+
+bool validate(const char* data, size_t size)
+{
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+
+  while (i < size)
+  {
+    i += skip_ascii(data + i, size - i);
+
+    // validate until the next run of ascii characters
+    while (i < size && s[i] >= 0x80)
+    {
+      const size_t len = validate_sequence(s, size, i);
+
+      if (len == 0)
+        return false;
+
+      i += len;
+    }
+  }
+
+  return true;
+}
+
+size_t count_codepoints(const char* data, size_t size)
+{
+#if defined(TYPEWRITER_UTF8_AVX2)
+  if (has_avx2())
+    return count_avx2(data, size);
+#endif
+
+#if defined(TYPEWRITER_UTF8_SSE2)
+  return count_sse2(data, size);
+#else
+  return count_scalar(data, size);
+#endif
+}
+
+size_t byte_offset(const char* data, size_t size, size_t column)
+{
+#if defined(TYPEWRITER_UTF8_AVX2)
+  if (has_avx2())
+    return offset_avx2(data, size, column);
+#endif
+
+#if defined(TYPEWRITER_UTF8_SSE2)
+  return offset_sse2(data, size, column);
+#else
+  return offset_scalar(data, size, column);
+#endif
+}
+
+} // namespace utf8
+
+} // namespace typewriter
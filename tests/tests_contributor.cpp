@@ -40,3 +40,54 @@ TEST_CASE("Contributors ", "[contributor]")
 
   REQUIRE(document.text(0) == "Hello World!");
 }
+
+TEST_CASE("Contributors can undo their edits selectively", "[contributor]")
+{
+  TextDocument document{
+    "Hello !"
+  };
+
+  Contributor alice{ "Alice" };
+  Contributor bob{ "Bob" };
+
+  alice.beginEdit(&document);
+  alice.getCursor(&document)->setPosition(Position{ 0, 6 });
+  alice.getCursor(&document)->insertText("World");
+  alice.endEdit(&document);
+
+  bob.beginEdit(&document);
+  bob.getCursor(&document)->setPosition(Position{ 0, 0 });
+  bob.getCursor(&document)->insertText("Hey, ");
+  bob.endEdit(&document);
+
+  REQUIRE(document.text(0) == "Hey, Hello World!");
+
+  alice.undo(&document);
+  REQUIRE(document.text(0) == "Hey, Hello !");
+
+  bob.undo(&document);
+  REQUIRE(document.text(0) == "Hello !");
+
+  alice.redo(&document);
+  REQUIRE(document.text(0) == "Hello World!");
+
+  bob.redo(&document);
+  REQUIRE(document.text(0) == "Hey, Hello World!");
+
+  // Bob edits the text inserted by Alice
+  bob.beginEdit(&document);
+  bob.getCursor(&document)->setPosition(Position{ 0, 12 });
+  bob.getCursor(&document)->deleteChar();
+  bob.getCursor(&document)->insertText("O\nr");
+  bob.endEdit(&document);
+
+  REQUIRE(document.toString() == "Hey, Hello WO\nrrld!");
+
+  alice.undo(&document);
+  REQUIRE(document.toString() == "Hey, Hello O\nr!");
+
+  REQUIRE_THROWS(alice.undo(&document));
+
+  bob.undo(&document);
+  REQUIRE(document.toString() == "Hey, Hello !");
+}
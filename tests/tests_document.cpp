@@ -7,6 +7,20 @@
 #include "typewriter/textblock.h"
 #include "typewriter/textcursor.h"
 #include "typewriter/textdocument.h"
+#include "typewriter/textdocumentloader.h"
+#include "typewriter/textsnapshot.h"
+#include "typewriter/textwriter.h"
+#include "typewriter/stringview.h"
+#include "typewriter/utils/instrumentation.h"
+#include "typewriter/utils/utf8.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <sstream>
+#include <vector>
 
 using namespace typewriter;
 
@@ -46,6 +60,175 @@ TEST_CASE("TextBlock can be used to iterate over the document", "[document]")
   REQUIRE(it == end);
 }
 
+TEST_CASE("TextBlockView can be used to traverse the document", "[document]")
+{
+  TextDocument document{
+    "A\n"
+    "B\n"
+    "C"
+  };
+
+  std::string text;
+
+  for (TextBlockView it = document.firstBlock(); it.isValid(); it = it.next())
+    text += it.text();
+
+  REQUIRE(text == "ABC");
+
+  TextBlockView last = document.lastBlock();
+  REQUIRE(last.previous().text() == "B");
+  REQUIRE(last.next().block().isNull());
+  REQUIRE(last.block() == document.lastBlock());
+
+  REQUIRE(next(document.firstBlock(), 2) == document.lastBlock());
+  REQUIRE(prev(document.lastBlock(), 2) == document.firstBlock());
+  REQUIRE(next(document.firstBlock(), 3) == TextBlock{});
+}
+
+TEST_CASE("Blocks can be read from several threads", "[document]")
+{
+  std::string content;
+
+  for (int i(0); i < 2000; ++i)
+    content += "caf\xc3\xa9 " + std::to_string(i) + " \xe4\xb8\xad\n";
+
+  TextDocument document{ content };
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 10, 2 });
+  cursor.insertText("\xc3\xa9");
+
+  // the column indexes are built by the edits, not by the readers
+  auto read = [&document]() {
+    size_t n = 0;
+
+    for (TextBlockView it = document.firstBlock(); it.isValid(); it = it.next())
+      n += it.length() + it.byteOffset(it.length()) + it.columnAt(it.size());
+
+    return n;
+  };
+
+  const size_t expected = read();
+  std::vector<size_t> results(4);
+  std::vector<std::thread> threads;
+
+  for (size_t i(0); i < results.size(); ++i)
+    threads.emplace_back([&read, &results, i]() { results[i] = read(); });
+
+  for (std::thread& t : threads)
+    t.join();
+
+  REQUIRE(results == std::vector<size_t>(4, expected));
+}
+
+TEST_CASE("Blocks can be iterated as a range", "[document]")
+{
+  TextDocument document{
+    "Hello\n"
+    "\n"
+    "World!\n"
+    "Bye"
+  };
+
+  REQUIRE(document.size() == document.toString().size());
+
+  std::vector<int> lines;
+  std::vector<size_t> offsets;
+
+  for (const TextBlockRange::Item& b : document.blocks())
+  {
+    lines.push_back(b.line);
+    offsets.push_back(b.offset);
+    REQUIRE(b.block.block().blockNumber() == b.line);
+    REQUIRE(b.block.block().offset() == int(b.offset));
+  }
+
+  REQUIRE(lines == std::vector<int>{ 0, 1, 2, 3 });
+  REQUIRE(offsets == std::vector<size_t>{ 0, 6, 7, 14 });
+
+  std::string text;
+
+  for (const TextBlockRange::Item& b : document.blocks(1, 3))
+    text += b.text() + ";";
+
+  REQUIRE(text == ";World!;");
+
+  REQUIRE(document.blocks(4).begin() == document.blocks(4).end());
+  REQUIRE(document.blocks(2, 2).begin() == document.blocks(2, 2).end());
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 2, 5 });
+  cursor.insertBlock();
+  cursor.insertText("abc");
+  cursor.deletePreviousChar();
+  cursor.setPosition(Position{ 0, 0 });
+  cursor.deleteChar();
+  cursor.setPosition(Position{ 1, 0 }, TextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+
+  REQUIRE(document.toString() == "\nWorld\nab!\nBye");
+  REQUIRE(document.size() == document.toString().size());
+}
+
+TEST_CASE("UTF-8 utilities", "[utf8]")
+{
+  REQUIRE(utf8::validate(""));
+  REQUIRE(utf8::validate("Hello World!"));
+  REQUIRE(utf8::validate("\xC3\xA9t\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80"));
+  REQUIRE(!utf8::validate("\xC0\xAF")); // overlong
+  REQUIRE(!utf8::validate("\xE0\x80\xAF")); // overlong
+  REQUIRE(!utf8::validate("\xED\xA0\x80")); // surrogate
+  REQUIRE(!utf8::validate("\xF4\x90\x80\x80")); // > U+10FFFF
+  REQUIRE(!utf8::validate("abc\xE2\x82")); // truncated
+  REQUIRE(!utf8::validate("\x80"));
+
+  // Long strings go through the vectorized paths
+  std::string text;
+  std::vector<size_t> offsets;
+  const char* pieces[] = { "a", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "                " };
+
+  unsigned int seed = 3;
+  for (int i(0); i < 2000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    offsets.push_back(text.size());
+    text += pieces[(seed >> 16) % 5];
+  }
+
+  REQUIRE(utf8::validate(text));
+  REQUIRE(!utf8::validate(text + "\xFF" + text));
+  size_t expected_count = 0;
+  for (size_t i(0); i < offsets.size(); ++i)
+  {
+    const size_t end = i + 1 < offsets.size() ? offsets[i + 1] : text.size();
+    expected_count += text[offsets[i]] == ' ' ? end - offsets[i] : 1;
+  }
+
+  REQUIRE(utf8::count_codepoints(text) == expected_count);
+  REQUIRE(StringView(text.data(), text.size()).length() == expected_count);
+
+  for (size_t column(0); column <= expected_count; column += 7)
+  {
+    const size_t offset = utf8::byte_offset(text, column);
+    REQUIRE(utf8::count_codepoints(text.data(), offset) == column);
+    REQUIRE((offset == text.size() || (static_cast<unsigned char>(text[offset]) & 0xC0) != 0x80));
+  }
+
+  REQUIRE(utf8::byte_offset(text, expected_count) == text.size());
+  REQUIRE(utf8::byte_offset(text, expected_count + 10) == text.size());
+
+  TextDocument document{ "\xC3\xA9t\xC3\xA9" };
+  TextBlockIterator it = document.firstBlock().begin();
+  it.seekColumn(2);
+  REQUIRE(it.column() == 2);
+  REQUIRE(!it.atEnd());
+  it.seekColumn(1);
+  REQUIRE(it.current() == 't');
+  it.seekColumn(5);
+  REQUIRE(it.atEnd());
+  REQUIRE(it.column() == 3);
+}
+
 TEST_CASE("Cursors can be used to edit a document", "[document]")
 {
   TextDocument document;
@@ -72,6 +255,63 @@ TEST_CASE("Cursors can be used to edit a document", "[document]")
   REQUIRE(document.toString() == "Hello World!\nGo");
 }
 
+TEST_CASE("Columns are expressed in code points", "[document]")
+{
+  // "h\u00e9llo w\u00f6rld"
+  TextDocument document{ "h\xC3\xA9llo w\xC3\xB6rld" };
+
+  TextBlock block = document.firstBlock();
+  REQUIRE(block.length() == 11);
+  REQUIRE(block.size() == 13);
+  REQUIRE(block.byteOffset(2) == 3);
+  REQUIRE(block.columnAt(3) == 2);
+  REQUIRE(block.byteOffset(11) == 13);
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 0, 11 });
+  REQUIRE(cursor.position() == Position{ 0, 11 });
+
+  cursor.setPosition(Position{ 0, 7 });
+  cursor.setPosition(Position{ 0, 9 }, TextCursor::KeepAnchor);
+  REQUIRE(cursor.selectedText() == "\xC3\xB6r");
+
+  cursor.beginEdit();
+  cursor.insertText("\xE2\x82\xAC");
+  REQUIRE(cursor.position() == Position{ 0, 8 });
+  cursor.insertBlock();
+  cursor.deletePreviousChar();
+  cursor.deletePreviousChar();
+  cursor.insertChar('o');
+  cursor.endEdit();
+  REQUIRE(document.toString() == "h\xC3\xA9llo wold");
+  REQUIRE(document.size() == 11);
+
+  cursor.undo();
+  REQUIRE(document.toString() == "h\xC3\xA9llo w\xC3\xB6rld");
+
+  // long lines use the sparse index
+  std::string line;
+  for (int i(0); i < 300; ++i)
+    line += (i % 3 == 0) ? "\xC3\xA9" : "a";
+
+  cursor.setPosition(Position{ 0, 11 });
+  cursor.insertBlock();
+  cursor.insertText(line);
+  block = document.lastBlock();
+  REQUIRE(block.length() == 300);
+
+  for (int column(0); column <= 300; ++column)
+  {
+    const size_t offset = block.byteOffset(column);
+    REQUIRE(utf8::count_codepoints(line.data(), offset) == static_cast<size_t>(column));
+    REQUIRE(block.columnAt(offset) == column);
+  }
+
+  cursor.setPosition(Position{ 1, 200 });
+  cursor.setPosition(Position{ 1, 300 }, TextCursor::KeepAnchor);
+  REQUIRE(cursor.selectedText() == line.substr(block.byteOffset(200)));
+}
+
 TEST_CASE("Undo redo text insertion", "[cursors]")
 {
   TextDocument document{
@@ -131,3 +371,487 @@ TEST_CASE("Undo redo block insertion", "[cursors]")
   REQUIRE(document.toString() == "Hello !");
 }
 
+
+TEST_CASE("Consecutive edits are merged in the undo history", "[cursors]")
+{
+  TextDocument document{ "Hello" };
+  TextCursor cursor{ &document };
+
+  // by default, every edit is undone separately
+  cursor.setPosition(Position{ 0, 5 });
+  cursor.insertText(" ");
+  cursor.insertText("World");
+  cursor.undo();
+  REQUIRE(document.text(0) == "Hello ");
+  cursor.undo();
+  REQUIRE(document.text(0) == "Hello");
+  REQUIRE_THROWS(cursor.undo());
+
+  UndoPolicy policy;
+  policy.merge_consecutive_edits = true;
+  document.setUndoPolicy(policy);
+
+  cursor.insertText(" ");
+  cursor.insertText("World");
+  cursor.insertText("!");
+
+  REQUIRE(document.text(0) == "Hello World!");
+
+  cursor.undo();
+  REQUIRE(document.text(0) == "Hello");
+  REQUIRE_THROWS(cursor.undo());
+
+  cursor.redo();
+  REQUIRE(document.text(0) == "Hello World!");
+
+  policy.merge_consecutive_edits = false;
+  document.setUndoPolicy(policy);
+
+  cursor.insertText("!");
+  cursor.insertText("!");
+  cursor.undo();
+  REQUIRE(document.text(0) == "Hello World!!");
+}
+
+TEST_CASE("The undo history can be bounded", "[cursors]")
+{
+  TextDocument document{ "a\nb\nc\nd\ne" };
+  TextCursor cursor{ &document };
+
+  UndoPolicy policy;
+  policy.max_steps = 3;
+  policy.uncompressed_steps = 1;
+  document.setUndoPolicy(policy);
+
+  for (int i(0); i < 5; ++i)
+  {
+    cursor.setPosition(Position{ i, 1 });
+    cursor.insertText("xyz");
+  }
+
+  REQUIRE(document.toString() == "axyz\nbxyz\ncxyz\ndxyz\nexyz");
+
+  cursor.undo();
+  cursor.undo();
+  cursor.undo();
+  REQUIRE(document.toString() == "axyz\nbxyz\nc\nd\ne");
+  REQUIRE_THROWS(cursor.undo());
+
+  cursor.redo();
+  cursor.redo();
+  REQUIRE(document.toString() == "axyz\nbxyz\ncxyz\ndxyz\ne");
+
+  // Old steps are compressed and moved to disk rather than discarded
+  std::string line;
+  unsigned int seed = 7;
+  for (int i(0); i < 1000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    line.push_back('a' + (seed >> 16) % 26);
+  }
+
+  policy.max_steps = 0;
+  policy.max_bytes = 8192;
+  policy.spill_to_disk = true;
+  document.setUndoPolicy(policy);
+
+  for (int i(0); i < 20; ++i)
+  {
+    cursor.setPosition(Position{ i % 5, 0 });
+    cursor.insertText(line + "\n");
+  }
+
+  for (int i(0); i < 20; ++i)
+    cursor.undo();
+
+  REQUIRE(document.toString() == "axyz\nbxyz\ncxyz\ndxyz\ne");
+}
+
+TEST_CASE("Snapshots are not affected by later edits", "[document]")
+{
+  TextDocument document{
+    "Hello\n"
+    "World!"
+  };
+
+  TextSnapshot first = document.snapshot();
+  REQUIRE(first.lineCount() == 2);
+  REQUIRE(first.text(1) == "World!");
+  REQUIRE(first.toString() == document.toString());
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 0, 5 });
+  cursor.insertText(",\nBeautiful");
+
+  TextSnapshot second = document.snapshot();
+  REQUIRE(second.lineCount() == 3);
+  REQUIRE(second.toString() == "Hello,\nBeautiful\nWorld!");
+  REQUIRE(second.length() == document.toString().size());
+
+  cursor.setPosition(Position{ 0, 0 });
+  cursor.setPosition(Position{ 1, 4 }, TextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+
+  REQUIRE(document.toString() == "tiful\nWorld!");
+  REQUIRE(first.toString() == "Hello\nWorld!");
+  REQUIRE(second.toString() == "Hello,\nBeautiful\nWorld!");
+  REQUIRE(document.snapshot().toString() == document.toString());
+
+  // Random edits, each checked against an older snapshot
+  unsigned int seed = 11;
+  auto rand = [&seed](int n) -> int {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+  };
+
+  std::vector<std::pair<TextSnapshot, std::string>> snapshots;
+
+  for (int i(0); i < 500; ++i)
+  {
+    const int line = rand(document.lineCount());
+    cursor.setPosition(Position{ line, rand(document.text(line).size() + 1) });
+
+    switch (rand(4))
+    {
+    case 0:
+      cursor.insertText("abc");
+      break;
+    case 1:
+      cursor.insertBlock();
+      break;
+    case 2:
+      cursor.deletePreviousChar();
+      break;
+    default:
+      cursor.deleteChar();
+      break;
+    }
+
+    if (i % 10 == 0)
+      snapshots.emplace_back(document.snapshot(), document.toString());
+  }
+
+  for (const auto& s : snapshots)
+  {
+    REQUIRE(s.first.toString() == s.second);
+  }
+
+  REQUIRE(document.snapshot().toString() == document.toString());
+}
+
+TEST_CASE("Documents can be loaded incrementally", "[document]")
+{
+  TextDocument document;
+
+  struct Listener : TextDocumentListener
+  {
+    std::vector<std::pair<int, int>> appends;
+
+    void blocksAppended(int line, int count) override
+    {
+      appends.emplace_back(line, count);
+    }
+  };
+
+  Listener* listener = new Listener;
+  document.addListener(listener);
+
+  {
+    TextDocumentLoader loader{ &document };
+    REQUIRE(document.isLoading());
+    REQUIRE_THROWS(TextDocumentLoader{ &document });
+
+    loader.feed("Hello\r");
+    REQUIRE(document.toString() == "Hello");
+
+    TextCursor cursor{ &document };
+    cursor.setPosition(Position{ 0, 5 });
+    cursor.insertText("!");
+
+    loader.feed("\nWorld \xE2\x82");
+    REQUIRE(document.toString() == "Hello!\nWorld ");
+    REQUIRE(cursor.position() == Position{ 0, 6 });
+
+    loader.feed("\xAC\r\nBye");
+    REQUIRE(document.lineCount() == 3);
+
+    cursor.undo();
+    REQUIRE(document.toString() == "Hello\nWorld \xE2\x82\xAC\nBye");
+  }
+
+  REQUIRE(!document.isLoading());
+  REQUIRE(document.size() == document.toString().size());
+  REQUIRE(document.snapshot().toString() == document.toString());
+
+  REQUIRE(listener->appends.size() == 3);
+  REQUIRE(listener->appends.at(0) == std::make_pair(0, 0));
+  REQUIRE(listener->appends.at(1) == std::make_pair(0, 1));
+  REQUIRE(listener->appends.at(2) == std::make_pair(1, 1));
+
+  document.removeListener(listener);
+  delete listener;
+
+  // Loading from a stream
+  std::string content;
+  for (int i(0); i < 1000; ++i)
+    content += "line " + std::to_string(i) + "\n";
+
+  std::istringstream stream{ content };
+
+  TextDocument other;
+  TextDocumentLoader loader{ &other, stream };
+  loader.setChunkSize(100);
+
+  int chunks = 0;
+  while (loader.loadChunk())
+    ++chunks;
+
+  REQUIRE(chunks > 10);
+  REQUIRE(loader.isFinished());
+  REQUIRE(!other.isLoading());
+  REQUIRE(other.toString() == content);
+  REQUIRE(other.lineCount() == 1001);
+}
+
+TEST_CASE("The number of blocks of a document can be limited", "[document]")
+{
+  TextDocument document{ "a\nb\nc" };
+
+  TextCursor first{ &document };
+  first.setPosition(Position{ 0, 1 });
+
+  TextCursor last{ &document };
+  last.setPosition(Position{ 2, 0 });
+  last.insertText("c");
+
+  TextSnapshot snapshot = document.snapshot();
+
+  document.setMaximumBlockCount(4);
+  document.append("\nd\ne");
+
+  REQUIRE(document.lineCount() == 4);
+  REQUIRE(document.toString() == "b\ncc\nd\ne");
+  REQUIRE(document.size() == document.toString().size());
+  REQUIRE(document.snapshot().toString() == document.toString());
+  REQUIRE(snapshot.toString() == "a\nb\ncc");
+
+  REQUIRE(first.position() == Position{ 0, 0 });
+  REQUIRE(first.block() == document.firstBlock());
+  REQUIRE(last.position() == Position{ 1, 1 });
+  REQUIRE(last.block().text() == "cc");
+
+  // The history is cleared as its positions are no longer valid
+  REQUIRE_THROWS(last.undo());
+
+  document.setMaximumBlockCount(2);
+  REQUIRE(document.toString() == "d\ne");
+  REQUIRE(last.position() == Position{ 0, 0 });
+
+  document.setMaximumBlockCount(0);
+  document.append("\nf\ng");
+  REQUIRE(document.lineCount() == 4);
+}
+
+static std::string read_file(const std::string& path)
+{
+  std::ifstream file{ path, std::ios::binary };
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+TEST_CASE("Documents can be saved to a file", "[document]")
+{
+  TextDocument document{
+    "Hello\n"
+    "\n"
+    "World!"
+  };
+
+  const std::string path = "typewriter_save_test.txt";
+
+  save(document, path);
+  REQUIRE(read_file(path) == "Hello\n\nWorld!");
+
+  SaveOptions options;
+  options.line_ending = SaveOptions::CRLF;
+  options.atomic_replace = false;
+  options.fsync = true;
+  save(document, path, options);
+  REQUIRE(read_file(path) == "Hello\r\n\r\nWorld!");
+
+  // The file is written from a snapshot, edits made in the meantime are not saved
+  options.line_ending = SaveOptions::LF;
+  options.atomic_replace = true;
+  std::future<void> result = saveAsync(document, path, options);
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 1, 0 });
+  cursor.insertText("Beautiful");
+
+  result.get();
+  REQUIRE(read_file(path) == "Hello\n\nWorld!");
+
+  // the snapshot used for the save was released
+  cursor.insertText(",");
+  REQUIRE(document.memoryUsage().snapshots == 0);
+
+  save(document.snapshot(), path);
+  REQUIRE(read_file(path) == "Hello\nBeautiful,\nWorld!");
+
+  REQUIRE_THROWS(save(document, "non-existing-directory/file.txt"));
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE("Saving a large document", "[save-bench]")
+{
+  std::string line = "  for (int i(0); i < document.lineCount(); ++i) { /* some text */ }";
+  std::string content;
+
+  for (int i(0); i < 200000; ++i)
+  {
+    content += line;
+    content.push_back('\n');
+  }
+
+  TextDocument document{ content };
+
+  const std::string path = "typewriter_save_bench.txt";
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  {
+    std::string text = document.toString();
+    std::ofstream file{ path, std::ios::binary };
+    file.write(text.data(), text.size());
+  }
+
+  auto end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "TextDocument toString() + write " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << std::endl;
+
+  start = std::chrono::high_resolution_clock::now();
+
+  save(document, path);
+
+  end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "TextDocument save() " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << std::endl;
+
+  REQUIRE(read_file(path) == content);
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE("Instrumentation probes", "[document][instrumentation]")
+{
+  using namespace typewriter::instrumentation;
+
+  static Probe counter{ "test.counter", Probe::Counter };
+  counter.reset();
+
+  REQUIRE(find("test.counter") == &counter);
+  REQUIRE(counter.subsystem() == "test");
+  REQUIRE(counter.percentile(0.5) == 0);
+
+  for (uint64_t i(1); i <= 100; ++i)
+    counter.record(i);
+
+  REQUIRE(counter.count() == 100);
+  REQUIRE(counter.total() == 5050);
+  REQUIRE(counter.max() == 100);
+  REQUIRE(counter.bucket(0) == 1);
+  REQUIRE(counter.bucket(1) == 2);
+  REQUIRE(counter.bucket(6) == 37);
+  REQUIRE(counter.percentile(0.5) == 63);
+  REQUIRE(counter.percentile(1) == 100);
+
+  static Probe timer{ "test.timer" };
+  timer.reset();
+
+  startTracing();
+
+  {
+    ScopedTimer t{ timer };
+  }
+
+  stopTracing();
+
+  {
+    ScopedTimer t{ timer };
+  }
+
+  REQUIRE(timer.count() == 2);
+
+  std::stringstream trace;
+  writeChromeTrace(trace);
+  REQUIRE(trace.str().find("\"name\":\"test.timer\",\"cat\":\"test\",\"ph\":\"X\"") != std::string::npos);
+  REQUIRE(trace.str().find("test.timer", trace.str().find("test.timer") + 1) == std::string::npos);
+
+  std::stringstream summary;
+  writeSummary(summary);
+  REQUIRE(summary.str().find("test.counter") != std::string::npos);
+
+  reset();
+  REQUIRE(counter.count() == 0);
+  REQUIRE(timer.count() == 0);
+}
+
+TEST_CASE("Memory usage of a document", "[document]")
+{
+  std::string content;
+
+  for (int i(0); i < 100; ++i)
+    content += std::string(200, 'a' + i % 26) + "\n";
+
+  TextDocument document{ content };
+
+  DocumentMemoryUsage usage = document.memoryUsage();
+  REQUIRE(usage.blocks > 0);
+  REQUIRE(usage.text >= 100 * 200);
+  REQUIRE(usage.snapshots == 0);
+  REQUIRE(usage.undo.steps == 0);
+  REQUIRE(usage.total() > usage.text);
+
+  {
+    // the lines are shared with the snapshots
+    TextSnapshot tmp = document.snapshot();
+    REQUIRE(document.memoryUsage().snapshots > 0);
+    REQUIRE(document.memoryUsage().snapshots < 100 * 200);
+    REQUIRE(document.memoryUsage().text == usage.text);
+  }
+
+  // the snapshot tree is dropped with the last snapshot
+  REQUIRE(document.memoryUsage().snapshots == 0);
+
+  TextSnapshot snapshot = document.snapshot();
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 10, 2 });
+  cursor.setPosition(Position{ 10, 198 }, TextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  cursor.insertText("é");
+
+  usage = document.memoryUsage();
+  REQUIRE(usage.undo.steps == 2);
+  REQUIRE(usage.undo.live > 196);
+
+  const std::string text = document.text(10);
+  document.shrink();
+
+  // the line edited while the snapshot exists is a trimmed copy
+  DocumentMemoryUsage after = document.memoryUsage();
+  REQUIRE(after.text <= usage.text);
+  REQUIRE(after.text < 100 * 201);
+  REQUIRE(after.snapshots == 0);
+  REQUIRE(after.undo.steps == 2);
+  REQUIRE(document.text(10) == text);
+  REQUIRE(document.toString() != content);
+  REQUIRE(snapshot.text(10) == content.substr(10 * 201, 200));
+
+  cursor.undo();
+  cursor.undo();
+  REQUIRE(document.toString() == content);
+  REQUIRE(document.snapshot().text(10) == document.text(10));
+}
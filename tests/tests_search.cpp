@@ -0,0 +1,501 @@
+// Copyright (C) 2021 Vincent Chambrin
+// This file is part of the typewriter library
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "catch.hpp"
+
+#include "typewriter/textsearch.h"
+
+#include "typewriter/textcursor.h"
+#include "typewriter/textdocument.h"
+#include "typewriter/textsearchindex.h"
+#include "typewriter/textsnapshot.h"
+#include "typewriter/textview.h"
+
+#include <mutex>
+#include <regex>
+#include <string>
+
+using namespace typewriter;
+
+static std::vector<std::string> matched_texts(const TextDocument& document, const std::vector<SearchMatch>& matches)
+{
+  std::vector<std::string> result;
+  TextCursor cursor{ const_cast<TextDocument*>(&document) };
+
+  for (const SearchMatch& m : matches)
+  {
+    cursor.setPosition(m.begin);
+    cursor.setPosition(m.end, TextCursor::KeepAnchor);
+    result.push_back(cursor.selectedText());
+  }
+
+  return result;
+}
+
+static SearchOptions regex_options(bool case_sensitive = true)
+{
+  SearchOptions options;
+  options.regex = true;
+  options.case_sensitive = case_sensitive;
+  return options;
+}
+
+TEST_CASE("Literal search", "[search]")
+{
+  TextDocument document{ "Hello World!\nhello again, HELLO\n\nhéllo hello" };
+
+  std::vector<SearchMatch> matches = findAll(document, TextSearcher("hello"));
+  REQUIRE(matches.size() == 2);
+  REQUIRE(matches.at(0) == SearchMatch(Position(1, 0), Position(1, 5)));
+  REQUIRE(matches.at(1) == SearchMatch(Position(3, 6), Position(3, 11)));
+
+  SearchOptions options;
+  options.case_sensitive = false;
+  matches = findAll(document, TextSearcher("HeLLo", options));
+  REQUIRE(matches.size() == 4);
+  REQUIRE(matches.at(2).begin == Position(1, 13));
+
+  REQUIRE(findAll(document, TextSearcher("")).empty());
+  REQUIRE(findAll(document, TextSearcher("o")).size() == 5);
+  REQUIRE(findAll(document, TextSearcher("ll")).size() == 4);
+
+  // overlapping occurrences are not reported
+  TextDocument aaaa{ "aaaaa" };
+  REQUIRE(findAll(aaaa, TextSearcher("aa")).size() == 2);
+}
+
+TEST_CASE("Multiline literal search", "[search]")
+{
+  TextDocument document{ "int a;\nint b;\nint c;\nint d;" };
+
+  std::vector<SearchMatch> matches = findAll(document, TextSearcher("a;\nint"));
+  REQUIRE(matches.size() == 1);
+  REQUIRE(matches.front() == SearchMatch(Position(0, 4), Position(1, 3)));
+
+  matches = findAll(document, TextSearcher(";\nint"));
+  REQUIRE(matches.size() == 3);
+  REQUIRE(matched_texts(document, matches).back() == ";\nint");
+
+  matches = findAll(document, TextSearcher("b;\nint c;\nint"));
+  REQUIRE(matches.size() == 1);
+  REQUIRE(matches.front().end == Position(3, 3));
+
+  REQUIRE(findAll(document, TextSearcher("d;\n")).empty());
+  REQUIRE(findAll(document, TextSearcher("\n")).size() == 3);
+
+  TextDocument lines{ "a\na\na\na\na" };
+
+  matches = findAll(lines, TextSearcher("a\na\na"));
+  REQUIRE(matches.size() == 1);
+  REQUIRE(matches.front() == SearchMatch(Position(0, 0), Position(2, 1)));
+
+  matches = findAll(lines, TextSearcher("\na\na\n"));
+  REQUIRE(matches.size() == 1);
+  REQUIRE(matches.front() == SearchMatch(Position(0, 1), Position(3, 0)));
+
+  REQUIRE(findAll(lines, TextSearcher("a\na")).size() == 2);
+}
+
+TEST_CASE("Regular expression search", "[search]")
+{
+  TextDocument document{ "foo(bar, 42);\n  x = 0x1F + y_2;\nçà et là" };
+
+  auto find = [&document](const std::string& pattern, bool case_sensitive = true) {
+    return matched_texts(document, findAll(document, TextSearcher(pattern, regex_options(case_sensitive))));
+  };
+
+  REQUIRE(find("[0-9]+") == std::vector<std::string>{ "42", "0", "1", "2" });
+  REQUIRE(find("0x[0-9a-f]+", false) == std::vector<std::string>{ "0x1F" });
+  REQUIRE(find("\\w+\\(") == std::vector<std::string>{ "foo(" });
+  REQUIRE(find("^\\s*\\w") == std::vector<std::string>{ "f", "  x" });
+  REQUIRE(find(";$").size() == 2);
+  REQUIRE(find("b(a|o)r|y_\\d") == std::vector<std::string>{ "bar", "y_2" });
+  REQUIRE(find("l.") == std::vector<std::string>{ "l\xc3\xa0" });
+  REQUIRE(find("[àç]") == std::vector<std::string>{ "\xc3\xa7", "\xc3\xa0", "\xc3\xa0" });
+  REQUIRE(find("[^ ]+$") == std::vector<std::string>{ "42);", "y_2;", "l\xc3\xa0" });
+  REQUIRE(find("a{2,}").empty());
+  REQUIRE(find("(?:x|0x1)+") == std::vector<std::string>{ "x", "0x1" });
+
+  // leftmost-longest
+  REQUIRE(find("4|42|2") == std::vector<std::string>{ "42", "2" });
+
+  // an anchored pattern searched after the start of a line
+  TextDocument anchored{ "ab ab\nxab" };
+  std::vector<SearchMatch> matches = findAll(anchored, TextSearcher("^ab", regex_options()));
+  REQUIRE(matches.size() == 1);
+  REQUIRE(matches.front() == SearchMatch(Position(0, 0), Position(0, 2)));
+
+  REQUIRE_THROWS(TextSearcher("(abc", regex_options()));
+  REQUIRE_THROWS(TextSearcher("[abc", regex_options()));
+  REQUIRE_THROWS(TextSearcher("*a", regex_options()));
+  REQUIRE_THROWS(TextSearcher("a{3,2}", regex_options()));
+  REQUIRE_THROWS(TextSearcher("\\q", regex_options()));
+}
+
+TEST_CASE("Regular expressions agree with std::regex", "[search]")
+{
+  const std::string text = "aab abab bba a-b ab_ba 123 ab12 b1a2 zzz";
+  const char* patterns[] = { "a+b", "(ab)+", "[ab]+", "b?a", "a.b", "[0-9]+[a-z]*", "[0-9][a-z0-9_]", "z{2}", "(a|b)*b" };
+
+  TextDocument document{ text };
+
+  for (const char* p : patterns)
+  {
+    // std::regex is leftmost-first, both agree on these patterns
+    std::vector<std::string> expected;
+    std::regex re{ p, std::regex::extended };
+
+    for (auto it = std::sregex_iterator(text.begin(), text.end(), re); it != std::sregex_iterator(); ++it)
+      expected.push_back(it->str());
+
+    REQUIRE(matched_texts(document, findAll(document, TextSearcher(p, regex_options()))) == expected);
+  }
+}
+
+TEST_CASE("Empty regex matches", "[search]")
+{
+  TextDocument document{ "ab\n\ncd" };
+
+  std::vector<SearchMatch> matches = findAll(document, TextSearcher("^", regex_options()));
+  REQUIRE(matches.size() == 3);
+  REQUIRE(matches.at(1) == SearchMatch(Position(1, 0), Position(1, 0)));
+
+  matches = findAll(document, TextSearcher("x*", regex_options()));
+  REQUIRE(matches.size() == 3 + 1 + 3);
+
+  TextCursor cursor{ &document };
+  REQUIRE(findNext(cursor, TextSearcher("$", regex_options())));
+  REQUIRE(cursor.position() == Position(0, 2));
+  REQUIRE(findNext(cursor, TextSearcher("$", regex_options())));
+  REQUIRE(cursor.position() == Position(1, 0));
+}
+
+TEST_CASE("Find next and previous", "[search]")
+{
+  TextDocument document{ "one two one\nthree one\nfour" };
+  TextSearcher searcher{ "one" };
+
+  REQUIRE(findNext(document, searcher, Position(0, 0)) == SearchMatch(Position(0, 0), Position(0, 3)));
+  REQUIRE(findNext(document, searcher, Position(0, 1)) == SearchMatch(Position(0, 8), Position(0, 11)));
+  REQUIRE(findNext(document, searcher, Position(1, 7)) == SearchMatch(Position(0, 0), Position(0, 3)));
+  REQUIRE(findNext(document, searcher, Position(1, 7), false).isNull());
+  REQUIRE(findNext(document, TextSearcher("two"), Position(0, 5)) == SearchMatch(Position(0, 4), Position(0, 7)));
+  REQUIRE(findNext(document, TextSearcher("two"), Position(0, 5), false).isNull());
+
+  REQUIRE(findPrevious(document, searcher, Position(1, 6)) == SearchMatch(Position(0, 8), Position(0, 11)));
+  REQUIRE(findPrevious(document, searcher, Position(0, 2)) == SearchMatch(Position(0, 0), Position(0, 3)));
+  REQUIRE(findPrevious(document, searcher, Position(0, 0)) == SearchMatch(Position(1, 6), Position(1, 9)));
+  REQUIRE(findPrevious(document, searcher, Position(0, 0), false).isNull());
+  REQUIRE(findPrevious(document, TextSearcher("two"), Position(0, 4), false).isNull());
+
+  TextCursor cursor{ &document };
+  REQUIRE(findNext(cursor, searcher));
+  REQUIRE(cursor.selectedText() == "one");
+  REQUIRE(cursor.selectionStart() == Position(0, 0));
+  REQUIRE(findNext(cursor, searcher));
+  REQUIRE(cursor.selectionStart() == Position(0, 8));
+  REQUIRE(findNext(cursor, searcher));
+  REQUIRE(cursor.selectionStart() == Position(1, 6));
+  REQUIRE(findNext(cursor, searcher));
+  REQUIRE(cursor.selectionStart() == Position(0, 0));
+  REQUIRE(findPrevious(cursor, searcher));
+  REQUIRE(cursor.selectionStart() == Position(1, 6));
+  REQUIRE(!findNext(cursor, TextSearcher("five")));
+  REQUIRE(cursor.selectionStart() == Position(1, 6));
+}
+
+TEST_CASE("Searching in the background", "[search]")
+{
+  std::string content;
+
+  for (int i(0); i < 10000; ++i)
+    content += "line " + std::to_string(i) + "\n";
+
+  TextDocument document{ content };
+  TextSearcher searcher{ "[0-9]*7$", regex_options() };
+
+  std::future<std::vector<SearchMatch>> result = findAllAsync(document, searcher);
+
+  // the document may be modified while searching
+  TextCursor cursor{ &document };
+  cursor.insertText("line 7\n");
+
+  REQUIRE(result.get().size() == 1000);
+  REQUIRE(findAll(document, searcher).size() == 1001);
+
+  std::mutex mutex;
+  std::vector<SearchMatch> matches;
+  size_t batches = 0;
+
+  {
+    SearchJob job{ document.snapshot(), searcher, [&](const std::vector<SearchMatch>& batch) {
+      std::lock_guard<std::mutex> lock{ mutex };
+      matches.insert(matches.end(), batch.begin(), batch.end());
+      ++batches;
+      }, 100 };
+
+    job.wait();
+    REQUIRE(job.isFinished());
+    REQUIRE(job.matchCount() == 1001);
+  }
+
+  REQUIRE(batches == 11);
+  REQUIRE(matches == findAll(document, searcher));
+}
+
+TEST_CASE("Parallel search", "[search]")
+{
+  std::string content;
+
+  for (int i(0); i < 80000; ++i)
+    content += "int value_" + std::to_string(i) + " = " + std::to_string(i % 97) + ";\n";
+
+  TextDocument document{ content };
+  REQUIRE(document.size() > 4 * 256 * 1024);
+
+  SearchOptions sequential;
+  sequential.threads = 1;
+  SearchOptions parallel;
+  parallel.threads = 4;
+
+  const char* literals[] = { "value_1", "= 5;\nint", ";\nint value_2" };
+
+  for (const char* p : literals)
+  {
+    std::vector<SearchMatch> expected = findAll(document, TextSearcher(p, sequential));
+    REQUIRE(!expected.empty());
+    REQUIRE(findAll(document, TextSearcher(p, parallel)) == expected);
+    REQUIRE(findAll(document.snapshot(), TextSearcher(p, parallel)) == expected);
+  }
+
+  sequential.regex = true;
+  parallel.regex = true;
+
+  std::vector<SearchMatch> expected = findAll(document, TextSearcher("_[0-9]*7 = [0-9]+", sequential));
+  REQUIRE(expected.size() == 8000);
+  REQUIRE(findAll(document, TextSearcher("_[0-9]*7 = [0-9]+", parallel)) == expected);
+}
+
+TEST_CASE("Parallel search with matches across chunks", "[search]")
+{
+  std::string content;
+
+  for (int i(0); i < 600001; ++i)
+    content += "a\n";
+
+  TextDocument document{ content };
+
+  SearchOptions options;
+  options.threads = 1;
+  std::vector<SearchMatch> expected = findAll(document, TextSearcher("a\na", options));
+  REQUIRE(expected.size() == 300000);
+
+  // the chunk boundaries depend on the number of threads
+  for (int threads(2); threads <= 4; ++threads)
+  {
+    options.threads = threads;
+    REQUIRE(findAll(document, TextSearcher("a\na", options)) == expected);
+  }
+
+  TextSearchIndex index{ &document };
+  index.rebuild();
+  REQUIRE(findAll(index, TextSearcher("a\na")) == expected);
+}
+
+TEST_CASE("Replace all", "[search]")
+{
+  TextDocument document{ "one two one\nthree one\nfour" };
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position(1, 9));
+
+  REQUIRE(replaceAll(cursor, TextSearcher("one"), "1") == 3);
+  REQUIRE(document.toString() == "1 two 1\nthree 1\nfour");
+  REQUIRE(cursor.position() == Position(1, 7));
+  REQUIRE(replaceAll(document, TextSearcher("five"), "5") == 0);
+
+  cursor.undo();
+  REQUIRE(document.toString() == "one two one\nthree one\nfour");
+
+  REQUIRE(replaceAll(document, TextSearcher("e\nt"), "E T") == 1);
+  REQUIRE(document.toString() == "one two onE Three one\nfour");
+
+  TextDocument lines{ "a\na\na\na\na" };
+  REQUIRE(replaceAll(lines, TextSearcher("a\na\na"), "X") == 1);
+  REQUIRE(lines.toString() == "X\na\na");
+}
+
+TEST_CASE("Replace all with many matches", "[search]")
+{
+  std::string content;
+
+  for (int i(0); i < 1000; ++i)
+    content += "foo(" + std::to_string(i) + "); foo();\n";
+
+  auto replaced = [](std::string text, const std::string& before, const std::string& after) {
+    for (size_t pos = text.find(before); pos != std::string::npos; pos = text.find(before, pos + after.size()))
+      text.replace(pos, before.size(), after);
+    return text;
+  };
+
+  TextDocument document{ content };
+  TextView view{ &document };
+  TextSnapshot snapshot = document.snapshot();
+
+  TextCursor first{ &document };
+  first.setPosition(Position(0, 1));
+  TextCursor last{ &document };
+  last.setPosition(Position(999, 8));
+  last.setPosition(Position(999, 15), TextCursor::KeepAnchor);
+
+  auto check_view = [&]() {
+    REQUIRE(view.height() == document.lineCount());
+    REQUIRE(view.blocks().size() == static_cast<size_t>(document.lineCount()));
+    REQUIRE(view.lines().back().block() == document.lastBlock());
+  };
+
+  // line feeds are inserted
+  REQUIRE(replaceAll(first, TextSearcher("foo"), "bar\n  ") == 2000);
+  REQUIRE(document.toString() == replaced(content, "foo", "bar\n  "));
+  REQUIRE(document.lineCount() == 3001);
+  REQUIRE(snapshot.toString() == content);
+  REQUIRE(document.snapshot().toString() == document.toString());
+  REQUIRE(first.position() == Position(1, 2));
+  REQUIRE(last.anchor() == Position(2998, 7));
+  REQUIRE(last.position() == Position(2999, 4));
+  REQUIRE(last.block() == document.findBlockByNumber(2999));
+  check_view();
+
+  // line feeds are removed
+  REQUIRE(replaceAll(first, TextSearcher("bar\n  ("), "(") == 2000);
+  REQUIRE(document.toString() == replaced(content, "foo", ""));
+  REQUIRE(document.lineCount() == 1001);
+  check_view();
+
+  first.undo();
+  REQUIRE(document.toString() == replaced(content, "foo", "bar\n  "));
+  check_view();
+
+  first.undo();
+  REQUIRE(document.toString() == content);
+  REQUIRE(document.size() == content.size());
+  REQUIRE(last.block() == document.findBlockByNumber(last.position().line));
+  check_view();
+
+  first.redo();
+  REQUIRE(document.toString() == replaced(content, "foo", "bar\n  "));
+  check_view();
+}
+
+TEST_CASE("Search index", "[search]")
+{
+  std::string content;
+
+  for (int i(0); i < 20000; ++i)
+    content += (i % 5000 == 123 ? "needle_" : "hay_") + std::to_string(i) + " = " + std::to_string(i % 97) + ";\n";
+
+  TextDocument document{ content };
+  TextSearchIndex index{ &document };
+  REQUIRE(index.dirtyChunkCount() == index.chunkCount());
+
+  index.rebuild();
+  REQUIRE(index.chunkCount() == 20000 / TextSearchIndex::ChunkLines + 1);
+  REQUIRE(index.dirtyChunkCount() == 0);
+
+  SearchOptions regex;
+  regex.regex = true;
+  SearchOptions case_insensitive;
+  case_insensitive.case_sensitive = false;
+
+  auto check = [&]() {
+    const TextSearcher searchers[] = {
+      TextSearcher("needle_"),
+      TextSearcher("NEEDLE", case_insensitive),
+      TextSearcher("= 5;\nhay", case_insensitive),
+      TextSearcher("nee+dle_[0-9]+", regex),
+      TextSearcher("(needle|hay)_1[0-9]*23 ", regex),
+      TextSearcher("_[0-9]*7 = 1", regex),
+    };
+
+    for (const TextSearcher& s : searchers)
+      REQUIRE(findAll(index, s) == findAll(document, s));
+  };
+
+  check();
+
+  std::vector<TextSearchIndex::LineRange> ranges = index.candidates(TextSearcher("needle_"));
+  REQUIRE(ranges.size() <= 4);
+  REQUIRE(ranges.front().begin <= 123);
+  REQUIRE(ranges.front().end > 123);
+  REQUIRE(index.candidates(TextSearcher("(hay|needle)", regex)).size() == 1);
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position(10000, 0));
+  cursor.insertText("needle_");
+  cursor.insertBlock();
+  cursor.insertText("needle_");
+  REQUIRE(index.dirtyChunkCount() == 1);
+  check();
+
+  cursor.setPosition(Position(10100, 0));
+  cursor.setPosition(Position(10400, 0), TextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  REQUIRE(index.dirtyChunkCount() > 1);
+  check();
+
+  index.update();
+  REQUIRE(index.dirtyChunkCount() == 0);
+  check();
+
+  REQUIRE(replaceAll(cursor, TextSearcher("hay_1"), "needle\n_") > 1000);
+  check();
+  index.update();
+  check();
+
+  cursor.undo();
+  check();
+
+  document.append("needle_append\nneedle_");
+  check();
+
+  // edits made during a background build are replayed
+  index.rebuildAsync();
+  cursor.setPosition(Position(0, 0));
+  cursor.insertText("needle_");
+  cursor.setPosition(Position(15000, 0));
+  cursor.insertBlock();
+  cursor.insertText("needle_");
+  index.wait();
+  REQUIRE(!index.isBuilding());
+  REQUIRE(index.dirtyChunkCount() == 2);
+  check();
+
+  cursor.setPosition(Position(0, 0));
+  cursor.setPosition(Position(document.lineCount() - 1, 0), TextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  REQUIRE(index.chunkCount() == 1);
+  check();
+}
+
+TEST_CASE("Search index memory budget", "[search]")
+{
+  std::string content;
+
+  for (int i(0); i < 20000; ++i)
+    content += "item_" + std::to_string(i) + "\n";
+
+  TextDocument document{ content };
+  TextSearchIndex index{ &document, 32 * 1024 };
+  index.rebuild();
+  REQUIRE(index.memoryUsage() <= 32 * 1024 + 1024);
+  REQUIRE(findAll(index, TextSearcher("item_1234\n")) == findAll(document, TextSearcher("item_1234\n")));
+
+  index.setMemoryBudget(0);
+  index.rebuild();
+  REQUIRE(index.memoryUsage() > 32 * 1024);
+
+  int candidate_lines = 0;
+  for (const TextSearchIndex::LineRange& r : index.candidates(TextSearcher("item_1234\n")))
+    candidate_lines += r.end - r.begin;
+  REQUIRE(candidate_lines < 1000);
+}
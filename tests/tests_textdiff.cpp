@@ -6,6 +6,14 @@
 
 #include "typewriter/textdiff.h"
 
+#include "typewriter/textcursor.h"
+#include "typewriter/textdocument.h"
+#include "typewriter/textview.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
 using namespace typewriter;
 
 inline static Position pos(int n)
@@ -13,6 +21,30 @@ inline static Position pos(int n)
   return Position{ 0, n };
 }
 
+TEST_CASE("TextRange maps offsets and positions", "[textdiff]")
+{
+  TextRange range{ "abc\nde\n\nfghi", Position{ 2, 5 } };
+
+  REQUIRE(range.end() == Position{ 5, 4 });
+  REQUIRE(range.seek(Position{ 2, 7 }) == 2);
+  REQUIRE(range.seek(Position{ 3, 1 }) == 5);
+  REQUIRE(range.seek(Position{ 5, 4 }) == 12);
+  REQUIRE(range.map(3) == Position{ 2, 8 });
+  REQUIRE(range.map(4) == Position{ 3, 0 });
+  REQUIRE(range.map(8) == Position{ 5, 0 });
+  REQUIRE(TextRange::end(Position{ 2, 5 }, range.text()) == range.end());
+
+  range += TextRange{ "x\ny", Position{ 3, 1 } };
+  REQUIRE(range.text() == "abc\ndx\nye\n\nfghi");
+  REQUIRE(range.end() == Position{ 6, 4 });
+  REQUIRE(range.map(9) == Position{ 4, 2 });
+
+  range -= Range{ Position{ 2, 7 }, Position{ 4, 1 } };
+  REQUIRE(range.text() == "abe\n\nfghi");
+  REQUIRE(range.end() == Position{ 4, 4 });
+  REQUIRE(range.seek(Position{ 4, 2 }) == 7);
+}
+
 TEST_CASE("Simple text diffs are working", "[textdiff]")
 {
   std::string text = "01234567890123456789";
@@ -209,3 +241,345 @@ TEST_CASE("Complex text diffs are working", "[textdiff]")
   REQUIRE(td1.diffs().size() == 1);
   REQUIRE((td1.diffs().at(0) == diff::insert(pos(9), std::string("d"))));
 }
+
+static size_t offset_of(const std::string& text, const Position& pos)
+{
+  size_t offset = 0;
+
+  for (int i(0); i < pos.line; ++i)
+    offset = text.find('\n', offset) + 1;
+
+  return offset + pos.column;
+}
+
+static std::string apply_to(std::string text, const TextDiff& td)
+{
+  const auto& diffs = td.diffs();
+
+  for (auto it = diffs.rbegin(); it != diffs.rend(); ++it)
+  {
+    const size_t offset = offset_of(text, it->begin());
+
+    if (it->isInsertion())
+      text.insert(offset, it->text());
+    else
+      text.erase(offset, it->text().size());
+  }
+
+  return text;
+}
+
+static Position position_of(const std::string& text, size_t offset)
+{
+  Position pos{ 0, 0 };
+
+  for (size_t i(0); i < offset; ++i)
+  {
+    if (text[i] == '\n')
+      pos = Position{ pos.line + 1, 0 };
+    else
+      pos.column += 1;
+  }
+
+  return pos;
+}
+
+TEST_CASE("Text diffs compose random edits", "[textdiff]")
+{
+  std::mt19937 rng{ 1234 };
+  const char* pieces[] = { "a", "bc", "\n", "d\ne", "fgh", "\n\n" };
+
+  for (int iter(0); iter < 200; ++iter)
+  {
+    const std::string original = "0123\n4567\n89\nabcdef\n\nghij";
+    std::string text = original;
+    TextDiff td;
+    TextDiff first_half;
+    std::string half;
+
+    for (int i(0); i < 30; ++i)
+    {
+      if (i == 15)
+      {
+        first_half = td;
+        half = text;
+      }
+
+      if (rng() % 2 || text.empty())
+      {
+        const size_t offset = rng() % (text.size() + 1);
+        const std::string piece = pieces[rng() % 6];
+        td << diff::insert(position_of(text, offset), piece);
+        text.insert(offset, piece);
+      }
+      else
+      {
+        const size_t offset = rng() % text.size();
+        const size_t count = 1 + rng() % std::min<size_t>(6, text.size() - offset);
+        td << diff::remove(position_of(text, offset), text.substr(offset, count));
+        text.erase(offset, count);
+      }
+
+      REQUIRE(apply_to(original, td) == text);
+    }
+
+    TextDiff composed = first_half;
+    composed << diff::compute(half, text);
+    REQUIRE(apply_to(original, composed) == text);
+
+    std::string current = original;
+    TextDiff remaining = td;
+
+    while (!remaining.isEmpty())
+    {
+      TextDiff single;
+      single.append(remaining.takeFirst());
+      current = apply_to(current, single);
+      REQUIRE(apply_to(current, remaining) == text);
+    }
+
+    REQUIRE(current == text);
+  }
+}
+
+TEST_CASE("Concurrent diffs can be transformed", "[textdiff]")
+{
+  std::mt19937 rng{ 5 };
+  const char* pieces[] = { "x", "yz", "\n", "u\nv" };
+
+  auto random_diff = [&](const std::string& text) -> TextDiff {
+    TextDiff td;
+    std::string current = text;
+
+    for (int i(0); i < 4; ++i)
+    {
+      if (rng() % 2 || current.empty())
+      {
+        const size_t offset = rng() % (current.size() + 1);
+        const std::string piece = pieces[rng() % 4];
+        td << diff::insert(position_of(current, offset), piece);
+        current.insert(offset, piece);
+      }
+      else
+      {
+        const size_t offset = rng() % current.size();
+        const size_t count = 1 + rng() % std::min<size_t>(5, current.size() - offset);
+        td << diff::remove(position_of(current, offset), current.substr(offset, count));
+        current.erase(offset, count);
+      }
+    }
+
+    return td;
+  };
+
+  for (int iter(0); iter < 500; ++iter)
+  {
+    const std::string text = "abc\ndef\n\nghijkl\nm";
+    TextDiff a = random_diff(text);
+    TextDiff b = random_diff(text);
+
+    const std::string after_a = apply_to(text, a);
+    const std::string after_b = apply_to(text, b);
+
+    TextDiff a2 = a, b2 = b;
+    diff::transform(a2, b2);
+
+    REQUIRE(apply_to(after_b, a2) == apply_to(after_a, b2));
+    REQUIRE(apply_to(after_a, a.inverted()) == text);
+  }
+}
+
+TEST_CASE("Text diffs can compose many edits", "[textdiff-bench]")
+{
+  std::mt19937 rng{ 99 };
+  std::string text;
+
+  for (int i(0); i < 1000; ++i)
+    text += "some line of text\n";
+
+  const std::string original = text;
+  std::vector<int> line_lengths(1000, 17);
+  std::vector<TextDiff::Diff> edits;
+  edits.reserve(100000);
+
+  // Edits are generated beforehand so that timing only covers the diff
+  for (int i(0); i < 100000; ++i)
+  {
+    const int line = rng() % 1000;
+    const int column = rng() % (line_lengths[line] + 1);
+    const size_t offset = offset_of(text, Position{ line, column });
+
+    if (rng() % 3 || column == line_lengths[line])
+    {
+      edits.push_back(diff::insert(Position{ line, column }, "x"));
+      text.insert(offset, "x");
+      line_lengths[line] += 1;
+    }
+    else
+    {
+      edits.push_back(diff::remove(Position{ line, column }, text.substr(offset, 1)));
+      text.erase(offset, 1);
+      line_lengths[line] -= 1;
+    }
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  TextDiff first_half, second_half;
+  for (size_t i(0); i < edits.size(); ++i)
+    (i < edits.size() / 2 ? first_half : second_half) << edits[i];
+
+  auto end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "TextDiff composition of 100k edits " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << std::endl;
+
+  start = std::chrono::high_resolution_clock::now();
+
+  TextDiff td = first_half;
+  td << second_half;
+
+  end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "TextDiff composition of two diffs " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << std::endl;
+
+  REQUIRE(apply_to(original, td) == text);
+}
+
+TEST_CASE("Diffs can be computed between two texts", "[textdiff]")
+{
+  TextDiff td = diff::compute("abc\ndef\nghi", "abc\ndxf\nghi");
+  REQUIRE(td.diffs().size() == 2);
+  REQUIRE((td.diffs().at(0) == diff::remove(Position{ 1, 1 }, std::string("e"))));
+  REQUIRE((td.diffs().at(1) == diff::insert(Position{ 1, 2 }, std::string("x"))));
+
+  td = diff::compute("abc\ndef\nghi", "abc\nghi");
+  REQUIRE(td.diffs().size() == 1);
+  REQUIRE((td.diffs().at(0) == diff::remove(Position{ 1, 0 }, std::string("def\n"))));
+
+  td = diff::compute("abc\ndef", "abc\ndef\nghi");
+  REQUIRE(td.diffs().size() == 1);
+  REQUIRE((td.diffs().at(0) == diff::insert(Position{ 1, 3 }, std::string("\nghi"))));
+
+  td = diff::compute("abc", "abc");
+  REQUIRE(td.diffs().empty());
+
+  TextDocument document{ "Hello World!\nfoo\nbar" };
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 2, 1 });
+
+  document.reload("Hi World!\nfoo\nbaz\nbar\r\n");
+  REQUIRE(document.toString() == "Hi World!\nfoo\nbaz\nbar\n");
+  REQUIRE(cursor.position() == Position{ 3, 1 });
+
+  // Undoing a multi-diff edit
+  cursor.setPosition(Position{ 0, 2 });
+  cursor.beginEdit();
+  cursor.insertText("a\nb");
+  cursor.setPosition(Position{ 1, 4 });
+  cursor.insertText("c");
+  cursor.setPosition(Position{ 3, 0 });
+  cursor.deleteChar();
+  cursor.endEdit();
+  REQUIRE(document.toString() == "Hia\nb Wocrld!\nfoo\naz\nbar\n");
+
+  cursor.undo();
+  REQUIRE(document.toString() == "Hi World!\nfoo\nbaz\nbar\n");
+}
+
+TEST_CASE("Computed diffs can be applied and reverted", "[textdiff]")
+{
+  std::mt19937 rng{ 42 };
+  const char* words[] = { "int", "foo", "bar", " ", "(", ")", ";", "{", "}", "\n", "\n", "\xc3\xa9" };
+
+  auto random_text = [&](int n) -> std::string {
+    std::string result;
+    for (int i(0); i < n; ++i)
+      result += words[rng() % 12];
+    return result;
+  };
+
+  for (int iter(0); iter < 100; ++iter)
+  {
+    const std::string original = random_text(200);
+    std::string modified = original;
+
+    // edits must not split a code point
+    auto is_boundary = [&modified](size_t p) -> bool {
+      return p >= modified.size() || (static_cast<unsigned char>(modified[p]) & 0xC0) != 0x80;
+    };
+
+    const int nb_edits = 1 + rng() % 5;
+    for (int i(0); i < nb_edits; ++i)
+    {
+      size_t p = rng() % (modified.size() + 1);
+      while (!is_boundary(p))
+        --p;
+
+      if (rng() % 2)
+      {
+        modified.insert(p, random_text(1 + rng() % 8));
+      }
+      else
+      {
+        size_t q = std::min(p + rng() % 12, modified.size());
+        while (!is_boundary(q))
+          ++q;
+
+        modified.erase(p, q - p);
+      }
+    }
+
+    TextDocument document{ original };
+    TextDiff td = diff::compute(document, modified);
+    document.apply(td);
+    REQUIRE(document.toString() == modified);
+
+    document.apply(diff::compute(document, original));
+    REQUIRE(document.toString() == original);
+  }
+}
+
+TEST_CASE("Reloading a large document only patches the changed regions", "[textdiff]")
+{
+  std::string content;
+
+  for (int i(0); i < 50000; ++i)
+    content += "line number " + std::to_string(i) + "\n";
+
+  TextDocument document{ content };
+  TextView view{ &document };
+
+  std::string modified = content;
+  modified.replace(modified.find("line number 100\n"), 16, "line number 100 (modified)\n");
+  modified.erase(modified.find("line number 20000\n"), 18);
+  modified.insert(modified.find("line number 30000\n"), "new line\n");
+
+  TextDiff td = diff::compute(document, modified);
+  REQUIRE(td.diffs().size() == 3);
+
+  const TextBlock unchanged = document.findBlockByNumber(10000);
+  const TextBlock shifted = document.findBlockByNumber(25000);
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 25000, 5 });
+
+  document.reload(modified);
+  REQUIRE(document.toString() == modified);
+  REQUIRE(view.height() == document.lineCount());
+
+  // the blocks and the cursors of the unchanged lines are preserved
+  REQUIRE(unchanged.isValid());
+  REQUIRE(document.findBlockByNumber(10000).impl() == unchanged.impl());
+  REQUIRE(shifted.isValid());
+  REQUIRE(document.findBlockByNumber(24999).impl() == shifted.impl());
+  REQUIRE(cursor.position() == Position(24999, 5));
+  REQUIRE(cursor.block().impl() == shifted.impl());
+
+  REQUIRE(document.availableUndoSteps() == 1);
+  document.undo();
+  REQUIRE(document.toString() == content);
+  REQUIRE(cursor.position() == Position(25000, 5));
+  REQUIRE(!document.isUndoAvailable());
+
+  document.redo();
+  REQUIRE(document.toString() == modified);
+}
@@ -8,12 +8,17 @@
 #include "typewriter/syntaxhighlighter.h"
 #include "typewriter/textblock.h"
 #include "typewriter/textcursor.h"
+#include "typewriter/textdecorations.h"
+#include "typewriter/textsearch.h"
 #include "typewriter/textview.h"
+#include "typewriter/view/block.h"
 #include "typewriter/view/fragment.h"
+#include "typewriter/utils/displaywidth.h"
 
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <random>
 
 using namespace typewriter;
 
@@ -66,6 +71,267 @@ TEST_CASE("Part of a view can be hidden with folds", "[view]")
   REQUIRE(view.height() == 2);
 }
 
+// the ids of the folds displayed by the view
+static std::vector<int> displayed_folds(const TextView& view)
+{
+  std::vector<int> result;
+
+  for (const view::Line& l : view.lines())
+  {
+    for (const view::LineElement& e : l.elements)
+    {
+      if (e.kind == view::LineElement::LE_Fold)
+        result.push_back(e.id);
+    }
+  }
+
+  return result;
+}
+
+static bool same_lines(const TextView& a, const TextView& b)
+{
+  if (a.lines().size() != b.lines().size())
+    return false;
+
+  auto it = b.lines().begin();
+
+  for (const view::Line& l : a.lines())
+  {
+    if (l.displayedText() != it->displayedText() || l.elements.size() != it->elements.size())
+      return false;
+
+    for (size_t i(0); i < l.elements.size(); ++i)
+    {
+      if (l.elements.at(i).kind != it->elements.at(i).kind)
+        return false;
+    }
+
+    ++it;
+  }
+
+  return true;
+}
+
+TEST_CASE("Folds can be nested", "[view]")
+{
+  std::string content;
+
+  for (int i(0); i < 10; ++i)
+    content += "line " + std::to_string(i) + "\n";
+
+  TextDocument document{ content };
+  TextView view{ &document };
+  REQUIRE(view.height() == 11);
+
+  auto selection = [&document](Position begin, Position end) {
+    TextCursor c{ &document };
+    c.setPosition(begin);
+    c.setPosition(end, TextCursor::KeepAnchor);
+    return c;
+  };
+
+  view.addFold(2, selection(Position(2, 0), Position(3, 4)));
+  REQUIRE(view.height() == 10);
+  REQUIRE(displayed_folds(view) == std::vector<int>{ 2 });
+
+  // the outer fold hides the inner one
+  view.addFold(1, selection(Position(6, 1), Position(1, 2)));
+  REQUIRE(view.height() == 6);
+  REQUIRE(displayed_folds(view) == std::vector<int>{ 1 });
+  REQUIRE(std::next(view.lines().begin())->displayedText() == "liine 6");
+
+  // folds follow the edits
+  TextCursor cursor{ &document };
+  cursor.insertBlock();
+  REQUIRE(view.height() == 7);
+  REQUIRE(std::next(view.lines().begin(), 2)->displayedText() == "liine 6");
+
+  view.removeFold(1);
+  REQUIRE(view.height() == 11);
+  REQUIRE(displayed_folds(view) == std::vector<int>{ 2 });
+
+  // among folds starting at the same position, the longest one is displayed;
+  // a fold starting inside another fold is hidden
+  view.addFold(3, selection(Position(3, 0), Position(5, 0)));
+  view.addFold(4, selection(Position(4, 1), Position(6, 2)));
+  REQUIRE(view.height() == 10);
+  REQUIRE(displayed_folds(view) == std::vector<int>{ 3 });
+  REQUIRE(view.foldCount() == 3);
+
+  // a fold replaces the fold with the same id
+  view.addFold(3, selection(Position(8, 0), Position(9, 0)));
+  REQUIRE(view.foldCount() == 3);
+  REQUIRE(displayed_folds(view) == std::vector<int>{ 2, 3 });
+  REQUIRE(view.height() == 10);
+
+  view.clearFolds();
+  REQUIRE(view.foldCount() == 0);
+  REQUIRE(!view.hasFold(2));
+  REQUIRE(view.height() == 12);
+}
+
+TEST_CASE("A fold hidden by another fold can be removed", "[view]")
+{
+  std::string content;
+
+  for (int i(0); i < 12; ++i)
+    content += "line " + std::to_string(i) + "\n";
+
+  TextDocument document{ content };
+  TextView view{ &document };
+  REQUIRE(view.height() == 13);
+
+  auto selection = [&document](Position begin, Position end) {
+    TextCursor c{ &document };
+    c.setPosition(begin);
+    c.setPosition(end, TextCursor::KeepAnchor);
+    return c;
+  };
+
+  view.addFold(1, selection(Position(1, 0), Position(8, 0)));
+  view.addFold(2, selection(Position(3, 0), Position(5, 0)));
+  REQUIRE(view.height() == 6);
+
+  view.removeFold(2);
+  REQUIRE(view.height() == 6);
+  REQUIRE(displayed_folds(view) == std::vector<int>{ 1 });
+
+  view.removeFold(1);
+  REQUIRE(view.height() == 13);
+  REQUIRE(displayed_folds(view).empty());
+
+  // the fold ends in the middle of the line where the removed fold starts
+  view.addFold(1, selection(Position(1, 2), Position(3, 2)));
+  view.addFold(2, selection(Position(3, 4), Position(6, 0)));
+  REQUIRE(view.height() == 8);
+
+  view.removeFold(2);
+  REQUIRE(view.height() == 11);
+
+  TextView reference{ &document };
+  reference.addFold(1, selection(Position(1, 2), Position(3, 2)));
+  REQUIRE(same_lines(view, reference));
+}
+
+TEST_CASE("Folds can be added and removed in bulk", "[view]")
+{
+  std::string content;
+
+  for (int i(0); i < 3000; ++i)
+    content += "  statement_" + std::to_string(i) + ";\n";
+
+  TextDocument document{ content };
+  TextView view{ &document };
+  TextView reference{ &document };
+
+  std::vector<TextFold> folds;
+
+  for (int i(0); i < 1000; ++i)
+  {
+    TextCursor c{ &document };
+    c.setPosition(Position(3 * i + 1, 0));
+    c.setPosition(Position(3 * i, 2), TextCursor::KeepAnchor);
+
+    reference.addFold(i, c);
+
+    TextFold f;
+    f.cursor = c;
+    f.id = i;
+    f.width = 3;
+    folds.push_back(f);
+  }
+
+  // a nested fold
+  TextFold nested;
+  nested.cursor = TextCursor{ &document };
+  nested.cursor.setPosition(Position(3, 3));
+  nested.cursor.setPosition(Position(3, 6), TextCursor::KeepAnchor);
+  nested.id = 1000;
+  nested.width = 3;
+  folds.push_back(nested);
+  reference.addFold(1000, nested.cursor);
+
+  view.addFolds(std::move(folds));
+  REQUIRE(view.foldCount() == 1001);
+  REQUIRE(view.height() == 2001);
+  REQUIRE(view.width() == reference.width());
+
+  REQUIRE(same_lines(view, reference));
+
+  std::vector<int> ids;
+
+  for (int i(0); i < 1000; i += 2)
+  {
+    ids.push_back(i);
+    reference.removeFold(i);
+  }
+
+  view.removeFolds(ids);
+  REQUIRE(view.foldCount() == 501);
+  REQUIRE(view.height() == 2501);
+  REQUIRE(same_lines(view, reference));
+
+  view.clearFolds();
+  reference.clearFolds();
+  REQUIRE(view.height() == 3001);
+  REQUIRE(same_lines(view, reference));
+}
+
+TEST_CASE("Folds may start at the end of a line", "[view]")
+{
+  std::string content;
+
+  for (int i(0); i < 12; ++i)
+    content += "line " + std::to_string(i) + "\n";
+
+  TextDocument document{ content };
+
+  auto fold = [&document](int id, Position begin, Position end) {
+    TextFold f;
+    f.cursor = TextCursor{ &document };
+    f.cursor.setPosition(begin);
+    f.cursor.setPosition(end, TextCursor::KeepAnchor);
+    f.id = id;
+    f.width = 3;
+    return f;
+  };
+
+  TextView view{ &document };
+  view.addFold(1, fold(1, Position(1, 6), Position(3, 3)).cursor);
+  view.addFold(2, fold(2, Position(8, 0), Position(11, 0)).cursor);
+  REQUIRE(view.height() == 8);
+  REQUIRE(displayed_folds(view) == std::vector<int>{ 1, 2 });
+
+  TextView bulk{ &document };
+  bulk.addFolds({ fold(1, Position(1, 6), Position(3, 3)), fold(2, Position(8, 0), Position(11, 0)) });
+  REQUIRE(same_lines(view, bulk));
+
+  std::mt19937 rng{ 7 };
+
+  for (int n(0); n < 300; ++n)
+  {
+    TextView sequential{ &document };
+    std::vector<TextFold> folds;
+
+    for (int id(0); id < 4; ++id)
+    {
+      const int line = rng() % 12;
+      Position begin{ line, static_cast<int>(rng() % 7) };
+      Position end{ line + 1 + static_cast<int>(rng() % (12 - line)), static_cast<int>(rng() % 7) };
+
+      if (end.line == 12)
+        end.column = 0;
+
+      folds.push_back(fold(id, begin, end));
+      sequential.addFold(id, folds.back().cursor);
+    }
+
+    TextView view{ &document };
+    view.addFolds(folds);
+    REQUIRE(same_lines(view, sequential));
+  }
+}
+
 TEST_CASE("Info can be inserted into a view with inserts", "[view]")
 {
   TextDocument document{
@@ -95,6 +361,152 @@ TEST_CASE("Info can be inserted into a view with inserts", "[view]")
   REQUIRE(lines.front().elements.size() == 1); // text
 }
 
+TEST_CASE("Inserts can be added and removed in bulk", "[view]")
+{
+  std::string content;
+
+  for (int i(0); i < 1000; ++i)
+    content += "line " + std::to_string(i) + "\n";
+
+  TextDocument document{ content };
+  TextView view{ &document };
+  TextView reference{ &document };
+
+  auto make_insert = [&document](Position pos, int span) {
+    view::Insert ins;
+    ins.cursor = TextCursor{ &document };
+    ins.cursor.setPosition(pos);
+    ins.span = span;
+    return ins;
+  };
+
+  auto make_inline_insert = [&document](Position pos, int span) {
+    view::InlineInsert ins;
+    ins.cursor = TextCursor{ &document };
+    ins.cursor.setPosition(pos);
+    ins.span = span;
+    return ins;
+  };
+
+  std::vector<view::Insert> inserts;
+  std::vector<view::InlineInsert> inline_inserts;
+
+  // not in document order
+  for (int i(999); i >= 0; --i)
+  {
+    inline_inserts.push_back(make_inline_insert(Position(i, 2), 4));
+    reference.addInlineInsert(inline_inserts.back());
+
+    if (i % 10 == 0)
+    {
+      inserts.push_back(make_insert(Position(i, 0), 2));
+      reference.addInsert(inserts.back());
+    }
+  }
+
+  view.addInlineInserts(inline_inserts);
+  view.addInserts(inserts);
+  REQUIRE(view.insertCount() == 100);
+  REQUIRE(view.inlineInsertCount() == 1000);
+  REQUIRE(view.height() == 1001 + 200);
+  REQUIRE(same_lines(view, reference));
+
+  const view::Line& first = *std::next(view.lines().begin(), 2);
+  REQUIRE(first.elements.size() == 3);
+  REQUIRE(first.elements.at(1).kind == view::LineElement::LE_InlineInsert);
+  REQUIRE(view.inserts().front().cursor.position() == Position(0, 0));
+  REQUIRE(view.inlineInserts().back().cursor.position() == Position(999, 2));
+
+  // inserts follow the edits
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position(20, 4));
+  cursor.insertBlock();
+  cursor.setPosition(Position(31, 1));
+  cursor.insertBlock();
+  REQUIRE(view.height() == 1003 + 200);
+
+  {
+    TextView expected{ &document };
+    expected.addInserts(view.inserts());
+    expected.addInlineInserts(view.inlineInserts());
+    REQUIRE(same_lines(view, expected));
+    REQUIRE(std::next(view.lines().begin(), 6 + 20)->displayedText() == "line");
+    REQUIRE(std::next(view.lines().begin(), 6 + 21)->displayedText() == " 20");
+  }
+
+  cursor.deletePreviousChar();
+  REQUIRE(view.height() == 1002 + 200);
+
+  // the inserts of the first half are replaced in a single call
+  std::vector<view::InlineInsert> replacements;
+
+  for (int i(0); i < 500; ++i)
+    replacements.push_back(make_inline_insert(Position(i, 0), 1));
+
+  // the split moved an insert of line 499 out of the range
+  view.replaceInlineInserts(Position(0, 0), Position(500, 0), replacements);
+  REQUIRE(view.inlineInsertCount() == 1001);
+  REQUIRE(std::next(view.lines().begin(), 2)->elements.front().kind == view::LineElement::LE_InlineInsert);
+
+  view.removeInserts(Position(0, 0), Position(500, 0));
+  REQUIRE(view.insertCount() == 50);
+  REQUIRE(view.height() == 1002 + 100);
+
+  // a batch of edits
+  replaceAll(cursor, TextSearcher("ne "), "\n");
+  REQUIRE(view.inlineInsertCount() == 1001);
+
+  {
+    TextView expected{ &document };
+    expected.addInserts(view.inserts());
+    expected.addInlineInserts(view.inlineInserts());
+    REQUIRE(same_lines(view, expected));
+  }
+
+  view.clearInserts();
+  REQUIRE(view.insertCount() == 0);
+  REQUIRE(view.height() == 2001);
+  REQUIRE(std::next(view.lines().begin(), 2)->elements.size() == 1);
+}
+
+TEST_CASE("Inserts are hidden by folds", "[view]")
+{
+  TextDocument document{
+    "line 0\n"
+    "line 1\n"
+    "line 2\n"
+    "line 3"
+  };
+
+  TextView view{ &document };
+
+  std::vector<view::Insert> inserts;
+
+  for (int i(0); i < 4; ++i)
+  {
+    view::Insert ins;
+    ins.cursor = TextCursor{ &document };
+    ins.cursor.setPosition(Position(i, 0));
+    ins.span = 1;
+    inserts.push_back(ins);
+  }
+
+  view.addInserts(inserts);
+  REQUIRE(view.height() == 8);
+
+  TextCursor sel{ &document };
+  sel.setPosition(Position(0, 2));
+  sel.setPosition(Position(2, 2), TextCursor::KeepAnchor);
+  view.addFold(0, sel);
+  REQUIRE(view.height() == 4);
+  REQUIRE(view.lines().front().isInsert());
+  REQUIRE(std::next(view.lines().begin(), 1)->displayedText() == "line 2");
+  REQUIRE(std::next(view.lines().begin(), 2)->isInsert());
+
+  view.removeFold(0);
+  REQUIRE(view.height() == 8);
+}
+
 TEST_CASE("TextView supports word-wrap", "[view]")
 {
   TextDocument document{
@@ -142,6 +554,127 @@ TEST_CASE("TextView supports tabs", "[view]")
   REQUIRE(view.width() == 25);
 }
 
+TEST_CASE("TextView supports wide characters", "[view]")
+{
+  REQUIRE(display::char_width('a') == 1);
+  REQUIRE(display::char_width(0x65E5) == 2);
+  REQUIRE(display::char_width(0x0301) == 0);
+  REQUIRE(display::width("\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9") == 2); // man ZWJ woman
+  REQUIRE(display::width("\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD") == 2); // thumbs up, skin tone
+
+  // "日本語 text" and "été"
+  TextDocument document{
+    "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E text\n"
+    "e\xCC\x81t\xC3\xA9"
+  };
+
+  TextBlock block = document.firstBlock();
+  REQUIRE(block.displayWidth(2) == 4);
+  REQUIRE(block.columnAtDisplayWidth(3) == 1);
+  REQUIRE(block.columnAtDisplayWidth(4) == 2);
+
+  block = block.next();
+  REQUIRE(block.length() == 4);
+  REQUIRE(block.displayWidth(4) == 3);
+  REQUIRE(block.columnAtDisplayWidth(1) == 2);
+
+  TextView view{ &document };
+  REQUIRE(view.width() == 11);
+
+  view.setWrapMode(TextView::WrapMode::Anywhere);
+  view.setCharactersPerLine(5);
+
+  std::vector<view::Line> lines{ view.lines().begin(), view.lines().end() };
+  REQUIRE(lines.size() == 4);
+  REQUIRE(lines.at(0).displayedText() == "\xE6\x97\xA5\xE6\x9C\xAC");
+  REQUIRE(lines.at(1).displayedText() == "\xE8\xAA\x9E te");
+  REQUIRE(lines.at(2).displayedText() == "xt");
+  REQUIRE(lines.at(3).width() == 3);
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 1, 4 });
+  cursor.insertText(" \xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E");
+  view.setWrapMode(TextView::WrapMode::WordBoundaryOrAnywhere);
+
+  lines.assign(view.lines().begin(), view.lines().end());
+  REQUIRE(lines.size() == 7);
+  REQUIRE(lines.at(4).displayedText() == "\xE6\x97\xA5\xE6\x9C\xAC");
+  REQUIRE(lines.at(5).displayedText() == "\xE8\xAA\x9E\xE6\x97\xA5");
+  REQUIRE(lines.at(6).displayedText() == "\xE6\x9C\xAC\xE8\xAA\x9E");
+
+  // long lines use the width prefix sums
+  std::string text;
+  for (int i(0); i < 10000; ++i)
+    text += (i % 7 == 0) ? "\xE6\x97\xA5" : "a";
+
+  TextDocument long_document{ text };
+  block = long_document.firstBlock();
+
+  int expected_width = 0;
+  for (int column(0); column <= 10000; ++column)
+  {
+    REQUIRE(block.displayWidth(column) == expected_width);
+    REQUIRE(block.columnAtDisplayWidth(expected_width) == column);
+    expected_width += (column % 7 == 0) ? 2 : 1;
+  }
+}
+
+TEST_CASE("Positions can be mapped to the view and back", "[view]")
+{
+  TextDocument document{
+    "a\tb \xE6\x97\xA5\xE6\x9C\xAC\n"
+    "second line\n"
+    "third line"
+  };
+
+  TextView view{ &document };
+  view.setTabSize(4);
+
+  REQUIRE(view.lineAt(2)->displayedText() == "third line");
+  REQUIRE(view.lineAt(3) == view.lines().end());
+
+  REQUIRE(view.map(Position{ 0, 1 }).x == 1);
+  REQUIRE(view.map(Position{ 0, 2 }).x == 4);
+  REQUIRE(view.map(Position{ 0, 5 }).x == 8);
+  REQUIRE(view.map(Position{ 2, 3 }).row == 2);
+  REQUIRE(view.map(Position{ 2, 3 }).x == 3);
+
+  REQUIRE(view.hitTest(view::Point{ 0, 2 }) == Position{ 0, 1 });
+  REQUIRE(view.hitTest(view::Point{ 0, 3 }) == Position{ 0, 2 });
+  REQUIRE(view.hitTest(view::Point{ 0, 7 }) == Position{ 0, 4 });
+  REQUIRE(view.hitTest(view::Point{ 0, 100 }) == Position{ 0, 6 });
+  REQUIRE(view.hitTest(view::Point{ 1, 3 }) == Position{ 1, 3 });
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 1, 2 });
+  cursor.setPosition(Position{ 2, 3 }, TextCursor::KeepAnchor);
+  view.addFold(1, cursor);
+
+  REQUIRE(view.height() == 2);
+  REQUIRE(view.lineAt(1)->displayedText() == "serd line");
+  REQUIRE(view.map(Position{ 2, 5 }).row == 1);
+  REQUIRE(view.map(Position{ 2, 5 }).x == 7);
+  REQUIRE(view.map(Position{ 1, 8 }).x == 2);
+  REQUIRE(view.hitTest(view::Point{ 1, 3 }) == Position{ 1, 2 });
+  REQUIRE(view.hitTest(view::Point{ 1, 6 }) == Position{ 2, 4 });
+
+  view.removeFold(1);
+  view.setWrapMode(TextView::WrapMode::Word);
+  view.setCharactersPerLine(8);
+
+  REQUIRE(view.height() == 6);
+  REQUIRE(view.map(Position{ 1, 8 }).row == 3);
+  REQUIRE(view.map(Position{ 1, 8 }).x == 1);
+  REQUIRE(view.hitTest(view::Point{ 5, 2 }) == Position{ 2, 8 });
+
+  cursor.setPosition(Position{ 0, 0 });
+  cursor.insertText("xy\n");
+
+  REQUIRE(view.height() == 7);
+  REQUIRE(view.map(Position{ 3, 8 }).row == 6);
+  REQUIRE(view.hitTest(view::Point{ 0, 1 }) == Position{ 0, 1 });
+}
+
 TEST_CASE("TextView reacts correctly to edits", "[view]")
 {
   TextDocument document{
@@ -163,6 +696,66 @@ TEST_CASE("TextView reacts correctly to edits", "[view]")
   REQUIRE(view.width() == 11);
 }
 
+TEST_CASE("TextView lays out the lines of a batch of edits", "[view]")
+{
+  std::string content;
+
+  for (int i(0); i < 3000; ++i)
+  {
+    if (i < 100)
+      content += "head " + std::to_string(i) + "\n";
+    else if (i >= 1000 && i < 1100)
+      content += "foo bar baz qux with a longer text " + std::to_string(i) + "\n";
+    else if (i >= 2900)
+      content += "tail " + std::to_string(i) + "\n";
+    else
+      content += "line " + std::to_string(i) + "\n";
+  }
+
+  TextDocument document{ content };
+  TextView view{ &document };
+  TextView wrapped{ &document };
+  wrapped.setCharactersPerLine(8);
+
+  REQUIRE(view.width() == 39);
+
+  auto check_views = [&]() {
+    TextView expected{ &document };
+    REQUIRE(same_lines(view, expected));
+    REQUIRE(view.height() == expected.height());
+    REQUIRE(view.width() == expected.width());
+    REQUIRE(view.blocks().size() == static_cast<size_t>(document.lineCount()));
+
+    expected.setCharactersPerLine(8);
+    REQUIRE(same_lines(wrapped, expected));
+    REQUIRE(wrapped.height() == expected.height());
+  };
+
+  const view::Line* first_line = &view.lines().front();
+  const view::Line* last_line = &view.lines().back();
+
+  // blocks are split in the middle of the document
+  REQUIRE(replaceAll(document, TextSearcher("bar "), "\n") == 100);
+  check_views();
+  REQUIRE(&view.lines().front() == first_line);
+  REQUIRE(&view.lines().back() == last_line);
+
+  // the longest lines are shortened and merged
+  REQUIRE(replaceAll(document, TextSearcher("foo \n"), "") == 100);
+  REQUIRE(replaceAll(document, TextSearcher(" with a longer text"), "") == 100);
+  check_views();
+  REQUIRE(view.width() == 12);
+  REQUIRE(&view.lines().front() == first_line);
+
+  // at the start and at the end of the document
+  REQUIRE(replaceAll(document, TextSearcher("head "), "h\n") == 100);
+  check_views();
+  REQUIRE(&view.lines().back() == last_line);
+
+  REQUIRE(replaceAll(document, TextSearcher("tail "), "") == 100);
+  check_views();
+}
+
 TEST_CASE("TextView supports basic syntax highlighting", "[view.highlight]")
 {
   const char* source =
@@ -228,6 +821,269 @@ TEST_CASE("TextView supports basic syntax highlighting", "[view.highlight]")
   }
 }
 
+// each fragment of the line as "text:format:decoration"
+static std::vector<std::string> styled_fragments(const TextView& view, const view::Line& line)
+{
+  std::vector<std::string> result;
+  view::StyledFragments fragments = view.fragments(line, line.elements.front());
+
+  for (view::StyledFragment frag = fragments.begin(); frag != fragments.end(); frag = frag.next())
+    result.push_back(frag.text() + ":" + std::to_string(frag.format()) + ":" + std::to_string(frag.decoration()));
+
+  return result;
+}
+
+TEST_CASE("Decorations are displayed on top of syntax formats", "[view.highlight]")
+{
+  TextDocument document{ "int foo = foo(1);\nfoo();\nbar" };
+  TextView view{ &document };
+
+  typewriter::SyntaxHighlighter highlighter{ view };
+  highlighter.setFormat(0, 0, 3, 1);
+  highlighter.setFormat(0, 14, 1, 2);
+
+  TextDecorations decorations{ &document };
+  view.setDecorations(&decorations);
+
+  const view::Line* first_line = &view.lines().front();
+
+  decorations.add(findAll(document, TextSearcher("foo")), 5);
+  REQUIRE(decorations.count() == 3);
+  REQUIRE(styled_fragments(view, view.lines().front()) == std::vector<std::string>{ "int:1:0", " :0:0", "foo:0:5", " = :0:0", "foo:0:5", "(:0:0", "1:2:0", ");:0:0" });
+
+  // a decoration overlapping a format splits it
+  decorations.add(Position(0, 2), Position(0, 5), 7);
+  REQUIRE(styled_fragments(view, view.lines().front()) == std::vector<std::string>{ "in:1:0", "t:1:7", " f:0:7", "oo:0:5", " = :0:0", "foo:0:5", "(:0:0", "1:2:0", ");:0:0" });
+
+  // multiline decorations have one range per line
+  decorations.add(Position(0, 16), Position(2, 1), 8);
+  REQUIRE(decorations.count() == 6);
+  REQUIRE(styled_fragments(view, *std::next(view.lines().begin(), 1)) == std::vector<std::string>{ "foo();:0:8" });
+  REQUIRE(styled_fragments(view, view.lines().back()) == std::vector<std::string>{ "b:0:8", "ar:0:0" });
+
+  decorations.remove(8);
+  decorations.remove(Position(0, 0), Position(0, 10));
+  REQUIRE(decorations.count() == 1);
+  REQUIRE(styled_fragments(view, view.lines().front()) == std::vector<std::string>{ "int:1:0", " foo = :0:0", "foo:0:5", "(:0:0", "1:2:0", ");:0:0" });
+
+  // neither the layout nor the syntax formats are modified
+  REQUIRE(&view.lines().front() == first_line);
+  REQUIRE(view.blocks().at(document.firstBlock().impl())->formats.size() == 2);
+
+  decorations.clear();
+  REQUIRE(decorations.isEmpty());
+  REQUIRE(styled_fragments(view, view.lines().front()) == std::vector<std::string>{ "int:1:0", " foo = foo(:0:0", "1:2:0", ");:0:0" });
+
+  view.setDecorations(nullptr);
+}
+
+TEST_CASE("Decorations follow the edits of the document", "[view]")
+{
+  TextDocument document{ "one two three\nfour five" };
+  TextDecorations decorations{ &document };
+  TextCursor cursor{ &document };
+
+  auto ranges = [&](int line) {
+    std::vector<std::string> result;
+    TextBlock block = document.findBlockByNumber(line);
+    for (const view::FormatRange& r : decorations.ranges(block))
+      result.push_back(block.text().substr(r.start, r.length) + ":" + std::to_string(r.format_id));
+    return result;
+  };
+
+  decorations.add(Position(0, 4), Position(0, 13), 1);
+  decorations.add(Position(1, 5), Position(1, 9), 2);
+
+  // text inserted inside a decoration extends it, not at its boundaries
+  cursor.setPosition(Position(0, 7));
+  cursor.insertText("!");
+  cursor.setPosition(Position(0, 4));
+  cursor.insertText("<");
+  cursor.setPosition(Position(0, 15));
+  cursor.insertText(">");
+  REQUIRE(ranges(0) == std::vector<std::string>{ "two! three:1" });
+
+  // splitting a line splits its decorations
+  cursor.setPosition(Position(0, 9));
+  cursor.insertBlock();
+  REQUIRE(document.lineCount() == 3);
+  REQUIRE(ranges(0) == std::vector<std::string>{ "two!:1" });
+  REQUIRE(ranges(1) == std::vector<std::string>{ " three:1" });
+  REQUIRE(ranges(2) == std::vector<std::string>{ "five:2" });
+
+  // removed text shrinks the decorations, lines are merged
+  cursor.setPosition(Position(0, 6));
+  cursor.setPosition(Position(1, 3), TextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  REQUIRE(document.lineCount() == 2);
+  REQUIRE(document.findBlockByNumber(0).text() == "one <tree>");
+  REQUIRE(ranges(0) == std::vector<std::string>{ "t:1", "ree:1" });
+  REQUIRE(ranges(1) == std::vector<std::string>{ "five:2" });
+
+  cursor.setPosition(Position(1, 5));
+  cursor.setPosition(Position(1, 9), TextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  REQUIRE(ranges(1).empty());
+  REQUIRE(decorations.count() == 2);
+
+  // decorations of lines rewritten by a batch edit are removed
+  std::string content;
+  for (int i(0); i < 100; ++i)
+    content += "x = foo(x);\n";
+  document.reload(content + "y");
+  decorations.add(findAll(document, TextSearcher("foo")), 1);
+  decorations.add(Position(100, 0), Position(100, 1), 2);
+  REQUIRE(decorations.count() == 101);
+  REQUIRE(replaceAll(document, TextSearcher("foo"), "bar") == 100);
+  REQUIRE(decorations.count() == 1);
+  REQUIRE(ranges(100) == std::vector<std::string>{ "y:2" });
+}
+
+TEST_CASE("The view is updated when text is appended to the document", "[view]")
+{
+  TextDocument document{ "Hello" };
+
+  TextView view{ &document };
+  view.setCharactersPerLine(8);
+
+  document.append(" World!\nThis line is wrapped\n");
+  document.append("\nLast");
+
+  REQUIRE(document.toString() == "Hello World!\nThis line is wrapped\n\nLast");
+
+  TextView expected{ &document };
+  expected.setCharactersPerLine(8);
+
+  REQUIRE(view.height() == expected.height());
+  REQUIRE(view.width() == expected.width());
+  REQUIRE(view.blocks().size() == 4);
+
+  auto it = view.lines().begin();
+  auto expected_it = expected.lines().begin();
+
+  for (; expected_it != expected.lines().end(); ++it, ++expected_it)
+  {
+    REQUIRE(it->block() == expected_it->block());
+    REQUIRE(it->width() == expected_it->width());
+  }
+
+  TextCursor cursor{ &document };
+  cursor.setPosition(Position{ 3, 4 });
+  cursor.insertBlock();
+  cursor.insertText("More");
+
+  REQUIRE(view.height() == expected.height());
+}
+
+TEST_CASE("The view is updated when the first blocks are discarded", "[view]")
+{
+  TextDocument document{ "A very long line\nB" };
+  document.setMaximumBlockCount(3);
+
+  TextView view{ &document };
+  view.setCharactersPerLine(6);
+
+  document.append("\nC\nD");
+
+  REQUIRE(document.toString() == "B\nC\nD");
+
+  TextView expected{ &document };
+  expected.setCharactersPerLine(6);
+
+  REQUIRE(view.height() == 3);
+  REQUIRE(view.blocks().size() == 3);
+  REQUIRE(view.width() == expected.width());
+  REQUIRE(view.lines().front().block() == document.firstBlock());
+}
+
+TEST_CASE("Folds in the discarded blocks are removed", "[view]")
+{
+  TextDocument document{ "l0\nl1\nl2\nl3\nl4\nl5" };
+  document.setMaximumBlockCount(6);
+
+  auto selection = [&document](Position begin, Position end) {
+    TextCursor c{ &document };
+    c.setPosition(begin);
+    c.setPosition(end, TextCursor::KeepAnchor);
+    return c;
+  };
+
+  TextView view{ &document };
+  view.addFold(1, selection(Position(1, 1), Position(3, 1)));
+  view.addFold(2, selection(Position(4, 0), Position(5, 1)));
+  REQUIRE(view.height() == 3);
+
+  // the start of the first fold is discarded
+  document.append("\nl6\nl7");
+  REQUIRE(document.toString() == "l2\nl3\nl4\nl5\nl6\nl7");
+  REQUIRE(view.foldCount() == 2);
+  REQUIRE(view.height() == 4);
+
+  // the first fold is discarded
+  document.append("\nl8\nl9");
+  REQUIRE(document.toString() == "l4\nl5\nl6\nl7\nl8\nl9");
+  REQUIRE(view.foldCount() == 1);
+  REQUIRE(!view.hasFold(1));
+  REQUIRE(view.height() == 5);
+
+  TextView expected{ &document };
+  expected.addFold(2, selection(Position(0, 0), Position(1, 1)));
+  REQUIRE(same_lines(view, expected));
+}
+
+TEST_CASE("Memory usage of a view", "[view]")
+{
+  TextDocument document{ "Hello World!\nThis line is wrapped\n\nLast" };
+
+  TextView view{ &document };
+  view.setCharactersPerLine(8);
+
+  SyntaxHighlighter highlighter{ view };
+  highlighter.setFormat(1, 0, 4, 1);
+  highlighter.setFormat(1, 5, 4, 2);
+
+  ViewMemoryUsage usage = view.memoryUsage();
+  REQUIRE(usage.lines > 0);
+  REQUIRE(usage.blocks > 0);
+  REQUIRE(usage.formats > 0);
+  REQUIRE(usage.line_index == 0);
+
+  const view::Point pt = view.map(Position{ 1, 10 });
+  usage = view.memoryUsage();
+  REQUIRE(usage.line_index > 0);
+
+  view.shrink();
+
+  ViewMemoryUsage after = view.memoryUsage();
+  REQUIRE(after.line_index == 0);
+  REQUIRE(after.total() < usage.total());
+  REQUIRE(view.hitTest(pt) == Position{ 1, 10 });
+}
+
+TEST_CASE("Appending lines to a view", "[view-bench]")
+{
+  TextDocument document;
+  document.setMaximumBlockCount(50000);
+
+  TextView view{ &document };
+
+  std::string batch;
+  for (int i(0); i < 1000; ++i)
+    batch += "\n[info] a message that was logged " + std::to_string(i);
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (int i(0); i < 100; ++i)
+    document.append(batch);
+
+  auto end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "TextDocument append of 100k lines " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << std::endl;
+
+  REQUIRE(document.lineCount() == 50000);
+  REQUIRE(view.height() == 50000);
+}
+
 TEST_CASE("TextView can handle catch.hpp", "[view-bench]")
 {
   std::string content;